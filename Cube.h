@@ -3,31 +3,41 @@
 #include <glad/glad.h>
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp> 
-#include "shader.h"
+#include "mesh.h"
+#include "vertex_format.h"
 
 /// The cube is rendered with two textures: one for the sides, and one for the top and bottom faces.
 /// Walls and the roof of buildings are made distinct this way.
 /// Its side faces are defined by the first 24 vertices in the vertex buffer.
 /// The top and bottom are the last 12. Based on this, the two parts are drawn separately, using textures bound to slots 0 and 1.
+/// A unit cube centred on the origin; the scene places and scales it.
 
 class Cube
 {
 public: 
+	static const int VERTEX_COUNT = 36;
+
 	Cube() { }
 
 	/// textureScaleX and textureScaleY control the texture coordinates' scale across the cube's faces. 
 	/// When creating cubes in larger scales, these can be used so that the texture is not stretched in a 
 	/// non-uniform manner.
-	/// rotationY is an angle in degrees.
 
-	Cube(Shader& shader, glm::vec3 position, float rotationY, glm::vec3 scale, float textureScaleX, float textureScaleY)
+	Cube(float textureScaleX, float textureScaleY)
 	{
-		m_position = position;
-		m_shader = &shader;
-		m_rotationY = rotationY;
-		m_scale = scale;
+		Vertex vertices[VERTEX_COUNT];
+		GetVertices(textureScaleX, textureScaleY, vertices);
+		m_texCoordDensity = VertexFormat::texCoordDensity(vertices, VERTEX_COUNT);
+
+		m_buffers.vertexArray = GLVertexArray::create("Cube");
+		m_buffers.vertices = GLBuffer::create("Cube");
+		VertexFormat::upload(m_buffers.vertexArray.id(), m_buffers.vertices.id(), vertices, VERTEX_COUNT);
+	}
 
-		float vertices[] = {
+	/// The cube's vertices at full precision, before packing; see vertex_format.h.
+	static void GetVertices(float textureScaleX, float textureScaleY, Vertex* out)
+	{
+		const float vertices[] = {
 			// positions          // normals           // texture coords
 			-0.5f, -0.5f, -0.5f,  0.0f,  0.0f, -1.0f,  0.0f,  1.0f * textureScaleY,
 			 0.5f, -0.5f, -0.5f,  0.0f,  0.0f, -1.0f,  1.0f * textureScaleX,  1.0f * textureScaleY,
@@ -73,45 +83,26 @@ public:
 			-0.5f,  0.5f,  0.5f,  0.0f,  1.0f,  0.0f,  0.0f,  0.0f,
 			-0.5f,  0.5f, -0.5f,  0.0f,  1.0f,  0.0f,  0.0f,  1.0f * textureScaleY
 		};
-
-		glGenBuffers(1, &m_VBO);
-		glGenVertexArrays(1, &m_VAO);
-
-		glBindBuffer(GL_ARRAY_BUFFER, m_VBO);
-		glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
-
-		glBindVertexArray(m_VAO);
-		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)0);
-		glEnableVertexAttribArray(0);
-		glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(3 * sizeof(float)));
-		glEnableVertexAttribArray(1);
-		glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(6 * sizeof(float)));
-		glEnableVertexAttribArray(2);
+		VertexFormat::fromFloats(vertices, 8, VERTEX_COUNT, out);
 	}
 	 
 
-	void Draw()
+	/// The walls are the main range and the top and bottom the secondary one.
+	Mesh GetMesh() const
 	{
-		m_shader->use();
-		glBindVertexArray(m_VAO); 
-		glm::mat4 model = glm::mat4(1.0f);
-		model = glm::translate(model, m_position);
-		model = glm::rotate(model, glm::radians(m_rotationY), glm::vec3(0, 1, 0));
-		model = glm::scale(model, m_scale);
-		m_shader->setMat4("model", model);
-		 
-		glDrawArrays(GL_TRIANGLES, 0, 24);
-
-		/// Draw the roof 
-		m_shader->setInt("material.diffuse", 1);
-		m_shader->setInt("material.specular", 1);
-		glDrawArrays(GL_TRIANGLES, 24, 12);
+		Mesh mesh;
+		mesh.VAO = m_buffers.vertexArray.id();
+		mesh.count = VERTEX_COUNT;
+		mesh.secondaryFirst = 24;
+		mesh.bounds = AABB(glm::vec3(-0.5f), glm::vec3(0.5f));
+		mesh.texCoordDensity = m_texCoordDensity;
+		return mesh;
 	}
 
+	/// Hands the GL objects over to the caller, leaving the model empty.
+	MeshBuffers TakeBuffers() { return std::move(m_buffers); }
+
 protected:
-	glm::vec3 m_position;
-	float m_rotationY;
-	glm::vec3 m_scale;
-	GLuint m_VAO, m_VBO;
-	Shader* m_shader;
+	MeshBuffers m_buffers;
+	float m_texCoordDensity = 1.0f;
 };
\ No newline at end of file
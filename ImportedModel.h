@@ -0,0 +1,64 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include "mesh.h"
+#include "mesh_import.h"
+#include "vertex_format.h"
+
+#include <string>
+
+class ImportedModel
+{
+public:
+	/// A model read from an OBJ or glTF file through its optimised cache; see mesh_import.h. A model that
+	/// cannot be imported is reported and has no triangles.
+	ImportedModel(const std::string& path) : m_indexCount(0), m_texCoordDensity(1.0f)
+	{
+		MappedFile file;
+		const MeshImport::Header* header = MeshImport::open(path, file);
+		if (header == NULL)
+			return;
+
+		// both uploads read straight from the mapped cache
+		const unsigned char* data = file.data();
+		m_buffers.vertexArray = GLVertexArray::create(path);
+		m_buffers.vertices = GLBuffer::create(path);
+		m_buffers.indices = GLBuffer::create(path);
+		glBindBuffer(GL_ARRAY_BUFFER, m_buffers.vertices.id());
+		glBufferData(GL_ARRAY_BUFFER, header->vertexCount * sizeof(PackedVertex) + sizeof(VertexQuantization), data + header->vertices, GL_STATIC_DRAW);
+		VertexFormat::setAttributes(m_buffers.vertexArray.id(), m_buffers.vertices.id(), header->vertexCount);
+
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_buffers.indices.id());
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, header->indexCount * sizeof(GLuint), data + header->indices, GL_STATIC_DRAW);
+		GpuResources::resize(GPU_BUFFER, m_buffers.vertices.id(), header->vertexCount * sizeof(PackedVertex) + sizeof(VertexQuantization));
+		GpuResources::resize(GPU_BUFFER, m_buffers.indices.id(), header->indexCount * sizeof(GLuint));
+
+		m_indexCount = (GLsizei)header->indexCount;
+		m_bounds = AABB(glm::vec3(header->boundsMin[0], header->boundsMin[1], header->boundsMin[2]),
+			glm::vec3(header->boundsMax[0], header->boundsMax[1], header->boundsMax[2]));
+		m_texCoordDensity = header->texCoordDensity;
+	}
+
+	/// An indexed triangle list, drawn in the order the importer optimised.
+	Mesh GetMesh() const
+	{
+		Mesh mesh;
+		mesh.VAO = m_buffers.vertexArray.id();
+		mesh.count = m_indexCount;
+		mesh.indexed = true;
+		mesh.secondaryFirst = m_indexCount;
+		mesh.bounds = m_indexCount > 0 ? m_bounds : AABB(glm::vec3(0.0f), glm::vec3(0.0f));
+		mesh.texCoordDensity = m_texCoordDensity;
+		return mesh;
+	}
+
+	/// Hands the GL objects over to the caller, leaving the model empty.
+	MeshBuffers TakeBuffers() { return std::move(m_buffers); }
+
+protected:
+	MeshBuffers m_buffers;
+	GLsizei m_indexCount;
+	AABB m_bounds;
+	float m_texCoordDensity;
+};
@@ -3,20 +3,29 @@
 #include <glad/glad.h>
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp> 
-#include "shader.h"
+#include "mesh.h"
+#include "vertex_format.h"
 
 class Pyramid
 {
 public:
-	Pyramid() { }
-	Pyramid(Shader& shader, glm::vec3 position, float rotationY, glm::vec3 scale)
+	static const int VERTEX_COUNT = 12;
+
+	/// A unit square pyramid centred on the origin.
+	Pyramid()
 	{
-		m_position = position;
-		m_shader = &shader;
-		m_rotationY = rotationY;
-		m_scale = scale;
+		Vertex vertices[VERTEX_COUNT];
+		GetVertices(vertices);
+
+		m_buffers.vertexArray = GLVertexArray::create("Pyramid");
+		m_buffers.vertices = GLBuffer::create("Pyramid");
+		VertexFormat::upload(m_buffers.vertexArray.id(), m_buffers.vertices.id(), vertices, VERTEX_COUNT);
+	}
 
-		float vertices[] = {
+	/// The vertices at full precision, before packing; see vertex_format.h.
+	static void GetVertices(Vertex* out)
+	{
+		const float vertices[] = {
 			// position        normal 
 			
 			// Front face
@@ -41,36 +50,22 @@ public:
 
 			// We do not need a bottom face.
 		};
+		VertexFormat::fromFloats(vertices, 6, VERTEX_COUNT, out);
+	}
 
-		glGenBuffers(1, &m_VBO);
-		glGenVertexArrays(1, &m_VAO);
-
-		glBindBuffer(GL_ARRAY_BUFFER, m_VBO);
-		glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
-
-		glBindVertexArray(m_VAO);
-		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)0);
-		glEnableVertexAttribArray(0);
-		glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)(3 * sizeof(float)));
-		glEnableVertexAttribArray(1);
-	} 
-
-	void Draw()
+	Mesh GetMesh() const
 	{
-		m_shader->use();
-		glBindVertexArray(m_VAO); 
-		glm::mat4 model = glm::mat4(1.0f);
-		model = glm::translate(model, m_position);
-		model = glm::scale(model, m_scale);
-		m_shader->setMat4("model", model); 
-
-		glDrawArrays(GL_TRIANGLES, 0, 12);
+		Mesh mesh;
+		mesh.VAO = m_buffers.vertexArray.id();
+		mesh.count = VERTEX_COUNT;
+		mesh.secondaryFirst = VERTEX_COUNT;
+		mesh.bounds = AABB(glm::vec3(-0.5f), glm::vec3(0.5f));
+		return mesh;
 	}
 
+	/// Hands the GL objects over to the caller, leaving the model empty.
+	MeshBuffers TakeBuffers() { return std::move(m_buffers); }
+
 protected:
-	glm::vec3 m_position;
-	float m_rotationY;
-	glm::vec3 m_scale;
-	GLuint m_VAO, m_VBO;
-	Shader* m_shader;
+	MeshBuffers m_buffers;
 };
\ No newline at end of file
@@ -4,20 +4,43 @@
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 
+#define ALLOCATION_COUNTER_IMPLEMENTATION
+#include "allocation_counter.h"
+
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
 #include "shader.h"
+#include "shader_variants.h"
+#include "shadows.h"
+#include "occlusion.h"
+#include "crowd.h"
+#include "dynamic_resolution.h"
+#include "texture_streamer.h"
+#include "gpu_resources.h"
+#include "frame_capture.h"
+#include "batch_render.h"
+#include "image_file.h"
+#include "image_regression.h"
+#include "software_rasterizer.h"
 #include "camera.h"
-
-/// Models
-#include "Plane.h"
-#include "Cube.h"
-#include "Pyramid.h"
-#include "Torus.h"
-
+#include "scene.h"
+#include "scene_file.h"
+#include "bvh.h"
+#include "bvh_benchmark.h"
+#include "vertex_format_check.h"
+#include "job_system.h"
+#include "simulation.h"
+#include "command_list.h"
+#include "frame_arena.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
 #include <iostream>
+#include <mutex>
+#include <thread>
 
 using namespace std;
 
@@ -25,14 +48,18 @@ void framebuffer_size_callback(GLFWwindow* window, int width, int height);
 void mouse_callback(GLFWwindow* window, double xpos, double ypos);
 void scroll_callback(GLFWwindow* window, double xoffset, double yoffset);
 void input_callback(GLFWwindow* window, int key, int scancode, int action, int mods);
-void processInput(GLFWwindow *window);
+void mouse_button_callback(GLFWwindow* window, int button, int action, int mods);
 unsigned int loadTexture(const char *path);
+bool decodeImage(const char* path, int& width, int& height, std::vector<uint8_t>& pixels);
+bool readImage(const char* path, int& width, int& height, std::vector<uint8_t>& pixels);
 
 // settings
 const unsigned int SCR_WIDTH = 800;
 const unsigned int SCR_HEIGHT = 600;
 
 // camera
+/// The camera the render thread draws from; the simulation starts from it, and it is then interpolated
+/// from the simulation's snapshots every frame.
 Camera camera(glm::vec3(0, 15.0f, 35.0f));
 float lastX = SCR_WIDTH / 2.0f;
 float lastY = SCR_HEIGHT / 2.0f;
@@ -40,220 +67,1185 @@ bool firstMouse = true;
 
 float cameraSpeed = 2.0f;
 bool perspectiveProjection = true;
-
-// timing
-float deltaTime = 0.0f;
-float lastFrame = 0.0f;
+/// Width over height of the perspective projection.
+float projectionAspect = (float)SCR_WIDTH / (float)SCR_HEIGHT;
+/// Seconds into the crowd's animation; kept at 0 for batch renders, so their images do not depend on timing.
+double animationTime = 0.0;
+
+/// Owns the camera and steps it at a fixed tick on a thread of its own. The main thread only handles
+/// window events and feeds the input to it; a render thread draws.
+Simulation simulation;
+/// Request counts of the last snapshot the render thread acted on.
+unsigned int seenOcclusionCycles = 0;
+unsigned int seenPicks = 0;
+unsigned int seenMemoryReports = 0;
+unsigned int seenVenueSwitches = 0;
+
+/// Set by the main thread when the window closes, and by the render thread when it has stopped.
+std::atomic<bool> quitRendering(false);
+std::atomic<bool> renderingStopped(false);
+/// Set by the render thread if it could not start, before renderingStopped.
+bool renderingFailed = false;
+/// Framebuffer size from the last resize; the render thread sets the viewport when it changes.
+std::atomic<int> framebufferWidth(SCR_WIDTH), framebufferHeight(SCR_HEIGHT);
+/// Window titles may only be set on the main thread, so the render thread leaves them here.
+std::mutex windowTitleMutex;
+std::string windowTitle;
 
 // lighting
 glm::vec3 lightPos(1.2f, 10.0f, 2.0f);
+/// Taken from the scene's directional light when it is loaded.
+glm::vec3 dirLightDirection(-0.2f, -1.0f, -0.3f);
+
+/// Shadows of the directional light; cascade matrices are refit to the camera every frame.
+CascadedShadowMap shadowMap;
+const int SHADOW_MAP_TEXTURE_UNIT = 2;
+unsigned int frameIndex = 0;
+
+/// Occlusion culling against a depth pyramid of the big buildings.
+HiZOcclusion hiZ;
+/// Bounding box occlusion queries for the expensive objects, used instead of hiZ. H cycles through Hi-Z,
+/// queries and no occlusion culling.
+OcclusionQueries occlusionQueries;
+
+// projection planes
+const float FAR_PLANE = 100.0f;
+
+/// Both lighting shaders are variants of shaderfiles/multiple_lights.*, owned by lightingShaders.
+ShaderVariants lightingShaders;
+Shader* lightingShader;
+Shader* lightingShaderColor;
+/// Edits to the shader sources are picked up at the start of the next frame.
+FileWatcher shaderWatcher;
+
+/// The spectators of the scene's stands, drawn in one instanced call after the entities.
+Crowd crowd;
+
+/// Draws the scene below the window's resolution when the GPU would otherwise miss the frame budget; see
+/// dynamic_resolution.h. --frame-budget MS sets the budget, and --fixed-resolution draws straight to the window.
+DynamicResolution dynamicResolution;
+float frameBudgetMilliseconds = 1000.0f / 60.0f;
+bool fixedResolution = false;
+
+/// The scene's textures, whose finer mip levels are streamed in as the view needs them and out when it no
+/// longer does; see texture_streamer.h. --texture-budget MB caps the memory they take. --batch and
+/// --check-images wait for every level a frame needs before drawing it, so their images do not depend on
+/// timing or on the poses drawn before.
+TextureStreamer textureStreamer;
+bool settleTextures = false;
+
+/// Every object in the scene; see scene.h. The layout is loaded from the first of scenePaths, by default
+/// DEFAULT_SCENE_PATH. --scene PATH, given once per venue, sets them, and V switches to the next one. Edits
+/// to the file of the venue shown are picked up at the start of the next frame; either way swapScene()
+/// replaces the scene, keeping whatever the old and new ones share.
+Scene scene;
+const char* const DEFAULT_SCENE_PATH = "scenes/stadium.scene";
+std::vector<std::string> scenePaths;
+size_t currentScene = 0;
+FileWatcher sceneWatcher;
+/// Dense indices of the entities drawn this frame, each in the low 32 bits of a key that sorts them by
+/// material and then mesh.
+std::vector<uint64_t> drawList;
+/// Program and uniform locations of a lighting shader, for recording draws without GL calls. Looked up
+/// on the render thread every frame, as reloading a shader changes them.
+struct LightingProgram
+{
+	GLuint program = 0;
+	GLint model = -1;
+	GLint diffuse = -1;
+	GLint specular = -1;
+};
+LightingProgram texturedProgram, colorProgram;
+/// drawList split into ranges of DRAW_RECORD_GRAIN entities, each recorded by a job and replayed in order
+/// by drawScene(). Only the first drawCommandCount lists hold this frame's commands.
+std::vector<CommandList> drawCommands;
+size_t drawCommandCount = 0;
+const size_t DRAW_RECORD_GRAIN = 256;
+/// Dense indices of the entities the BVH found in the view, before the per-entity occlusion test.
+std::vector<uint32_t> visibleEntities;
+std::vector<uint64_t> drawListScratch;
+/// Sorts after every real key; given to entities the Hi-Z test culls.
+const uint64_t CULLED_KEY = ~0ull;
+const size_t DRAW_KEY_GRAIN = 2048;
+
+/// Runs the frame's CPU work on every core. The render thread helps while it waits, and issues every GL call.
+JobSystem jobs;
+/// Memory for everything that lives only until the frame has been drawn: the command lists and the
+/// window title. One arena per thread of jobs; all are reset after the swap.
+FrameArena frameArena;
+/// Culls and sorts drawList on the workers while the render thread draws the shadows; see setupFrameJobs().
+JobGraph cullGraph;
+/// Camera the culling jobs cull for, taken before they start.
+glm::mat4 cullViewProjection;
+/// Wall time of the last run of cullGraph.
+double cullStartTime = 0.0;
+float cullMilliseconds = 0.0f;
+
+/// Hierarchy over the entities' world bounds, for culling and picking. Refitted when entities move, and
+/// rebuilt when they are created or destroyed or when refitting has made it BVH_REBUILD_RATIO times costlier.
+BVH sceneBVH;
+unsigned int sceneBVHVersion = ~0u;
+const float BVH_REBUILD_RATIO = 1.5f;
+/// Per BVH node, whether every entity below it is occludable, so that the whole node may be tested
+/// against the Hi-Z pyramid at once.
+std::vector<uint8_t> bvhNodeOccludable;
+/// The entity last clicked on; the crosshair is the centre of the screen.
+EntityHandle pickedEntity;
+
+/// --software: frames are drawn on the CPU by softwareRasterizer and GL only presents them.
+bool softwareRendering = false;
+/// --compare-software: draws SOFTWARE_COMPARE_FRAME with GL and then on the CPU, reports how far the two
+/// images are apart and quits, with exit code 1 if more than SOFTWARE_COMPARE_TOLERANCE of the pixels differ
+/// by more than SOFTWARE_COMPARE_THRESHOLD in any channel. The GL frame leaves out the crowd, which the
+/// software path does not draw.
+bool compareSoftware = false;
+bool softwareCompareFailed = false;
+const unsigned int SOFTWARE_COMPARE_FRAME = 3;
+const int SOFTWARE_COMPARE_THRESHOLD = 24;
+const double SOFTWARE_COMPARE_TOLERANCE = 0.01;
+SoftwareRasterizer softwareRasterizer;
+
+/// --capture PATH records every frame drawn: PATH.y4m into one YUV4MPEG2 file, any other PATH as numbered
+/// PNGs. --capture-pipe COMMAND streams YUV4MPEG2 to COMMAND instead, and --capture-fps N sets the rate
+/// written into the stream. The pixels are read back asynchronously; see frame_capture.h.
+FrameCapture frameCapture;
+
+/// --batch POSES DIRECTORY draws each pose listed in POSES into a PNG in DIRECTORY, at the size set by
+/// --batch-size W H, and quits. --batch-processes N spreads the poses over N processes, each started with
+/// --batch-worker K N; see batch_render.h.
+std::string batchPoses, batchDirectory;
+int batchWidth = 1920, batchHeight = 1080;
+int batchProcesses = BatchRender::defaultProcesses();
+int batchWorker = -1;
+
+/// --check-images draws every view in REGRESSION_VIEWS, a pose list like --batch's, at REGRESSION_WIDTH by
+/// REGRESSION_HEIGHT pixels, and compares each with its golden image, REGRESSION_DIRECTORY/view_<i>.png, by
+/// how different they look (see image_regression.h). It reports every view and quits, with exit code 1 if
+/// any view failed or has no golden image; for each failed view it leaves view_<i>.test.png, the render, and
+/// view_<i>.diff.png, where the two differ, next to the golden image. --update-golden writes the renders
+/// as the new golden images instead. Each view is drawn REGRESSION_FRAMES times and the last one is
+/// compared, so that the Hi-Z pyramid and the occlusion queries, which use the frame before, are tested too.
+const char* const REGRESSION_VIEWS = "regression/views.poses";
+const char* const REGRESSION_DIRECTORY = "regression";
+const int REGRESSION_WIDTH = 400, REGRESSION_HEIGHT = 300;
+const int REGRESSION_FRAMES = 4;
+bool checkImages = false;
+bool updateGolden = false;
+
+/// --check-allocations N: after ALLOCATION_CHECK_WARMUP frames, counts the heap allocations made on any
+/// thread during each of the next N frames, reports them and quits, with exit code 1 if there were any.
+/// Only a build with COUNT_ALLOCATIONS defined can count them; see allocation_counter.h.
+int allocationCheckFrames = 0;
+const int ALLOCATION_CHECK_WARMUP = 30;
+bool allocationCheckFailed = false;
+
+/// --gpu-report PATH writes every GL object still alive, with its size and owner, to PATH as JSON when the
+/// renderer stops; see gpu_resources.h. M prints the same breakdown at any time.
+std::string gpuReportPath;
+
+/// Shaders owned by the rendering passes rather than by a ShaderVariants set.
+std::vector<Shader*> getPassShaders()
+{
+	std::vector<Shader*> shaders;
+	shaders.push_back(&shadowMap.depthShader());
+	shaders.push_back(&hiZ.depthShader());
+	shaders.push_back(&hiZ.downsampleShader());
+	shaders.push_back(&occlusionQueries.boxShader());
+	shaders.push_back(&crowd.shader());
+	shaders.push_back(&dynamicResolution.upscaleShader());
+	return shaders;
+}
 
-Shader lightingShader;
-Shader lightingShaderColor;
-unsigned int diffuseMapBuildingWall;  
-unsigned int diffuseMapBuildingRoof; 
-unsigned int diffuseMapStadium;
+/// Takes what the frame needs from the scene just loaded: the direction of its directional light, the
+/// lighting variants for its lights and the occlusion queries of its entities.
+void prepareScene()
+{
+	const std::vector<Light>& lights = scene.lights();
+	for (size_t i = 0; i < lights.size(); i++)
+		if (lights[i].type == LIGHT_DIRECTIONAL)
+			dirLightDirection = lights[i].direction;
+
+	const int pointLights = scene.lightCount(LIGHT_POINT);
+	const bool spotLight = scene.lightCount(LIGHT_SPOT) > 0;
+	lightingShader = &lightingShaders.get(ShaderKey(true, pointLights, spotLight, true));
+	lightingShaderColor = &lightingShaders.get(ShaderKey(false, pointLights, spotLight, true));
+
+	occlusionQueries.clear();
+	const uint8_t* flags = scene.flags();
+	for (uint32_t i = 0; i < (uint32_t)scene.size(); i++)
+		if (flags[i] & ENTITY_OCCLUSION_QUERY)
+			scene.setOcclusionQuery(scene.handleAt(i), occlusionQueries.add());
+}
 
-/// Models used in the scene
-Plane ground;
-Cube businessCentre, businessCentre2;
-Cube tower1, tower2;
-Pyramid pyramidTower1;
-Cube stadiumBottom;
-Torus stadiumTop;
+/// Returns false, having set up nothing, if the scene cannot be loaded.
+bool setupScene()
+{
+	/// Load the scene.
+	/// Then, set up the lighting shaders and the rendering passes.
+	/// Then, prepare them for the scene.
+
+	if (!SceneFile::load(scenePaths[currentScene], scene, loadTexture))
+		return false;
+	sceneWatcher.watch(scenePaths[currentScene]);
+
+	lightingShaders = ShaderVariants("shaderfiles/multiple_lights.vs", "shaderfiles/multiple_lights.fs");
+	lightingShaders.watch(shaderWatcher);
+
+	shadowMap = CascadedShadowMap(2048, 60.0f);
+	hiZ = HiZOcclusion(256, 256);
+	occlusionQueries = OcclusionQueries(4);
+	occlusionQueries.enabled = false;
+	crowd = Crowd(scene.crowdStands());
+	dynamicResolution = DynamicResolution(frameBudgetMilliseconds);
+	std::vector<Shader*> passShaders = getPassShaders();
+	for (size_t i = 0; i < passShaders.size(); i++)
+	{
+		std::vector<std::string> files = passShaders[i]->sourceFiles();
+		for (size_t j = 0; j < files.size(); j++)
+			shaderWatcher.watch(files[j]);
+	}
+	prepareScene();
+	return true;
+}
 
-void setupScene()
+/// Loads path in place of the scene, between frames. Meshes built from the same records and textures of
+/// the same images are kept, as are the passes and the lighting variants, of which only those for a new
+/// number of lights are compiled; the crowd is rebuilt only if its stands changed. changed compiles path
+/// whether or not its binary looks current. If path cannot be loaded the scene stays as it was.
+void swapScene(const std::string& path, bool changed)
 {
-	/// Load the shaders.
-	/// Then, set up models 
-	/// Then, load the textures. 
+	const double start = Simulation::now();
+	const std::vector<CrowdStand> stands = scene.crowdStands();
+	const size_t texturesBefore = textureStreamer.textureCount();
+
+	// textures are added and deleted with the loader thread stopped
+	textureStreamer.stop();
+	const bool loaded = SceneFile::reload(path, scene, loadTexture, changed);
+	size_t deleted = 0;
+	if (loaded)
+	{
+		std::vector<GLuint> used;
+		for (uint32_t i = 0; i < (uint32_t)scene.materialCount(); i++)
+			for (int j = 0; j < 2; j++)
+				if (scene.material(i).textures[j] != 0)
+					used.push_back(scene.material(i).textures[j]);
+		deleted = textureStreamer.retain(used);
+	}
+	textureStreamer.start();
+	if (!loaded)
+		return;
+
+	if (scene.crowdStands() != stands)
+		crowd = Crowd(scene.crowdStands());
+	prepareScene();
+	sceneBVHVersion = ~0u;
+	pickedEntity = EntityHandle();
+	if (softwareRendering || compareSoftware)
+		softwareRasterizer.load(scene);
+	sceneWatcher.watch(path);
+
+	std::cout << "Swapped in " << path << " in " << (Simulation::now() - start) * 1000.0 << " ms; "
+		<< textureStreamer.textureCount() - (texturesBefore - deleted) << " texture(s) loaded, " << deleted << " deleted" << std::endl;
+}
 
-	lightingShader = Shader("shaderfiles/multiple_lights.vs", "shaderfiles/multiple_lights.fs");
-	lightingShaderColor = Shader("shaderfiles/multiple_lights_color.vs", "shaderfiles/multiple_lights_color.fs");
+/// Swaps the scene again when the file of the venue shown changed on disk.
+void reloadChangedScene()
+{
+	std::vector<std::string> changed = sceneWatcher.poll();
+	if (std::find(changed.begin(), changed.end(), scenePaths[currentScene]) != changed.end())
+		swapScene(scenePaths[currentScene], true);
+}
 
-	/// Ground, a plane where everything sits on.
+float getNearPlane()
+{
+	return perspectiveProjection ? 0.1f : 0.01f;
+}
 
-	ground = Plane(lightingShaderColor, glm::vec3(0), glm::vec3(100, 100, 100));
+glm::mat4 getProjection()
+{
+	if (perspectiveProjection) 
+	{
+		return glm::perspective(glm::radians(camera.Zoom), projectionAspect, getNearPlane(), FAR_PLANE);
+	}
+	else 
+	{
+		return glm::ortho(-10.0f, 10.0f, -10.0f, 10.0f, getNearPlane(), FAR_PLANE);
+	}
+}
 
-	/// Tiny value to add between things, so that two faces do not occupy the same space; this is done to prevent Z-fighting.
-	const float PADDING = 0.005f;
-	 
-	/// Business centre
+void setShaderVariables(Shader& shader)
+{
+	// be sure to activate shader when setting uniforms/drawing objects
+	shader.use();
+	shader.setVec3("viewPos", camera.Position);
 
+	// the lights come from the scene file; the variant was specialised for their number
+	const std::vector<Light>& lights = scene.lights();
+	int pointLight = 0;
+	for (size_t i = 0; i < lights.size(); i++)
 	{
-		const glm::vec3 position(-16.0f, 0.0f, 0.0f);
-		const float width = 3.0f;
-		const float height = 3.0f;
-		businessCentre = Cube(lightingShader, position + glm::vec3(width + PADDING, height/2.0f + PADDING, 0.0f), 0.0f, glm::vec3(width, height, width), 1.0f, 1.0f);
-		businessCentre2 = Cube(lightingShader, position + glm::vec3(0.0f, height/2.0f + PADDING, 0.0f), 90.0f, glm::vec3(3 * width, height, width), 1.0f, 1.0f);
+		const Light& light = lights[i];
+		if (light.type == LIGHT_DIRECTIONAL)
+		{
+			shader.setVec3("dirLight.direction", light.direction);
+			shader.setVec3("dirLight.ambient", light.ambient);
+			shader.setVec3("dirLight.diffuse", light.diffuse);
+			shader.setVec3("dirLight.specular", light.specular);
+		}
+		else if (light.type == LIGHT_POINT)
+		{
+			const UniformName pointLightName = UniformName("pointLights").at(pointLight++);
+			shader.setVec3(pointLightName.member("position"), light.position);
+			shader.setVec3(pointLightName.member("ambient"), light.ambient);
+			shader.setVec3(pointLightName.member("diffuse"), light.diffuse);
+			shader.setVec3(pointLightName.member("specular"), light.specular);
+			shader.setFloat(pointLightName.member("constant"), light.constant);
+			shader.setFloat(pointLightName.member("linear"), light.linear);
+			shader.setFloat(pointLightName.member("quadratic"), light.quadratic);
+		}
+		else
+		{
+			// the flashlight follows the camera
+			shader.setVec3("spotLight.position", camera.Position);
+			shader.setVec3("spotLight.direction", camera.Front);
+			shader.setVec3("spotLight.ambient", light.ambient);
+			shader.setVec3("spotLight.diffuse", light.diffuse);
+			shader.setVec3("spotLight.specular", light.specular);
+			shader.setFloat("spotLight.constant", light.constant);
+			shader.setFloat("spotLight.linear", light.linear);
+			shader.setFloat("spotLight.quadratic", light.quadratic);
+			shader.setFloat("spotLight.cutOff", light.cutOff);
+			shader.setFloat("spotLight.outerCutOff", light.outerCutOff);
+		}
 	}
 
-	/// Stadium
+	shadowMap.bind(shader, SHADOW_MAP_TEXTURE_UNIT);
 
+	// view/projection transformations
+	glm::mat4 projection = getProjection();
+	glm::mat4 view = camera.GetViewMatrix();
+	shader.setMat4("projection", projection);
+	shader.setMat4("view", view);
+	 
+	shader.setFloat("material.shininess", 32.0f);
+}
+
+/// Recompiles shaders whose source files changed on disk. Called between frames, so no draw ever sees a
+/// program swapped halfway through.
+void reloadChangedShaders()
+{
+	std::vector<std::string> changed = shaderWatcher.poll();
+	if (changed.empty())
+		return;
+
+	int reloaded = lightingShaders.reload(changed);
+	std::vector<Shader*> passShaders = getPassShaders();
+	for (size_t i = 0; i < passShaders.size(); i++)
 	{
-		const glm::vec3 position(0.0f, 0.0f, 0.0f);
-		const float width = 8.0f;
-		//const float height = 1.67f;
-		const float height = 2.3f;
-		const float topHeight = 1.0f;
-		stadiumBottom = Cube(lightingShader, position + glm::vec3(0.0f, height / 2 + PADDING, 0.0f), 0.0f, glm::vec3(width * 1.50f, height, width), 1.0f, 1.0f);
+		bool affected = false;
+		for (size_t j = 0; j < changed.size(); j++)
+			affected = affected || passShaders[i]->usesFile(changed[j]);
 
-		stadiumTop = Torus(lightingShader, position + glm::vec3(0.0f, height  + topHeight, 0.0f), glm::vec3(1.25f, 1.0f, 1.0f), width/1.50f, topHeight*1.50f);
+		if (affected && passShaders[i]->reload())
+			reloaded++;
 	}
+	std::cout << "Reloaded " << reloaded << " shader variant(s)" << std::endl;
+}
 
-	/// Towers
+/// Renders the cascades due for an update this frame. The ground only receives shadows; everything
+/// standing on it casts them.
+void renderShadows()
+{
+	if (shadowMap.update(camera.GetViewMatrix(), getProjection(), getNearPlane(), FAR_PLANE, dirLightDirection, frameIndex) == 0)
+		return;
+
+	shadowMap.begin();
+	Shader& depthShader = shadowMap.depthShader();
+	const int instances = shadowMap.updateCount();
+
+	const size_t count = scene.size();
+	const uint8_t* flags = scene.flags();
+	const uint32_t* meshIds = scene.meshIds();
+	const glm::mat4* modelMatrices = scene.modelMatrices();
+	uint32_t boundMesh = EntityHandle::INVALID;
+	for (size_t i = 0; i < count; i++)
+	{
+		if (!(flags[i] & ENTITY_CASTS_SHADOW))
+			continue;
+
+		const Mesh& mesh = scene.mesh(meshIds[i]);
+		if (meshIds[i] != boundMesh)
+		{
+			mesh.bind();
+			boundMesh = meshIds[i];
+		}
+		depthShader.setMat4("model", modelMatrices[i]);
+		mesh.drawDepth(instances);
+	}
 
+	shadowMap.end();
+}
+
+/// Draws the buildings that hide most of the city into the Hi-Z pyramid. Everything drawn in drawScene()
+/// is then tested against the pyramid read back from an earlier frame.
+void renderOccluders()
+{
+	if (!hiZ.enabled)
+		return;
+
+	hiZ.beginOccluders(getProjection() * camera.GetViewMatrix());
+	Shader& depthShader = hiZ.depthShader();
+
+	const size_t count = scene.size();
+	const uint8_t* flags = scene.flags();
+	const uint32_t* meshIds = scene.meshIds();
+	const glm::mat4* modelMatrices = scene.modelMatrices();
+	for (size_t i = 0; i < count; i++)
 	{
-		const glm::vec3 position(16.0f, 0.0f, 0.0f);
-		const float width = 2.0f;
-		const float height = 6.0f; const float height2 = 7.0f;
-		const float pyramidWidth = 2.0f;
-		const float pyramidHeight = 1.5f;
-		const glm::vec3 pyramidPosition = position + glm::vec3(0, height + pyramidHeight/2.0f, 0);
+		if (!(flags[i] & ENTITY_OCCLUDER))
+			continue;
 
-		tower1 = Cube(lightingShader, position + glm::vec3(0.0f, height / 2 + PADDING, 0.0f), 0.0f, glm::vec3(width, height, width), 1.f, 4.0f);
-		pyramidTower1 = Pyramid(lightingShaderColor, pyramidPosition, 0, glm::vec3(pyramidWidth, pyramidHeight, pyramidWidth));
-		 
-		const glm::vec3 positionTower2(14.0f, 0.0f, 8.0f);
-		tower2 = Cube(lightingShader, positionTower2 + glm::vec3(0.0f, height2 / 2 + PADDING, 0.0f), 0.0f, glm::vec3(width, height2, width), 1.f, 4.0f);
+		const Mesh& mesh = scene.mesh(meshIds[i]);
+		mesh.bind();
+		depthShader.setMat4("model", modelMatrices[i]);
+		mesh.drawDepth(1);
 	}
-	 
-	/// Load textures 
-	diffuseMapBuildingWall = loadTexture("building_wall.jpg");
-	diffuseMapBuildingRoof = loadTexture("building_roof.jpg");
-	diffuseMapStadium = loadTexture("stadium.jpg");
+
+	hiZ.endOccluders();
 }
 
-void setShaderVariables(Shader& shader)
+/// Issues the bounding box queries that decide, on the next frame, whether the expensive objects are drawn.
+/// Must follow drawScene() so the boxes are tested against this frame's depth buffer.
+void issueOcclusionQueries()
 {
-	// be sure to activate shader when setting uniforms/drawing objects
-	shader.use();
-	shader.setVec3("viewPos", camera.Position);
+	if (!occlusionQueries.enabled)
+		return;
 
-	/*
-	   Here we set all the uniforms for the 5/6 types of lights we have. We have to set them manually and index
-	   the proper PointLight struct in the array to set each uniform variable. This can be done more code-friendly
-	   by defining light types as classes and set their values in there, or by using a more efficient uniform approach
-	   by using 'Uniform buffer objects', but that is something we'll discuss in the 'Advanced GLSL' tutorial.
-	*/
-	// directional light
-	shader.setVec3("dirLight.direction", -0.2f, -1.0f, -0.3f);
-	shader.setVec3("dirLight.ambient", 0.75f, 0.75f, 0.75f);
-	shader.setVec3("dirLight.diffuse", 0.4f, 0.4f, 0.4f);
-	shader.setVec3("dirLight.specular", 0.5f, 0.5f, 0.5f);
-
-	// point light 1
-	shader.setVec3("pointLights[0].position", glm::vec3(0.0f, 7.0f, 0.0f));
-	shader.setVec3("pointLights[0].ambient", 0.01f, 0.01f, 0.5f);
-	shader.setVec3("pointLights[0].diffuse", 0.01f, 0.01f, 0.5f);
-	shader.setVec3("pointLights[0].specular", 0.01f, 0.01f, 0.5f);
-	shader.setFloat("pointLights[0].constant", 0.003f);
-	shader.setFloat("pointLights[0].linear", 0.007f);
-	shader.setFloat("pointLights[0].quadratic", 0.0027f);
-
-	// spotLight
-	shader.setVec3("spotLight.position", camera.Position);
-	shader.setVec3("spotLight.direction", camera.Front);
-	shader.setVec3("spotLight.ambient", 0.0f, 0.0f, 0.0f);
-	shader.setVec3("spotLight.diffuse", 0.4f, 0.4f, 0.4f);
-	shader.setVec3("spotLight.specular", 0.4f, 0.4f, 0.4f);
-	shader.setFloat("spotLight.constant", 0.5f);
-	shader.setFloat("spotLight.linear", 0.007f);
-	shader.setFloat("spotLight.quadratic", 0.011f);
-	shader.setFloat("spotLight.cutOff", glm::cos(glm::radians(12.5f)));
-	shader.setFloat("spotLight.outerCutOff", glm::cos(glm::radians(15.0f)));
+	occlusionQueries.beginQueries(getProjection() * camera.GetViewMatrix(), camera.Position);
 
-	// view/projection transformations
-	glm::mat4 projection;
+	const size_t count = scene.size();
+	const int* queries = scene.occlusionQueries();
+	const AABB* bounds = scene.worldBounds();
+	for (size_t i = 0; i < count; i++)
+		if (queries[i] >= 0)
+			occlusionQueries.issueQuery(queries[i], bounds[i]);
 
-	if (perspectiveProjection) 
+	occlusionQueries.endQueries();
+}
+
+/// Brings sceneBVH up to date with the entities' world bounds; moved tells whether any entity moved.
+void updateBVH(bool moved)
+{
+	bool rebuild = scene.structureVersion() != sceneBVHVersion;
+	if (!rebuild && moved)
+		rebuild = sceneBVH.refit(scene.worldBounds()) > BVH_REBUILD_RATIO;
+	if (!rebuild)
+		return;
+
+	sceneBVH.build(scene.worldBounds(), scene.size());
+	sceneBVHVersion = scene.structureVersion();
+
+	// children come after their parents, so a reverse sweep sees them first
+	const std::vector<BVH::Node>& nodes = sceneBVH.nodes();
+	const std::vector<uint32_t>& indices = sceneBVH.indices();
+	const uint8_t* flags = scene.flags();
+	bvhNodeOccludable.assign(nodes.size(), 1);
+	for (size_t i = nodes.size(); i-- > 0; )
 	{
-		projection = glm::perspective(glm::radians(camera.Zoom), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 100.0f);
+		if (!nodes[i].isLeaf())
+		{
+			bvhNodeOccludable[i] = bvhNodeOccludable[i + 1] && bvhNodeOccludable[nodes[i].offset];
+			continue;
+		}
+		for (uint32_t j = 0; j < nodes[i].count; j++)
+			if (!(flags[indices[nodes[i].offset + j]] & ENTITY_OCCLUDABLE))
+				bvhNodeOccludable[i] = 0;
 	}
-	else 
+}
+
+/// Finds the entities in the view. Whole subtrees of occludable entities are dropped when hidden; the
+/// rest are tested one by one by buildDrawKeys().
+void findVisibleEntities()
+{
+	cullStartTime = glfwGetTime();
+	Frustum frustum(cullViewProjection);
+	visibleEntities.clear();
+	sceneBVH.query(frustum, scene.worldBounds(), [](uint32_t node, const AABB& nodeBounds) {
+		return !bvhNodeOccludable[node] || hiZ.isVisible(nodeBounds);
+	}, visibleEntities);
+}
+
+/// Gives each visible entity its key in drawList, or CULLED_KEY if the Hi-Z test culls it.
+void buildDrawKeys()
+{
+	const AABB* bounds = scene.worldBounds();
+	const uint8_t* flags = scene.flags();
+	const uint32_t* meshIds = scene.meshIds();
+	const uint32_t* materialIds = scene.materialIds();
+
+	drawList.resize(visibleEntities.size());
+	std::atomic<int> tested(0), culled(0);
+	jobs.parallelFor(visibleEntities.size(), DRAW_KEY_GRAIN, [&](size_t begin, size_t end) {
+		int rangeTested = 0, rangeCulled = 0;
+		for (size_t v = begin; v < end; v++)
+		{
+			const uint32_t i = visibleEntities[v];
+			if (flags[i] & ENTITY_OCCLUDABLE)
+			{
+				rangeTested++;
+				if (hiZ.isHidden(bounds[i]))
+				{
+					rangeCulled++;
+					drawList[v] = CULLED_KEY;
+					continue;
+				}
+			}
+
+			// 16 bits each of material and mesh are plenty; the entity's index fills the rest
+			drawList[v] = ((uint64_t)(materialIds[i] & 0xffff) << 48) | ((uint64_t)(meshIds[i] & 0xffff) << 32) | (uint64_t)i;
+		}
+		tested += rangeTested;
+		culled += rangeCulled;
+	});
+	hiZ.addStatistics(tested, culled);
+}
+
+/// Sorts drawList so drawScene() changes material and mesh as rarely as possible, and drops the culled
+/// entities, whose keys sort last.
+void sortDrawList()
+{
+	jobs.sort(drawList, drawListScratch);
+	drawList.erase(std::lower_bound(drawList.begin(), drawList.end(), CULLED_KEY), drawList.end());
+}
+
+void beginConditional(void* queries, int query)
+{
+	((OcclusionQueries*)queries)->beginConditional(query);
+}
+
+/// Takes the same arguments as beginConditional(), as CommandList::call() passes them.
+void endConditional(void* queries, int)
+{
+	((OcclusionQueries*)queries)->endConditional();
+}
+
+/// Records binding a material's textures or colour to the lighting program it needs.
+void recordMaterial(CommandList& commands, const LightingProgram& program, const Material& material)
+{
+	if (!material.textured)
 	{
-		projection = glm::ortho(-10.0f, 10.0f, -10.0f, 10.0f, 0.01f, 100.0f);
+		commands.setVec3(program.diffuse, material.color);
+		commands.setVec3(program.specular, material.color);
+		return;
 	}
 
-	glm::mat4 view = camera.GetViewMatrix();
-	shader.setMat4("projection", projection);
-	shader.setMat4("view", view);
-	 
-	lightingShaderColor.setFloat("material.shininess", 32.0f);
+	commands.bindTexture(0, material.textures[0]);
+	commands.bindTexture(1, material.textures[1]);
+	commands.setInt(program.diffuse, material.sampler);
+	commands.setInt(program.specular, material.sampler);
 }
 
-/// Sets both the diffuse and specular uniforms of the color shader to the same value.
-void setShaderColor(glm::vec3 color)
+/// Records drawList[first, last) into commands. Each range starts from unknown GL state, so it binds
+/// everything its first entity needs and from then on only what changes.
+void recordDrawRange(CommandList& commands, size_t first, size_t last)
 {
-	lightingShaderColor.setVec3("material.diffuse", color);
-	lightingShaderColor.setVec3("material.specular", color);
+	const uint32_t* meshIds = scene.meshIds();
+	const uint32_t* materialIds = scene.materialIds();
+	const glm::mat4* modelMatrices = scene.modelMatrices();
+	const int* queries = scene.occlusionQueries();
+
+	commands.clear(frameArena.local(JobSystem::threadIndex()));
+	const LightingProgram* program = NULL;
+	uint32_t boundMaterial = EntityHandle::INVALID, boundMesh = EntityHandle::INVALID;
+	bool secondaryDrawn = false;
+	for (size_t i = first; i < last; i++)
+	{
+		const uint32_t entity = (uint32_t)drawList[i];
+		const Material& material = scene.material(materialIds[entity]);
+		const Mesh& mesh = scene.mesh(meshIds[entity]);
+
+		if (materialIds[entity] != boundMaterial)
+		{
+			const LightingProgram* next = material.textured ? &texturedProgram : &colorProgram;
+			if (next != program)
+				commands.useProgram(next->program);
+			program = next;
+			recordMaterial(commands, *program, material);
+			boundMaterial = materialIds[entity];
+		}
+		// the previous entity's secondary range left unit 1 selected
+		else if (secondaryDrawn)
+		{
+			commands.setInt(program->diffuse, material.sampler);
+			commands.setInt(program->specular, material.sampler);
+		}
+		secondaryDrawn = material.textured && mesh.hasSecondary();
+
+		if (meshIds[entity] != boundMesh)
+		{
+			commands.bindVertexArray(mesh.VAO);
+			boundMesh = meshIds[entity];
+		}
+
+		commands.setMat4(program->model, modelMatrices[entity]);
+		if (queries[entity] >= 0)
+			commands.call(beginConditional, &occlusionQueries, queries[entity]);
+
+		// the main range samples the material's unit, the secondary range unit 1; see mesh.h
+		commands.draw(mesh, 0, mesh.secondaryFirst, 1);
+		if (mesh.hasSecondary())
+		{
+			if (material.textured)
+			{
+				commands.setInt(program->diffuse, 1);
+				commands.setInt(program->specular, 1);
+			}
+			commands.draw(mesh, mesh.secondaryFirst, mesh.count - mesh.secondaryFirst, 1);
+		}
+
+		if (queries[entity] >= 0)
+			commands.call(endConditional, &occlusionQueries, queries[entity]);
+	}
 }
 
-/// Sets both the diffuse and specular uniforms of the texture shader to the same value.
-void setShaderTexture(int samplerValue)
+/// Records drawList into drawCommands, one range per job.
+void recordDrawCommands()
 {
-	lightingShaderColor.setInt("material.diffuse", samplerValue);
-	lightingShaderColor.setInt("material.specular", samplerValue);
+	drawCommandCount = (drawList.size() + DRAW_RECORD_GRAIN - 1) / DRAW_RECORD_GRAIN;
+	if (drawCommands.size() < drawCommandCount)
+		drawCommands.resize(drawCommandCount);
+
+	jobs.parallelFor(drawCommandCount, 1, [](size_t begin, size_t end) {
+		for (size_t range = begin; range < end; range++)
+			recordDrawRange(drawCommands[range], range * DRAW_RECORD_GRAIN, std::min(drawList.size(), (range + 1) * DRAW_RECORD_GRAIN));
+	});
+	cullMilliseconds = (float)((glfwGetTime() - cullStartTime) * 1000.0);
 }
 
-void drawScene()
-{  
-	/// Non-textured models -- ground and pyramid at the top
-	/// ------------------------------
-	
-	setShaderVariables(lightingShaderColor);
-	lightingShaderColor.setFloat("material.shininess", 32.0f);
+/// Looks up what recordDrawRange() needs of the lighting shaders. Render thread only.
+LightingProgram getLightingProgram(const Shader& shader)
+{
+	LightingProgram program;
+	program.program = shader.id();
+	program.model = shader.location("model");
+	program.diffuse = shader.location("material.diffuse");
+	program.specular = shader.location("material.specular");
+	return program;
+}
 
-	/// Render the ground   
-	setShaderColor(glm::vec3(0.21f, 0.21f, 0.21f));
+/// Builds cullGraph, which fills drawList with the entities inside the view frustum that the Hi-Z test
+/// does not cull, and records the commands that draw them. Each stage spreads its work over the workers
+/// itself.
+void setupFrameJobs()
+{
+	int find = cullGraph.add(findVisibleEntities);
+	int keys = cullGraph.add(buildDrawKeys);
+	int sort = cullGraph.add(sortDrawList);
+	int record = cullGraph.add(recordDrawCommands);
+	cullGraph.precede(find, keys);
+	cullGraph.precede(keys, sort);
+	cullGraph.precede(sort, record);
+}
 
-	ground.Draw();
-	 
-	setShaderColor(glm::vec3(0.25f, 0, 0.0f));
-	pyramidTower1.Draw();
-	 
-	/// Textured models -- business centre, stadium, towers
-	/// ------------------------------
-	
-	/// Buildings
-
-	/// Textures -- 0 is the wall, 1 is the roof texture
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, diffuseMapBuildingWall); 
-	glActiveTexture(GL_TEXTURE1);
-	glBindTexture(GL_TEXTURE_2D, diffuseMapBuildingRoof);
-
-	setShaderVariables(lightingShader);
-	
-	/// Draw the business centre 
-	 
-	setShaderTexture(0);
-	businessCentre.Draw(); 
-	setShaderTexture(0);
-	businessCentre2.Draw();
+/// Shows the frame rate, the GPU cost of the shadow pass, the occlusion culling results, the GPU memory
+/// taken and the frame arena's use in the title bar, refreshed once a second.
+void updateWindowTitle()
+{
+	static float lastUpdate = 0.0f;
+	static int frames = 0;
+
+	frames++;
+	float now = (float)glfwGetTime();
+	if (now - lastUpdate < 1.0f)
+		return;
+
+	// each part is appended by formatting the title so far into a new string; the arena makes that free
+	Arena& text = frameArena.local(JobSystem::threadIndex());
+	const char* title = NULL;
+	if (softwareRendering)
+	{
+		const SoftwareRasterizer::Statistics& software = softwareRasterizer.lastStatistics();
+		title = text.format("LearnOpenGL | %.2f fps | software, %zu triangles on %d threads: shadows %.2f ms, geometry %.2f ms, binning %.2f ms, raster %.2f ms",
+			frames / (now - lastUpdate), software.triangles, jobs.workerCount() + 1, software.shadowMilliseconds, software.geometryMilliseconds,
+			software.binningMilliseconds, software.rasterMilliseconds);
+		title = text.format("%s | tick %llu | drawn %zu/%zu", title, (unsigned long long)simulation.latest().tick, visibleEntities.size(), scene.size());
+	}
+	else
+	{
+		title = text.format("LearnOpenGL | %.2f fps | shadows %.2f ms", frames / (now - lastUpdate), shadowMap.lastPassMilliseconds());
+		if (hiZ.enabled)
+			title = text.format("%s | Hi-Z occlusion, culled %d/%d", title, hiZ.lastCulled(), hiZ.lastTested());
+		else if (occlusionQueries.enabled)
+			title = text.format("%s | occlusion queries, hidden %d/%d, %d queries pooled", title, occlusionQueries.lastHidden(),
+				occlusionQueries.tracked(), occlusionQueries.poolSize());
+		else
+			title = text.format("%s | occlusion off", title);
+		if (!fixedResolution)
+			title = text.format("%s | resolution %.0f%% (%dx%d), scene %.2f ms, budget %.2f ms", title, dynamicResolution.scale() * 100.0f,
+				dynamicResolution.width(), dynamicResolution.height(), dynamicResolution.lastPassMilliseconds(), dynamicResolution.budgetMilliseconds());
+		size_t commands = 0;
+		for (size_t i = 0; i < drawCommandCount; i++)
+			commands += drawCommands[i].size();
+		title = text.format("%s | tick %llu | drawn %zu/%zu in %zu commands | culled and recorded in %.2f ms on %d threads", title,
+			(unsigned long long)simulation.latest().tick, drawList.size(), scene.size(), commands, cullMilliseconds, jobs.workerCount() + 1);
+	}
+	if (textureStreamer.streaming)
+		title = text.format("%s | textures %.1f/%.0f MB, %zu/%zu sharp enough", title, textureStreamer.committedBytes() / 1048576.0,
+			textureStreamer.budgetBytes / 1048576.0, textureStreamer.satisfied(), textureStreamer.textureCount());
+	const GpuResources::Totals gpu = GpuResources::totals();
+	title = text.format("%s | GPU %.1f MB in %zu objects", title, gpu.allBytes / 1048576.0, gpu.allCount);
+	const GpuResources::DriverMemory driver = GpuResources::driverMemory();
+	if (driver.availableBytes > 0)
+		title = text.format("%s (%.0f MB free)", title, driver.availableBytes / 1048576.0);
+	title = text.format("%s | frame arena %.1f/%.1f KB", title, frameArena.lastUsed() / 1024.0, frameArena.peak() / 1024.0);
+	if (frameCapture.active())
+		title = text.format("%s | captured %zu, dropped %zu", title, frameCapture.captured(), frameCapture.dropped());
+	if (scene.alive(pickedEntity))
+		title = text.format("%s | picked %u", title, (unsigned int)scene.indexOf(pickedEntity));
+	{
+		// assigning into the capacity the main thread left keeps this off the heap too
+		std::lock_guard<std::mutex> lock(windowTitleMutex);
+		windowTitle = title;
+	}
+	glfwPostEmptyEvent();
 
-	/// Render the towers
+	lastUpdate = now;
+	frames = 0;
+}
 
-	setShaderTexture(0);
-	tower1.Draw();
+/// Draws drawList by replaying drawCommands. With occlusion queries on, the GPU may still skip entities
+/// whose box was hidden last frame.
+void drawScene()
+{
+	setShaderVariables(*lightingShader);
+	setShaderVariables(*lightingShaderColor);
+	for (size_t i = 0; i < drawCommandCount; i++)
+		drawCommands[i].execute();
+}
+ 
+/// Draws the crowd if any of its stands is in view. However many spectators there are, this is one draw
+/// call; they are animated on the GPU.
+void drawCrowd()
+{
+	if (crowd.size() == 0 || !Frustum(getProjection() * camera.GetViewMatrix()).intersects(crowd.bounds()))
+		return;
+
+	Light light;
+	const std::vector<Light>& lights = scene.lights();
+	for (size_t i = 0; i < lights.size(); i++)
+		if (lights[i].type == LIGHT_DIRECTIONAL)
+			light = lights[i];
+	crowd.draw(camera.GetViewMatrix(), getProjection(), light, (float)animationTime);
+}
 
+/// Draws the entities in the view frustum on the CPU, lit as setShaderVariables() lights them and shadowed
+/// by the cascades shadowMap last chose.
+void renderSoftware(int width, int height)
+{
+	SoftwareRasterizer::View view;
+	view.view = camera.GetViewMatrix();
+	view.projection = getProjection();
+	view.position = camera.Position;
+	view.front = camera.Front;
+
+	visibleEntities.clear();
+	sceneBVH.query(Frustum(view.projection * view.view), scene.worldBounds(), [](uint32_t, const AABB&) { return true; }, visibleEntities);
+	softwareRasterizer.render(scene, view, visibleEntities.data(), visibleEntities.size(), shadowMap, jobs, width, height);
+}
 
-	setShaderTexture(0);
-	tower2.Draw();
-	  
-	/// Draw the stadium
+/// Draws the frame with --software, in place of every GL pass: the cascades are refitted as renderShadows()
+/// would, and the frame drawn on the CPU is copied to the window.
+void drawSoftware(int width, int height)
+{
+	shadowMap.update(camera.GetViewMatrix(), getProjection(), getNearPlane(), FAR_PLANE, dirLightDirection, frameIndex);
+	renderSoftware(width, height);
+	softwareRasterizer.present();
+}
 
-	setShaderTexture(1);
-	stadiumBottom.Draw();
+/// Draws the frame GL has just drawn again on the CPU, and reports how far apart the two are;
+/// --compare-software.
+void compareWithSoftware(int width, int height)
+{
+	std::vector<uint8_t> drawn((size_t)width * height * 4);
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, drawn.data());
+
+	const double start = glfwGetTime();
+	renderSoftware(width, height);
+	const double milliseconds = (glfwGetTime() - start) * 1000.0;
+
+	const uint8_t* software = softwareRasterizer.pixels();
+	const size_t pixels = (size_t)width * height;
+	size_t differing = 0;
+	double total = 0.0;
+	int largest = 0;
+	for (size_t i = 0; i < pixels; i++)
+	{
+		int difference = 0;
+		for (int channel = 0; channel < 3; channel++)
+			difference = std::max(difference, std::abs((int)drawn[i * 4 + channel] - (int)software[i * 4 + channel]));
+		total += difference;
+		largest = std::max(largest, difference);
+		differing += difference > SOFTWARE_COMPARE_THRESHOLD ? 1 : 0;
+	}
 
-	/// Load the stadium's texture into the slot 0, then use it to draw the torus.
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, diffuseMapStadium);
-	setShaderTexture(0);
-	stadiumTop.Draw();
+	const SoftwareRasterizer::Statistics& statistics = softwareRasterizer.lastStatistics();
+	std::cout << "Software frame " << width << "x" << height << ", " << statistics.triangles << " triangles on " << jobs.workerCount() + 1
+		<< " threads: " << milliseconds << " ms (shadows " << statistics.shadowMilliseconds << ", geometry " << statistics.geometryMilliseconds
+		<< ", binning " << statistics.binningMilliseconds << ", raster " << statistics.rasterMilliseconds << ")" << std::endl;
+	std::cout << "Mean difference from GL " << total / pixels << ", largest " << largest << "; " << differing << " of " << pixels
+		<< " pixels (" << 100.0 * differing / pixels << "%) differ by more than " << SOFTWARE_COMPARE_THRESHOLD << std::endl;
+	softwareCompareFailed = differing > pixels * SOFTWARE_COMPARE_TOLERANCE;
 }
  
-int main()
+/// Toggles the occlusion culling mode: Hi-Z -> occlusion queries -> off -> Hi-Z.
+void cycleOcclusionCulling()
+{
+	bool useQueries = hiZ.enabled;
+	hiZ.enabled = !hiZ.enabled && !occlusionQueries.enabled;
+	occlusionQueries.enabled = useQueries;
+	if (hiZ.enabled)
+		hiZ.invalidate();
+}
+
+/// Picks the nearest entity under the crosshair, by its bounding box.
+void pickEntity()
+{
+	uint32_t hit;
+	float distance;
+	if (!sceneBVH.raycast(camera.Position, camera.Front, FAR_PLANE, scene.worldBounds(), hit, distance))
+	{
+		pickedEntity = EntityHandle();
+		std::cout << "Picked nothing" << std::endl;
+		return;
+	}
+
+	pickedEntity = scene.handleAt(hit);
+	std::cout << "Picked entity " << hit << " (mesh " << scene.meshIds()[hit] << ", material " << scene.materialIds()[hit]
+		<< ") at distance " << distance << std::endl;
+}
+
+/// Counts the allocations of the frame just drawn, for --check-allocations: those through operator new and
+/// the blocks the frame arena took from the heap, which bypass it. Returns true once the check is over.
+bool checkFrameAllocations()
+{
+	static int frame = 0;
+	static size_t before = 0, allocations = 0, allocatingFrames = 0, worstFrame = 0;
+
+	const size_t now = AllocationCounter::count() + frameArena.heapAllocations();
+	if (frame >= ALLOCATION_CHECK_WARMUP)
+	{
+		const size_t frameAllocations = now - before;
+		allocations += frameAllocations;
+		allocatingFrames += frameAllocations > 0 ? 1 : 0;
+		worstFrame = std::max(worstFrame, frameAllocations);
+	}
+	before = now;
+	if (++frame < ALLOCATION_CHECK_WARMUP + allocationCheckFrames)
+		return false;
+
+	std::cout << allocations << " heap allocation(s) in " << allocationCheckFrames << " frames after " << ALLOCATION_CHECK_WARMUP
+		<< " warm-up frames; " << allocatingFrames << " frame(s) allocated, at most " << worstFrame << " in one" << std::endl;
+	allocationCheckFailed = allocations > 0;
+	return true;
+}
+
+/// Takes the camera and settings for this frame from the newest simulation snapshot, and carries out the
+/// requests made since the last one.
+void applySnapshot()
+{
+	const SimulationSnapshot& snapshot = simulation.latest();
+	animationTime = Simulation::now();
+	camera = Simulation::interpolate(snapshot, animationTime);
+	perspectiveProjection = snapshot.perspective;
+
+	for (; seenOcclusionCycles != snapshot.occlusionCycles; seenOcclusionCycles++)
+		cycleOcclusionCulling();
+	for (; seenPicks != snapshot.picks; seenPicks++)
+		pickEntity();
+	for (; seenMemoryReports != snapshot.memoryReports; seenMemoryReports++)
+		GpuResources::print(std::cout, GpuResources::driverMemory());
+	// presses made while a swap was pending move on that many venues, with one swap
+	if (seenVenueSwitches != snapshot.venueSwitches)
+	{
+		currentScene = (currentScene + (snapshot.venueSwitches - seenVenueSwitches)) % scenePaths.size();
+		seenVenueSwitches = snapshot.venueSwitches;
+		swapScene(scenePaths[currentScene], false);
+	}
+}
+
+/// Tells the texture streamer how large each visible textured entity is on screen where it is closest to
+/// the camera. Non-uniformly scaled entities count with their smallest scale, which errs towards the finer
+/// level.
+void requestTextureLevels()
+{
+	GLint viewport[4];
+	glGetIntegerv(GL_VIEWPORT, viewport);
+	float height = (float)viewport[3];
+	if (!fixedResolution)
+		height *= dynamicResolution.scale();
+	// pixels per world unit one unit in front of the camera; the orthographic view is 20 units high
+	const float pixelsPerUnit = perspectiveProjection ? height / (2.0f * std::tan(glm::radians(camera.Zoom) * 0.5f)) : height / 20.0f;
+
+	const glm::vec3* scales = scene.scales();
+	const AABB* bounds = scene.worldBounds();
+	const uint32_t* meshIds = scene.meshIds();
+	const uint32_t* materialIds = scene.materialIds();
+	for (size_t v = 0; v < visibleEntities.size(); v++)
+	{
+		const uint32_t i = visibleEntities[v];
+		const Material& material = scene.material(materialIds[i]);
+		if (!material.textured)
+			continue;
+
+		const glm::vec3 closest = glm::clamp(camera.Position, bounds[i].min, bounds[i].max);
+		const float distance = perspectiveProjection ? std::max(glm::length(closest - camera.Position), getNearPlane()) : 1.0f;
+		const float scale = std::min(scales[i].x, std::min(scales[i].y, scales[i].z));
+		const float texCoordsPerUnit = scene.mesh(meshIds[i]).texCoordDensity / std::max(scale, 1e-6f);
+		for (int j = 0; j < 2; j++)
+			textureStreamer.require(material.textures[j], texCoordsPerUnit, pixelsPerUnit / distance);
+	}
+}
+
+/// Makes the window's context current on this thread, loads GL and the scene, and starts the workers.
+/// Returns false if GL or the scene cannot be loaded.
+bool startRendering(GLFWwindow* window, int workers)
+{
+	glfwMakeContextCurrent(window);
+
+	// glad: load all OpenGL function pointers
+	// ---------------------------------------
+	if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress))
+	{
+		std::cout << "Failed to initialize GLAD" << std::endl;
+		return false;
+	}
+
+	// configure global opengl state
+	// -----------------------------
+	glEnable(GL_DEPTH_TEST);
+	GpuResources::detectDriverMemoryInfo();
+
+	// the software rasterizer reads every level back once, so it gets them all from the start
+	textureStreamer.streaming = !softwareRendering && !compareSoftware;
+	if (!setupScene())
+	{
+		std::cout << "Failed to load the scene " << scenePaths[currentScene] << std::endl;
+		glfwMakeContextCurrent(NULL);
+		return false;
+	}
+	if (softwareRendering || compareSoftware)
+		softwareRasterizer.load(scene);
+	textureStreamer.start();
+	jobs.start(workers);
+	frameArena.start(jobs.workerCount() + 1);
+	setupFrameJobs();
+	return true;
+}
+
+/// Draws the frame from camera with the GL passes, into the framebuffer bound.
+void drawFrame()
+{
+	renderOccluders();
+
+	// cull against the pyramid renderOccluders() just picked up, while this thread draws the shadows
+	cullViewProjection = getProjection() * camera.GetViewMatrix();
+	texturedProgram = getLightingProgram(*lightingShader);
+	colorProgram = getLightingProgram(*lightingShaderColor);
+	jobs.submit(cullGraph);
+	renderShadows();
+	jobs.wait(cullGraph);
+	requestTextureLevels();
+	if (settleTextures)
+		textureStreamer.settle();
+	else
+		textureStreamer.update();
+
+	if (!fixedResolution)
+		dynamicResolution.begin(shadowMap.lastPassMilliseconds());
+	drawScene();
+	if (!compareSoftware)
+		drawCrowd();
+	issueOcclusionQueries();
+	if (!fixedResolution)
+		dynamicResolution.end();
+}
+
+/// Deletes the GL objects of the scene and of every pass while the context is still current; their handles
+/// would otherwise be destroyed at exit, with no context to delete them in. Anything still tracked after
+/// this has leaked.
+void releaseGpuResources()
+{
+	scene = Scene();
+	textureStreamer.clear();
+	crowd = Crowd();
+	lightingShader = lightingShaderColor = NULL;
+	lightingShaders = ShaderVariants();
+	shadowMap = CascadedShadowMap();
+	hiZ = HiZOcclusion();
+	occlusionQueries = OcclusionQueries();
+	dynamicResolution = DynamicResolution();
+	softwareRasterizer.releasePresent();
+
+	const GpuResources::Totals leaked = GpuResources::totals();
+	if (leaked.allCount > 0)
+	{
+		std::cout << "Leaked " << leaked.allCount << " GL object(s):" << std::endl;
+		GpuResources::print(std::cout, GpuResources::DriverMemory());
+	}
+}
+
+/// Hands on the frames still being captured, stops the workers, deletes every GL object and releases the
+/// context.
+void stopRendering()
+{
+	frameCapture.finish();
+	if (!gpuReportPath.empty() && !GpuResources::writeJson(gpuReportPath, GpuResources::driverMemory()))
+		std::cout << "Failed to write GPU report " << gpuReportPath << std::endl;
+	textureStreamer.stop();
+	jobs.stop();
+	releaseGpuResources();
+	glfwMakeContextCurrent(NULL);
+}
+
+/// The render thread: owns the GL context, and draws frames until the window closes.
+void renderLoop(GLFWwindow* window, int workers)
+{
+	if (!startRendering(window, workers))
+	{
+		renderingFailed = true;
+		renderingStopped = true;
+		glfwPostEmptyEvent();
+		return;
+	}
+	int viewportWidth = framebufferWidth, viewportHeight = framebufferHeight;
+
+	while (!quitRendering)
+	{
+		reloadChangedShaders();
+		reloadChangedScene();
+		applySnapshot();
+
+		// make sure the viewport matches the new window dimensions; note that width and
+		// height will be significantly larger than specified on retina displays.
+		if (framebufferWidth != viewportWidth || framebufferHeight != viewportHeight)
+		{
+			viewportWidth = framebufferWidth;
+			viewportHeight = framebufferHeight;
+			glViewport(0, 0, viewportWidth, viewportHeight);
+		}
+
+		// render
+		// ------
+		glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
+		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+		 
+		updateBVH(scene.updateTransforms(&jobs));
+		if (softwareRendering)
+			drawSoftware(viewportWidth, viewportHeight);
+		else
+			drawFrame();
+		if (compareSoftware && frameIndex == SOFTWARE_COMPARE_FRAME)
+		{
+			compareWithSoftware(viewportWidth, viewportHeight);
+			break;
+		}
+		frameIndex++;
+		updateWindowTitle();
+
+		frameCapture.capture(viewportWidth, viewportHeight);
+		glfwSwapBuffers(window);
+		frameArena.reset();
+		if (allocationCheckFrames > 0 && checkFrameAllocations())
+			break;
+	}
+
+	stopRendering();
+	renderingStopped = true;
+	glfwPostEmptyEvent();
+}
+
+/// A colour and depth framebuffer for drawing without a window; deleted with it.
+struct OffscreenTarget
+{
+	GLFramebuffer framebuffer;
+	GLRenderbuffer color, depth;
+};
+
+/// Creates and binds a width by height offscreen target, and sets the viewport to it.
+OffscreenTarget createOffscreenTarget(int width, int height)
+{
+	OffscreenTarget target;
+	target.framebuffer = GLFramebuffer::create("offscreen target");
+	target.color = GLRenderbuffer::create("offscreen target");
+	target.depth = GLRenderbuffer::create("offscreen target");
+	glBindRenderbuffer(GL_RENDERBUFFER, target.color.id());
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+	GpuResources::resize(GPU_RENDERBUFFER, target.color.id(), GpuResources::imageBytes(GL_RGBA8, width, height));
+	glBindRenderbuffer(GL_RENDERBUFFER, target.depth.id());
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+	GpuResources::resize(GPU_RENDERBUFFER, target.depth.id(), GpuResources::imageBytes(GL_DEPTH_COMPONENT24, width, height));
+	glBindFramebuffer(GL_FRAMEBUFFER, target.framebuffer.id());
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, target.color.id());
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, target.depth.id());
+	glViewport(0, 0, width, height);
+	return target;
+}
+
+/// Draws one frame of the scene from pose into the framebuffer bound.
+void drawPose(const BatchPose& pose)
+{
+	camera = BatchRender::camera(pose);
+	perspectiveProjection = pose.perspective;
+
+	glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	updateBVH(scene.updateTransforms(&jobs));
+	drawFrame();
+}
+
+/// Draws this process's share of poses into an offscreen framebuffer of batchWidth by batchHeight pixels,
+/// each written as a PNG while the next is drawn. Returns the exit code.
+int renderBatch(GLFWwindow* window, int workers, const std::vector<BatchPose>& poses)
+{
+	if (!startRendering(window, workers))
+		return 1;
+
+	// every pose is a cut, so nothing drawn for the last one can be reused; the occlusion tests would cull
+	// against the previous view
+	hiZ.enabled = false;
+	occlusionQueries.enabled = false;
+	fixedResolution = true;
+	settleTextures = true;
+	projectionAspect = (float)batchWidth / (float)batchHeight;
+
+	OffscreenTarget target = createOffscreenTarget(batchWidth, batchHeight);
+	frameCapture.start(CAPTURE_PNG, BatchRender::outputPath(batchDirectory), 0, false);
+
+	const double start = Simulation::now();
+	size_t drawn = 0;
+	for (size_t i = (size_t)batchWorker; i < poses.size(); i += (size_t)batchProcesses)
+	{
+		shadowMap.invalidate();
+		drawPose(poses[i]);
+		frameCapture.capture(batchWidth, batchHeight, i);
+		frameIndex++;
+		frameArena.reset();
+		drawn++;
+	}
+
+	// deleted while the context is current
+	target = OffscreenTarget();
+	stopRendering();
+	frameCapture.stop();
+	const double seconds = Simulation::now() - start;
+	std::cout << "Drew " << drawn << " poses in " << seconds << " s, " << drawn / seconds << " per second"
+		<< (frameCapture.failed() ? "; writing failed" : "") << std::endl;
+	return frameCapture.written() == drawn ? 0 : 1;
+}
+
+/// Creates the window and its GL 3.3 core context, or returns NULL.
+GLFWwindow* createWindow(int width, int height, bool visible)
 {
 	// glfw: initialize and configure
 	// ------------------------------
@@ -261,6 +1253,7 @@ int main()
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
 	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+	glfwWindowHint(GLFW_VISIBLE, visible ? GLFW_TRUE : GLFW_FALSE);
 
 #ifdef __APPLE__
 	glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
@@ -268,105 +1261,321 @@ int main()
 
 	// glfw window creation
 	// --------------------
-	GLFWwindow* window = glfwCreateWindow(SCR_WIDTH, SCR_HEIGHT, "LearnOpenGL", NULL, NULL);
+	GLFWwindow* window = glfwCreateWindow(width, height, "LearnOpenGL", NULL, NULL);
 	if (window == NULL)
 	{
 		std::cout << "Failed to create GLFW window" << std::endl;
 		glfwTerminate();
+	}
+	return window;
+}
+
+/// --batch: in the parent, makes sure the scene's caches are compiled and runs batchProcesses workers;
+/// in a worker, or with a single process, draws the poses.
+int runBatch(int argc, char** argv, int workers)
+{
+	std::vector<BatchPose> poses;
+	if (!BatchRender::readPoses(batchPoses, poses))
+		return 1;
+
+	if (batchWorker < 0 && batchProcesses > 1)
+	{
+		if (!SceneFile::compileIfStale(scenePaths[currentScene]))
+			return 1;
+		std::string commandLine;
+		for (int i = 0; i < argc; i++)
+			commandLine += (i > 0 ? " " : "") + BatchRender::quote(argv[i]);
+		commandLine += " --jobs " + std::to_string(BatchRender::workersPerProcess(batchProcesses));
+
+		const double start = Simulation::now();
+		const bool succeeded = BatchRender::runWorkers(commandLine, batchProcesses);
+		const double seconds = Simulation::now() - start;
+		std::cout << "Drew " << poses.size() << " poses on " << batchProcesses << " processes in " << seconds << " s, "
+			<< poses.size() / seconds << " per second" << std::endl;
+		return succeeded ? 0 : 1;
+	}
+	if (batchWorker < 0)
+	{
+		batchWorker = 0;
+		batchProcesses = 1;
+	}
+
+	GLFWwindow* window = createWindow(batchWidth, batchHeight, false);
+	if (window == NULL)
+		return 1;
+	const int result = renderBatch(window, workers, poses);
+	glfwTerminate();
+	return result;
+}
+
+/// Compares the image drawn for view with its golden image, or replaces the golden image with it, and
+/// reports the view. Returns whether it passed.
+bool checkImage(int view, const std::vector<uint8_t>& image, std::vector<uint8_t>& golden, std::vector<uint8_t>& diff,
+	std::vector<uint8_t>& png)
+{
+	char path[256];
+	snprintf(path, sizeof(path), "%s/view_%05d.png", REGRESSION_DIRECTORY, view);
+	if (updateGolden)
+	{
+		const bool written = ImageFile::writePNG(path, image.data(), REGRESSION_WIDTH, REGRESSION_HEIGHT, png);
+		std::cout << (written ? "Wrote " : "Failed to write ") << path << std::endl;
+		return written;
+	}
+
+	int width = 0, height = 0;
+	if (!readImage(path, width, height, golden) || width != REGRESSION_WIDTH || height != REGRESSION_HEIGHT)
+	{
+		std::cout << "view " << view << ": no " << REGRESSION_WIDTH << "x" << REGRESSION_HEIGHT << " golden image "
+			<< path << "; run with --update-golden to make one" << std::endl;
+		return false;
+	}
+
+	const ImageRegression::Result result = ImageRegression::compare(image.data(), golden.data(), width, height, diff);
+	printf("view %d: %s, %zu pixels noticeably different, %zu beyond tolerance; mean delta E %.3f, largest %.1f\n",
+		view, result.passed() ? "passed" : "FAILED", result.noticeable, result.differing, result.meanDelta, result.largestDelta);
+	if (result.passed())
+		return true;
+
+	snprintf(path, sizeof(path), "%s/view_%05d.test.png", REGRESSION_DIRECTORY, view);
+	ImageFile::writePNG(path, image.data(), width, height, png);
+	snprintf(path, sizeof(path), "%s/view_%05d.diff.png", REGRESSION_DIRECTORY, view);
+	ImageFile::writePNG(path, diff.data(), width, height, png);
+	return false;
+}
+
+/// --check-images and --update-golden. Returns the exit code.
+int runRegression(int workers)
+{
+	std::vector<BatchPose> views;
+	if (!BatchRender::readPoses(REGRESSION_VIEWS, views))
+		return 1;
+	GLFWwindow* window = createWindow(REGRESSION_WIDTH, REGRESSION_HEIGHT, false);
+	if (window == NULL)
+		return 1;
+	if (!startRendering(window, workers))
+	{
+		glfwTerminate();
+		return 1;
+	}
+
+	// what is compared must not depend on how fast this machine draws
+	fixedResolution = true;
+	settleTextures = true;
+	projectionAspect = (float)REGRESSION_WIDTH / (float)REGRESSION_HEIGHT;
+	OffscreenTarget target = createOffscreenTarget(REGRESSION_WIDTH, REGRESSION_HEIGHT);
+
+	std::vector<uint8_t> image((size_t)REGRESSION_WIDTH * REGRESSION_HEIGHT * 4), golden, diff, png;
+	int failed = 0;
+	for (size_t view = 0; view < views.size(); view++)
+	{
+		shadowMap.invalidate();
+		hiZ.invalidate();
+		for (int frame = 0; frame < REGRESSION_FRAMES; frame++)
+		{
+			drawPose(views[view]);
+			frameIndex++;
+			frameArena.reset();
+		}
+
+		glPixelStorei(GL_PACK_ALIGNMENT, 1);
+		glReadPixels(0, 0, REGRESSION_WIDTH, REGRESSION_HEIGHT, GL_RGBA, GL_UNSIGNED_BYTE, image.data());
+		failed += checkImage((int)view, image, golden, diff, png) ? 0 : 1;
+	}
+
+	// deleted while the context is current
+	target = OffscreenTarget();
+	stopRendering();
+	glfwTerminate();
+	if (!updateGolden)
+		std::cout << views.size() - failed << " of " << views.size() << " views passed" << std::endl;
+	return failed == 0 ? 0 : 1;
+}
+
+int main(int argc, char** argv)
+{
+	int workers = JobSystem::defaultWorkerCount();
+	std::string captureTarget;
+	CaptureFormat captureFormat = CAPTURE_PNG;
+	int captureFramesPerSecond = 60;
+	for (int i = 1; i < argc; i++)
+	{
+		if (std::string(argv[i]) == "--bench-bvh")
+			return BVHBenchmark::runAll();
+		if (std::string(argv[i]) == "--check-vertex-format")
+			return VertexFormatCheck::runAll();
+		if (std::string(argv[i]) == "--import-mesh" && i + 1 < argc)
+			return MeshImport::reimport(argv[i + 1]);
+		// --jobs 0 keeps all CPU work on the render thread
+		if (std::string(argv[i]) == "--jobs" && i + 1 < argc)
+			workers = std::max(0, atoi(argv[++i]));
+		if (std::string(argv[i]) == "--check-allocations" && i + 1 < argc)
+			allocationCheckFrames = std::max(1, atoi(argv[++i]));
+		if (std::string(argv[i]) == "--software")
+			softwareRendering = true;
+		if (std::string(argv[i]) == "--compare-software")
+			compareSoftware = true;
+		if (std::string(argv[i]) == "--frame-budget" && i + 1 < argc)
+			frameBudgetMilliseconds = std::max(1.0f, (float)atof(argv[++i]));
+		if (std::string(argv[i]) == "--fixed-resolution")
+			fixedResolution = true;
+		if (std::string(argv[i]) == "--texture-budget" && i + 1 < argc)
+			textureStreamer.budgetBytes = (size_t)std::max(1, atoi(argv[++i])) << 20;
+		if (std::string(argv[i]) == "--gpu-report" && i + 1 < argc)
+			gpuReportPath = argv[++i];
+		if (std::string(argv[i]) == "--scene" && i + 1 < argc)
+			scenePaths.push_back(argv[++i]);
+		if (std::string(argv[i]) == "--capture" && i + 1 < argc)
+		{
+			captureTarget = argv[++i];
+			const size_t length = captureTarget.size();
+			captureFormat = length >= 4 && captureTarget.compare(length - 4, 4, ".y4m") == 0 ? CAPTURE_Y4M : CAPTURE_PNG;
+		}
+		if (std::string(argv[i]) == "--capture-pipe" && i + 1 < argc)
+		{
+			captureTarget = argv[++i];
+			captureFormat = CAPTURE_PIPE;
+		}
+		if (std::string(argv[i]) == "--capture-fps" && i + 1 < argc)
+			captureFramesPerSecond = std::max(1, atoi(argv[++i]));
+		if (std::string(argv[i]) == "--check-images")
+			checkImages = true;
+		if (std::string(argv[i]) == "--update-golden")
+			updateGolden = true;
+		if (std::string(argv[i]) == "--batch" && i + 2 < argc)
+		{
+			batchPoses = argv[++i];
+			batchDirectory = argv[++i];
+		}
+		if (std::string(argv[i]) == "--batch-size" && i + 2 < argc)
+		{
+			batchWidth = std::max(1, atoi(argv[++i]));
+			batchHeight = std::max(1, atoi(argv[++i]));
+		}
+		if (std::string(argv[i]) == "--batch-processes" && i + 1 < argc)
+			batchProcesses = std::max(1, atoi(argv[++i]));
+		if (std::string(argv[i]) == "--batch-worker" && i + 2 < argc)
+		{
+			batchWorker = std::max(0, atoi(argv[++i]));
+			batchProcesses = std::max(1, atoi(argv[++i]));
+		}
+	}
+	// the software frame is compared with a full resolution one
+	fixedResolution = fixedResolution || compareSoftware;
+	if (scenePaths.empty())
+		scenePaths.push_back(DEFAULT_SCENE_PATH);
+	if (allocationCheckFrames > 0 && !AllocationCounter::enabled)
+	{
+		std::cout << "--check-allocations needs a build with COUNT_ALLOCATIONS defined" << std::endl;
+		return 1;
+	}
+	if (!batchPoses.empty())
+		return runBatch(argc, argv, workers);
+	if (checkImages || updateGolden)
+		return runRegression(workers);
+
+	if (!captureTarget.empty() && !frameCapture.start(captureFormat, captureTarget, captureFramesPerSecond))
+	{
+		std::cout << "Failed to open capture output " << captureTarget << std::endl;
 		return -1;
 	}
-	glfwMakeContextCurrent(window);
+
+	GLFWwindow* window = createWindow(SCR_WIDTH, SCR_HEIGHT, true);
+	if (window == NULL)
+		return -1;
 	glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
 	glfwSetCursorPosCallback(window, mouse_callback);
 	glfwSetScrollCallback(window, scroll_callback);
 	glfwSetKeyCallback(window, input_callback);
+	glfwSetMouseButtonCallback(window, mouse_button_callback);
 
 	// tell GLFW to capture our mouse
 	glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
 
-	// glad: load all OpenGL function pointers
-	// ---------------------------------------
-	if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress))
+	// room for any title, so posting one never allocates
+	windowTitle.reserve(1024);
+	simulation.start(camera, cameraSpeed);
+	std::thread renderThread(renderLoop, window, workers);
+
+	// this thread only handles events, so input reaches the simulation however long frames take
+	while (!glfwWindowShouldClose(window) && !renderingStopped)
 	{
-		std::cout << "Failed to initialize GLAD" << std::endl;
-		return -1;
+		glfwWaitEvents();
+
+		std::lock_guard<std::mutex> lock(windowTitleMutex);
+		if (!windowTitle.empty())
+		{
+			glfwSetWindowTitle(window, windowTitle.c_str());
+			windowTitle.clear();
+		}
 	}
 
-	// configure global opengl state
-	// -----------------------------
-	glEnable(GL_DEPTH_TEST);
-
-	setupScene();
-	 
-	// render loop
-	// -----------
-	while (!glfwWindowShouldClose(window))
+	quitRendering = true;
+	renderThread.join();
+	simulation.stop();
+	if (frameCapture.active())
 	{
-		// per-frame time logic
-		// --------------------
-		float currentFrame = glfwGetTime();
-		deltaTime = currentFrame - lastFrame;
-		lastFrame = currentFrame;
-
-		// input
-		// -----
-		processInput(window);
-
-		// render
-		// ------
-		glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
-		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-		 
-		drawScene();
-		  
-		// glfw: swap buffers and poll IO events (keys pressed/released, mouse moved etc.)
-		// -------------------------------------------------------------------------------
-		glfwSwapBuffers(window);
-		glfwPollEvents();
+		frameCapture.stop();
+		std::cout << "Captured " << frameCapture.written() << " frames to " << captureTarget << ", dropped " << frameCapture.dropped()
+			<< (frameCapture.failed() ? "; writing failed" : "") << std::endl;
 	}
-	 
+
 	// glfw: terminate, clearing all previously allocated GLFW resources.
 	// ------------------------------------------------------------------
 	glfwTerminate();
-	return 0;
+	return renderingFailed || allocationCheckFailed || softwareCompareFailed ? 1 : 0;
 }
 
-// process all input: query GLFW whether relevant keys are pressed/released this frame and react accordingly
-// ---------------------------------------------------------------------------------------------------------
-void processInput(GLFWwindow *window)
+// glfw: keys go to the simulation; movement keys count as held from press to release
+// -----------------------------------------------------------------------------------
+void input_callback(GLFWwindow* window, int key, int scancode, int action, int mods)
 {
-	if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS)
+	if (key == GLFW_KEY_ESCAPE && action == GLFW_PRESS)
 		glfwSetWindowShouldClose(window, true);
 
-	if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS)
-		camera.ProcessKeyboard(FORWARD, deltaTime);
-	if (glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS)
-		camera.ProcessKeyboard(BACKWARD, deltaTime);
-	if (glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS)
-		camera.ProcessKeyboard(LEFT, deltaTime);
-	if (glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS)
-		camera.ProcessKeyboard(RIGHT, deltaTime);  
-	if (glfwGetKey(window, GLFW_KEY_Q) == GLFW_PRESS)
-		camera.ProcessKeyboard(UPWARD, deltaTime);
-	if (glfwGetKey(window, GLFW_KEY_E) == GLFW_PRESS)
-		camera.ProcessKeyboard(DOWNWARD, deltaTime); 
+	if (action == GLFW_PRESS || action == GLFW_RELEASE)
+	{
+		const bool pressed = action == GLFW_PRESS;
+		if (key == GLFW_KEY_W)
+			simulation.setMoving(FORWARD, pressed);
+		if (key == GLFW_KEY_S)
+			simulation.setMoving(BACKWARD, pressed);
+		if (key == GLFW_KEY_A)
+			simulation.setMoving(LEFT, pressed);
+		if (key == GLFW_KEY_D)
+			simulation.setMoving(RIGHT, pressed);
+		if (key == GLFW_KEY_Q)
+			simulation.setMoving(UPWARD, pressed);
+		if (key == GLFW_KEY_E)
+			simulation.setMoving(DOWNWARD, pressed);
+	}
+
+	if (key == GLFW_KEY_Z && action == GLFW_PRESS)
+		simulation.toggleProjection();
+
+	if (key == GLFW_KEY_H && action == GLFW_PRESS)
+		simulation.cycleOcclusion();
+
+	if (key == GLFW_KEY_M && action == GLFW_PRESS)
+		simulation.reportGpuMemory();
+
+	if (key == GLFW_KEY_V && action == GLFW_PRESS)
+		simulation.switchVenue();
 }
 
-void input_callback(GLFWwindow* window, int key, int scancode, int action, int mods)
+/// A left click picks the nearest entity under the crosshair, by its bounding box.
+void mouse_button_callback(GLFWwindow*, int button, int action, int)
 {
-	if (key == GLFW_KEY_Z && action == GLFW_PRESS)
-	{ 
-		perspectiveProjection = !perspectiveProjection;
-	}
+	if (button == GLFW_MOUSE_BUTTON_LEFT && action == GLFW_PRESS)
+		simulation.pick();
 }
 
 // glfw: whenever the window size changed (by OS or user resize) this callback function executes
 // ---------------------------------------------------------------------------------------------
 void framebuffer_size_callback(GLFWwindow* window, int width, int height)
 {
-	// make sure the viewport matches the new window dimensions; note that width and 
-	// height will be significantly larger than specified on retina displays.
-	glViewport(0, 0, width, height);
+	// the render thread owns the context, and sets the viewport at its next frame
+	framebufferWidth = width;
+	framebufferHeight = height;
 }
 
 // glfw: whenever the mouse moves, this callback is called
@@ -386,56 +1595,44 @@ void mouse_callback(GLFWwindow* window, double xpos, double ypos)
 	lastX = xpos;
 	lastY = ypos;
 
-	camera.ProcessMouseMovement(xoffset, yoffset);
+	simulation.addMouseMovement(xoffset, yoffset);
 }
 
 // glfw: whenever the mouse scroll wheel scrolls, this callback is called
 // ----------------------------------------------------------------------
 void scroll_callback(GLFWwindow* window, double xoffset, double yoffset)
 {
-	cameraSpeed += (float) yoffset;
-	
-	if (cameraSpeed < 0.5f)
-		cameraSpeed = 0.5f;
-
-	camera.MovementSpeed = cameraSpeed; 
+	simulation.addScroll((float) yoffset);
 }
 
 // utility function for loading a 2D texture from file
 // ---------------------------------------------------
+/// Loads a scene texture through the streamer.
 unsigned int loadTexture(char const * path)
 {
-	unsigned int textureID;
-	glGenTextures(1, &textureID);
-
-	int width, height, nrComponents;
-	unsigned char *data = stbi_load(path, &width, &height, &nrComponents, 0);
-	if (data)
-	{
-		GLenum format;
-		if (nrComponents == 1)
-			format = GL_RED;
-		else if (nrComponents == 3)
-			format = GL_RGB;
-		else if (nrComponents == 4)
-			format = GL_RGBA;
-
-		glBindTexture(GL_TEXTURE_2D, textureID);
-		glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-		glGenerateMipmap(GL_TEXTURE_2D);
+	return textureStreamer.load(path, decodeImage);
+}
 
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+/// Decodes an image file to RGBA, top row first. Returns false if it could not be read.
+bool decodeImage(const char* path, int& width, int& height, std::vector<uint8_t>& pixels)
+{
+	int components;
+	unsigned char* data = stbi_load(path, &width, &height, &components, 4);
+	if (data == NULL)
+		return false;
+	pixels.assign(data, data + (size_t)width * height * 4);
+	stbi_image_free(data);
+	return true;
+}
 
-		stbi_image_free(data);
-	}
-	else
-	{
-		std::cout << "Texture failed to load at path: " << path << std::endl;
-		stbi_image_free(data);
-	}
+/// Reads an image file as RGBA, bottom row first like glReadPixels. Returns false if it could not be read.
+bool readImage(const char* path, int& width, int& height, std::vector<uint8_t>& pixels)
+{
+	if (!decodeImage(path, width, height, pixels))
+		return false;
 
-	return textureID;
+	const size_t row = (size_t)width * 4;
+	for (int y = 0; y < height / 2; y++)
+		std::swap_ranges(pixels.begin() + row * y, pixels.begin() + row * (y + 1), pixels.begin() + row * (height - 1 - y));
+	return true;
 }
\ No newline at end of file
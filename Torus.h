@@ -4,8 +4,12 @@
 #include <glad/glad.h>
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp> 
-#include "shader.h"
+#include <glm/gtc/constants.hpp>
+#include "mesh.h"
+#include "frame_arena.h"
+#include "vertex_format.h"
 
+#include <cmath>
 #include <vector>
 using namespace std;
 
@@ -14,39 +18,77 @@ class Torus
 public:
     static const int mainSegments = 16;
     static const int tubeSegments = 16;
+    static const int VERTEX_COUNT = (mainSegments + 1) * (tubeSegments + 1);
+    /// Times the texture repeats around the main circle and around the tube.
+    static constexpr float mainTextureRepeats = 12.0f;
+    static constexpr float tubeTextureRepeats = 4.0f;
     
     Torus() { } 
-	Torus(Shader& shader, glm::vec3 position, glm::vec3 scale, float mainRadius, float tubeRadius)
+	/// A torus around the Y axis, centred on the origin.
+	Torus(float mainRadius, float tubeRadius)
 	{
-		m_position = position;
-		m_shader = &shader;
-        m_scale = scale;
+        m_mainRadius = mainRadius;
+        m_tubeRadius = tubeRadius;
 
-        int numVertices = (mainSegments + 1) * (tubeSegments + 1);
-        int primitiveRestartIndex = numVertices;
+        int primitiveRestartIndex = VERTEX_COUNT;
         int numIndices = (mainSegments * 2 * (tubeSegments + 1)) + mainSegments - 1;
 
         m_numIndices = numIndices;
         m_primitiveRestartIndex = primitiveRestartIndex;
 
-        vector<float> vertices;
-        vertices.reserve(numVertices * 8); // 3, 3, 2 -- position, normal, tex coords.
+        // Both arrays come from one scratch block, freed once they are uploaded
+        Arena scratch(VERTEX_COUNT * sizeof(Vertex) + numIndices * sizeof(GLuint) + 2 * alignof(std::max_align_t));
+        Vertex* vertices = scratch.allocateArray<Vertex>(VERTEX_COUNT);
+        GetVertices(mainRadius, tubeRadius, vertices);
 
-        vector<GLuint> indices;
-        indices.reserve(numIndices);
+        GLuint* indices = scratch.allocateArray<GLuint>(numIndices);
+        GLuint* index = indices;
 
         // Generate VAO and VBOs for vertex attributes and indices
-        glGenVertexArrays(1, &m_VAO); 
-        glGenBuffers(1, &m_VBO);
-        glGenBuffers(1, &m_VEO);
+        m_buffers.vertexArray = GLVertexArray::create("Torus");
+        m_buffers.vertices = GLBuffer::create("Torus");
+        m_buffers.indices = GLBuffer::create("Torus");
+
+        // Generate indices for rendering
+        GLuint currentVertexOffset = 0;
+        for (int i = 0; i < mainSegments; i++)
+        {
+            for (int j = 0; j <= tubeSegments; j++)
+            {
+                GLuint vertexIndexA = currentVertexOffset;  
+                GLuint vertexIndexB = currentVertexOffset + tubeSegments + 1; 
+
+                *index++ = vertexIndexA;
+                *index++ = vertexIndexB;
+                 
+                currentVertexOffset++;
+            }
+
+            // Don't restart primitive, if it's last segment, rendering ends here anyway
+            if (i != mainSegments - 1) { 
+                *index++ = primitiveRestartIndex;
+            }
+        }
+
+        VertexFormat::upload(m_buffers.vertexArray.id(), m_buffers.vertices.id(), vertices, VERTEX_COUNT);
+
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_buffers.indices.id());
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, (index - indices) * sizeof(GLuint), indices, GL_STATIC_DRAW); 
+        GpuResources::resize(GPU_BUFFER, m_buffers.indices.id(), (index - indices) * sizeof(GLuint));
+	}
+
+	/// The torus's vertices at full precision, before packing; see vertex_format.h.
+	static void GetVertices(float mainRadius, float tubeRadius, Vertex* vertices)
+	{
+        Vertex* vertex = vertices;
            
         // Precalculate steps in radians for main segment and tube segment
         float mainSegmentAngleStep = glm::radians(360.0f / static_cast<float>(mainSegments));
         float tubeSegmentAngleStep = glm::radians(360.0f / static_cast<float>(tubeSegments));
 
         // Precalculate steps in texture coordinates for main segment and tube segment 
-        const float mainSegmentTextureStep = 12.0f / static_cast<float>(mainSegments);
-        const float tubeSegmentTextureStep = 4.0f / static_cast<float>(tubeSegments);
+        const float mainSegmentTextureStep = mainTextureRepeats / static_cast<float>(mainSegments);
+        const float tubeSegmentTextureStep = tubeTextureRepeats / static_cast<float>(tubeSegments);
           
         float currentMainSegmentAngle = 0.0f;
         float currentMainSegmentTexCoordV = 0.0f;
@@ -69,9 +111,7 @@ public:
                     tubeRadius * sinTubeSegment,
                     (mainRadius + tubeRadius * cosTubeSegment) * sinMainSegment);
 
-                vertices.push_back(surfacePosition[0]);
-                vertices.push_back(surfacePosition[1]);
-                vertices.push_back(surfacePosition[2]);
+                vertex->position = surfacePosition;
                  
                 // Normals
                 glm::vec3 normal = glm::vec3(
@@ -80,15 +120,13 @@ public:
                     sinTubeSegment
                 );
 
-                vertices.push_back(normal[0]);
-                vertices.push_back(normal[1]);
-                vertices.push_back(normal[2]);
+                vertex->normal = normal;
 
                 // Texture coordinates
                 glm::vec2 textureCoordinate = glm::vec2(currentTubeSegmentTexCoordU, currentMainSegmentTexCoordV);
 
-                vertices.push_back(textureCoordinate[0]);
-                vertices.push_back(textureCoordinate[1]);
+                vertex->texCoords = textureCoordinate;
+                vertex++;
                  
                 // Update current tube angle
                 currentTubeSegmentAngle += tubeSegmentAngleStep;
@@ -100,68 +138,32 @@ public:
             // Update texture coordinate of main segment
             currentMainSegmentTexCoordV += mainSegmentTextureStep;
         } 
-         
-
-        // Finally, generate indices for rendering
-        GLuint currentVertexOffset = 0;
-        for (int i = 0; i < mainSegments; i++)
-        {
-            for (int j = 0; j <= tubeSegments; j++)
-            {
-                GLuint vertexIndexA = currentVertexOffset;  
-                GLuint vertexIndexB = currentVertexOffset + tubeSegments + 1; 
-
-                indices.push_back(vertexIndexA);
-                indices.push_back(vertexIndexB);
-                 
-                currentVertexOffset++;
-            }
-
-            // Don't restart primitive, if it's last segment, rendering ends here anyway
-            if (i != mainSegments - 1) { 
-                indices.push_back(primitiveRestartIndex);
-            }
-        }
-          
-        glBindBuffer(GL_ARRAY_BUFFER, m_VBO);
-        glBufferData(GL_ARRAY_BUFFER, vertices.size() * 8, vertices.data(), GL_STATIC_DRAW);
-
-        glBindVertexArray(m_VAO);
-        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)0);
-        glEnableVertexAttribArray(0);
-        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(3 * sizeof(float)));
-        glEnableVertexAttribArray(1);
-        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(6 * sizeof(float)));
-        glEnableVertexAttribArray(2);
-
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_VEO);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLuint), indices.data(), GL_STATIC_DRAW); 
 	}
      
-	void Draw()
+	/// Drawn as one triangle strip per main segment, separated by the primitive restart index.
+	Mesh GetMesh() const
 	{
-        m_shader->use();
-		glBindVertexArray(m_VAO); 
-		glm::mat4 model = glm::mat4(1.0f);
-		model = glm::translate(model, m_position);
-        model = glm::scale(model, m_scale);
-		m_shader->setMat4("model", model);
-          
-        // Enable primitive restart, because we're rendering several triangle strips (for each main segment)
-        glEnable(GL_PRIMITIVE_RESTART);
-        glPrimitiveRestartIndex(m_primitiveRestartIndex);
-
-        // Render torus using precalculated indices
-        glDrawElements(GL_TRIANGLE_STRIP, m_numIndices, GL_UNSIGNED_INT, 0);
-
-        // Disable primitive restart, we won't need it now
-        glDisable(GL_PRIMITIVE_RESTART);
+        const float outer = m_mainRadius + m_tubeRadius;
+
+		Mesh mesh;
+		mesh.VAO = m_buffers.vertexArray.id();
+		mesh.primitive = GL_TRIANGLE_STRIP;
+		mesh.count = m_numIndices;
+		mesh.indexed = true;
+		mesh.restartIndex = m_primitiveRestartIndex;
+		mesh.secondaryFirst = m_numIndices;
+		mesh.bounds = AABB(glm::vec3(-outer, -m_tubeRadius, -outer), glm::vec3(outer, m_tubeRadius, outer));
+		// measured along the tube's centre line
+		const float twoPi = glm::two_pi<float>();
+		mesh.texCoordDensity = std::sqrt(mainTextureRepeats / (twoPi * m_mainRadius) * tubeTextureRepeats / (twoPi * m_tubeRadius));
+		return mesh;
 	}
 
+	/// Hands the GL objects over to the caller, leaving the model empty.
+	MeshBuffers TakeBuffers() { return std::move(m_buffers); }
+
 protected:
-	glm::vec3 m_position;
-    glm::vec3 m_scale;
-	GLuint m_VAO, m_VBO, m_VEO;
+	MeshBuffers m_buffers;
     int m_numIndices, m_primitiveRestartIndex;
-	Shader* m_shader;
+    float m_mainRadius, m_tubeRadius;
 };
\ No newline at end of file
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+
+/// Counts every heap allocation made through operator new, on any thread, so a frame can be checked for
+/// allocating: read count() before and after it.
+///
+/// Counting is a build option, as it replaces the standard operator new and delete for the whole program:
+/// build with COUNT_ALLOCATIONS defined to turn it on. Without it enabled is false, count() stays 0 and the
+/// standard operators are left alone. Define ALLOCATION_COUNTER_IMPLEMENTATION in exactly one source file
+/// before including this header.
+
+namespace AllocationCounter
+{
+#ifdef COUNT_ALLOCATIONS
+	const bool enabled = true;
+#else
+	const bool enabled = false;
+#endif
+
+	std::atomic<size_t>& counter();
+
+	inline size_t count() { return counter().load(std::memory_order_relaxed); }
+}
+
+#ifdef ALLOCATION_COUNTER_IMPLEMENTATION
+
+std::atomic<size_t>& AllocationCounter::counter()
+{
+	static std::atomic<size_t> allocations(0);
+	return allocations;
+}
+
+#ifdef COUNT_ALLOCATIONS
+
+#include <cstdlib>
+#include <new>
+
+#ifdef _MSC_VER
+#include <malloc.h>
+#define ALLOCATION_COUNTER_NOINLINE __declspec(noinline)
+#else
+#define ALLOCATION_COUNTER_NOINLINE __attribute__((noinline))
+#endif
+
+namespace AllocationCounter
+{
+	/// Every operator new below comes here, and every operator delete goes to release(). They are never
+	/// inlined, so the compiler does not see a pointer from operator new handed to free().
+	ALLOCATION_COUNTER_NOINLINE inline void* allocate(size_t size, size_t alignment)
+	{
+		counter().fetch_add(1, std::memory_order_relaxed);
+		if (size == 0)
+			size = 1;
+		if (alignment <= alignof(std::max_align_t))
+			return malloc(size);
+#ifdef _MSC_VER
+		return _aligned_malloc(size, alignment);
+#else
+		void* memory = NULL;
+		return posix_memalign(&memory, alignment, size) == 0 ? memory : NULL;
+#endif
+	}
+
+	ALLOCATION_COUNTER_NOINLINE inline void release(void* memory, size_t alignment)
+	{
+#ifdef _MSC_VER
+		if (alignment > alignof(std::max_align_t))
+		{
+			_aligned_free(memory);
+			return;
+		}
+#else
+		(void)alignment;
+#endif
+		free(memory);
+	}
+
+	inline void* allocateOrThrow(size_t size, size_t alignment)
+	{
+		if (void* memory = allocate(size, alignment))
+			return memory;
+		throw std::bad_alloc();
+	}
+}
+
+void* operator new(size_t size) { return AllocationCounter::allocateOrThrow(size, 0); }
+void* operator new[](size_t size) { return AllocationCounter::allocateOrThrow(size, 0); }
+void* operator new(size_t size, const std::nothrow_t&) noexcept { return AllocationCounter::allocate(size, 0); }
+void* operator new[](size_t size, const std::nothrow_t&) noexcept { return AllocationCounter::allocate(size, 0); }
+
+void operator delete(void* memory) noexcept { AllocationCounter::release(memory, 0); }
+void operator delete[](void* memory) noexcept { AllocationCounter::release(memory, 0); }
+void operator delete(void* memory, size_t) noexcept { AllocationCounter::release(memory, 0); }
+void operator delete[](void* memory, size_t) noexcept { AllocationCounter::release(memory, 0); }
+void operator delete(void* memory, const std::nothrow_t&) noexcept { AllocationCounter::release(memory, 0); }
+void operator delete[](void* memory, const std::nothrow_t&) noexcept { AllocationCounter::release(memory, 0); }
+
+// the over-aligned forms only exist from C++17 on
+#ifdef __cpp_aligned_new
+void* operator new(size_t size, std::align_val_t alignment) { return AllocationCounter::allocateOrThrow(size, (size_t)alignment); }
+void* operator new[](size_t size, std::align_val_t alignment) { return AllocationCounter::allocateOrThrow(size, (size_t)alignment); }
+void* operator new(size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept { return AllocationCounter::allocate(size, (size_t)alignment); }
+void* operator new[](size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept { return AllocationCounter::allocate(size, (size_t)alignment); }
+
+void operator delete(void* memory, std::align_val_t alignment) noexcept { AllocationCounter::release(memory, (size_t)alignment); }
+void operator delete[](void* memory, std::align_val_t alignment) noexcept { AllocationCounter::release(memory, (size_t)alignment); }
+void operator delete(void* memory, size_t, std::align_val_t alignment) noexcept { AllocationCounter::release(memory, (size_t)alignment); }
+void operator delete[](void* memory, size_t, std::align_val_t alignment) noexcept { AllocationCounter::release(memory, (size_t)alignment); }
+void operator delete(void* memory, std::align_val_t alignment, const std::nothrow_t&) noexcept { AllocationCounter::release(memory, (size_t)alignment); }
+void operator delete[](void* memory, std::align_val_t alignment, const std::nothrow_t&) noexcept { AllocationCounter::release(memory, (size_t)alignment); }
+#endif
+
+#endif
+
+#endif
@@ -0,0 +1,179 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include "camera.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+/// One viewpoint of a batch render.
+struct BatchPose
+{
+	glm::vec3 position = glm::vec3(0.0f);
+	float yaw = YAW;
+	float pitch = PITCH;
+	float zoom = ZOOM;
+	bool perspective = true;
+};
+
+/// Batch rendering: draws the scene from every pose in a list into numbered PNGs, without showing a window.
+///
+/// The pose list has one pose per line; # starts a comment:
+///
+///   <x> <y> <z> <yaw> <pitch> [<zoom>] [perspective|ortho]
+///
+/// Pose i is written to <directory>/pose_<i>.png, i counting from 0 in list order and padded to five digits.
+///
+/// The work is spread over processes, each with a context of its own and an even share of the cores for
+/// its job system. Process k of n draws poses k, k + n, k + 2n, ..., so the shares stay even when costly
+/// views are bunched together in the list. The parent compiles the scene first, so the children all map
+/// the same compiled scene and mesh caches and the OS keeps one copy of their pages; GL objects cannot be
+/// shared between processes, so each child uploads the scene once and draws all its poses with it.
+
+class BatchRender
+{
+public:
+	/// Reads a pose list. Errors are reported as path:line.
+	static bool readPoses(const std::string& path, std::vector<BatchPose>& poses)
+	{
+		std::ifstream file(path.c_str());
+		if (!file)
+		{
+			std::cout << "Failed to open pose list " << path << std::endl;
+			return false;
+		}
+
+		std::string text;
+		for (int lineNumber = 1; std::getline(file, text); lineNumber++)
+		{
+			const std::string::size_type comment = text.find('#');
+			std::istringstream line(comment == std::string::npos ? text : text.substr(0, comment));
+			std::string first;
+			if (!(line >> first))
+				continue;
+
+			BatchPose pose;
+			std::istringstream number(first);
+			if (!(number >> pose.position.x) || !(line >> pose.position.y >> pose.position.z >> pose.yaw >> pose.pitch))
+			{
+				std::cout << path << ":" << lineNumber << ": expected: <x> <y> <z> <yaw> <pitch> [<zoom>] [perspective|ortho]" << std::endl;
+				return false;
+			}
+
+			std::string word;
+			while (line >> word)
+			{
+				std::istringstream zoom(word);
+				if (word == "perspective" || word == "ortho")
+					pose.perspective = word == "perspective";
+				else if (!(zoom >> pose.zoom))
+				{
+					std::cout << path << ":" << lineNumber << ": unexpected '" << word << "'" << std::endl;
+					return false;
+				}
+			}
+			poses.push_back(pose);
+		}
+		return true;
+	}
+
+	static Camera camera(const BatchPose& pose)
+	{
+		Camera camera(pose.position, glm::vec3(0.0f, 1.0f, 0.0f), pose.yaw, pose.pitch);
+		camera.Zoom = pose.zoom;
+		return camera;
+	}
+
+	static std::string outputPath(const std::string& directory)
+	{
+		return directory + "/pose.png";
+	}
+
+	/// Enough processes that one is always feeding the GPU while the others cull, record and encode on the
+	/// CPU; beyond a few, the one GPU they share is the limit.
+	static int defaultProcesses()
+	{
+		const int cores = (int)std::max(1u, std::thread::hardware_concurrency());
+		return std::max(1, std::min(4, cores / 2));
+	}
+
+	/// Worker threads for each of processes processes, so that together they use every core once.
+	static int workersPerProcess(int processes)
+	{
+		const int cores = (int)std::max(1u, std::thread::hardware_concurrency());
+		return std::max(0, cores / processes - 1);
+	}
+
+	/// Quotes an argument for the shell runWorkers() starts the workers with.
+	static std::string quote(const std::string& argument)
+	{
+#ifdef _WIN32
+		// no file name can contain a double quote
+		return "\"" + argument + "\"";
+#else
+		std::string quoted = "'";
+		for (size_t i = 0; i < argument.size(); i++)
+			quoted += argument[i] == '\'' ? std::string("'\\''") : std::string(1, argument[i]);
+		return quoted + "'";
+#endif
+	}
+
+	/// Starts commandLine + " --batch-worker <k> <processes>" for every k at once, passes on their output
+	/// prefixed with k, and waits for them all. Returns whether every one succeeded.
+	static bool runWorkers(const std::string& commandLine, int processes)
+	{
+		std::vector<FILE*> workers;
+		for (int k = 0; k < processes; k++)
+		{
+			std::ostringstream command;
+			command << commandLine << " --batch-worker " << k << " " << processes;
+			FILE* worker = openPipe(command.str().c_str());
+			if (worker == NULL)
+				std::cout << "Failed to start batch worker " << k << std::endl;
+			workers.push_back(worker);
+		}
+
+		// each worker prints a few lines at most, far less than a pipe holds, so reading them in turn
+		// never leaves one blocked on a full pipe
+		bool succeeded = true;
+		for (int k = 0; k < processes; k++)
+		{
+			if (workers[k] == NULL)
+			{
+				succeeded = false;
+				continue;
+			}
+			char line[1024];
+			while (fgets(line, sizeof(line), workers[k]) != NULL)
+				std::cout << "[" << k << "] " << line << std::flush;
+			succeeded = closePipe(workers[k]) == 0 && succeeded;
+		}
+		return succeeded;
+	}
+
+protected:
+	static FILE* openPipe(const char* command)
+	{
+#ifdef _WIN32
+		// cmd /c strips the outermost quotes, which would otherwise be the executable's
+		return _popen(("\"" + std::string(command) + "\"").c_str(), "r");
+#else
+		return popen(command, "r");
+#endif
+	}
+
+	static int closePipe(FILE* pipe)
+	{
+#ifdef _WIN32
+		return _pclose(pipe);
+#else
+		return pclose(pipe);
+#endif
+	}
+};
@@ -0,0 +1,124 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <cfloat>
+
+/// Axis-aligned bounding box in world space.
+struct AABB
+{
+	glm::vec3 min;
+	glm::vec3 max;
+
+	AABB() : min(FLT_MAX), max(-FLT_MAX) { }
+	AABB(glm::vec3 min, glm::vec3 max) : min(min), max(max) { }
+
+	bool empty() const { return min.x > max.x; }
+	glm::vec3 center() const { return (min + max) * 0.5f; }
+	glm::vec3 extent() const { return max - min; }
+
+	float surfaceArea() const
+	{
+		if (empty())
+			return 0.0f;
+		glm::vec3 size = extent();
+		return 2.0f * (size.x * size.y + size.y * size.z + size.z * size.x);
+	}
+
+	/// Distance along the ray at which it enters the box, or a negative value if it misses. inverseDirection
+	/// is 1 / direction per component; infinities for axis-parallel rays are handled.
+	float intersectRay(glm::vec3 origin, glm::vec3 inverseDirection, float maxDistance) const
+	{
+		glm::vec3 t0 = (min - origin) * inverseDirection;
+		glm::vec3 t1 = (max - origin) * inverseDirection;
+		glm::vec3 tNear = glm::min(t0, t1), tFar = glm::max(t0, t1);
+		float enter = glm::max(glm::max(tNear.x, tNear.y), glm::max(tNear.z, 0.0f));
+		float exit = glm::min(glm::min(tFar.x, tFar.y), glm::min(tFar.z, maxDistance));
+		return enter <= exit ? enter : -1.0f;
+	}
+
+	void grow(glm::vec3 point)
+	{
+		min = glm::min(min, point);
+		max = glm::max(max, point);
+	}
+
+	void grow(const AABB& other)
+	{
+		min = glm::min(min, other.min);
+		max = glm::max(max, other.max);
+	}
+
+	/// The corners are numbered by bits: bit 0 picks max.x, bit 1 max.y, bit 2 max.z.
+	glm::vec3 corner(int index) const
+	{
+		return glm::vec3((index & 1) ? max.x : min.x, (index & 2) ? max.y : min.y, (index & 4) ? max.z : min.z);
+	}
+
+	/// Bounds of this box after transforming it by matrix.
+	AABB transformed(const glm::mat4& matrix) const
+	{
+		AABB result;
+		for (int i = 0; i < 8; i++)
+			result.grow(glm::vec3(matrix * glm::vec4(corner(i), 1.0f)));
+		return result;
+	}
+};
+
+enum FrustumTest
+{
+	FRUSTUM_OUTSIDE,
+	FRUSTUM_INTERSECTS,
+	FRUSTUM_INSIDE,
+};
+
+/// The six clip planes of a view-projection matrix, pointing inwards.
+struct Frustum
+{
+	glm::vec4 planes[6];
+
+	Frustum() { }
+
+	explicit Frustum(const glm::mat4& viewProjection)
+	{
+		// Gribb & Hartmann: each plane is the fourth row plus or minus one of the others
+		glm::vec4 rows[4];
+		for (int i = 0; i < 4; i++)
+			rows[i] = glm::vec4(viewProjection[0][i], viewProjection[1][i], viewProjection[2][i], viewProjection[3][i]);
+		for (int i = 0; i < 3; i++)
+		{
+			planes[i * 2] = rows[3] + rows[i];
+			planes[i * 2 + 1] = rows[3] - rows[i];
+		}
+	}
+
+	/// False only if box lies entirely outside one of the planes; boxes near a frustum corner may pass.
+	bool intersects(const AABB& box) const
+	{
+		for (int i = 0; i < 6; i++)
+		{
+			// the corner furthest along the plane's normal
+			glm::vec3 normal(planes[i]);
+			glm::vec3 positive(normal.x >= 0.0f ? box.max.x : box.min.x, normal.y >= 0.0f ? box.max.y : box.min.y, normal.z >= 0.0f ? box.max.z : box.min.z);
+			if (glm::dot(normal, positive) + planes[i].w < 0.0f)
+				return false;
+		}
+		return true;
+	}
+
+	/// Like intersects(), but also tells whether box is entirely inside, so hierarchies can stop testing.
+	FrustumTest classify(const AABB& box) const
+	{
+		FrustumTest result = FRUSTUM_INSIDE;
+		for (int i = 0; i < 6; i++)
+		{
+			glm::vec3 normal(planes[i]);
+			glm::vec3 positive(normal.x >= 0.0f ? box.max.x : box.min.x, normal.y >= 0.0f ? box.max.y : box.min.y, normal.z >= 0.0f ? box.max.z : box.min.z);
+			glm::vec3 negative(normal.x >= 0.0f ? box.min.x : box.max.x, normal.y >= 0.0f ? box.min.y : box.max.y, normal.z >= 0.0f ? box.min.z : box.max.z);
+			if (glm::dot(normal, positive) + planes[i].w < 0.0f)
+				return FRUSTUM_OUTSIDE;
+			if (glm::dot(normal, negative) + planes[i].w < 0.0f)
+				result = FRUSTUM_INTERSECTS;
+		}
+		return result;
+	}
+};
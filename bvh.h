@@ -0,0 +1,348 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include "bounds.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+/// Bounding volume hierarchy over a set of boxes, such as the scene's entity bounds.
+///
+/// build() splits with a binned surface area heuristic and stores the tree depth first in one array: a
+/// node's left child is the next node, so only the right child's index is kept, and leaves refer to a run of
+/// the primitive index array. Each node is 32 bytes, so a cache line holds two.
+///
+/// refit() recomputes the node bounds bottom-up after the boxes move, without changing the tree. A refitted
+/// tree gets slower to traverse as objects wander, so refit() reports how its surface area cost compares to
+/// the cost when it was built, and callers rebuild once that grows too much.
+
+class BVH
+{
+public:
+	/// Primitives per leaf above which build() always splits, and at or below which it may stop.
+	static const uint32_t MAX_LEAF_SIZE = 4;
+
+	struct Node
+	{
+		AABB bounds;
+		/// Interior nodes: index of the right child. Leaves: first entry in the primitive index array.
+		uint32_t offset;
+		/// Number of primitives in a leaf; 0 for interior nodes.
+		uint32_t count;
+
+		bool isLeaf() const { return count != 0; }
+	};
+
+	BVH() { }
+
+	void build(const AABB* bounds, size_t count)
+	{
+		m_nodes.clear();
+		m_indices.resize(count);
+		m_centroids.resize(count);
+		for (size_t i = 0; i < count; i++)
+		{
+			m_indices[i] = (uint32_t)i;
+			m_centroids[i] = bounds[i].center();
+		}
+		if (count == 0)
+		{
+			m_builtCost = 0.0f;
+			return;
+		}
+
+		m_nodes.reserve(2 * count);
+		m_nodes.push_back(Node());
+		buildNode(0, 0, (uint32_t)count, bounds, 0);
+		m_builtCost = cost();
+
+		// centroids are only needed while building
+		m_centroids.clear();
+		m_centroids.shrink_to_fit();
+	}
+
+	/// Recomputes every node's bounds from the primitives' current bounds. Returns the tree's surface area
+	/// cost relative to when it was built; 1 means no worse.
+	float refit(const AABB* bounds)
+	{
+		// children always come after their parent, so a reverse sweep sees them first
+		for (size_t i = m_nodes.size(); i-- > 0; )
+		{
+			Node& node = m_nodes[i];
+			node.bounds = AABB();
+			if (node.isLeaf())
+			{
+				for (uint32_t j = 0; j < node.count; j++)
+					node.bounds.grow(bounds[m_indices[node.offset + j]]);
+			}
+			else
+			{
+				node.bounds.grow(m_nodes[i + 1].bounds);
+				node.bounds.grow(m_nodes[node.offset].bounds);
+			}
+		}
+		return m_builtCost > 0.0f ? cost() / m_builtCost : 1.0f;
+	}
+
+	/// Appends to out every primitive whose box intersects the frustum and whose nodes all pass visible(), a
+	/// callable taking a node index and the node's bounds. visible() is asked about interior nodes too, so a
+	/// whole subtree hidden behind an occluder is skipped at once. Subtrees found wholly inside the frustum
+	/// skip the remaining plane tests.
+	template <typename Visible>
+	void query(const Frustum& frustum, const AABB* bounds, Visible visible, std::vector<uint32_t>& out) const
+	{
+		if (m_nodes.empty())
+			return;
+
+		// the top bit of a stack entry marks nodes already known to be inside the frustum
+		const uint32_t INSIDE = 0x80000000u;
+		uint32_t stack[STACK_SIZE];
+		int top = 0;
+		stack[top++] = 0;
+		while (top > 0)
+		{
+			uint32_t entry = stack[--top];
+			const uint32_t index = entry & ~INSIDE;
+			const Node& node = m_nodes[index];
+			bool inside = (entry & INSIDE) != 0;
+			if (!inside)
+			{
+				FrustumTest test = frustum.classify(node.bounds);
+				if (test == FRUSTUM_OUTSIDE)
+					continue;
+				inside = test == FRUSTUM_INSIDE;
+			}
+			if (!visible(index, node.bounds))
+				continue;
+
+			if (node.isLeaf())
+			{
+				for (uint32_t i = 0; i < node.count; i++)
+				{
+					uint32_t primitive = m_indices[node.offset + i];
+					if (inside || frustum.intersects(bounds[primitive]))
+						out.push_back(primitive);
+				}
+				continue;
+			}
+
+			uint32_t flag = inside ? INSIDE : 0;
+			stack[top++] = node.offset | flag;
+			stack[top++] = (index + 1) | flag;
+		}
+	}
+
+	/// Finds the nearest primitive box hit by the ray within maxDistance. direction need not be normalised;
+	/// distance is in units of its length.
+	bool raycast(glm::vec3 origin, glm::vec3 direction, float maxDistance, const AABB* bounds, uint32_t& hit, float& distance) const
+	{
+		if (m_nodes.empty())
+			return false;
+
+		const glm::vec3 inverseDirection = 1.0f / direction;
+		float nearest = maxDistance;
+		bool found = false;
+
+		uint32_t stack[STACK_SIZE];
+		int top = 0;
+		if (m_nodes[0].bounds.intersectRay(origin, inverseDirection, nearest) >= 0.0f)
+			stack[top++] = 0;
+		while (top > 0)
+		{
+			const uint32_t index = stack[--top];
+			const Node& node = m_nodes[index];
+			if (node.isLeaf())
+			{
+				for (uint32_t i = 0; i < node.count; i++)
+				{
+					uint32_t primitive = m_indices[node.offset + i];
+					float t = bounds[primitive].intersectRay(origin, inverseDirection, nearest);
+					if (t >= 0.0f && (!found || t < nearest))
+					{
+						nearest = t;
+						hit = primitive;
+						found = true;
+					}
+				}
+				continue;
+			}
+
+			// visit the nearer child first by pushing it last
+			uint32_t left = index + 1, right = node.offset;
+			float tLeft = m_nodes[left].bounds.intersectRay(origin, inverseDirection, nearest);
+			float tRight = m_nodes[right].bounds.intersectRay(origin, inverseDirection, nearest);
+			if (tLeft >= 0.0f && tRight >= 0.0f)
+			{
+				bool leftFirst = tLeft <= tRight;
+				stack[top++] = leftFirst ? right : left;
+				stack[top++] = leftFirst ? left : right;
+			}
+			else if (tLeft >= 0.0f)
+				stack[top++] = left;
+			else if (tRight >= 0.0f)
+				stack[top++] = right;
+		}
+
+		distance = nearest;
+		return found;
+	}
+
+	/// Expected cost of a query under the surface area heuristic, in primitive tests.
+	float cost() const
+	{
+		if (m_nodes.empty())
+			return 0.0f;
+
+		float rootArea = m_nodes[0].bounds.surfaceArea();
+		if (rootArea <= 0.0f)
+			return 0.0f;
+
+		float total = 0.0f;
+		for (size_t i = 0; i < m_nodes.size(); i++)
+		{
+			const Node& node = m_nodes[i];
+			float probability = node.bounds.surfaceArea() / rootArea;
+			total += probability * (node.isLeaf() ? (float)node.count : TRAVERSAL_COST);
+		}
+		return total;
+	}
+
+	const std::vector<Node>& nodes() const { return m_nodes; }
+	/// The primitive index array that leaves refer into.
+	const std::vector<uint32_t>& indices() const { return m_indices; }
+	size_t size() const { return m_indices.size(); }
+
+protected:
+	static const int BINS = 16;
+	/// Below this depth build() only halves, so no tree is deeper than SAH_DEPTH plus log2 of the count.
+	static const int SAH_DEPTH = 64;
+	static const int STACK_SIZE = SAH_DEPTH + 64;
+	/// Cost of visiting a node relative to testing one primitive.
+	static constexpr float TRAVERSAL_COST = 1.0f;
+
+	struct Bin
+	{
+		AABB bounds;
+		uint32_t count = 0;
+	};
+
+	void buildNode(uint32_t nodeIndex, uint32_t first, uint32_t count, const AABB* bounds, int depth)
+	{
+		AABB nodeBounds, centroidBounds;
+		for (uint32_t i = first; i < first + count; i++)
+		{
+			nodeBounds.grow(bounds[m_indices[i]]);
+			centroidBounds.grow(m_centroids[m_indices[i]]);
+		}
+		m_nodes[nodeIndex].bounds = nodeBounds;
+
+		uint32_t leftCount = 0;
+		if (count > MAX_LEAF_SIZE)
+			leftCount = depth < SAH_DEPTH ? split(first, count, bounds, nodeBounds, centroidBounds) : halve(first, count, centroidBounds);
+		if (leftCount == 0)
+		{
+			m_nodes[nodeIndex].offset = first;
+			m_nodes[nodeIndex].count = count;
+			return;
+		}
+
+		// the left child follows its parent; the right child comes after the whole left subtree
+		uint32_t leftIndex = (uint32_t)m_nodes.size();
+		m_nodes.push_back(Node());
+		buildNode(leftIndex, first, leftCount, bounds, depth + 1);
+
+		uint32_t rightIndex = (uint32_t)m_nodes.size();
+		m_nodes.push_back(Node());
+		m_nodes[nodeIndex].offset = rightIndex;
+		m_nodes[nodeIndex].count = 0;
+		buildNode(rightIndex, first + leftCount, count - leftCount, bounds, depth + 1);
+	}
+
+	/// Partitions the primitives at the cheapest binned SAH split and returns the size of the left side, or
+	/// 0 if a leaf is cheaper.
+	uint32_t split(uint32_t first, uint32_t count, const AABB* bounds, const AABB& nodeBounds, const AABB& centroidBounds)
+	{
+		float bestCost = (float)count;
+		int bestAxis = -1, bestBin = 0;
+
+		glm::vec3 extent = centroidBounds.extent();
+		for (int axis = 0; axis < 3; axis++)
+		{
+			if (extent[axis] <= 0.0f)
+				continue;
+
+			Bin bins[BINS];
+			float scale = BINS / extent[axis];
+			for (uint32_t i = first; i < first + count; i++)
+			{
+				uint32_t primitive = m_indices[i];
+				int bin = glm::min(BINS - 1, (int)((m_centroids[primitive][axis] - centroidBounds.min[axis]) * scale));
+				bins[bin].count++;
+				bins[bin].bounds.grow(bounds[primitive]);
+			}
+
+			// sweep from the right to get the area and count of every right side, then from the left
+			float rightArea[BINS - 1];
+			uint32_t rightCount[BINS - 1];
+			AABB accumulated;
+			uint32_t accumulatedCount = 0;
+			for (int i = BINS - 1; i > 0; i--)
+			{
+				accumulated.grow(bins[i].bounds);
+				accumulatedCount += bins[i].count;
+				rightArea[i - 1] = accumulated.surfaceArea();
+				rightCount[i - 1] = accumulatedCount;
+			}
+
+			accumulated = AABB();
+			accumulatedCount = 0;
+			const float inverseArea = 1.0f / glm::max(nodeBounds.surfaceArea(), 1e-20f);
+			for (int i = 0; i < BINS - 1; i++)
+			{
+				accumulated.grow(bins[i].bounds);
+				accumulatedCount += bins[i].count;
+				if (accumulatedCount == 0 || rightCount[i] == 0)
+					continue;
+
+				float splitCost = TRAVERSAL_COST + (accumulated.surfaceArea() * accumulatedCount + rightArea[i] * rightCount[i]) * inverseArea;
+				if (splitCost < bestCost)
+				{
+					bestCost = splitCost;
+					bestAxis = axis;
+					bestBin = i;
+				}
+			}
+		}
+
+		if (bestAxis < 0)
+		{
+			// a leaf is cheaper, unless it would be too large
+			return count <= 4 * MAX_LEAF_SIZE ? 0 : halve(first, count, centroidBounds);
+		}
+
+		float scale = BINS / extent[bestAxis];
+		float minimum = centroidBounds.min[bestAxis];
+		uint32_t* begin = &m_indices[first];
+		uint32_t* middle = std::partition(begin, begin + count, [&](uint32_t primitive) {
+			return glm::min(BINS - 1, (int)((m_centroids[primitive][bestAxis] - minimum) * scale)) <= bestBin;
+		});
+		return (uint32_t)(middle - begin);
+	}
+
+	/// Splits at the median centroid along the longest axis.
+	uint32_t halve(uint32_t first, uint32_t count, const AABB& centroidBounds)
+	{
+		glm::vec3 extent = centroidBounds.extent();
+		int axis = extent.x >= extent.y && extent.x >= extent.z ? 0 : (extent.y >= extent.z ? 1 : 2);
+		uint32_t half = count / 2;
+		std::nth_element(m_indices.begin() + first, m_indices.begin() + first + half, m_indices.begin() + first + count,
+			[this, axis](uint32_t a, uint32_t b) { return m_centroids[a][axis] < m_centroids[b][axis]; });
+		return half;
+	}
+
+	std::vector<Node> m_nodes;
+	std::vector<uint32_t> m_indices;
+	std::vector<glm::vec3> m_centroids;
+	float m_builtCost = 0.0f;
+};
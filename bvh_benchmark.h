@@ -0,0 +1,166 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include "bounds.h"
+#include "bvh.h"
+
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <vector>
+
+/// Measures the BVH against plain linear scans on synthetic cities of 10k, 100k and 1M buildings, and checks
+/// that both give the same answers. Run with --bench-bvh; needs no window or GL context.
+///
+/// The buildings are boxes scattered over a square whose side grows with the square root of their number,
+/// so the density, and the number seen by a street-level camera, stays about the same at every size. Each
+/// size reports the build time, a refit after every building has moved a little and the cost ratio it
+/// leaves, and the average time of a frustum query and of a ray cast next to the linear scan doing the same.
+
+namespace BVHBenchmark
+{
+	typedef std::chrono::steady_clock Clock;
+
+	inline double millisecondsSince(Clock::time_point start)
+	{
+		return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+	}
+
+	inline std::vector<AABB> makeCity(size_t count, float side, std::mt19937& random)
+	{
+		std::uniform_real_distribution<float> position(-0.5f * side, 0.5f * side);
+		std::uniform_real_distribution<float> width(0.5f, 3.0f);
+		std::uniform_real_distribution<float> height(1.0f, 10.0f);
+
+		std::vector<AABB> boxes(count);
+		for (size_t i = 0; i < count; i++)
+		{
+			glm::vec3 center(position(random), 0.0f, position(random));
+			glm::vec3 half(0.5f * width(random), 0.0f, 0.5f * width(random));
+			boxes[i].min = center - half;
+			boxes[i].max = center + half + glm::vec3(0.0f, height(random), 0.0f);
+		}
+		return boxes;
+	}
+
+	/// Runs one city size; returns false if the BVH and the linear scans disagreed.
+	inline bool run(size_t count, std::mt19937& random)
+	{
+		const int FRUSTUM_QUERIES = 50;
+		const int RAYS = 200;
+		const float FAR_PLANE = 100.0f;
+
+		const float side = 2.5f * sqrtf((float)count);
+		std::vector<AABB> boxes = makeCity(count, side, random);
+		bool agreed = true;
+
+		BVH bvh;
+		Clock::time_point start = Clock::now();
+		bvh.build(boxes.data(), boxes.size());
+		const double buildMs = millisecondsSince(start);
+
+		std::uniform_real_distribution<float> jitter(-0.5f, 0.5f);
+		for (size_t i = 0; i < count; i++)
+		{
+			glm::vec3 offset(jitter(random), 0.0f, jitter(random));
+			boxes[i].min += offset;
+			boxes[i].max += offset;
+		}
+		start = Clock::now();
+		const float refitRatio = bvh.refit(boxes.data());
+		const double refitMs = millisecondsSince(start);
+
+		// cameras at street level, looking somewhere across the city
+		std::uniform_real_distribution<float> position(-0.4f * side, 0.4f * side);
+		std::uniform_real_distribution<float> angle(0.0f, 6.2831853f);
+		std::uniform_real_distribution<float> pitch(-0.3f, 0.1f);
+		const glm::mat4 projection = glm::perspective(glm::radians(45.0f), 800.0f / 600.0f, 0.1f, FAR_PLANE);
+
+		std::vector<uint32_t> found;
+		double queryMs = 0.0, scanMs = 0.0;
+		size_t visible = 0;
+		for (int q = 0; q < FRUSTUM_QUERIES; q++)
+		{
+			glm::vec3 eye(position(random), 2.0f, position(random));
+			float yaw = angle(random);
+			glm::vec3 front(cosf(yaw), pitch(random), sinf(yaw));
+			Frustum frustum(projection * glm::lookAt(eye, eye + front, glm::vec3(0.0f, 1.0f, 0.0f)));
+
+			found.clear();
+			start = Clock::now();
+			bvh.query(frustum, boxes.data(), [](uint32_t, const AABB&) { return true; }, found);
+			queryMs += millisecondsSince(start);
+
+			start = Clock::now();
+			size_t scanned = 0;
+			for (size_t i = 0; i < count; i++)
+				if (frustum.intersects(boxes[i]))
+					scanned++;
+			scanMs += millisecondsSince(start);
+
+			agreed = agreed && scanned == found.size();
+			visible += found.size();
+		}
+
+		double rayMs = 0.0, bruteMs = 0.0;
+		int hits = 0;
+		for (int r = 0; r < RAYS; r++)
+		{
+			glm::vec3 origin(position(random), 2.0f, position(random));
+			float yaw = angle(random);
+			glm::vec3 direction = glm::normalize(glm::vec3(cosf(yaw), pitch(random), sinf(yaw)));
+
+			uint32_t hit = 0;
+			float distance = 0.0f;
+			start = Clock::now();
+			bool hitFound = bvh.raycast(origin, direction, FAR_PLANE, boxes.data(), hit, distance);
+			rayMs += millisecondsSince(start);
+
+			start = Clock::now();
+			const glm::vec3 inverseDirection = 1.0f / direction;
+			float nearest = FAR_PLANE;
+			bool bruteFound = false;
+			for (size_t i = 0; i < count; i++)
+			{
+				float t = boxes[i].intersectRay(origin, inverseDirection, nearest);
+				if (t >= 0.0f && (!bruteFound || t < nearest))
+				{
+					nearest = t;
+					bruteFound = true;
+				}
+			}
+			bruteMs += millisecondsSince(start);
+
+			// compare distances rather than indices; overlapping boxes can tie
+			agreed = agreed && hitFound == bruteFound && (!hitFound || distance == nearest);
+			hits += hitFound ? 1 : 0;
+		}
+
+		std::cout << std::setw(9) << count
+			<< std::setw(10) << buildMs
+			<< std::setw(10) << refitMs << std::setw(7) << refitRatio
+			<< std::setw(11) << queryMs / FRUSTUM_QUERIES << std::setw(11) << scanMs / FRUSTUM_QUERIES
+			<< std::setw(8) << visible / FRUSTUM_QUERIES
+			<< std::setw(11) << 1000.0 * rayMs / RAYS << std::setw(11) << 1000.0 * bruteMs / RAYS
+			<< std::setw(6) << hits
+			<< (agreed ? "" : "   MISMATCH") << std::endl;
+		return agreed;
+	}
+
+	/// Returns the process exit code: 0 if every size agreed with the linear scans.
+	inline int runAll()
+	{
+		std::mt19937 random(12345);
+		std::cout << std::fixed << std::setprecision(3);
+		std::cout << "  objects  build ms  refit ms  ratio   query ms    scan ms  visible     ray us   brute us  hits" << std::endl;
+
+		const size_t SIZES[] = { 10000, 100000, 1000000 };
+		bool agreed = true;
+		for (size_t i = 0; i < sizeof(SIZES) / sizeof(SIZES[0]); i++)
+			agreed = run(SIZES[i], random) && agreed;
+		return agreed ? 0 : 1;
+	}
+}
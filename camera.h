@@ -118,6 +118,14 @@ public:
 			Zoom = 45.0f;
 	}
 
+	// sets the Euler angles directly, e.g. when interpolating between two states of the camera
+	void SetEulerAngles(float yaw, float pitch)
+	{
+		Yaw = yaw;
+		Pitch = pitch;
+		updateCameraVectors();
+	}
+
 private:
 	// calculates the front vector from the Camera's (updated) Euler Angles
 	void updateCameraVectors()
@@ -0,0 +1,224 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include "mesh.h"
+#include "frame_arena.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+/// GL state changes and draws recorded into one flat buffer, to be replayed later on the thread that owns
+/// the context.
+///
+/// Recording makes no GL calls, so any thread may record a list, and several threads may record lists
+/// of their own at once. Everything a command needs is copied into the list, including uniform values, so
+/// the data it was recorded from may change before the replay. Programs, vertex arrays, textures and
+/// uniform locations are plain GL names, looked up on the context thread before recording starts.
+///
+/// Commands are packed one after another, each a small header followed by its arguments, into memory
+/// taken from the Arena given to clear(): a list lives until the arena is reset, typically at the end of
+/// the frame, and recording never touches the heap. When the buffer fills, a twice larger one is taken
+/// from the arena and the commands are copied over.
+
+class CommandList
+{
+public:
+	/// Runs on the context thread during execute(); context and argument are the values given to call().
+	typedef void (*Callback)(void* context, int argument);
+
+	CommandList() { }
+
+	/// Starts an empty list in arena, which must outlive its replay.
+	void clear(Arena& arena)
+	{
+		m_arena = &arena;
+		m_buffer = NULL;
+		m_capacity = 0;
+		m_size = 0;
+		m_commands = 0;
+	}
+
+	void useProgram(GLuint program)
+	{
+		UseProgram command = { program };
+		push(USE_PROGRAM, command);
+	}
+
+	void bindVertexArray(GLuint vertexArray)
+	{
+		BindVertexArray command = { vertexArray };
+		push(BIND_VERTEX_ARRAY, command);
+	}
+
+	void bindTexture(int unit, GLuint texture)
+	{
+		BindTexture command = { unit, texture };
+		push(BIND_TEXTURE, command);
+	}
+
+	void setInt(GLint location, int value)
+	{
+		SetInt command = { location, value };
+		push(SET_INT, command);
+	}
+
+	void setVec3(GLint location, const glm::vec3& value)
+	{
+		SetVec3 command = { location, value };
+		push(SET_VEC3, command);
+	}
+
+	void setMat4(GLint location, const glm::mat4& value)
+	{
+		SetMat4 command = { location, value };
+		push(SET_MAT4, command);
+	}
+
+	/// Draws elements first to first + count of mesh, which must be bound by then.
+	void draw(const Mesh& mesh, GLsizei first, GLsizei count, int instances)
+	{
+		if (count <= 0)
+			return;
+		Draw command = { mesh.primitive, mesh.indexed, mesh.restartIndex, first, count, instances };
+		push(DRAW, command);
+	}
+
+	/// Calls back into the renderer, for work that has no command of its own, such as conditional rendering.
+	void call(Callback callback, void* context, int argument)
+	{
+		Call command = { callback, context, argument };
+		push(CALL, command);
+	}
+
+	/// Replays the commands in the order they were recorded. Context thread only.
+	void execute() const
+	{
+		const unsigned char* command = m_buffer;
+		const unsigned char* end = command + m_size;
+		while (command < end)
+		{
+			Header header;
+			memcpy(&header, command, sizeof(header));
+			const unsigned char* arguments = command + sizeof(Header);
+			switch (header.type)
+			{
+			case USE_PROGRAM:
+				glUseProgram(read<UseProgram>(arguments).program);
+				break;
+			case BIND_VERTEX_ARRAY:
+				glBindVertexArray(read<BindVertexArray>(arguments).vertexArray);
+				break;
+			case BIND_TEXTURE:
+			{
+				BindTexture bind = read<BindTexture>(arguments);
+				glActiveTexture(GL_TEXTURE0 + bind.unit);
+				glBindTexture(GL_TEXTURE_2D, bind.texture);
+				break;
+			}
+			case SET_INT:
+			{
+				SetInt set = read<SetInt>(arguments);
+				glUniform1i(set.location, set.value);
+				break;
+			}
+			case SET_VEC3:
+			{
+				SetVec3 set = read<SetVec3>(arguments);
+				glUniform3fv(set.location, 1, &set.value[0]);
+				break;
+			}
+			case SET_MAT4:
+			{
+				SetMat4 set = read<SetMat4>(arguments);
+				glUniformMatrix4fv(set.location, 1, GL_FALSE, &set.value[0][0]);
+				break;
+			}
+			case DRAW:
+			{
+				Draw draw = read<Draw>(arguments);
+				Mesh::drawElements(draw.primitive, draw.indexed, draw.restartIndex, draw.first, draw.count, draw.instances);
+				break;
+			}
+			case CALL:
+			{
+				Call call = read<Call>(arguments);
+				call.callback(call.context, call.argument);
+				break;
+			}
+			}
+			command += header.size;
+		}
+	}
+
+	/// Number of commands recorded.
+	size_t size() const { return m_commands; }
+	size_t bytes() const { return m_size; }
+
+protected:
+	enum Type : uint32_t
+	{
+		USE_PROGRAM,
+		BIND_VERTEX_ARRAY,
+		BIND_TEXTURE,
+		SET_INT,
+		SET_VEC3,
+		SET_MAT4,
+		DRAW,
+		CALL,
+	};
+
+	struct Header
+	{
+		Type type;
+		/// Of the header and arguments together, rounded up so every command starts 8-byte aligned.
+		uint32_t size;
+	};
+
+	struct UseProgram { GLuint program; };
+	struct BindVertexArray { GLuint vertexArray; };
+	struct BindTexture { int unit; GLuint texture; };
+	struct SetInt { GLint location; int value; };
+	struct SetVec3 { GLint location; glm::vec3 value; };
+	struct SetMat4 { GLint location; glm::mat4 value; };
+	struct Draw { GLenum primitive; bool indexed; GLint restartIndex; GLsizei first; GLsizei count; int instances; };
+	struct Call { Callback callback; void* context; int argument; };
+
+	template <typename T>
+	void push(Type type, const T& arguments)
+	{
+		Header header = { type, (uint32_t)((sizeof(Header) + sizeof(T) + 7) & ~(size_t)7) };
+		if (m_size + header.size > m_capacity)
+		{
+			const size_t capacity = std::max(m_capacity * 2, m_size + header.size + (size_t)INITIAL_BYTES);
+			unsigned char* buffer = (unsigned char*)m_arena->allocate(capacity, 8);
+			if (m_size > 0)
+				memcpy(buffer, m_buffer, m_size);
+			m_buffer = buffer;
+			m_capacity = capacity;
+		}
+
+		memcpy(&m_buffer[m_size], &header, sizeof(header));
+		memcpy(&m_buffer[m_size + sizeof(Header)], &arguments, sizeof(T));
+		m_size += header.size;
+		m_commands++;
+	}
+
+	template <typename T>
+	static T read(const unsigned char* arguments)
+	{
+		T value;
+		memcpy(&value, arguments, sizeof(T));
+		return value;
+	}
+
+	static const size_t INITIAL_BYTES = 4096;
+
+	Arena* m_arena = NULL;
+	unsigned char* m_buffer = NULL;
+	size_t m_capacity = 0;
+	size_t m_size = 0;
+	size_t m_commands = 0;
+};
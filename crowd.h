@@ -0,0 +1,293 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/constants.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/packing.hpp>
+#include "shader.h"
+#include "gl_handle.h"
+#include "bounds.h"
+#include "scene.h"
+#include "Torus.h"
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/// One seat of the crowd, as the vertex shader reads it per instance: 20 bytes.
+struct CrowdInstance
+{
+	float position[3];
+	/// Direction the spectator faces, in radians around Y divided by pi, as a normalised short.
+	int16_t facing;
+	/// Seat spacing, which sizes the figure; a half float.
+	uint16_t size;
+	/// Shirt colour, and the phase of the spectator's fidgeting in alpha.
+	uint8_t color[4];
+};
+
+/// The spectators of every stand in the scene (see CrowdStand), drawn with a single instanced call.
+///
+/// Seats are laid out once, when the crowd is built: rows run around the stand at even steps of the tube
+/// angle, each with as many seats as its length holds at the stand's seat spacing, which is chosen so the
+/// stand takes exactly its number of spectators. They sit on the faceted surface Torus draws. Every
+/// spectator is a low-poly figure of two boxes, turned towards the middle of the stand and animated in
+/// shaderfiles/crowd.vs: a Mexican wave circling the stand and some fidgeting. Drawing costs one uniform
+/// and one draw call however large the crowd is.
+
+class Crowd
+{
+public:
+	Crowd() { }
+
+	explicit Crowd(const std::vector<CrowdStand>& stands)
+	{
+		std::vector<CrowdInstance> instances;
+		for (size_t i = 0; i < stands.size(); i++)
+			seat(stands[i], (uint32_t)i, instances, m_bounds);
+		m_count = (GLsizei)instances.size();
+
+		// a box for the body and a smaller one for the head; height 1, feet at the origin, facing +z
+		struct FigureVertex
+		{
+			float position[3];
+			float head;
+		};
+		FigureVertex vertices[16];
+		GLushort indices[INDEX_COUNT];
+		addBox(vertices, indices, 0, glm::vec3(-0.3f, 0.0f, -0.18f), glm::vec3(0.3f, 0.7f, 0.18f), 0.0f);
+		addBox(vertices, indices, 1, glm::vec3(-0.13f, 0.74f, -0.12f), glm::vec3(0.13f, 1.0f, 0.14f), 1.0f);
+
+		m_VAO = GLVertexArray::create("crowd");
+		m_figureVBO = GLBuffer::create("crowd");
+		m_EBO = GLBuffer::create("crowd");
+		m_instanceVBO = GLBuffer::create("crowd");
+		glBindVertexArray(m_VAO.id());
+
+		glBindBuffer(GL_ARRAY_BUFFER, m_figureVBO.id());
+		glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(FigureVertex), (void*)offsetof(FigureVertex, position));
+		glEnableVertexAttribArray(0);
+		glVertexAttribPointer(1, 1, GL_FLOAT, GL_FALSE, sizeof(FigureVertex), (void*)offsetof(FigureVertex, head));
+		glEnableVertexAttribArray(1);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_EBO.id());
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
+
+		glBindBuffer(GL_ARRAY_BUFFER, m_instanceVBO.id());
+		glBufferData(GL_ARRAY_BUFFER, instances.size() * sizeof(CrowdInstance), instances.data(), GL_STATIC_DRAW);
+		glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, sizeof(CrowdInstance), (void*)offsetof(CrowdInstance, position));
+		glVertexAttribPointer(3, 1, GL_SHORT, GL_TRUE, sizeof(CrowdInstance), (void*)offsetof(CrowdInstance, facing));
+		glVertexAttribPointer(4, 1, GL_HALF_FLOAT, GL_FALSE, sizeof(CrowdInstance), (void*)offsetof(CrowdInstance, size));
+		glVertexAttribPointer(5, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(CrowdInstance), (void*)offsetof(CrowdInstance, color));
+		for (GLuint attribute = 2; attribute <= 5; attribute++)
+		{
+			glEnableVertexAttribArray(attribute);
+			glVertexAttribDivisor(attribute, 1);
+		}
+		glBindVertexArray(0);
+		GpuResources::resize(GPU_BUFFER, m_figureVBO.id(), sizeof(vertices));
+		GpuResources::resize(GPU_BUFFER, m_EBO.id(), sizeof(indices));
+		GpuResources::resize(GPU_BUFFER, m_instanceVBO.id(), instances.size() * sizeof(CrowdInstance));
+
+		m_shader = Shader("shaderfiles/crowd.vs", "shaderfiles/crowd.fs");
+	}
+
+	/// Number of spectators.
+	size_t size() const { return (size_t)m_count; }
+	/// World bounds of the seats.
+	const AABB& bounds() const { return m_bounds; }
+	Shader& shader() { return m_shader; }
+
+	/// Draws every spectator, lit by light, at time seconds into their animation.
+	void draw(const glm::mat4& view, const glm::mat4& projection, const Light& light, float time)
+	{
+		if (m_count == 0)
+			return;
+
+		m_shader.use();
+		m_shader.setMat4("view", view);
+		m_shader.setMat4("projection", projection);
+		m_shader.setFloat("time", time);
+		m_shader.setVec3("lightDirection", light.direction);
+		m_shader.setVec3("lightAmbient", light.ambient);
+		m_shader.setVec3("lightDiffuse", light.diffuse);
+
+		glBindVertexArray(m_VAO.id());
+		glDrawElementsInstanced(GL_TRIANGLES, INDEX_COUNT, GL_UNSIGNED_SHORT, (void*)0, m_count);
+	}
+
+	/// Appends the seats of stand to instances, growing bounds around them. index varies the colours and
+	/// phases between stands.
+	static void seat(const CrowdStand& stand, uint32_t index, std::vector<CrowdInstance>& instances, AABB& bounds)
+	{
+		if (stand.spectators == 0)
+			return;
+
+		// the stand in world space, without the translation
+		const glm::mat3 orientation = glm::mat3(glm::rotate(glm::mat4(1.0f), glm::radians(stand.rotationY), glm::vec3(0.0f, 1.0f, 0.0f)))
+			* glm::mat3(stand.scale.x, 0.0f, 0.0f, 0.0f, stand.scale.y, 0.0f, 0.0f, 0.0f, stand.scale.z);
+
+		// the rows' lengths, and the depth each row covers up the tube, measured in world space
+		const float from = glm::radians(stand.fromDegrees), to = glm::radians(stand.toDegrees);
+		float area = 0.0f, depth = 0.0f;
+		for (int i = 0; i < AREA_SAMPLES; i++)
+		{
+			const float tube = from + (to - from) * (i + 0.5f) / AREA_SAMPLES;
+			const float step = rowDepth(stand, orientation, tube, (to - from) / AREA_SAMPLES);
+			area += rowLength(stand, orientation, tube) * step;
+			depth += step;
+		}
+		const float spacing = sqrtf(area / (float)stand.spectators);
+		const int rows = glm::max(1, (int)roundf(depth / spacing));
+
+		// each row gets its share of the spectators by the area it covers; the last takes what rounding left
+		std::vector<float> shares(rows);
+		float totalShare = 0.0f;
+		for (int row = 0; row < rows; row++)
+		{
+			const float tube = from + (to - from) * (row + 0.5f) / rows;
+			shares[row] = rowLength(stand, orientation, tube) * rowDepth(stand, orientation, tube, (to - from) / rows);
+			totalShare += shares[row];
+		}
+
+		instances.reserve(instances.size() + stand.spectators);
+		uint32_t random = 0x9E3779B9u * (index + 1);
+		uint32_t seated = 0;
+		for (int row = 0; row < rows; row++)
+		{
+			const uint32_t seats = row == rows - 1 ? stand.spectators - seated
+				: glm::min(stand.spectators - seated, (uint32_t)roundf(stand.spectators * shares[row] / totalShare));
+			const float tube = from + (to - from) * (row + 0.5f) / rows;
+			for (uint32_t i = 0; i < seats; i++)
+			{
+				// alternate rows sit half a seat round, and nobody sits quite square
+				const float jitter = 0.5f * (row & 1) + 0.3f * (next(random) - 0.5f);
+				const float around = 2.0f * glm::pi<float>() * (i + 0.5f + jitter) / seats;
+				const glm::vec3 position = stand.position + orientation * facetPoint(stand, around, tube);
+				const glm::vec3 toCentre = stand.position - position;
+
+				CrowdInstance instance;
+				instance.position[0] = position.x;
+				instance.position[1] = position.y;
+				instance.position[2] = position.z;
+				instance.facing = (int16_t)roundf(atan2f(toCentre.x, toCentre.z) / glm::pi<float>() * 32767.0f);
+				instance.size = glm::packHalf1x16(spacing * FIGURE_HEIGHT);
+				shirtColor(next(random), instance.color);
+				instance.color[3] = (uint8_t)(next(random) * 255.0f);
+				instances.push_back(instance);
+				// the figure is a little wider than a seat, and the wave lifts it
+				bounds.grow(position - glm::vec3(spacing));
+				bounds.grow(position + glm::vec3(spacing, 2.0f * spacing * FIGURE_HEIGHT, spacing));
+			}
+			seated += seats;
+		}
+	}
+
+protected:
+	/// Indices of the two boxes of the figure.
+	static const int INDEX_COUNT = 72;
+	static const int AREA_SAMPLES = 64;
+	/// Height of a figure, in seat spacings; they are seated, so some overlap the row behind.
+	static constexpr float FIGURE_HEIGHT = 1.3f;
+
+	/// Home shirts, away shirts, and everyone who came in whatever they had on.
+	static void shirtColor(float pick, uint8_t* color)
+	{
+		static const uint8_t palette[][3] = {
+			{ 235, 235, 240 }, { 235, 235, 240 }, { 235, 235, 240 }, { 20, 30, 80 }, { 20, 30, 80 },
+			{ 180, 30, 40 }, { 60, 60, 65 }, { 120, 90, 60 }, { 40, 110, 60 }, { 200, 170, 40 },
+		};
+		const int count = (int)(sizeof(palette) / sizeof(palette[0]));
+		const int i = glm::min((int)(pick * count), count - 1);
+		color[0] = palette[i][0];
+		color[1] = palette[i][1];
+		color[2] = palette[i][2];
+	}
+
+	/// A uniform random number in [0, 1), from a xorshift generator.
+	static float next(uint32_t& state)
+	{
+		state ^= state << 13;
+		state ^= state >> 17;
+		state ^= state << 5;
+		return (state >> 8) * (1.0f / 16777216.0f);
+	}
+
+	/// The point of the torus as Torus draws it, flat between its segments, at the given angles around the
+	/// torus and around its tube. On the inside the facets stand proud of the smooth torus, and would hide
+	/// seats placed on it.
+	static glm::vec3 facetPoint(const CrowdStand& stand, float around, float tube)
+	{
+		const float mainStep = 2.0f * glm::pi<float>() / Torus::mainSegments;
+		const float tubeStep = 2.0f * glm::pi<float>() / Torus::tubeSegments;
+		const float i = floorf(around / mainStep), j = floorf(tube / tubeStep);
+		const float u = around / mainStep - i, v = tube / tubeStep - j;
+		const glm::vec3 a0 = torusPoint(stand, i * mainStep, j * tubeStep);
+		const glm::vec3 b0 = torusPoint(stand, (i + 1.0f) * mainStep, j * tubeStep);
+		const glm::vec3 a1 = torusPoint(stand, i * mainStep, (j + 1.0f) * tubeStep);
+		const glm::vec3 b1 = torusPoint(stand, (i + 1.0f) * mainStep, (j + 1.0f) * tubeStep);
+
+		// each quad of the strips is split along b0-a1
+		if (u + v <= 1.0f)
+			return a0 + u * (b0 - a0) + v * (a1 - a0);
+		return b1 + (1.0f - u) * (a1 - b1) + (1.0f - v) * (b0 - b1);
+	}
+
+	/// As Torus::GetVertices().
+	static glm::vec3 torusPoint(const CrowdStand& stand, float around, float tube)
+	{
+		const float radius = stand.mainRadius + stand.tubeRadius * cosf(tube);
+		return glm::vec3(radius * cosf(around), stand.tubeRadius * sinf(tube), radius * sinf(around));
+	}
+
+	/// World length of the ring of seats at tube angle tube.
+	static float rowLength(const CrowdStand& stand, const glm::mat3& orientation, float tube)
+	{
+		const float radius = stand.mainRadius + stand.tubeRadius * cosf(tube);
+		float length = 0.0f;
+		glm::vec3 previous = orientation * glm::vec3(radius, 0.0f, 0.0f);
+		for (int i = 1; i <= AREA_SAMPLES; i++)
+		{
+			const float around = 2.0f * glm::pi<float>() * i / AREA_SAMPLES;
+			const glm::vec3 point = orientation * glm::vec3(radius * cosf(around), 0.0f, radius * sinf(around));
+			length += glm::length(point - previous);
+			previous = point;
+		}
+		return length;
+	}
+
+	/// World distance up the tube covered by a step of tube angle, averaged around the stand's scale.
+	static float rowDepth(const CrowdStand& stand, const glm::mat3& orientation, float tube, float step)
+	{
+		const float horizontal = 0.5f * (glm::length(orientation[0]) + glm::length(orientation[2]));
+		const float vertical = glm::length(orientation[1]);
+		return stand.tubeRadius * step * glm::length(glm::vec2(sinf(tube) * horizontal, cosf(tube) * vertical));
+	}
+
+	template <typename FigureVertex>
+	static void addBox(FigureVertex* vertices, GLushort* indices, int box, glm::vec3 low, glm::vec3 high, float head)
+	{
+		static const GLushort faces[36] = {
+			0, 2, 1, 1, 2, 3,  4, 5, 6, 5, 7, 6,  0, 1, 4, 1, 5, 4,
+			2, 6, 3, 3, 6, 7,  0, 4, 2, 2, 4, 6,  1, 3, 5, 3, 7, 5,
+		};
+		for (int corner = 0; corner < 8; corner++)
+		{
+			FigureVertex& vertex = vertices[box * 8 + corner];
+			vertex.position[0] = (corner & 1) ? high.x : low.x;
+			vertex.position[1] = (corner & 2) ? high.y : low.y;
+			vertex.position[2] = (corner & 4) ? high.z : low.z;
+			vertex.head = head;
+		}
+		for (int i = 0; i < 36; i++)
+			indices[box * 36 + i] = (GLushort)(box * 8 + faces[i]);
+	}
+
+	GLVertexArray m_VAO;
+	GLBuffer m_figureVBO, m_EBO, m_instanceVBO;
+	GLsizei m_count = 0;
+	AABB m_bounds;
+	Shader m_shader;
+};
@@ -0,0 +1,196 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include "shader.h"
+#include "gl_handle.h"
+
+#include <algorithm>
+#include <cmath>
+
+/// Dynamic resolution: the scene is drawn into an offscreen framebuffer at a fraction of the window's
+/// size, and stretched over the window with a sharpening filter (see upscale.fs).
+///
+/// The fraction, scale(), is chosen so the GPU keeps to a frame time budget. The scene pass is timed with
+/// a timer query, read back a few frames late like CascadedShadowMap's, and the GPU time of the passes
+/// drawn at full resolution regardless (the shadows) is added to it. Cost is taken to grow with the number
+/// of pixels, so the scale that would just fit the budget is the scale the timed frame was drawn at times
+/// the square root of the time left over that its pass took. The controller falls towards that quickly and
+/// climbs back slowly, and ignores changes of a couple of percent, so the image does not pump.
+///
+/// The colour texture and depth buffer are the size of the window, and a smaller scale only draws into
+/// their lower left corner, so changing the scale costs nothing.
+
+class DynamicResolution
+{
+public:
+	/// The least fraction of the window's width and height the scene is drawn at.
+	static constexpr float MIN_SCALE = 0.5f;
+
+	DynamicResolution() { }
+
+	/// budgetMilliseconds is the GPU time a frame may take.
+	DynamicResolution(float budgetMilliseconds)
+	{
+		m_budgetMilliseconds = budgetMilliseconds;
+
+		m_colorTexture = GLTexture::create("dynamic resolution");
+		glBindTexture(GL_TEXTURE_2D, m_colorTexture.id());
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		m_depthBuffer = GLRenderbuffer::create("dynamic resolution");
+		m_FBO = GLFramebuffer::create("dynamic resolution");
+
+		// a core profile context needs some vertex array bound to draw, even one with no attributes
+		m_emptyVAO = GLVertexArray::create("dynamic resolution");
+		for (int i = 0; i < TIMER_QUERIES; i++)
+			m_timerQueries[i] = GLQuery::create("dynamic resolution");
+
+		m_upscaleShader = Shader("shaderfiles/upscale.vs", "shaderfiles/upscale.fs");
+	}
+
+	/// Picks the scale from the finished timings, binds the offscreen framebuffer with the viewport set to
+	/// the part of it drawn at that scale, and clears it. otherMilliseconds is the GPU time of this frame's
+	/// other passes, whose cost does not depend on the scale. The scene is then drawn as usual until end().
+	void begin(float otherMilliseconds)
+	{
+		m_otherMilliseconds = otherMilliseconds;
+		collectTimerResults();
+
+		glGetIntegerv(GL_VIEWPORT, m_savedViewport);
+		glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &m_savedFramebuffer);
+		resize(m_savedViewport[2], m_savedViewport[3]);
+		m_width = std::max(1, (int)std::lround(m_savedViewport[2] * m_scale));
+		m_height = std::max(1, (int)std::lround(m_savedViewport[3] * m_scale));
+
+		m_timerActive = m_queryFrame - m_queryResolved < (unsigned int)TIMER_QUERIES;
+		if (m_timerActive)
+		{
+			m_queryScales[m_queryFrame % TIMER_QUERIES] = m_scale;
+			glBeginQuery(GL_TIME_ELAPSED, m_timerQueries[m_queryFrame % TIMER_QUERIES].id());
+		}
+
+		glBindFramebuffer(GL_FRAMEBUFFER, m_FBO.id());
+		glViewport(0, 0, m_width, m_height);
+		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	}
+
+	/// Stretches what was drawn since begin() over the framebuffer and viewport begin() found, and restores them.
+	void end()
+	{
+		glBindFramebuffer(GL_FRAMEBUFFER, (GLuint)m_savedFramebuffer);
+		glViewport(m_savedViewport[0], m_savedViewport[1], m_savedViewport[2], m_savedViewport[3]);
+
+		glDisable(GL_DEPTH_TEST);
+		glBindVertexArray(m_emptyVAO.id());
+		glActiveTexture(GL_TEXTURE0);
+		glBindTexture(GL_TEXTURE_2D, m_colorTexture.id());
+		m_upscaleShader.use();
+		m_upscaleShader.setInt("scene", 0);
+		m_upscaleShader.setVec2("sourceSize", glm::vec2((float)m_width, (float)m_height));
+		m_upscaleShader.setVec2("outputSize", glm::vec2((float)m_savedViewport[2], (float)m_savedViewport[3]));
+		// the further the image is stretched, the more it needs sharpening; at full scale it is copied as is
+		m_upscaleShader.setFloat("sharpness", (1.0f - m_scale) / (1.0f - MIN_SCALE));
+		glDrawArrays(GL_TRIANGLES, 0, 3);
+		glEnable(GL_DEPTH_TEST);
+
+		if (m_timerActive)
+		{
+			glEndQuery(GL_TIME_ELAPSED);
+			m_queryFrame++;
+		}
+	}
+
+	/// Fraction of the window's width and height the next frame is drawn at.
+	float scale() const { return m_scale; }
+	/// Size the last frame was drawn at.
+	int width() const { return m_width; }
+	int height() const { return m_height; }
+	float budgetMilliseconds() const { return m_budgetMilliseconds; }
+	/// GPU time of the most recently completed scene pass and upscale, in milliseconds.
+	float lastPassMilliseconds() const { return m_lastPassMilliseconds; }
+	Shader& upscaleShader() { return m_upscaleShader; }
+
+protected:
+	static const int TIMER_QUERIES = 4;
+	/// Share of the budget aimed at, leaving room for the GPU time of frames to vary.
+	static constexpr float BUDGET_TARGET = 0.9f;
+	/// The most the scale changes by at one reading: falling over budget is worse than looking soft.
+	static constexpr float MAX_FALL = 0.85f;
+	static constexpr float MAX_CLIMB = 1.05f;
+	/// Changes smaller than this share of the scale are not made.
+	static constexpr float DEAD_BAND = 0.02f;
+
+	/// Reallocates the colour texture and depth buffer when the window's size changes.
+	void resize(int width, int height)
+	{
+		if (width == m_textureWidth && height == m_textureHeight)
+			return;
+
+		m_textureWidth = width;
+		m_textureHeight = height;
+		glBindTexture(GL_TEXTURE_2D, m_colorTexture.id());
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+		glBindRenderbuffer(GL_RENDERBUFFER, m_depthBuffer.id());
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+		GpuResources::resize(GPU_TEXTURE, m_colorTexture.id(), GpuResources::imageBytes(GL_RGBA8, width, height));
+		GpuResources::resize(GPU_RENDERBUFFER, m_depthBuffer.id(), GpuResources::imageBytes(GL_DEPTH_COMPONENT24, width, height));
+
+		glBindFramebuffer(GL_FRAMEBUFFER, m_FBO.id());
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, m_colorTexture.id(), 0);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, m_depthBuffer.id());
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	}
+
+	void collectTimerResults()
+	{
+		while (m_queryResolved < m_queryFrame)
+		{
+			const int slot = m_queryResolved % TIMER_QUERIES;
+			GLint available = 0;
+			glGetQueryObjectiv(m_timerQueries[slot].id(), GL_QUERY_RESULT_AVAILABLE, &available);
+			if (!available)
+				break;
+
+			GLuint64 nanoseconds = 0;
+			glGetQueryObjectui64v(m_timerQueries[slot].id(), GL_QUERY_RESULT, &nanoseconds);
+			m_lastPassMilliseconds = (float)nanoseconds / 1.0e6f;
+			adjustScale(m_queryScales[slot], m_lastPassMilliseconds);
+			m_queryResolved++;
+		}
+	}
+
+	/// Moves the scale towards the one at which a pass that took milliseconds at timedScale would fit the budget.
+	void adjustScale(float timedScale, float milliseconds)
+	{
+		// whatever the other passes take, the scene keeps a tenth of the budget to aim at
+		const float available = std::max(m_budgetMilliseconds * BUDGET_TARGET - m_otherMilliseconds, m_budgetMilliseconds * 0.1f);
+		float target = timedScale * std::sqrt(available / std::max(milliseconds, 0.01f));
+		target = glm::clamp(target, m_scale * MAX_FALL, m_scale * MAX_CLIMB);
+		target = glm::clamp(target, MIN_SCALE, 1.0f);
+		if (std::abs(target - m_scale) >= m_scale * DEAD_BAND || target == 1.0f || target == MIN_SCALE)
+			m_scale = target;
+	}
+
+	float m_budgetMilliseconds = 1000.0f / 60.0f;
+	float m_scale = 1.0f;
+	float m_otherMilliseconds = 0.0f;
+	int m_width = 0, m_height = 0;
+	int m_textureWidth = 0, m_textureHeight = 0;
+	GLTexture m_colorTexture;
+	GLRenderbuffer m_depthBuffer;
+	GLFramebuffer m_FBO;
+	GLVertexArray m_emptyVAO;
+	Shader m_upscaleShader;
+	GLint m_savedViewport[4];
+	GLint m_savedFramebuffer = 0;
+
+	GLQuery m_timerQueries[TIMER_QUERIES];
+	/// The scale each query's frame was drawn at.
+	float m_queryScales[TIMER_QUERIES];
+	unsigned int m_queryFrame = 0, m_queryResolved = 0;
+	bool m_timerActive = false;
+	float m_lastPassMilliseconds = 0.0f;
+};
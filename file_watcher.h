@@ -0,0 +1,130 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#else
+#include "mapped_file.h"
+#include <chrono>
+#endif
+
+/// Reports files that have been modified since the last call to poll().
+/// On Linux this uses inotify on the containing directories, so editors that save by writing a temporary
+/// file and renaming it over the original are still seen. Elsewhere each file's FileStamp is compared, at
+/// most a few times a second, so a file saved twice within a second is still seen the second time. poll()
+/// never blocks, so it is safe to call once per frame.
+
+class FileWatcher
+{
+public:
+	FileWatcher() { }
+	FileWatcher(const FileWatcher&) = delete;
+	FileWatcher& operator=(const FileWatcher&) = delete;
+	~FileWatcher()
+	{
+#ifdef __linux__
+		if (m_inotify >= 0)
+			close(m_inotify);
+#endif
+	}
+
+	void watch(const std::string& path)
+	{
+		for (size_t i = 0; i < m_files.size(); i++)
+			if (m_files[i].path == path)
+				return;
+
+		WatchedFile file;
+		file.path = path;
+		std::string::size_type slash = path.find_last_of("/\\");
+		file.directory = slash == std::string::npos ? "." : path.substr(0, slash);
+		file.name = slash == std::string::npos ? path : path.substr(slash + 1);
+#ifdef __linux__
+		if (m_inotify < 0)
+			m_inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+		file.watch = m_inotify < 0 ? -1 : inotify_add_watch(m_inotify, file.directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE);
+#else
+		file.stamp = MappedFile::stamp(path);
+#endif
+		m_files.push_back(file);
+	}
+
+	/// Returns the watched paths that changed since the previous call; each path is reported once.
+	std::vector<std::string> poll()
+	{
+		std::vector<std::string> changed;
+#ifdef __linux__
+		if (m_inotify < 0)
+			return changed;
+
+		alignas(struct inotify_event) char buffer[4096];
+		for (;;)
+		{
+			ssize_t length = read(m_inotify, buffer, sizeof(buffer));
+			if (length <= 0)
+				break;
+
+			for (char* cursor = buffer; cursor < buffer + length; )
+			{
+				const struct inotify_event* event = (const struct inotify_event*)cursor;
+				if (event->len > 0)
+				{
+					for (size_t i = 0; i < m_files.size(); i++)
+						if (m_files[i].watch == event->wd && m_files[i].name == event->name)
+							addOnce(changed, m_files[i].path);
+				}
+				cursor += sizeof(struct inotify_event) + event->len;
+			}
+		}
+#else
+		std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+		if (now - m_lastPoll < std::chrono::milliseconds(250))
+			return changed;
+		m_lastPoll = now;
+
+		for (size_t i = 0; i < m_files.size(); i++)
+		{
+			FileStamp stamp = MappedFile::stamp(m_files[i].path);
+			if (stamp.exists() && stamp != m_files[i].stamp)
+			{
+				m_files[i].stamp = stamp;
+				changed.push_back(m_files[i].path);
+			}
+		}
+#endif
+		return changed;
+	}
+
+private:
+	struct WatchedFile
+	{
+		std::string path;
+		std::string directory;
+		std::string name;
+#ifdef __linux__
+		int watch;
+#else
+		FileStamp stamp;
+#endif
+	};
+
+	static void addOnce(std::vector<std::string>& paths, const std::string& path)
+	{
+		for (size_t i = 0; i < paths.size(); i++)
+			if (paths[i] == path)
+				return;
+		paths.push_back(path);
+	}
+
+	std::vector<WatchedFile> m_files;
+#ifdef __linux__
+	int m_inotify = -1;
+#else
+	std::chrono::steady_clock::time_point m_lastPoll;
+#endif
+};
@@ -0,0 +1,193 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdarg>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+/// A bump allocator: allocate() hands out the next bytes of a large block, and reset() frees everything at
+/// once. Nothing is freed individually and no destructors run, so it only holds trivially destructible data.
+///
+/// The first block is taken up front. When a block runs out another is taken from the heap. reset() then
+/// replaces all the blocks with a single one as large as all of them together, so after the first few
+/// frames the arena serves a frame's worth of allocations from one block without touching the heap.
+
+class Arena
+{
+public:
+	static const size_t DEFAULT_BLOCK_SIZE = 64 * 1024;
+
+	explicit Arena(size_t blockSize = DEFAULT_BLOCK_SIZE) : m_blockSize(blockSize) { addBlock(blockSize); }
+	Arena(const Arena&) = delete;
+	Arena& operator=(const Arena&) = delete;
+	~Arena() { release(); }
+
+	void* allocate(size_t bytes, size_t alignment = alignof(std::max_align_t))
+	{
+		const Block& block = m_blocks[m_current];
+		const size_t offset = (m_offset + alignment - 1) & ~(alignment - 1);
+		if (offset + bytes <= block.size)
+		{
+			m_offset = offset + bytes;
+			m_used += bytes;
+			m_peak = std::max(m_peak, m_used);
+			return block.data + offset;
+		}
+
+		// the current block is full; move on to the next, which is always empty
+		if (m_current + 1 == m_blocks.size())
+			addBlock(std::max(m_blockSize, bytes + alignment));
+		m_current++;
+		m_offset = 0;
+		return allocate(bytes, alignment);
+	}
+
+	/// Uninitialised storage for count objects of T.
+	template <typename T>
+	T* allocateArray(size_t count)
+	{
+		static_assert(std::is_trivially_destructible<T>::value, "arena memory is released without running destructors");
+		return (T*)allocate(count * sizeof(T), alignof(T));
+	}
+
+	/// printf into arena memory.
+	const char* format(const char* format, ...)
+	{
+		va_list arguments;
+		va_start(arguments, format);
+		va_list copy;
+		va_copy(copy, arguments);
+		int length = vsnprintf(NULL, 0, format, copy);
+		va_end(copy);
+
+		char* text = allocateArray<char>(length + 1);
+		vsnprintf(text, length + 1, format, arguments);
+		va_end(arguments);
+		return text;
+	}
+
+	/// Frees every allocation. Pointers handed out so far must no longer be used.
+	void reset()
+	{
+		if (m_blocks.size() > 1)
+		{
+			size_t total = 0;
+			for (size_t i = 0; i < m_blocks.size(); i++)
+				total += m_blocks[i].size;
+			release();
+			addBlock(total);
+		}
+		m_current = 0;
+		m_offset = 0;
+		m_used = 0;
+	}
+
+	/// Bytes allocated since the last reset(), and the most ever allocated between two resets.
+	size_t used() const { return m_used; }
+	size_t peak() const { return m_peak; }
+	/// Bytes of all blocks held.
+	size_t capacity() const
+	{
+		size_t total = 0;
+		for (size_t i = 0; i < m_blocks.size(); i++)
+			total += m_blocks[i].size;
+		return total;
+	}
+	/// Blocks taken from the heap so far; stops growing once the arena has settled.
+	size_t heapAllocations() const { return m_heapAllocations; }
+
+protected:
+	struct Block
+	{
+		unsigned char* data;
+		size_t size;
+	};
+
+	void addBlock(size_t size)
+	{
+		Block block;
+		block.size = size;
+		block.data = (unsigned char*)malloc(size);
+		m_blocks.push_back(block);
+		m_heapAllocations++;
+	}
+
+	void release()
+	{
+		for (size_t i = 0; i < m_blocks.size(); i++)
+			free(m_blocks[i].data);
+		m_blocks.clear();
+	}
+
+	size_t m_blockSize;
+	std::vector<Block> m_blocks;
+	size_t m_current = 0;
+	size_t m_offset = 0;
+	size_t m_used = 0;
+	size_t m_peak = 0;
+	size_t m_heapAllocations = 0;
+};
+
+/// One Arena per thread of a JobSystem, for data that lives until the end of the frame: each thread
+/// allocates from its own arena without locking, and the render thread resets them all once the frame
+/// has been drawn.
+
+class FrameArena
+{
+public:
+	FrameArena() { }
+
+	/// threads must cover every JobSystem::threadIndex() that will allocate.
+	void start(int threads, size_t blockSize = Arena::DEFAULT_BLOCK_SIZE)
+	{
+		m_arenas.clear();
+		for (int i = 0; i < threads; i++)
+			m_arenas.push_back(std::unique_ptr<Arena>(new Arena(blockSize)));
+	}
+
+	/// The arena of thread index, such as JobSystem::threadIndex().
+	Arena& local(int index) { return *m_arenas[index]; }
+
+	/// Frees the frame's allocations on every thread. No thread may be allocating.
+	void reset()
+	{
+		size_t used = 0;
+		for (size_t i = 0; i < m_arenas.size(); i++)
+		{
+			used += m_arenas[i]->used();
+			m_arenas[i]->reset();
+		}
+		m_lastUsed = used;
+		m_peak = std::max(m_peak, used);
+	}
+
+	/// Bytes all threads allocated during the last frame, and during the busiest frame so far.
+	size_t lastUsed() const { return m_lastUsed; }
+	size_t peak() const { return m_peak; }
+
+	size_t capacity() const
+	{
+		size_t total = 0;
+		for (size_t i = 0; i < m_arenas.size(); i++)
+			total += m_arenas[i]->capacity();
+		return total;
+	}
+
+	/// Blocks all the arenas took from the heap so far, with malloc() rather than operator new.
+	size_t heapAllocations() const
+	{
+		size_t total = 0;
+		for (size_t i = 0; i < m_arenas.size(); i++)
+			total += m_arenas[i]->heapAllocations();
+		return total;
+	}
+
+protected:
+	std::vector<std::unique_ptr<Arena>> m_arenas;
+	size_t m_lastUsed = 0;
+	size_t m_peak = 0;
+};
@@ -0,0 +1,394 @@
+#pragma once
+
+#include <glad/glad.h>
+#include "image_file.h"
+#include "gl_handle.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/// What FrameCapture writes.
+enum CaptureFormat
+{
+	/// One PNG per frame: target "flight.png" becomes flight_00000.png, flight_00001.png, ...
+	CAPTURE_PNG,
+	/// Every frame into one YUV4MPEG2 file, 4:2:0 and full range.
+	CAPTURE_Y4M,
+	/// The same YUV4MPEG2 stream, written to the standard input of the command target, such as
+	/// "ffmpeg -y -f yuv4mpegpipe -i - flight.mp4".
+	CAPTURE_PIPE,
+};
+
+/// Records the frames the render thread draws without making it wait for them.
+///
+/// capture() starts copying the back buffer into one of READBACK_SLOTS pixel buffer objects and puts a
+/// fence after it, as HiZOcclusion reads its pyramid back. Later frames map the copies whose fences have
+/// signalled, oldest first, copy them into one of FRAME_BUFFERS frames and hand those to an encoder thread,
+/// which converts and writes them while the next frames are drawn. The render thread never waits: if every
+/// slot is still in flight, or every frame is still queued for the encoder because the disk or the external
+/// encoder cannot keep up, the frame is dropped and counted instead.
+///
+/// Started with dropFrames false, as for batch renders, capture() instead waits for a slot and a frame to
+/// come free, so every frame is written.
+///
+/// Every frame has the size of the first one; frames drawn while the window has another size are dropped.
+/// PNGs are stored without compression (see ImageFile), which keeps the encoder far ahead of the renderer;
+/// recompress them afterwards if space matters.
+
+class FrameCapture
+{
+public:
+	/// Frames being copied on the GPU at once.
+	static const int READBACK_SLOTS = 3;
+	/// Frames copied to the CPU that the encoder has not written yet.
+	static const int FRAME_BUFFERS = 8;
+
+	FrameCapture() { }
+	FrameCapture(const FrameCapture&) = delete;
+	FrameCapture& operator=(const FrameCapture&) = delete;
+	~FrameCapture() { stop(); }
+
+	/// Opens the output and starts the encoder thread. framesPerSecond only goes into the YUV4MPEG2 header.
+	/// Returns false if the output cannot be opened.
+	bool start(CaptureFormat format, const std::string& target, int framesPerSecond, bool dropFrames = true)
+	{
+		stop();
+		m_format = format;
+		m_target = target;
+		m_framesPerSecond = framesPerSecond;
+		m_dropFrames = dropFrames;
+		m_captured = 0;
+		m_dropped = 0;
+		m_written = 0;
+		m_failed = false;
+
+		if (format == CAPTURE_Y4M)
+			m_output = ImageFile::openForWriting(target.c_str());
+		else if (format == CAPTURE_PIPE)
+		{
+#ifdef _WIN32
+			m_output = _popen(target.c_str(), "wb");
+#else
+			// an encoder that exits early must not take the renderer with it; its writes fail instead
+			signal(SIGPIPE, SIG_IGN);
+			m_output = popen(target.c_str(), "w");
+#endif
+		}
+		if (format != CAPTURE_PNG && m_output == NULL)
+			return false;
+
+		// frame_%05d.png, with the number before the extension
+		const size_t dot = target.rfind('.');
+		m_pngStem = dot == std::string::npos ? target : target.substr(0, dot);
+
+		m_quit = false;
+		m_active = true;
+		m_thread = std::thread(&FrameCapture::encodeLoop, this);
+		return true;
+	}
+
+	/// Writes every frame already handed to the encoder, and closes the output.
+	void stop()
+	{
+		if (!m_thread.joinable())
+			return;
+
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_quit = true;
+		}
+		m_wake.notify_all();
+		m_thread.join();
+
+		if (m_format == CAPTURE_PIPE && m_output != NULL)
+		{
+#ifdef _WIN32
+			_pclose(m_output);
+#else
+			pclose(m_output);
+#endif
+		}
+		else if (m_output != NULL)
+			fclose(m_output);
+		m_output = NULL;
+		m_active = false;
+	}
+
+	bool active() const { return m_active; }
+
+	/// Render thread, after a frame is drawn and before the buffers are swapped: hands on the copies that
+	/// have finished, and starts copying width by height pixels of the framebuffer bound for drawing, the
+	/// back buffer if that is the window's. number names the PNG; by default frames are numbered in the
+	/// order they are written.
+	void capture(int width, int height, size_t number = NEXT_NUMBER)
+	{
+		if (!m_active)
+			return;
+
+		if (m_width == 0)
+			allocate(width, height);
+		const int slot = m_nextSlot;
+		collect(!m_dropFrames && m_fences[slot] != 0);
+		if (width != m_width || height != m_height)
+		{
+			m_dropped++;
+			return;
+		}
+
+		if (m_fences[slot] != 0)
+		{
+			// every slot is still in flight; drop this frame rather than wait
+			m_dropped++;
+			return;
+		}
+
+		GLint framebuffer = 0;
+		glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &framebuffer);
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, (GLuint)framebuffer);
+		glReadBuffer(framebuffer == 0 ? GL_BACK : GL_COLOR_ATTACHMENT0);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, m_PBOs[slot].id());
+		glPixelStorei(GL_PACK_ALIGNMENT, 4);
+		glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, (void*)0);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+		m_fences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		m_slotNumbers[slot] = number;
+		m_nextSlot = (slot + 1) % READBACK_SLOTS;
+	}
+
+	/// Render thread, before the context goes: waits for the copies still in flight, hands them on too and
+	/// deletes the pixel buffers. Nothing more can be captured.
+	void finish()
+	{
+		if (m_active && m_width != 0)
+			collect(true);
+		for (int i = 0; i < READBACK_SLOTS; i++)
+			m_PBOs[i].reset();
+	}
+
+	/// Frames handed to the encoder, dropped, and written so far.
+	size_t captured() const { return m_captured; }
+	size_t dropped() const { return m_dropped; }
+	size_t written() const { return m_written; }
+	/// Whether a write failed; the frames after it are dropped.
+	bool failed() const { return m_failed; }
+
+protected:
+	static const size_t NEXT_NUMBER = ~(size_t)0;
+
+	/// A frame waiting for the encoder, or being encoded.
+	struct Frame
+	{
+		std::vector<uint8_t> pixels;
+		size_t number = 0;
+	};
+
+	/// Creates the pixel buffers and frames for width by height frames, and writes the YUV4MPEG2 header.
+	void allocate(int width, int height)
+	{
+		m_width = width;
+		m_height = height;
+		const size_t bytes = (size_t)width * height * 4;
+
+		for (int i = 0; i < READBACK_SLOTS; i++)
+		{
+			m_PBOs[i] = GLBuffer::create("frame capture");
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, m_PBOs[i].id());
+			glBufferData(GL_PIXEL_PACK_BUFFER, bytes, NULL, GL_STREAM_READ);
+			GpuResources::resize(GPU_BUFFER, m_PBOs[i].id(), bytes);
+			m_fences[i] = 0;
+		}
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+		std::lock_guard<std::mutex> lock(m_mutex);
+		for (int i = 0; i < FRAME_BUFFERS; i++)
+		{
+			m_frames[i].pixels.resize(bytes);
+			m_free[i] = i;
+		}
+		m_freeCount = FRAME_BUFFERS;
+		m_queueStart = m_queueCount = 0;
+		const size_t chroma = (size_t)((width + 1) / 2) * ((height + 1) / 2);
+		m_yuv.resize((size_t)width * height + chroma * 2);
+		m_png.resize(ImageFile::pngSize(width, height));
+
+		if (m_format != CAPTURE_PNG)
+		{
+			fprintf(m_output, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C420jpeg XYSCSS=420JPEG XCOLORRANGE=FULL\n", width, height, m_framesPerSecond);
+			fflush(m_output);
+		}
+	}
+
+	/// Maps the copies whose fences have signalled, oldest first, and queues them for the encoder. With
+	/// wait, waits for every copy still in flight. Unless frames may be dropped, waits for the encoder to
+	/// free a frame to queue each copy in.
+	void collect(bool wait)
+	{
+		for (int i = 0; i < READBACK_SLOTS; i++)
+		{
+			const int slot = (m_nextSlot + i) % READBACK_SLOTS;
+			if (m_fences[slot] == 0)
+				continue;
+
+			GLenum status = glClientWaitSync(m_fences[slot], GL_SYNC_FLUSH_COMMANDS_BIT, wait ? 1000000000ull : 0);
+			if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+				return; // later copies cannot be done before this one, and must stay in order
+			glDeleteSync(m_fences[slot]);
+			m_fences[slot] = 0;
+
+			int frame = -1;
+			{
+				std::unique_lock<std::mutex> lock(m_mutex);
+				if (!m_dropFrames)
+					m_freed.wait(lock, [this] { return m_freeCount > 0 || m_failed; });
+				if (m_freeCount > 0 && !m_failed)
+					frame = m_free[--m_freeCount];
+			}
+			if (frame < 0)
+			{
+				m_dropped++;
+				continue;
+			}
+
+			const size_t bytes = m_frames[frame].pixels.size();
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, m_PBOs[slot].id());
+			const void* data = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, bytes, GL_MAP_READ_BIT);
+			if (data != NULL)
+				memcpy(m_frames[frame].pixels.data(), data, bytes);
+			glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				if (data == NULL)
+				{
+					m_free[m_freeCount++] = frame;
+					m_dropped++;
+					continue;
+				}
+				m_frames[frame].number = m_slotNumbers[slot] == NEXT_NUMBER ? m_captured : m_slotNumbers[slot];
+				m_captured++;
+				m_queue[(m_queueStart + m_queueCount++) % FRAME_BUFFERS] = frame;
+			}
+			m_wake.notify_one();
+		}
+	}
+
+	/// The encoder thread: writes queued frames in order until stop() is called and the queue is empty.
+	void encodeLoop()
+	{
+		for (;;)
+		{
+			int frame;
+			{
+				std::unique_lock<std::mutex> lock(m_mutex);
+				m_wake.wait(lock, [this] { return m_queueCount > 0 || m_quit; });
+				if (m_queueCount == 0)
+					return;
+				frame = m_queue[m_queueStart];
+				m_queueStart = (m_queueStart + 1) % FRAME_BUFFERS;
+				m_queueCount--;
+			}
+
+			const bool written = m_format == CAPTURE_PNG ? writePNG(m_frames[frame]) : writeY4M(m_frames[frame]);
+
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				m_free[m_freeCount++] = frame;
+				if (written)
+					m_written++;
+				else
+					m_failed = true;
+			}
+			m_freed.notify_one();
+		}
+	}
+
+	/// Writes the frame as a YUV4MPEG2 frame: the BT.601 full range planes, each chroma sample the average
+	/// of the 2x2 pixels it covers. GL's rows run bottom up, the stream's top down.
+	bool writeY4M(const Frame& frame)
+	{
+		const int width = m_width, height = m_height;
+		const int chromaWidth = (width + 1) / 2, chromaHeight = (height + 1) / 2;
+		uint8_t* luma = m_yuv.data();
+		uint8_t* cb = luma + (size_t)width * height;
+		uint8_t* cr = cb + (size_t)chromaWidth * chromaHeight;
+		const uint8_t* pixels = frame.pixels.data();
+
+		for (int y = 0; y < height; y++)
+		{
+			const uint8_t* row = pixels + (size_t)(height - 1 - y) * width * 4;
+			for (int x = 0; x < width; x++)
+			{
+				const int r = row[x * 4], g = row[x * 4 + 1], b = row[x * 4 + 2];
+				luma[(size_t)y * width + x] = (uint8_t)((19595 * r + 38470 * g + 7471 * b + 32768) >> 16);
+			}
+		}
+		for (int y = 0; y < chromaHeight; y++)
+		{
+			const uint8_t* top = pixels + (size_t)(height - 1 - 2 * y) * width * 4;
+			const uint8_t* bottom = 2 * y + 1 < height ? top - (size_t)width * 4 : top;
+			for (int x = 0; x < chromaWidth; x++)
+			{
+				const int left = x * 8, right = 2 * x + 1 < width ? left + 4 : left;
+				const int r = top[left] + top[right] + bottom[left] + bottom[right];
+				const int g = top[left + 1] + top[right + 1] + bottom[left + 1] + bottom[right + 1];
+				const int b = top[left + 2] + top[right + 2] + bottom[left + 2] + bottom[right + 2];
+				// the sums are four pixels' worth, so the offset of 128 is too
+				cb[(size_t)y * chromaWidth + x] = (uint8_t)std::min(255, std::max(0, (-11059 * r - 21709 * g + 32768 * b + (512 << 16) + 131072) >> 18));
+				cr[(size_t)y * chromaWidth + x] = (uint8_t)std::min(255, std::max(0, (32768 * r - 27439 * g - 5329 * b + (512 << 16) + 131072) >> 18));
+			}
+		}
+
+		return fwrite("FRAME\n", 1, 6, m_output) == 6 && fwrite(m_yuv.data(), 1, m_yuv.size(), m_output) == m_yuv.size();
+	}
+
+	/// Writes the frame as the PNG numbered frame.number.
+	bool writePNG(const Frame& frame)
+	{
+		char path[1024];
+		snprintf(path, sizeof(path), "%s_%05zu.png", m_pngStem.c_str(), frame.number);
+		return ImageFile::writePNG(path, frame.pixels.data(), m_width, m_height, m_png);
+	}
+
+	CaptureFormat m_format = CAPTURE_PNG;
+	std::string m_target, m_pngStem;
+	int m_framesPerSecond = 60;
+	FILE* m_output = NULL;
+	bool m_active = false;
+	bool m_dropFrames = true;
+	int m_width = 0, m_height = 0;
+
+	// render thread
+	GLBuffer m_PBOs[READBACK_SLOTS];
+	GLsync m_fences[READBACK_SLOTS];
+	size_t m_slotNumbers[READBACK_SLOTS];
+	int m_nextSlot = 0;
+
+	// shared, under m_mutex: frames are either free, queued for the encoder, or being encoded
+	std::mutex m_mutex;
+	std::condition_variable m_wake, m_freed;
+	bool m_quit = false;
+	Frame m_frames[FRAME_BUFFERS];
+	int m_free[FRAME_BUFFERS];
+	int m_freeCount = 0;
+	int m_queue[FRAME_BUFFERS];
+	int m_queueStart = 0, m_queueCount = 0;
+	size_t m_captured = 0;
+	std::atomic<size_t> m_written{ 0 };
+	std::atomic<size_t> m_dropped{ 0 };
+	std::atomic<bool> m_failed{ false };
+
+	// encoder thread
+	std::vector<uint8_t> m_yuv, m_png;
+	std::thread m_thread;
+};
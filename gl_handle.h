@@ -0,0 +1,101 @@
+#pragma once
+
+#include <glad/glad.h>
+#include "gpu_resources.h"
+
+#include <string>
+
+/// Sole owner of one GL object of kind Kind: deletes it, and forgets it in GpuResources, when destroyed or
+/// given another. Handles move but never copy, so every object has exactly one owner and is deleted exactly
+/// once, and a class keeping its objects in handles is movable but not copyable without writing any of that
+/// itself. A default handle holds nothing.
+///
+/// Deleting needs the context current; whatever holds handles is destroyed or reset on the GL thread before
+/// the context is released (see stopRendering()).
+
+template <GpuResourceKind Kind>
+class GLHandle
+{
+public:
+	GLHandle() { }
+	GLHandle(GLHandle&& other) noexcept : m_name(other.m_name) { other.m_name = 0; }
+	GLHandle& operator=(GLHandle&& other) noexcept
+	{
+		if (this != &other)
+		{
+			reset();
+			m_name = other.m_name;
+			other.m_name = 0;
+		}
+		return *this;
+	}
+	GLHandle(const GLHandle&) = delete;
+	GLHandle& operator=(const GLHandle&) = delete;
+	~GLHandle() { reset(); }
+
+	/// Creates an object, recorded in GpuResources as owner's with no storage yet; whoever defines its
+	/// storage reports the size with GpuResources::resize().
+	static GLHandle create(const std::string& owner)
+	{
+		GLHandle handle;
+		handle.m_name = generate();
+		GpuResources::track(Kind, handle.m_name, 0, owner);
+		return handle;
+	}
+
+	GLuint id() const { return m_name; }
+	explicit operator bool() const { return m_name != 0; }
+
+	/// Deletes the object held, if any.
+	void reset()
+	{
+		if (m_name == 0)
+			return;
+		GpuResources::release(Kind, m_name);
+		destroy(m_name);
+		m_name = 0;
+	}
+
+protected:
+	static GLuint generate()
+	{
+		GLuint name = 0;
+		switch (Kind)
+		{
+		case GPU_BUFFER: glGenBuffers(1, &name); break;
+		case GPU_TEXTURE: glGenTextures(1, &name); break;
+		case GPU_RENDERBUFFER: glGenRenderbuffers(1, &name); break;
+		case GPU_VERTEX_ARRAY: glGenVertexArrays(1, &name); break;
+		case GPU_FRAMEBUFFER: glGenFramebuffers(1, &name); break;
+		case GPU_PROGRAM: name = glCreateProgram(); break;
+		case GPU_QUERY: glGenQueries(1, &name); break;
+		default: break;
+		}
+		return name;
+	}
+
+	static void destroy(GLuint name)
+	{
+		switch (Kind)
+		{
+		case GPU_BUFFER: glDeleteBuffers(1, &name); break;
+		case GPU_TEXTURE: glDeleteTextures(1, &name); break;
+		case GPU_RENDERBUFFER: glDeleteRenderbuffers(1, &name); break;
+		case GPU_VERTEX_ARRAY: glDeleteVertexArrays(1, &name); break;
+		case GPU_FRAMEBUFFER: glDeleteFramebuffers(1, &name); break;
+		case GPU_PROGRAM: glDeleteProgram(name); break;
+		case GPU_QUERY: glDeleteQueries(1, &name); break;
+		default: break;
+		}
+	}
+
+	GLuint m_name = 0;
+};
+
+typedef GLHandle<GPU_BUFFER> GLBuffer;
+typedef GLHandle<GPU_TEXTURE> GLTexture;
+typedef GLHandle<GPU_RENDERBUFFER> GLRenderbuffer;
+typedef GLHandle<GPU_VERTEX_ARRAY> GLVertexArray;
+typedef GLHandle<GPU_FRAMEBUFFER> GLFramebuffer;
+typedef GLHandle<GPU_PROGRAM> GLProgram;
+typedef GLHandle<GPU_QUERY> GLQuery;
@@ -0,0 +1,342 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+
+// GL_NVX_gpu_memory_info and GL_ATI_meminfo, which the loader was not generated with
+#ifndef GL_GPU_MEMORY_INFO_DEDICATED_VIDMEM_NVX
+#define GL_GPU_MEMORY_INFO_DEDICATED_VIDMEM_NVX 0x9047
+#define GL_GPU_MEMORY_INFO_TOTAL_AVAILABLE_MEMORY_NVX 0x9048
+#define GL_GPU_MEMORY_INFO_CURRENT_AVAILABLE_VIDMEM_NVX 0x9049
+#define GL_GPU_MEMORY_INFO_EVICTED_MEMORY_NVX 0x904B
+#endif
+#ifndef GL_VBO_FREE_MEMORY_ATI
+#define GL_VBO_FREE_MEMORY_ATI 0x87FB
+#define GL_TEXTURE_FREE_MEMORY_ATI 0x87FC
+#define GL_RENDERBUFFER_FREE_MEMORY_ATI 0x87FD
+#endif
+
+enum GpuResourceKind
+{
+	GPU_BUFFER,
+	GPU_TEXTURE,
+	GPU_RENDERBUFFER,
+	GPU_VERTEX_ARRAY,
+	GPU_FRAMEBUFFER,
+	GPU_PROGRAM,
+	GPU_QUERY,
+	GPU_RESOURCE_KINDS,
+};
+
+/// A registry of every GL object the renderer creates: its kind, its owner and the bytes of GPU memory
+/// its storage takes, as far as the sizes and formats given to GL tell. GLHandle (see gl_handle.h) records
+/// objects as they are created and deleted, and whoever defines an object's storage reports its size.
+/// Objects without storage of their own (vertex arrays, framebuffers, programs, queries) count zero bytes
+/// but are still counted, so one created every frame shows up as a leak too.
+///
+/// The totals are in the window title, M prints the breakdown by kind and owner, and --gpu-report PATH
+/// writes it as JSON when the renderer stops, for comparing runs. Where the driver offers
+/// GL_NVX_gpu_memory_info or GL_ATI_meminfo, its view of free video memory is reported alongside.
+///
+/// Only the GL thread touches GL; the registry itself may be read from any thread.
+
+class GpuResources
+{
+public:
+	struct Totals
+	{
+		size_t count[GPU_RESOURCE_KINDS] = {};
+		size_t bytes[GPU_RESOURCE_KINDS] = {};
+		size_t allCount = 0;
+		size_t allBytes = 0;
+	};
+
+	/// What the driver says about video memory; sizes are 0 where it does not say.
+	struct DriverMemory
+	{
+		/// "GL_NVX_gpu_memory_info", "GL_ATI_meminfo" or NULL.
+		const char* source = NULL;
+		size_t dedicatedBytes = 0;
+		size_t availableBytes = 0;
+		size_t evictedBytes = 0;
+	};
+
+	/// Records that owner holds the object name of kind, with bytes of storage. Recording it again replaces
+	/// the size and the owner.
+	static void track(GpuResourceKind kind, GLuint name, size_t bytes, const std::string& owner)
+	{
+		State& state = get();
+		std::lock_guard<std::mutex> lock(state.mutex);
+		Record& record = state.records[key(kind, name)];
+		record.kind = kind;
+		record.name = name;
+		record.bytes = bytes;
+		record.owner = owner;
+	}
+
+	/// Updates the size of an object already tracked, as when its storage is redefined; allocates nothing,
+	/// so it may be called every frame.
+	static void resize(GpuResourceKind kind, GLuint name, size_t bytes)
+	{
+		State& state = get();
+		std::lock_guard<std::mutex> lock(state.mutex);
+		std::unordered_map<uint64_t, Record>::iterator found = state.records.find(key(kind, name));
+		if (found != state.records.end())
+			found->second.bytes = bytes;
+	}
+
+	/// Forgets a deleted object. Unknown names are ignored, as GL ignores deleting them.
+	static void release(GpuResourceKind kind, GLuint name)
+	{
+		State& state = get();
+		std::lock_guard<std::mutex> lock(state.mutex);
+		state.records.erase(key(kind, name));
+	}
+
+	/// Bytes of a width by height by layers image in internalFormat, summed over levels mip levels.
+	static size_t imageBytes(GLenum internalFormat, int width, int height, int layers = 1, int levels = 1)
+	{
+		size_t bytes = 0;
+		for (int level = 0; level < levels; level++)
+			bytes += (size_t)std::max(1, width >> level) * std::max(1, height >> level) * layers * texelBytes(internalFormat);
+		return bytes;
+	}
+
+	static Totals totals()
+	{
+		State& state = get();
+		std::lock_guard<std::mutex> lock(state.mutex);
+		Totals totals;
+		for (std::unordered_map<uint64_t, Record>::const_iterator i = state.records.begin(); i != state.records.end(); ++i)
+		{
+			totals.count[i->second.kind]++;
+			totals.bytes[i->second.kind] += i->second.bytes;
+			totals.allCount++;
+			totals.allBytes += i->second.bytes;
+		}
+		return totals;
+	}
+
+	/// Looks for the memory info extensions; call once on the GL thread after loading GL.
+	static void detectDriverMemoryInfo()
+	{
+		State& state = get();
+		GLint extensions = 0;
+		glGetIntegerv(GL_NUM_EXTENSIONS, &extensions);
+		for (GLint i = 0; i < extensions; i++)
+		{
+			const char* extension = (const char*)glGetStringi(GL_EXTENSIONS, (GLuint)i);
+			if (extension != NULL && strcmp(extension, "GL_NVX_gpu_memory_info") == 0)
+				state.driverSource = "GL_NVX_gpu_memory_info";
+			else if (extension != NULL && strcmp(extension, "GL_ATI_meminfo") == 0 && state.driverSource == NULL)
+				state.driverSource = "GL_ATI_meminfo";
+		}
+	}
+
+	/// Asks the driver, if it can tell; GL thread only.
+	static DriverMemory driverMemory()
+	{
+		DriverMemory memory;
+		memory.source = get().driverSource;
+		if (memory.source == NULL)
+			return memory;
+
+		// both extensions count in kilobytes
+		if (strcmp(memory.source, "GL_NVX_gpu_memory_info") == 0)
+		{
+			GLint dedicated = 0, available = 0, evicted = 0;
+			glGetIntegerv(GL_GPU_MEMORY_INFO_DEDICATED_VIDMEM_NVX, &dedicated);
+			glGetIntegerv(GL_GPU_MEMORY_INFO_CURRENT_AVAILABLE_VIDMEM_NVX, &available);
+			glGetIntegerv(GL_GPU_MEMORY_INFO_EVICTED_MEMORY_NVX, &evicted);
+			memory.dedicatedBytes = (size_t)dedicated << 10;
+			memory.availableBytes = (size_t)available << 10;
+			memory.evictedBytes = (size_t)evicted << 10;
+		}
+		else
+		{
+			// total free and largest free block, then the same for auxiliary memory; textures are the pool
+			// the scene fills
+			GLint free[4] = { 0, 0, 0, 0 };
+			glGetIntegerv(GL_TEXTURE_FREE_MEMORY_ATI, free);
+			memory.availableBytes = (size_t)free[0] << 10;
+		}
+		return memory;
+	}
+
+	static const char* kindName(GpuResourceKind kind)
+	{
+		static const char* const names[GPU_RESOURCE_KINDS] = { "buffers", "textures", "renderbuffers", "vertex arrays", "framebuffers", "programs", "queries" };
+		return names[kind];
+	}
+
+	/// Prints the totals per kind and, under each, per owner, largest first; with driver, what the driver
+	/// says too.
+	static void print(std::ostream& out, const DriverMemory& driver)
+	{
+		std::map<std::string, Totals> owners;
+		const Totals all = collect(owners);
+		char line[512];
+		snprintf(line, sizeof(line), "GPU resources: %zu objects, %.2f MB", all.allCount, all.allBytes / 1048576.0);
+		out << line << std::endl;
+		for (int kind = 0; kind < GPU_RESOURCE_KINDS; kind++)
+		{
+			if (all.count[kind] == 0)
+				continue;
+			snprintf(line, sizeof(line), "  %-14s %6zu %10.2f MB", kindName((GpuResourceKind)kind), all.count[kind], all.bytes[kind] / 1048576.0);
+			out << line << std::endl;
+			const std::multimap<size_t, std::string> sorted = byBytes(owners, kind);
+			for (std::multimap<size_t, std::string>::const_reverse_iterator i = sorted.rbegin(); i != sorted.rend(); ++i)
+			{
+				snprintf(line, sizeof(line), "    %-32s %4zu %10.2f MB", i->second.c_str(), owners[i->second].count[kind], i->first / 1048576.0);
+				out << line << std::endl;
+			}
+		}
+		if (driver.source != NULL)
+		{
+			snprintf(line, sizeof(line), "  driver (%s): %.0f MB available of %.0f MB dedicated, %.0f MB evicted", driver.source,
+				driver.availableBytes / 1048576.0, driver.dedicatedBytes / 1048576.0, driver.evictedBytes / 1048576.0);
+			out << line << std::endl;
+		}
+	}
+
+	/// Writes every object and the totals as JSON. Returns false if the file cannot be written.
+	static bool writeJson(const std::string& path, const DriverMemory& driver)
+	{
+		std::ofstream file(path.c_str(), std::ios::trunc);
+		if (!file)
+			return false;
+
+		std::map<std::string, Totals> owners;
+		const Totals all = collect(owners);
+		file << "{\n  \"totalBytes\": " << all.allBytes << ",\n  \"totalCount\": " << all.allCount << ",\n  \"kinds\": {";
+		for (int kind = 0; kind < GPU_RESOURCE_KINDS; kind++)
+			file << (kind > 0 ? "," : "") << "\n    \"" << kindName((GpuResourceKind)kind) << "\": { \"count\": " << all.count[kind]
+				<< ", \"bytes\": " << all.bytes[kind] << " }";
+		file << "\n  },\n  \"owners\": [";
+		bool first = true;
+		for (std::map<std::string, Totals>::const_iterator i = owners.begin(); i != owners.end(); ++i)
+		{
+			file << (first ? "" : ",") << "\n    { \"owner\": " << quoted(i->first) << ", \"count\": " << i->second.allCount
+				<< ", \"bytes\": " << i->second.allBytes << " }";
+			first = false;
+		}
+		file << "\n  ],\n  \"objects\": [";
+		{
+			State& state = get();
+			std::lock_guard<std::mutex> lock(state.mutex);
+			first = true;
+			for (std::unordered_map<uint64_t, Record>::const_iterator i = state.records.begin(); i != state.records.end(); ++i)
+			{
+				file << (first ? "" : ",") << "\n    { \"kind\": \"" << kindName(i->second.kind) << "\", \"name\": " << i->second.name
+					<< ", \"bytes\": " << i->second.bytes << ", \"owner\": " << quoted(i->second.owner) << " }";
+				first = false;
+			}
+		}
+		file << "\n  ]";
+		if (driver.source != NULL)
+			file << ",\n  \"driver\": { \"source\": \"" << driver.source << "\", \"dedicatedBytes\": " << driver.dedicatedBytes
+				<< ", \"availableBytes\": " << driver.availableBytes << ", \"evictedBytes\": " << driver.evictedBytes << " }";
+		file << "\n}\n";
+		return (bool)file;
+	}
+
+protected:
+	struct Record
+	{
+		GpuResourceKind kind = GPU_BUFFER;
+		GLuint name = 0;
+		size_t bytes = 0;
+		std::string owner;
+	};
+
+	struct State
+	{
+		std::mutex mutex;
+		std::unordered_map<uint64_t, Record> records;
+		const char* driverSource = NULL;
+	};
+
+	/// The one registry, shared by every translation unit. Never destroyed, so handles destroyed during
+	/// static destruction can still release into it.
+	static State& get()
+	{
+		static State* state = new State();
+		return *state;
+	}
+
+	static uint64_t key(GpuResourceKind kind, GLuint name) { return (uint64_t)kind << 32 | name; }
+
+	static size_t texelBytes(GLenum internalFormat)
+	{
+		switch (internalFormat)
+		{
+		case GL_R8: return 1;
+		case GL_RG8: case GL_R16F: case GL_DEPTH_COMPONENT16: return 2;
+		case GL_RGB8: return 3;
+		case GL_RGBA16F: case GL_RG32F: return 8;
+		case GL_RGBA32F: return 16;
+		// RGBA8, depth 24 (padded to 32 bits) and 32F, depth-stencil and the rest
+		default: return 4;
+		}
+	}
+
+	/// Totals overall and per owner.
+	static Totals collect(std::map<std::string, Totals>& owners)
+	{
+		State& state = get();
+		std::lock_guard<std::mutex> lock(state.mutex);
+		Totals all;
+		for (std::unordered_map<uint64_t, Record>::const_iterator i = state.records.begin(); i != state.records.end(); ++i)
+		{
+			const Record& record = i->second;
+			Totals* totals[2] = { &all, &owners[record.owner] };
+			for (int j = 0; j < 2; j++)
+			{
+				totals[j]->count[record.kind]++;
+				totals[j]->bytes[record.kind] += record.bytes;
+				totals[j]->allCount++;
+				totals[j]->allBytes += record.bytes;
+			}
+		}
+		return all;
+	}
+
+	static std::multimap<size_t, std::string> byBytes(const std::map<std::string, Totals>& owners, int kind)
+	{
+		std::multimap<size_t, std::string> sorted;
+		for (std::map<std::string, Totals>::const_iterator i = owners.begin(); i != owners.end(); ++i)
+			if (i->second.count[kind] > 0)
+				sorted.insert(std::make_pair(i->second.bytes[kind], i->first));
+		return sorted;
+	}
+
+	static std::string quoted(const std::string& text)
+	{
+		std::string out = "\"";
+		for (size_t i = 0; i < text.size(); i++)
+		{
+			const unsigned char c = (unsigned char)text[i];
+			if (c == '"' || c == '\\')
+				out += std::string("\\") + (char)c;
+			else if (c < 0x20)
+			{
+				char escape[8];
+				snprintf(escape, sizeof(escape), "\\u%04x", c);
+				out += escape;
+			}
+			else
+				out += (char)c;
+		}
+		return out + "\"";
+	}
+};
@@ -0,0 +1,156 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+/// Writing images of RGBA pixels, bottom row first, as glReadPixels() returns them.
+///
+/// PNGs are written with their image data in stored deflate blocks, without compression: there is no zlib
+/// in the tree, and storing keeps up with the disk.
+
+class ImageFile
+{
+public:
+	/// fopen(path, "wb"), which MSVC's SDL checks only accept as fopen_s.
+	static FILE* openForWriting(const char* path)
+	{
+#ifdef _MSC_VER
+		FILE* file = NULL;
+		return fopen_s(&file, path, "wb") == 0 ? file : NULL;
+#else
+		return fopen(path, "wb");
+#endif
+	}
+
+	/// Bytes of a stored PNG of width by height RGB pixels: signature, IHDR, one IDAT and IEND.
+	static size_t pngSize(int width, int height)
+	{
+		const size_t raw = ((size_t)width * 3 + 1) * height;
+		const size_t blocks = (raw + MAX_STORED_BLOCK - 1) / MAX_STORED_BLOCK;
+		const size_t idat = 2 + raw + blocks * 5 + 4;
+		return 8 + (12 + 13) + (12 + idat) + 12;
+	}
+
+	/// Writes width by height pixels to path as a PNG, encoding into buffer, which is grown to pngSize().
+	static bool writePNG(const char* path, const uint8_t* pixels, int width, int height, std::vector<uint8_t>& buffer)
+	{
+		if (buffer.size() < pngSize(width, height))
+			buffer.resize(pngSize(width, height));
+
+		static const uint8_t signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+		uint8_t* out = buffer.data();
+		memcpy(out, signature, sizeof(signature));
+		size_t at = sizeof(signature);
+
+		uint8_t header[13];
+		writeBigEndian(header, (uint32_t)width);
+		writeBigEndian(header + 4, (uint32_t)height);
+		header[8] = 8; // bits per channel
+		header[9] = 2; // RGB
+		header[10] = header[11] = header[12] = 0;
+		at = writeChunk(out, at, "IHDR", header, sizeof(header));
+
+		// IDAT: a zlib stream of stored blocks, filled in place after the chunk's length and type
+		const size_t idatStart = at;
+		at += 8;
+		out[at++] = 0x78;
+		out[at++] = 0x01;
+		const size_t raw = ((size_t)width * 3 + 1) * height;
+		const size_t maxBlock = MAX_STORED_BLOCK;
+		size_t blockLeft = 0, rawLeft = raw;
+		uint32_t adlerA = 1, adlerB = 0;
+		for (int y = 0; y < height; y++)
+		{
+			// filter type 0, then the row's RGB, top row first
+			const uint8_t* row = pixels + (size_t)(height - 1 - y) * width * 4;
+			for (int x = -1; x < width; x++)
+			{
+				for (int channel = 0; channel < (x < 0 ? 1 : 3); channel++)
+				{
+					if (blockLeft == 0)
+					{
+						blockLeft = std::min(rawLeft, maxBlock);
+						out[at++] = rawLeft == blockLeft ? 1 : 0;
+						out[at++] = (uint8_t)blockLeft;
+						out[at++] = (uint8_t)(blockLeft >> 8);
+						out[at++] = (uint8_t)~blockLeft;
+						out[at++] = (uint8_t)(~blockLeft >> 8);
+					}
+					const uint8_t value = x < 0 ? 0 : row[x * 4 + channel];
+					out[at++] = value;
+					adlerA += value;
+					adlerB += adlerA;
+					blockLeft--;
+					rawLeft--;
+				}
+				// well before the sums can overflow
+				if (adlerB >= 0xf0000000u)
+				{
+					adlerA %= 65521;
+					adlerB %= 65521;
+				}
+			}
+		}
+		writeBigEndian(out + at, ((adlerB % 65521) << 16) | (adlerA % 65521));
+		at += 4;
+		const size_t idatLength = at - idatStart - 8;
+		writeBigEndian(out + idatStart, (uint32_t)idatLength);
+		memcpy(out + idatStart + 4, "IDAT", 4);
+		writeBigEndian(out + at, crc32(out + idatStart + 4, idatLength + 4));
+		at += 4;
+		at = writeChunk(out, at, "IEND", NULL, 0);
+
+		FILE* file = openForWriting(path);
+		if (file == NULL)
+			return false;
+		const bool written = fwrite(out, 1, at, file) == at;
+		return fclose(file) == 0 && written;
+	}
+
+protected:
+	static const size_t MAX_STORED_BLOCK = 65535;
+
+	static void writeBigEndian(uint8_t* out, uint32_t value)
+	{
+		out[0] = (uint8_t)(value >> 24);
+		out[1] = (uint8_t)(value >> 16);
+		out[2] = (uint8_t)(value >> 8);
+		out[3] = (uint8_t)value;
+	}
+
+	static size_t writeChunk(uint8_t* out, size_t at, const char* type, const uint8_t* data, size_t length)
+	{
+		writeBigEndian(out + at, (uint32_t)length);
+		memcpy(out + at + 4, type, 4);
+		if (length > 0)
+			memcpy(out + at + 8, data, length);
+		writeBigEndian(out + at + 8 + length, crc32(out + at + 4, length + 4));
+		return at + 12 + length;
+	}
+
+	static uint32_t crc32(const uint8_t* data, size_t length)
+	{
+		static const struct Table
+		{
+			uint32_t entries[256];
+			Table()
+			{
+				for (uint32_t i = 0; i < 256; i++)
+				{
+					uint32_t c = i;
+					for (int bit = 0; bit < 8; bit++)
+						c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+					entries[i] = c;
+				}
+			}
+		} table;
+
+		uint32_t crc = 0xffffffffu;
+		for (size_t i = 0; i < length; i++)
+			crc = table.entries[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+		return crc ^ 0xffffffffu;
+	}
+};
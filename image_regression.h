@@ -0,0 +1,119 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+/// Image regression checks: a render is compared with its golden image by how different the two look, not
+/// by their bytes, so optimisations that change nothing a viewer could see pass and anything else fails.
+///
+/// Both images are converted to CIELAB, where a distance (delta E) of about JUST_NOTICEABLE is the least
+/// difference people see. A pixel's difference is its distance to the closest colour within one pixel of
+/// it in the other image, taken both ways round, so an edge that moved by a pixel, as it may between GPUs
+/// or after vertices were quantised, does not count but anything missing or added does. A view fails when
+/// more than MAX_DIFFERING of its pixels differ by more than PIXEL_TOLERANCE.
+///
+/// The diff image shows the golden image in dim grey, noticeable differences within tolerance in yellow and
+/// failing pixels in red, brighter the more they differ.
+
+class ImageRegression
+{
+public:
+	static constexpr float JUST_NOTICEABLE = 2.3f;
+	static constexpr float PIXEL_TOLERANCE = 5.0f;
+	static constexpr double MAX_DIFFERING = 0.0001;
+
+	struct Result
+	{
+		double meanDelta = 0.0;
+		float largestDelta = 0.0f;
+		/// Pixels differing by more than JUST_NOTICEABLE, and by more than PIXEL_TOLERANCE.
+		size_t noticeable = 0;
+		size_t differing = 0;
+		size_t pixels = 0;
+
+		bool passed() const { return differing <= pixels * MAX_DIFFERING; }
+	};
+
+	/// Compares two width by height RGBA images and draws the diff image, in the same layout, into diff.
+	static Result compare(const uint8_t* image, const uint8_t* golden, int width, int height, std::vector<uint8_t>& diff)
+	{
+		Result result;
+		result.pixels = (size_t)width * height;
+		std::vector<glm::vec3> imageLab(result.pixels), goldenLab(result.pixels);
+		for (size_t i = 0; i < result.pixels; i++)
+		{
+			imageLab[i] = lab(image + i * 4);
+			goldenLab[i] = lab(golden + i * 4);
+		}
+
+		diff.resize(result.pixels * 4);
+		double total = 0.0;
+		for (int y = 0; y < height; y++)
+		{
+			for (int x = 0; x < width; x++)
+			{
+				const float delta = std::max(nearest(imageLab, goldenLab, x, y, width, height), nearest(goldenLab, imageLab, x, y, width, height));
+				total += delta;
+				result.largestDelta = std::max(result.largestDelta, delta);
+				result.noticeable += delta > JUST_NOTICEABLE ? 1 : 0;
+				result.differing += delta > PIXEL_TOLERANCE ? 1 : 0;
+
+				const size_t i = (size_t)y * width + x;
+				const uint8_t grey = (uint8_t)(goldenLab[i].x * 1.2f);
+				const uint8_t strength = (uint8_t)std::min(255.0f, 128.0f + delta * 4.0f);
+				uint8_t* out = &diff[i * 4];
+				out[0] = delta > JUST_NOTICEABLE ? strength : grey;
+				out[1] = delta > PIXEL_TOLERANCE ? 0 : delta > JUST_NOTICEABLE ? strength : grey;
+				out[2] = delta > JUST_NOTICEABLE ? 0 : grey;
+				out[3] = 255;
+			}
+		}
+		result.meanDelta = total / (double)result.pixels;
+		return result;
+	}
+
+protected:
+	/// The distance from from's pixel at x, y to the closest of to's pixels within one of it.
+	static float nearest(const std::vector<glm::vec3>& from, const std::vector<glm::vec3>& to, int x, int y, int width, int height)
+	{
+		const glm::vec3& colour = from[(size_t)y * width + x];
+		float closest = INFINITY;
+		for (int ny = std::max(0, y - 1); ny <= std::min(height - 1, y + 1); ny++)
+			for (int nx = std::max(0, x - 1); nx <= std::min(width - 1, x + 1); nx++)
+				closest = std::min(closest, glm::length(colour - to[(size_t)ny * width + nx]));
+		return closest;
+	}
+
+	/// CIELAB of an sRGB pixel, against the D65 white point.
+	static glm::vec3 lab(const uint8_t* rgb)
+	{
+		static const struct Linear
+		{
+			float values[256];
+			Linear()
+			{
+				for (int i = 0; i < 256; i++)
+				{
+					const float c = i / 255.0f;
+					values[i] = c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+				}
+			}
+		} linear;
+
+		const float r = linear.values[rgb[0]], g = linear.values[rgb[1]], b = linear.values[rgb[2]];
+		const float x = labCurve((0.4124f * r + 0.3576f * g + 0.1805f * b) / 0.95047f);
+		const float y = labCurve(0.2126f * r + 0.7152f * g + 0.0722f * b);
+		const float z = labCurve((0.0193f * r + 0.1192f * g + 0.9505f * b) / 1.08883f);
+		return glm::vec3(116.0f * y - 16.0f, 500.0f * (x - y), 200.0f * (y - z));
+	}
+
+	static float labCurve(float t)
+	{
+		const float delta = 6.0f / 29.0f;
+		return t > delta * delta * delta ? std::cbrt(t) : t / (3.0f * delta * delta) + 4.0f / 29.0f;
+	}
+};
@@ -0,0 +1,420 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/// Jobs and the dependencies between them, run by a JobSystem. A graph is built once and may then be run
+/// any number of times, typically once per frame: each run does every job once, and each job only after
+/// all the jobs that precede it. The graph must not be changed while a run is in progress.
+
+class JobGraph
+{
+public:
+	JobGraph() { }
+	JobGraph(const JobGraph&) = delete;
+	JobGraph& operator=(const JobGraph&) = delete;
+
+	/// Returns the job's id, for precede().
+	int add(std::function<void()> work)
+	{
+		Job job;
+		job.work = work;
+		m_jobs.push_back(job);
+		return (int)m_jobs.size() - 1;
+	}
+
+	/// Makes later wait until earlier has finished.
+	void precede(int earlier, int later)
+	{
+		m_jobs[earlier].successors.push_back(later);
+		m_jobs[later].dependencies++;
+	}
+
+	size_t size() const { return m_jobs.size(); }
+
+	/// True once every job of the last run has finished.
+	bool finished() const { return m_pending.load(std::memory_order_acquire) == 0; }
+
+private:
+	friend class JobSystem;
+
+	struct Job
+	{
+		std::function<void()> work;
+		std::vector<int> successors;
+		int dependencies = 0;
+	};
+
+	std::vector<Job> m_jobs;
+	/// Per job, the predecessors still running in the current run.
+	std::unique_ptr<std::atomic<int>[]> m_remaining;
+	size_t m_remainingSize = 0;
+	std::atomic<int> m_pending{ 0 };
+};
+
+/// A pool of worker threads that run JobGraphs.
+///
+/// Every worker has a queue of its own: jobs made ready by a finished job go to the back of the queue of
+/// the thread that finished it, which takes work from the back, so related jobs tend to stay on one core.
+/// A thread whose queue is empty steals from the front of another's, where the oldest and usually largest
+/// pieces of work are. Idle workers sleep until jobs are queued.
+///
+/// The thread that owns the system has queue 0 and no worker of its own: it submits graphs and then helps
+/// run jobs in wait(), which jobs may also call to wait for graphs they submit themselves. With no workers,
+/// the owner simply runs every job in wait().
+
+class JobSystem
+{
+public:
+	JobSystem()
+	{
+		m_queues.push_back(std::unique_ptr<Queue>(new Queue()));
+	}
+
+	JobSystem(const JobSystem&) = delete;
+	JobSystem& operator=(const JobSystem&) = delete;
+	~JobSystem() { stop(); }
+
+	/// One worker per core besides the owner's.
+	static int defaultWorkerCount()
+	{
+		unsigned int cores = std::thread::hardware_concurrency();
+		return cores > 1 ? (int)cores - 1 : 0;
+	}
+
+	void start(int workers)
+	{
+		stop();
+		m_quit = false;
+		for (int i = 0; i < workers; i++)
+			m_queues.push_back(std::unique_ptr<Queue>(new Queue()));
+		for (int i = 0; i < workers; i++)
+			m_threads.push_back(std::thread(&JobSystem::workerLoop, this, i + 1));
+	}
+
+	/// Joins the workers. No graph may be running.
+	void stop()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_sleepMutex);
+			m_quit = true;
+		}
+		m_wake.notify_all();
+		for (size_t i = 0; i < m_threads.size(); i++)
+			m_threads[i].join();
+		m_threads.clear();
+		m_queues.resize(1);
+	}
+
+	int workerCount() const { return (int)m_threads.size(); }
+
+	/// Index of the calling thread among the system's threads: 1 to workerCount() on a worker, 0 on any
+	/// other thread. Lets jobs pick per-thread data without locking.
+	static int threadIndex() { return currentQueueIndex(); }
+
+	/// Starts a run of graph and returns at once; its jobs may start on the workers straight away. wait()
+	/// must follow before the graph is submitted again.
+	void submit(JobGraph& graph)
+	{
+		const size_t count = graph.m_jobs.size();
+		if (graph.m_remainingSize != count)
+		{
+			graph.m_remaining.reset(new std::atomic<int>[count]);
+			graph.m_remainingSize = count;
+		}
+		for (size_t i = 0; i < count; i++)
+			graph.m_remaining[i].store(graph.m_jobs[i].dependencies, std::memory_order_relaxed);
+		graph.m_pending.store((int)count, std::memory_order_release);
+
+		const int self = currentQueue();
+		for (size_t i = 0; i < count; i++)
+			if (graph.m_jobs[i].dependencies == 0)
+				push(self, Task(&graph, (int)i));
+	}
+
+	/// Runs jobs, of this graph or any other, until every job of graph has finished.
+	void wait(JobGraph& graph)
+	{
+		helpUntil([&graph]() { return graph.finished(); });
+	}
+
+	void run(JobGraph& graph)
+	{
+		submit(graph);
+		wait(graph);
+	}
+
+	/// Calls body(begin, end) for ranges of about grain elements covering [0, count), spread over every
+	/// thread, and returns once all are done. One task per thread claims ranges until none are left, so
+	/// uneven ranges even out. The loop lives on the caller's stack and body is called through a plain
+	/// function pointer, so nothing is allocated.
+	template <typename Body>
+	void parallelFor(size_t count, size_t grain, const Body& body)
+	{
+		if (count == 0)
+			return;
+
+		grain = std::max(grain, (size_t)1);
+		const size_t ranges = (count + grain - 1) / grain;
+		if (ranges == 1 || m_threads.empty())
+		{
+			body(0, count);
+			return;
+		}
+
+		Loop loop;
+		loop.body = &body;
+		loop.invoke = [](const void* function, size_t begin, size_t end) { (*(const Body*)function)(begin, end); };
+		loop.count = count;
+		loop.grain = grain;
+		loop.ranges = ranges;
+		const size_t tasks = std::min(ranges, m_threads.size() + 1);
+		loop.pending.store((int)tasks, std::memory_order_relaxed);
+
+		const int self = currentQueue();
+		for (size_t i = 0; i < tasks; i++)
+			push(self, Task(&loop));
+		helpUntil([&loop]() { return loop.pending.load(std::memory_order_acquire) == 0; });
+	}
+
+	/// Sorts values with every thread: one range per thread is sorted, then pairs of ranges are merged,
+	/// the pairs in parallel, until one is left. scratch is working memory, kept by the caller so its
+	/// allocation is reused; it is left with unspecified contents.
+	template <typename T>
+	void sort(std::vector<T>& values, std::vector<T>& scratch)
+	{
+		const size_t count = values.size();
+		const size_t ranges = std::min(count / SORT_GRAIN, m_threads.size() + 1);
+		if (ranges < 2)
+		{
+			std::sort(values.begin(), values.end());
+			return;
+		}
+
+		const size_t rangeSize = (count + ranges - 1) / ranges;
+		parallelFor(ranges, 1, [&](size_t begin, size_t end) {
+			for (size_t range = begin; range < end; range++)
+				std::sort(values.begin() + range * rangeSize, values.begin() + std::min(count, (range + 1) * rangeSize));
+		});
+
+		scratch.resize(count);
+		std::vector<T>* from = &values;
+		std::vector<T>* to = &scratch;
+		for (size_t width = rangeSize; width < count; width *= 2)
+		{
+			const size_t pairs = (count + 2 * width - 1) / (2 * width);
+			parallelFor(pairs, 1, [&](size_t begin, size_t end) {
+				for (size_t pair = begin; pair < end; pair++)
+				{
+					const size_t first = pair * 2 * width;
+					const size_t middle = std::min(count, first + width);
+					const size_t last = std::min(count, first + 2 * width);
+					std::merge(from->begin() + first, from->begin() + middle, from->begin() + middle, from->begin() + last, to->begin() + first);
+				}
+			});
+			std::swap(from, to);
+		}
+		if (from != &values)
+			values.swap(scratch);
+	}
+
+protected:
+	/// Below this many elements per thread, sort() leaves it to std::sort.
+	static const size_t SORT_GRAIN = 16384;
+
+	/// A parallelFor() in progress.
+	struct Loop
+	{
+		void (*invoke)(const void* body, size_t begin, size_t end);
+		const void* body;
+		size_t count;
+		size_t grain;
+		size_t ranges;
+		std::atomic<size_t> next{ 0 };
+		/// Tasks of the loop not yet finished.
+		std::atomic<int> pending{ 0 };
+
+		void run()
+		{
+			for (size_t range = next.fetch_add(1); range < ranges; range = next.fetch_add(1))
+				invoke(body, range * grain, std::min(count, (range + 1) * grain));
+		}
+	};
+
+	/// A job of a graph, or a share of a loop.
+	struct Task
+	{
+		JobGraph* graph = NULL;
+		int job = 0;
+		Loop* loop = NULL;
+
+		Task() { }
+		Task(JobGraph* graph, int job) : graph(graph), job(job) { }
+		explicit Task(Loop* loop) : loop(loop) { }
+	};
+
+	/// A ring of tasks that doubles when full and never shrinks, so once it has grown to the largest
+	/// number of tasks queued at a time, queueing allocates nothing.
+	struct Queue
+	{
+		std::mutex mutex;
+		std::vector<Task> ring = std::vector<Task>(64);
+		size_t head = 0;
+		size_t size = 0;
+
+		void pushBack(const Task& task)
+		{
+			if (size == ring.size())
+			{
+				std::vector<Task> grown(ring.size() * 2);
+				for (size_t i = 0; i < size; i++)
+					grown[i] = ring[(head + i) % ring.size()];
+				ring.swap(grown);
+				head = 0;
+			}
+			ring[(head + size) % ring.size()] = task;
+			size++;
+		}
+
+		Task popBack()
+		{
+			size--;
+			return ring[(head + size) % ring.size()];
+		}
+
+		Task popFront()
+		{
+			Task task = ring[head];
+			head = (head + 1) % ring.size();
+			size--;
+			return task;
+		}
+	};
+
+	/// Queue of the calling thread: its worker's, or the owner's for any thread that is not a worker.
+	static int& currentQueueIndex()
+	{
+		thread_local int index = 0;
+		return index;
+	}
+
+	int currentQueue() const { return currentQueueIndex() < (int)m_queues.size() ? currentQueueIndex() : 0; }
+
+	void push(int queue, const Task& task)
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_queues[queue]->mutex);
+			m_queues[queue]->pushBack(task);
+		}
+		m_queued++;
+
+		// a worker that saw no work counted itself as sleeping first, so either it sees m_queued or it is
+		// counted here; taking the lock makes sure it is already waiting when notified
+		if (m_sleeping.load() > 0)
+		{
+			{
+				std::lock_guard<std::mutex> lock(m_sleepMutex);
+			}
+			m_wake.notify_one();
+		}
+	}
+
+	/// Takes the newest task of the thread's own queue, or else steals the oldest of another's.
+	bool takeTask(int self, Task& task)
+	{
+		if (m_queued.load() == 0)
+			return false;
+
+		const size_t queues = m_queues.size();
+		for (size_t i = 0; i < queues; i++)
+		{
+			Queue& queue = *m_queues[(self + i) % queues];
+			std::lock_guard<std::mutex> lock(queue.mutex);
+			if (queue.size == 0)
+				continue;
+
+			task = i == 0 ? queue.popBack() : queue.popFront();
+			m_queued--;
+			return true;
+		}
+		return false;
+	}
+
+	/// Runs tasks until done() returns true.
+	template <typename Done>
+	void helpUntil(Done done)
+	{
+		const int self = currentQueue();
+		while (!done())
+		{
+			Task task;
+			if (takeTask(self, task))
+				execute(self, task);
+			else
+				std::this_thread::yield();
+		}
+	}
+
+	void execute(int self, const Task& task)
+	{
+		if (task.loop)
+		{
+			task.loop->run();
+			// the loop is gone as soon as its last task is counted
+			task.loop->pending.fetch_sub(1, std::memory_order_acq_rel);
+			return;
+		}
+
+		JobGraph& graph = *task.graph;
+		const JobGraph::Job& job = graph.m_jobs[task.job];
+		job.work();
+
+		for (size_t i = 0; i < job.successors.size(); i++)
+		{
+			const int successor = job.successors[i];
+			if (graph.m_remaining[successor].fetch_sub(1, std::memory_order_acq_rel) == 1)
+				push(self, Task(&graph, successor));
+		}
+
+		// the graph may be gone as soon as its last job is counted
+		graph.m_pending.fetch_sub(1, std::memory_order_acq_rel);
+	}
+
+	void workerLoop(int index)
+	{
+		currentQueueIndex() = index;
+		for (;;)
+		{
+			Task task;
+			if (takeTask(index, task))
+			{
+				execute(index, task);
+				continue;
+			}
+
+			std::unique_lock<std::mutex> lock(m_sleepMutex);
+			m_sleeping++;
+			m_wake.wait(lock, [this]() { return m_quit || m_queued.load() > 0; });
+			m_sleeping--;
+			if (m_quit)
+				return;
+		}
+	}
+
+	std::vector<std::unique_ptr<Queue>> m_queues;
+	std::vector<std::thread> m_threads;
+	/// Tasks in all queues.
+	std::atomic<int> m_queued{ 0 };
+
+	std::mutex m_sleepMutex;
+	std::condition_variable m_wake;
+	std::atomic<int> m_sleeping{ 0 };
+	bool m_quit = false;
+};
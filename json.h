@@ -0,0 +1,273 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+/// A parsed JSON document, enough to read glTF: every value is a tree node, and looking up a missing key
+/// or index returns a shared null value instead of failing, so optional fields read as
+///
+///   size_t stride = view["byteStride"].unsignedValue(elementSize);
+///
+/// Strings are kept as written apart from the common escapes; \u escapes outside ASCII become '?', which
+/// no glTF key or URI we read relies on.
+
+class JsonValue
+{
+public:
+	enum Type
+	{
+		JSON_NULL,
+		JSON_BOOLEAN,
+		JSON_NUMBER,
+		JSON_STRING,
+		JSON_ARRAY,
+		JSON_OBJECT,
+	};
+
+	JsonValue() : m_type(JSON_NULL), m_number(0.0) { }
+
+	/// Parses text, which need not be NUL-terminated. Returns false, with error set, on malformed input.
+	static bool parse(const char* text, size_t length, JsonValue& value, std::string& error)
+	{
+		const char* p = text;
+		const char* end = text + length;
+		value = JsonValue();
+		if (!parseValue(p, end, value, 0))
+		{
+			error = "malformed JSON at byte " + std::to_string(p - text);
+			return false;
+		}
+		skipSpace(p, end);
+		if (p != end)
+		{
+			error = "unexpected data after JSON at byte " + std::to_string(p - text);
+			return false;
+		}
+		return true;
+	}
+
+	Type type() const { return m_type; }
+	bool isNull() const { return m_type == JSON_NULL; }
+	bool isNumber() const { return m_type == JSON_NUMBER; }
+	bool isString() const { return m_type == JSON_STRING; }
+	bool isArray() const { return m_type == JSON_ARRAY; }
+	bool isObject() const { return m_type == JSON_OBJECT; }
+
+	double number(double fallback) const { return m_type == JSON_NUMBER ? m_number : fallback; }
+	/// A count, offset or index: the number if it is a whole number no less than zero, else fallback.
+	size_t unsignedValue(size_t fallback) const
+	{
+		return m_type == JSON_NUMBER && m_number >= 0.0 && m_number < 9007199254740992.0 && m_number == (double)(uint64_t)m_number
+			? (size_t)m_number : fallback;
+	}
+	bool boolean(bool fallback) const { return m_type == JSON_BOOLEAN ? m_number != 0.0 : fallback; }
+	const std::string& string() const { return m_string; }
+
+	/// Items of an array, or members of an object.
+	size_t size() const { return m_items.size(); }
+
+	const JsonValue& operator[](size_t index) const
+	{
+		return m_type == JSON_ARRAY && index < m_items.size() ? m_items[index] : null();
+	}
+
+	/// Literal indices; 0 would otherwise be as good a match for the key overload.
+	const JsonValue& operator[](int index) const { return (*this)[(size_t)index]; }
+
+	const JsonValue& operator[](const char* key) const
+	{
+		if (m_type == JSON_OBJECT)
+			for (size_t i = 0; i < m_keys.size(); i++)
+				if (m_keys[i] == key)
+					return m_items[i];
+		return null();
+	}
+
+	bool has(const char* key) const { return !(*this)[key].isNull(); }
+
+protected:
+	/// Deeper nesting than any real document, low enough that a hostile one cannot exhaust the stack.
+	static const int MAX_DEPTH = 128;
+
+	static const JsonValue& null()
+	{
+		static const JsonValue value;
+		return value;
+	}
+
+	static void skipSpace(const char*& p, const char* end)
+	{
+		while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r'))
+			p++;
+	}
+
+	static bool literal(const char*& p, const char* end, const char* word)
+	{
+		const size_t length = strlen(word);
+		if ((size_t)(end - p) < length || memcmp(p, word, length) != 0)
+			return false;
+		p += length;
+		return true;
+	}
+
+	static bool parseString(const char*& p, const char* end, std::string& out)
+	{
+		if (p >= end || *p != '"')
+			return false;
+		p++;
+		out.clear();
+		while (p < end && *p != '"')
+		{
+			if (*p != '\\')
+			{
+				out += *p++;
+				continue;
+			}
+			if (++p >= end)
+				return false;
+			switch (*p++)
+			{
+			case '"': out += '"'; break;
+			case '\\': out += '\\'; break;
+			case '/': out += '/'; break;
+			case 'b': out += '\b'; break;
+			case 'f': out += '\f'; break;
+			case 'n': out += '\n'; break;
+			case 'r': out += '\r'; break;
+			case 't': out += '\t'; break;
+			case 'u':
+			{
+				if (end - p < 4)
+					return false;
+				char digits[5] = { p[0], p[1], p[2], p[3], 0 };
+				const long code = strtol(digits, NULL, 16);
+				out += code < 0x80 ? (char)code : '?';
+				p += 4;
+				break;
+			}
+			default:
+				return false;
+			}
+		}
+		if (p >= end)
+			return false;
+		p++;
+		return true;
+	}
+
+	static bool parseValue(const char*& p, const char* end, JsonValue& value, int depth)
+	{
+		skipSpace(p, end);
+		if (p >= end || depth > MAX_DEPTH)
+			return false;
+
+		switch (*p)
+		{
+		case '{':
+		{
+			value.m_type = JSON_OBJECT;
+			p++;
+			skipSpace(p, end);
+			if (p < end && *p == '}')
+			{
+				p++;
+				return true;
+			}
+			for (;;)
+			{
+				std::string key;
+				skipSpace(p, end);
+				if (!parseString(p, end, key))
+					return false;
+				skipSpace(p, end);
+				if (p >= end || *p++ != ':')
+					return false;
+				value.m_keys.push_back(key);
+				value.m_items.push_back(JsonValue());
+				if (!parseValue(p, end, value.m_items.back(), depth + 1))
+					return false;
+				skipSpace(p, end);
+				if (p < end && *p == ',')
+				{
+					p++;
+					continue;
+				}
+				if (p < end && *p == '}')
+				{
+					p++;
+					return true;
+				}
+				return false;
+			}
+		}
+		case '[':
+		{
+			value.m_type = JSON_ARRAY;
+			p++;
+			skipSpace(p, end);
+			if (p < end && *p == ']')
+			{
+				p++;
+				return true;
+			}
+			for (;;)
+			{
+				value.m_items.push_back(JsonValue());
+				if (!parseValue(p, end, value.m_items.back(), depth + 1))
+					return false;
+				skipSpace(p, end);
+				if (p < end && *p == ',')
+				{
+					p++;
+					continue;
+				}
+				if (p < end && *p == ']')
+				{
+					p++;
+					return true;
+				}
+				return false;
+			}
+		}
+		case '"':
+			value.m_type = JSON_STRING;
+			return parseString(p, end, value.m_string);
+		case 't':
+			value.m_type = JSON_BOOLEAN;
+			value.m_number = 1.0;
+			return literal(p, end, "true");
+		case 'f':
+			value.m_type = JSON_BOOLEAN;
+			return literal(p, end, "false");
+		case 'n':
+			return literal(p, end, "null");
+		default:
+		{
+			// strtod needs a terminated string; no number in a glTF file is anywhere near this long
+			char digits[64];
+			size_t length = 0;
+			while (p + length < end && length < sizeof(digits) - 1 && p[length] != '\0' && strchr("+-0123456789.eE", p[length]) != NULL)
+				length++;
+			memcpy(digits, p, length);
+			digits[length] = '\0';
+			char* parsed = NULL;
+			value.m_type = JSON_NUMBER;
+			value.m_number = strtod(digits, &parsed);
+			if (length == 0 || parsed != digits + length)
+				return false;
+			p += length;
+			return true;
+		}
+		}
+	}
+
+	Type m_type;
+	double m_number;
+	std::string m_string;
+	/// Array items, or object members in the order of m_keys.
+	std::vector<JsonValue> m_items;
+	std::vector<std::string> m_keys;
+};
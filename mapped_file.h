@@ -0,0 +1,147 @@
+#pragma once
+
+#include <string>
+#include <cstddef>
+#include <cstdint>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+/// Size and modification time of the file a cache was built from. Caches record their source's stamp and
+/// are built again whenever it no longer matches, rather than whenever they are older than the source: a
+/// source saved again within a second of its last import has a different stamp, but may well not look
+/// newer to a clock counting seconds. Plain data, as the caches' headers embed it.
+struct FileStamp
+{
+	uint64_t size;
+	/// Nanoseconds since the epoch, or 100 ns intervals since 1601 on Windows; 0 if there is no file.
+	int64_t modified;
+
+	bool exists() const { return modified != 0; }
+	bool operator==(const FileStamp& other) const { return size == other.size && modified == other.modified; }
+	bool operator!=(const FileStamp& other) const { return !(*this == other); }
+};
+
+/// A whole file mapped read-only into memory. Pages are read from disk as they are first touched, so
+/// opening a large file costs next to nothing until its contents are used.
+
+class MappedFile
+{
+public:
+	MappedFile() { }
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+	~MappedFile() { close(); }
+
+	/// Returns false, leaving the object closed, if the file cannot be opened or is empty.
+	bool open(const std::string& path)
+	{
+		close();
+#ifdef _WIN32
+		m_file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+		if (m_file == INVALID_HANDLE_VALUE)
+			return false;
+
+		LARGE_INTEGER size;
+		if (!GetFileSizeEx(m_file, &size) || size.QuadPart == 0)
+		{
+			close();
+			return false;
+		}
+		m_size = (size_t)size.QuadPart;
+
+		m_mapping = CreateFileMappingA(m_file, NULL, PAGE_READONLY, 0, 0, NULL);
+		m_data = m_mapping == NULL ? NULL : (const unsigned char*)MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0);
+#else
+		m_fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+		if (m_fd < 0)
+			return false;
+
+		struct stat info;
+		if (fstat(m_fd, &info) != 0 || info.st_size == 0)
+		{
+			close();
+			return false;
+		}
+		m_size = (size_t)info.st_size;
+
+		void* data = mmap(NULL, m_size, PROT_READ, MAP_PRIVATE, m_fd, 0);
+		m_data = data == MAP_FAILED ? NULL : (const unsigned char*)data;
+#endif
+		if (m_data == NULL)
+		{
+			close();
+			return false;
+		}
+		return true;
+	}
+
+	void close()
+	{
+#ifdef _WIN32
+		if (m_data != NULL)
+			UnmapViewOfFile(m_data);
+		if (m_mapping != NULL)
+			CloseHandle(m_mapping);
+		if (m_file != INVALID_HANDLE_VALUE)
+			CloseHandle(m_file);
+		m_mapping = NULL;
+		m_file = INVALID_HANDLE_VALUE;
+#else
+		if (m_data != NULL)
+			munmap((void*)m_data, m_size);
+		if (m_fd >= 0)
+			::close(m_fd);
+		m_fd = -1;
+#endif
+		m_data = NULL;
+		m_size = 0;
+	}
+
+	const unsigned char* data() const { return m_data; }
+	size_t size() const { return m_size; }
+
+	/// The file's size and modification time, as finely as the file system keeps it.
+	static FileStamp stamp(const std::string& path)
+	{
+		FileStamp stamp = { 0, 0 };
+#ifdef _WIN32
+		WIN32_FILE_ATTRIBUTE_DATA info;
+		if (!GetFileAttributesExA(path.c_str(), GetFileExInfoStandard, &info))
+			return stamp;
+		stamp.size = ((uint64_t)info.nFileSizeHigh << 32) | info.nFileSizeLow;
+		stamp.modified = (int64_t)(((uint64_t)info.ftLastWriteTime.dwHighDateTime << 32) | info.ftLastWriteTime.dwLowDateTime);
+#else
+		struct stat info;
+		if (stat(path.c_str(), &info) != 0)
+			return stamp;
+		stamp.size = (uint64_t)info.st_size;
+		stamp.modified = (int64_t)info.st_mtim.tv_sec * 1000000000 + info.st_mtim.tv_nsec;
+#endif
+		return stamp;
+	}
+
+private:
+	const unsigned char* m_data = NULL;
+	size_t m_size = 0;
+#ifdef _WIN32
+	HANDLE m_file = INVALID_HANDLE_VALUE;
+	HANDLE m_mapping = NULL;
+#else
+	int m_fd = -1;
+#endif
+};
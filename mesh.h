@@ -0,0 +1,85 @@
+#pragma once
+
+#include <glad/glad.h>
+#include "bounds.h"
+#include "gl_handle.h"
+
+#include <utility>
+
+/// GPU geometry of one mesh, described as plain data so every pass draws every kind of mesh the same way.
+/// The model classes (Cube, Plane, Pyramid, Torus, ImportedModel) own the buffers, in MeshBuffers, and hand
+/// out a Mesh describing them.
+///
+/// A mesh may have a secondary range, drawn by the lighting pass with the material's second texture unit
+/// while its main range samples the material's own; the cube uses it for its roof. Lighting draws are
+/// recorded range by range into command lists (see recordDrawRange() in Source.cpp) and replayed through
+/// drawElements(); depth-only passes draw the whole mesh in one call.
+
+/// The GL objects behind a Mesh. A model class owns them until the scene takes them over along with the
+/// mesh (see Scene::addModel()); they are deleted with whoever holds them last.
+struct MeshBuffers
+{
+	GLVertexArray vertexArray;
+	GLBuffer vertices;
+	/// Only for indexed meshes.
+	GLBuffer indices;
+};
+
+struct Mesh
+{
+	GLuint VAO = 0;
+	GLenum primitive = GL_TRIANGLES;
+	/// Vertices, or indices when indexed, of the whole mesh.
+	GLsizei count = 0;
+	/// GL_UNSIGNED_INT indices are bound to the VAO.
+	bool indexed = false;
+	/// Index that restarts the strip, or -1 for none.
+	GLint restartIndex = -1;
+	/// The secondary range runs from secondaryFirst to count; equal to count when there is none.
+	GLsizei secondaryFirst = 0;
+	/// Bounds in model space.
+	AABB bounds;
+	/// Texture repeats per model-space unit of the surface, on average; tells the texture streamer how
+	/// fine a mip level the mesh shows at a given size on screen.
+	float texCoordDensity = 1.0f;
+
+	bool hasSecondary() const { return secondaryFirst < count; }
+
+	void bind() const
+	{
+		glBindVertexArray(VAO);
+	}
+
+	/// Draws the whole mesh in one call; used by depth-only passes. The VAO must be bound.
+	void drawDepth(int instances) const
+	{
+		drawRange(0, count, instances);
+	}
+
+	/// Draws a range of any mesh's elements; the VAO must be bound. Also used to replay recorded draws.
+	static void drawElements(GLenum primitive, bool indexed, GLint restartIndex, GLsizei first, GLsizei elements, int instances)
+	{
+		if (elements <= 0)
+			return;
+
+		if (restartIndex >= 0)
+		{
+			glEnable(GL_PRIMITIVE_RESTART);
+			glPrimitiveRestartIndex((GLuint)restartIndex);
+		}
+
+		if (indexed)
+			glDrawElementsInstanced(primitive, elements, GL_UNSIGNED_INT, (void*)(first * sizeof(GLuint)), instances);
+		else
+			glDrawArraysInstanced(primitive, first, elements, instances);
+
+		if (restartIndex >= 0)
+			glDisable(GL_PRIMITIVE_RESTART);
+	}
+
+protected:
+	void drawRange(GLsizei first, GLsizei elements, int instances) const
+	{
+		drawElements(primitive, indexed, restartIndex, first, elements, instances);
+	}
+};
@@ -0,0 +1,912 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+#include "bounds.h"
+#include "json.h"
+#include "mapped_file.h"
+#include "mesh_optimizer.h"
+#include "vertex_format.h"
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+/// Imports models from Wavefront OBJ and glTF 2.0 files into optimised mesh caches.
+///
+/// Importing reads every triangle of the model, packs its vertices (see vertex_format.h), merges the
+/// vertices that pack alike, drops the triangles that collapsed, and runs the reorderings in
+/// mesh_optimizer.h. The result is written next to the model as *.meshbin:
+///
+///   Header, then the packed vertices followed by their VertexQuantization, then the indices,
+///   each aligned to 16 bytes.
+///
+/// so loading is one map and two buffer uploads straight from the mapped pages. open() re-imports the
+/// model whenever its cache is missing, from another version of the format, or stamped with another size
+/// or modification time of the model than it has now (see FileStamp).
+///
+/// From OBJ: v, vt, vn and f records; polygons are split into fans, and corners without a normal get the
+/// area-weighted average of the faces around their position. From glTF (.gltf with external or data: URI
+/// buffers, or .glb): the triangle primitives of the default scene's nodes, with their transforms applied
+/// and flat normals where a primitive has none. Materials are the scene file's business and are ignored.
+///
+/// Texture coordinates follow glTF and the images as loaded: v grows downwards. OBJ's are flipped.
+
+class MeshImport
+{
+public:
+	/// Offsets are in bytes from the start of the file.
+	struct Header
+	{
+		char magic[8];
+		uint32_t version;
+		uint32_t vertexCount, indexCount;
+		/// See Mesh::texCoordDensity.
+		float texCoordDensity;
+		/// The model as it was when imported.
+		FileStamp source;
+		/// Model-space bounds of the vertices as the shaders unpack them.
+		float boundsMin[3], boundsMax[3];
+		/// Packed vertices followed directly by their VertexQuantization, so both upload as one buffer.
+		uint64_t vertices;
+		uint64_t indices;
+		uint64_t fileSize;
+	};
+
+	/// What an import did, for --import-mesh.
+	struct Statistics
+	{
+		size_t triangles = 0;
+		size_t sourceVertices = 0;
+		size_t vertices = 0;
+		size_t indices = 0;
+		float sourceACMR = 0.0f, cacheACMR = 0.0f, finalACMR = 0.0f;
+		double milliseconds = 0.0;
+	};
+
+	/// The cache of model.obj or model.gltf is model.meshbin.
+	static std::string cachePathFor(const std::string& sourcePath)
+	{
+		std::string::size_type dot = sourcePath.find_last_of('.');
+		std::string::size_type slash = sourcePath.find_last_of("/\\");
+		if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+			return sourcePath + ".meshbin";
+		return sourcePath.substr(0, dot) + ".meshbin";
+	}
+
+	/// Maps sourcePath's cache into file, importing the model first if needed, and returns its header, or
+	/// NULL on failure. The header and the data after it stay valid while file is open.
+	static const Header* open(const std::string& sourcePath, MappedFile& file)
+	{
+		const std::string cachePath = cachePathFor(sourcePath);
+		const FileStamp source = MappedFile::stamp(sourcePath);
+		if (source.exists() && !isCurrentCache(cachePath, source))
+		{
+			Statistics statistics;
+			if (!import(sourcePath, cachePath, &statistics))
+				return NULL;
+			std::cout << "Imported " << sourcePath << ": " << statistics.triangles << " triangles, " << statistics.vertices
+				<< " vertices in " << statistics.milliseconds << " ms" << std::endl;
+		}
+
+		if (!file.open(cachePath))
+		{
+			std::cout << "ERROR::MESH_IMPORT::CANNOT_OPEN: " << cachePath << std::endl;
+			return NULL;
+		}
+		const Header* header = (const Header*)file.data();
+		if (!validate(header, file.size()))
+		{
+			std::cout << "ERROR::MESH_IMPORT::INVALID_CACHE: " << cachePath << std::endl;
+			file.close();
+			return NULL;
+		}
+		return header;
+	}
+
+	/// Reads, optimises and caches a model. Errors are reported on stdout.
+	static bool import(const std::string& sourcePath, const std::string& cachePath, Statistics* statistics = NULL)
+	{
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		// stamped before reading, so an edit made while importing is imported again next time
+		const FileStamp source = MappedFile::stamp(sourcePath);
+
+		std::vector<Vertex> triangles;
+		std::string error;
+		const bool read = isGltf(sourcePath) ? readGltf(sourcePath, triangles, error) : readObj(sourcePath, triangles, error);
+		if (read && triangles.empty())
+			error = "no triangles";
+		if (!read || triangles.empty())
+		{
+			std::cout << "ERROR::MESH_IMPORT::" << sourcePath << ": " << error << std::endl;
+			return false;
+		}
+
+		const VertexQuantization quantization = VertexFormat::quantization(triangles.data(), triangles.size());
+		const float texCoordDensity = VertexFormat::texCoordDensity(triangles.data(), triangles.size());
+		std::vector<PackedVertex> packed(triangles.size());
+		for (size_t i = 0; i < triangles.size(); i++)
+			packed[i] = VertexFormat::pack(triangles[i], quantization);
+
+		std::vector<uint32_t> indices(packed.size());
+		const size_t unique = MeshOptimizer::deduplicate(packed.data(), packed.size(), indices.data());
+
+		// triangles whose corners merged draw nothing
+		size_t indexCount = 0;
+		for (size_t i = 0; i + 2 < indices.size(); i += 3)
+		{
+			const uint32_t a = indices[i], b = indices[i + 1], c = indices[i + 2];
+			if (a == b || b == c || c == a)
+				continue;
+			indices[indexCount++] = a;
+			indices[indexCount++] = b;
+			indices[indexCount++] = c;
+		}
+		indices.resize(indexCount);
+		if (indexCount == 0)
+		{
+			std::cout << "ERROR::MESH_IMPORT::" << sourcePath << ": every triangle is degenerate" << std::endl;
+			return false;
+		}
+
+		Statistics result;
+		result.triangles = indexCount / 3;
+		result.sourceVertices = triangles.size();
+		result.sourceACMR = MeshOptimizer::acmr(indices.data(), indexCount, unique);
+		MeshOptimizer::optimizeVertexCache(indices.data(), indexCount, unique);
+		result.cacheACMR = MeshOptimizer::acmr(indices.data(), indexCount, unique);
+		MeshOptimizer::optimizeOverdraw(indices.data(), indexCount, packed.data(), unique);
+		result.finalACMR = MeshOptimizer::acmr(indices.data(), indexCount, unique);
+
+		std::vector<PackedVertex> vertices(unique);
+		vertices.resize(MeshOptimizer::optimizeVertexFetch(vertices.data(), indices.data(), indexCount, packed.data(), unique));
+		result.vertices = vertices.size();
+		result.indices = indexCount;
+
+		AABB bounds;
+		for (size_t i = 0; i < vertices.size(); i++)
+			bounds.grow(VertexFormat::unpack(vertices[i], quantization).position);
+
+		if (!write(cachePath, source, vertices, quantization, indices, bounds, texCoordDensity))
+			return false;
+
+		result.milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		if (statistics != NULL)
+			*statistics = result;
+		return true;
+	}
+
+	/// Imports a model whether or not its cache is current and prints what each step did. Returns the
+	/// process exit code; run with --import-mesh <path>.
+	static int reimport(const std::string& sourcePath)
+	{
+		Statistics statistics;
+		if (!import(sourcePath, cachePathFor(sourcePath), &statistics))
+			return 1;
+
+		std::cout << sourcePath << " -> " << cachePathFor(sourcePath) << std::endl
+			<< "  triangles        " << statistics.triangles << std::endl
+			<< "  vertices         " << statistics.sourceVertices << " read, " << statistics.vertices << " after deduplication" << std::endl
+			<< "  ACMR (FIFO " << MeshOptimizer::FIFO_SIZE << ")   " << statistics.sourceACMR << " as read, " << statistics.cacheACMR
+			<< " after vertex cache, " << statistics.finalACMR << " after overdraw" << std::endl
+			<< "  cache bytes      " << sizeof(Header) + statistics.vertices * sizeof(PackedVertex) + sizeof(VertexQuantization)
+			+ statistics.indices * sizeof(uint32_t) << std::endl
+			<< "  time             " << statistics.milliseconds << " ms" << std::endl;
+		return 0;
+	}
+
+protected:
+	static const uint32_t VERSION = 3;
+	static const size_t ALIGNMENT = 16;
+
+	static const char* magic() { return "STADMSH"; }
+
+	static bool isGltf(const std::string& path)
+	{
+		const std::string::size_type dot = path.find_last_of('.');
+		if (dot == std::string::npos)
+			return false;
+		std::string extension = path.substr(dot + 1);
+		for (size_t i = 0; i < extension.size(); i++)
+			extension[i] = (char)tolower((unsigned char)extension[i]);
+		return extension == "gltf" || extension == "glb";
+	}
+
+	static bool isCurrentCache(const std::string& cachePath, const FileStamp& source)
+	{
+		Header header;
+		std::ifstream file(cachePath.c_str(), std::ios::binary);
+		return file.read((char*)&header, sizeof(header)) && memcmp(header.magic, magic(), 8) == 0 && header.version == VERSION
+			&& header.source == source;
+	}
+
+	static bool inFile(uint64_t offset, uint64_t bytes, size_t fileSize)
+	{
+		return offset % 4 == 0 && offset <= fileSize && bytes <= fileSize - offset;
+	}
+
+	/// Checks that both arrays lie inside the file and every index is in range.
+	static bool validate(const Header* header, size_t fileSize)
+	{
+		if (fileSize < sizeof(Header) || memcmp(header->magic, magic(), 8) != 0 || header->version != VERSION || header->fileSize != fileSize)
+			return false;
+		if (header->vertexCount == 0 || header->indexCount == 0 || header->indexCount % 3 != 0
+			|| !inFile(header->vertices, (uint64_t)header->vertexCount * sizeof(PackedVertex) + sizeof(VertexQuantization), fileSize)
+			|| !inFile(header->indices, (uint64_t)header->indexCount * sizeof(uint32_t), fileSize))
+			return false;
+
+		const uint32_t* indices = (const uint32_t*)((const unsigned char*)header + header->indices);
+		uint32_t maxIndex = 0;
+		for (uint32_t i = 0; i < header->indexCount; i++)
+			maxIndex = glm::max(maxIndex, indices[i]);
+		return maxIndex < header->vertexCount;
+	}
+
+	/// Appends bytes to the file image at the next aligned offset, returning that offset.
+	static uint64_t append(std::vector<char>& image, const void* data, size_t bytes)
+	{
+		size_t offset = (image.size() + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+		image.resize(offset + bytes);
+		if (bytes > 0)
+			memcpy(&image[offset], data, bytes);
+		return offset;
+	}
+
+	static bool write(const std::string& cachePath, const FileStamp& source, const std::vector<PackedVertex>& vertices, const VertexQuantization& quantization,
+		const std::vector<uint32_t>& indices, const AABB& bounds, float texCoordDensity)
+	{
+		std::vector<char> image(sizeof(Header));
+		Header header;
+		memset(&header, 0, sizeof(header));
+		memcpy(header.magic, magic(), 8);
+		header.version = VERSION;
+		header.vertexCount = (uint32_t)vertices.size();
+		header.indexCount = (uint32_t)indices.size();
+		header.source = source;
+		header.texCoordDensity = texCoordDensity;
+		for (int i = 0; i < 3; i++)
+		{
+			header.boundsMin[i] = bounds.min[i];
+			header.boundsMax[i] = bounds.max[i];
+		}
+		header.vertices = append(image, vertices.data(), vertices.size() * sizeof(PackedVertex));
+		// sizeof(PackedVertex) is a multiple of the alignment, so this lands right after the vertices
+		append(image, &quantization, sizeof(quantization));
+		header.indices = append(image, indices.data(), indices.size() * sizeof(uint32_t));
+		header.fileSize = image.size();
+		memcpy(&image[0], &header, sizeof(header));
+
+		// write to a temporary file and rename it, so a crash never leaves a truncated cache behind
+		std::string temporaryPath = cachePath + ".tmp";
+		{
+			std::ofstream file(temporaryPath.c_str(), std::ios::binary | std::ios::trunc);
+			if (!file.write(image.data(), image.size()))
+			{
+				std::cout << "ERROR::MESH_IMPORT::CANNOT_WRITE: " << cachePath << std::endl;
+				return false;
+			}
+		}
+		std::remove(cachePath.c_str());
+		if (std::rename(temporaryPath.c_str(), cachePath.c_str()) != 0)
+		{
+			std::cout << "ERROR::MESH_IMPORT::CANNOT_WRITE: " << cachePath << std::endl;
+			return false;
+		}
+		return true;
+	}
+
+	static bool readFile(const std::string& path, std::vector<char>& contents)
+	{
+		std::ifstream file(path.c_str(), std::ios::binary | std::ios::ate);
+		if (!file)
+			return false;
+		contents.resize((size_t)file.tellg());
+		file.seekg(0);
+		return contents.empty() || (bool)file.read(contents.data(), contents.size());
+	}
+
+	/// The face normal scaled by twice the triangle's area.
+	static glm::vec3 faceNormal(const glm::vec3& a, const glm::vec3& b, const glm::vec3& c)
+	{
+		return glm::cross(b - a, c - a);
+	}
+
+	static glm::vec3 safeNormalize(const glm::vec3& v)
+	{
+		const float length = glm::length(v);
+		return length > 0.0f ? v / length : glm::vec3(0.0f, 1.0f, 0.0f);
+	}
+
+	// ---------------------------------------------------------------------------------------------------
+	// OBJ
+
+	struct ObjCorner
+	{
+		int position, texCoord, normal;
+	};
+
+	/// Resolves a 1-based or negative, relative, OBJ index against count items; -1 if out of range.
+	static int objIndex(long index, size_t count)
+	{
+		const long resolved = index > 0 ? index - 1 : (long)count + index;
+		return index != 0 && resolved >= 0 && resolved < (long)count ? (int)resolved : -1;
+	}
+
+	/// Parses one "p", "p/t", "p//n" or "p/t/n" corner.
+	static bool readObjCorner(char*& p, size_t positions, size_t texCoords, size_t normals, ObjCorner& corner)
+	{
+		char* end = NULL;
+		corner.position = objIndex(strtol(p, &end, 10), positions);
+		if (end == p || corner.position < 0)
+			return false;
+		p = end;
+		corner.texCoord = corner.normal = -1;
+		if (*p != '/')
+			return true;
+
+		p++;
+		if (*p != '/')
+		{
+			corner.texCoord = objIndex(strtol(p, &end, 10), texCoords);
+			if (end == p || corner.texCoord < 0)
+				return false;
+			p = end;
+		}
+		if (*p != '/')
+			return true;
+
+		p++;
+		corner.normal = objIndex(strtol(p, &end, 10), normals);
+		if (end == p || corner.normal < 0)
+			return false;
+		p = end;
+		return true;
+	}
+
+	static bool readObj(const std::string& path, std::vector<Vertex>& triangles, std::string& error)
+	{
+		std::vector<char> text;
+		if (!readFile(path, text))
+		{
+			error = "cannot open";
+			return false;
+		}
+		text.push_back('\0');
+
+		std::vector<glm::vec3> positions, normals;
+		std::vector<glm::vec2> texCoords;
+		// three per triangle
+		std::vector<ObjCorner> corners;
+		std::vector<ObjCorner> face;
+
+		char* line = text.data();
+		for (int lineNumber = 1; *line != '\0'; lineNumber++)
+		{
+			char* next = line + strcspn(line, "\n");
+			if (*next != '\0')
+				*next++ = '\0';
+
+			char* p = line + strspn(line, " \t");
+			line = next;
+			if (*p == 'v' && (p[1] == ' ' || p[1] == '\t'))
+			{
+				glm::vec3 v;
+				v.x = strtof(p + 1, &p);
+				v.y = strtof(p, &p);
+				v.z = strtof(p, &p);
+				positions.push_back(v);
+			}
+			else if (*p == 'v' && p[1] == 't' && (p[2] == ' ' || p[2] == '\t'))
+			{
+				glm::vec2 t;
+				t.x = strtof(p + 2, &p);
+				t.y = 1.0f - strtof(p, &p);
+				texCoords.push_back(t);
+			}
+			else if (*p == 'v' && p[1] == 'n' && (p[2] == ' ' || p[2] == '\t'))
+			{
+				glm::vec3 n;
+				n.x = strtof(p + 2, &p);
+				n.y = strtof(p, &p);
+				n.z = strtof(p, &p);
+				normals.push_back(n);
+			}
+			else if (*p == 'f' && (p[1] == ' ' || p[1] == '\t'))
+			{
+				face.clear();
+				p++;
+				for (;;)
+				{
+					p += strspn(p, " \t\r");
+					if (*p == '\0')
+						break;
+					ObjCorner corner;
+					if (!readObjCorner(p, positions.size(), texCoords.size(), normals.size(), corner))
+					{
+						error = "bad face on line " + std::to_string(lineNumber);
+						return false;
+					}
+					face.push_back(corner);
+				}
+				for (size_t i = 2; i < face.size(); i++)
+				{
+					corners.push_back(face[0]);
+					corners.push_back(face[i - 1]);
+					corners.push_back(face[i]);
+				}
+			}
+		}
+
+		// corners without a normal share their position's, averaged over the faces around it
+		std::vector<glm::vec3> smoothNormals;
+		for (size_t i = 0; i < corners.size(); i += 3)
+		{
+			if (corners[i].normal >= 0 && corners[i + 1].normal >= 0 && corners[i + 2].normal >= 0)
+				continue;
+			if (smoothNormals.empty())
+				smoothNormals.assign(positions.size(), glm::vec3(0.0f));
+			const glm::vec3 normal = faceNormal(positions[corners[i].position], positions[corners[i + 1].position], positions[corners[i + 2].position]);
+			for (int k = 0; k < 3; k++)
+				smoothNormals[corners[i + k].position] += normal;
+		}
+
+		triangles.resize(corners.size());
+		for (size_t i = 0; i < corners.size(); i++)
+		{
+			const ObjCorner& corner = corners[i];
+			triangles[i].position = positions[corner.position];
+			triangles[i].normal = safeNormalize(corner.normal >= 0 ? normals[corner.normal] : smoothNormals[corner.position]);
+			triangles[i].texCoords = corner.texCoord >= 0 ? texCoords[corner.texCoord] : glm::vec2(0.0f);
+		}
+		return true;
+	}
+
+	// ---------------------------------------------------------------------------------------------------
+	// glTF
+
+	enum GltfComponentType
+	{
+		GLTF_BYTE = 5120,
+		GLTF_UNSIGNED_BYTE = 5121,
+		GLTF_SHORT = 5122,
+		GLTF_UNSIGNED_SHORT = 5123,
+		GLTF_UNSIGNED_INT = 5125,
+		GLTF_FLOAT = 5126,
+	};
+
+	static const int GLTF_TRIANGLES = 4;
+
+	/// The document and its buffers, loaded.
+	struct Gltf
+	{
+		JsonValue document;
+		std::vector<std::vector<char>> buffers;
+	};
+
+	static std::string decodeBase64(const char* text, size_t length)
+	{
+		std::string bytes;
+		bytes.reserve(length / 4 * 3);
+		unsigned int bits = 0;
+		int count = 0;
+		for (size_t i = 0; i < length; i++)
+		{
+			const char c = text[i];
+			int value;
+			if (c >= 'A' && c <= 'Z') value = c - 'A';
+			else if (c >= 'a' && c <= 'z') value = c - 'a' + 26;
+			else if (c >= '0' && c <= '9') value = c - '0' + 52;
+			else if (c == '+' || c == '-') value = 62;
+			else if (c == '/' || c == '_') value = 63;
+			else continue;
+			bits = (bits << 6) | (unsigned int)value;
+			count += 6;
+			if (count >= 8)
+			{
+				count -= 8;
+				bytes += (char)((bits >> count) & 0xFF);
+			}
+		}
+		return bytes;
+	}
+
+	/// URIs are relative to the model, and may escape characters such as spaces.
+	static std::string decodeUri(const std::string& uri)
+	{
+		std::string decoded;
+		for (size_t i = 0; i < uri.size(); i++)
+		{
+			if (uri[i] == '%' && i + 2 < uri.size())
+			{
+				const char digits[3] = { uri[i + 1], uri[i + 2], 0 };
+				decoded += (char)strtol(digits, NULL, 16);
+				i += 2;
+			}
+			else
+				decoded += uri[i];
+		}
+		return decoded;
+	}
+
+	static bool loadGltf(const std::string& path, Gltf& gltf, std::string& error)
+	{
+		std::vector<char> file;
+		if (!readFile(path, file))
+		{
+			error = "cannot open";
+			return false;
+		}
+
+		// a .glb is a 12-byte header, a JSON chunk and optionally a binary chunk holding buffer 0
+		const char* json = file.data();
+		size_t jsonLength = file.size();
+		const char* binary = NULL;
+		size_t binaryLength = 0;
+		if (file.size() >= 12 && memcmp(file.data(), "glTF", 4) == 0)
+		{
+			size_t offset = 12;
+			json = NULL;
+			while (offset + 8 <= file.size())
+			{
+				uint32_t chunkLength, chunkType;
+				memcpy(&chunkLength, &file[offset], 4);
+				memcpy(&chunkType, &file[offset + 4], 4);
+				offset += 8;
+				if (chunkLength > file.size() - offset)
+				{
+					error = "truncated GLB chunk";
+					return false;
+				}
+				if (chunkType == 0x4E4F534A && json == NULL)
+				{
+					json = &file[offset];
+					jsonLength = chunkLength;
+				}
+				else if (chunkType == 0x004E4942 && binary == NULL)
+				{
+					binary = &file[offset];
+					binaryLength = chunkLength;
+				}
+				offset += (chunkLength + 3) & ~3u;
+			}
+			if (json == NULL)
+			{
+				error = "GLB without a JSON chunk";
+				return false;
+			}
+		}
+
+		if (!JsonValue::parse(json, jsonLength, gltf.document, error))
+			return false;
+
+		const std::string::size_type slash = path.find_last_of("/\\");
+		const std::string directory = slash == std::string::npos ? "" : path.substr(0, slash + 1);
+		const JsonValue& buffers = gltf.document["buffers"];
+		gltf.buffers.resize(buffers.size());
+		for (size_t i = 0; i < buffers.size(); i++)
+		{
+			const JsonValue& buffer = buffers[i];
+			const std::string& uri = buffer["uri"].string();
+			std::vector<char>& contents = gltf.buffers[i];
+			if (!buffer.has("uri"))
+			{
+				if (i != 0 || binary == NULL)
+				{
+					error = "buffer " + std::to_string(i) + " has no data";
+					return false;
+				}
+				contents.assign(binary, binary + binaryLength);
+			}
+			else if (uri.compare(0, 5, "data:") == 0)
+			{
+				const std::string::size_type comma = uri.find(',');
+				if (comma == std::string::npos || uri.rfind(";base64", comma) == std::string::npos)
+				{
+					error = "buffer " + std::to_string(i) + " is not base64";
+					return false;
+				}
+				const std::string bytes = decodeBase64(uri.c_str() + comma + 1, uri.size() - comma - 1);
+				contents.assign(bytes.begin(), bytes.end());
+			}
+			else if (!readFile(directory + decodeUri(uri), contents))
+			{
+				error = "cannot open buffer " + uri;
+				return false;
+			}
+
+			if (contents.size() < buffer["byteLength"].unsignedValue(0))
+			{
+				error = "buffer " + std::to_string(i) + " is shorter than its byteLength";
+				return false;
+			}
+		}
+		return true;
+	}
+
+	static int componentCount(const std::string& type)
+	{
+		if (type == "SCALAR") return 1;
+		if (type == "VEC2") return 2;
+		if (type == "VEC3") return 3;
+		if (type == "VEC4") return 4;
+		return 0;
+	}
+
+	static size_t componentSize(int componentType)
+	{
+		switch (componentType)
+		{
+		case GLTF_BYTE: case GLTF_UNSIGNED_BYTE: return 1;
+		case GLTF_SHORT: case GLTF_UNSIGNED_SHORT: return 2;
+		case GLTF_UNSIGNED_INT: case GLTF_FLOAT: return 4;
+		default: return 0;
+		}
+	}
+
+	/// Reads one component as a float; integer components are normalised if the accessor says so.
+	static float readComponent(const char* p, int componentType, bool normalized)
+	{
+		switch (componentType)
+		{
+		case GLTF_BYTE: { int8_t v; memcpy(&v, p, 1); return normalized ? glm::max(v / 127.0f, -1.0f) : (float)v; }
+		case GLTF_UNSIGNED_BYTE: { uint8_t v; memcpy(&v, p, 1); return normalized ? v / 255.0f : (float)v; }
+		case GLTF_SHORT: { int16_t v; memcpy(&v, p, 2); return normalized ? glm::max(v / 32767.0f, -1.0f) : (float)v; }
+		case GLTF_UNSIGNED_SHORT: { uint16_t v; memcpy(&v, p, 2); return normalized ? v / 65535.0f : (float)v; }
+		case GLTF_UNSIGNED_INT: { uint32_t v; memcpy(&v, p, 4); return (float)v; }
+		default: { float v; memcpy(&v, p, 4); return v; }
+		}
+	}
+
+	/// Finds accessor index's elements. Checks that it has components components and lies in its buffer.
+	static bool locateAccessor(const Gltf& gltf, size_t index, int components, const JsonValue*& accessor,
+		const char*& data, size_t& stride, std::string& error)
+	{
+		accessor = &gltf.document["accessors"][index];
+		const JsonValue& a = *accessor;
+		const int componentType = (int)a["componentType"].number(0);
+		const size_t count = a["count"].unsignedValue(0);
+		const size_t elementSize = componentSize(componentType) * components;
+		if (!a.isObject() || componentCount(a["type"].string()) != components || elementSize == 0)
+		{
+			error = "accessor " + std::to_string(index) + " has the wrong type";
+			return false;
+		}
+		if (a.has("sparse"))
+		{
+			error = "sparse accessors are not supported";
+			return false;
+		}
+
+		// an accessor without a view is all zeros
+		data = NULL;
+		stride = 0;
+		if (!a.has("bufferView"))
+			return true;
+
+		const JsonValue& view = gltf.document["bufferViews"][a["bufferView"].unsignedValue(SIZE_MAX)];
+		const size_t buffer = view["buffer"].unsignedValue(SIZE_MAX);
+		const size_t viewOffset = view["byteOffset"].unsignedValue(0), viewLength = view["byteLength"].unsignedValue(0);
+		const size_t offset = a["byteOffset"].unsignedValue(0);
+		stride = view["byteStride"].unsignedValue(elementSize);
+		if (!view.isObject() || buffer >= gltf.buffers.size() || viewOffset > gltf.buffers[buffer].size()
+			|| viewLength > gltf.buffers[buffer].size() - viewOffset
+			|| (count > 0 && (offset > viewLength || (count - 1) * stride + elementSize > viewLength - offset)))
+		{
+			error = "accessor " + std::to_string(index) + " lies outside its buffer";
+			return false;
+		}
+		data = gltf.buffers[buffer].data() + viewOffset + offset;
+		return true;
+	}
+
+	/// Reads an accessor of floats, or normalised integers, into components floats per element.
+	static bool readAccessor(const Gltf& gltf, size_t index, int components, std::vector<float>& values, std::string& error)
+	{
+		const JsonValue* accessor;
+		const char* data;
+		size_t stride;
+		if (!locateAccessor(gltf, index, components, accessor, data, stride, error))
+			return false;
+
+		const int componentType = (int)(*accessor)["componentType"].number(0);
+		const bool normalized = (*accessor)["normalized"].boolean(false);
+		const size_t count = (*accessor)["count"].unsignedValue(0);
+		const size_t size = componentSize(componentType);
+		values.assign(count * components, 0.0f);
+		if (data != NULL)
+			for (size_t i = 0; i < count; i++)
+				for (int c = 0; c < components; c++)
+					values[i * components + c] = readComponent(data + i * stride + c * size, componentType, normalized);
+		return true;
+	}
+
+	static bool readIndices(const Gltf& gltf, size_t index, std::vector<uint32_t>& indices, std::string& error)
+	{
+		const JsonValue* accessor;
+		const char* data;
+		size_t stride;
+		if (!locateAccessor(gltf, index, 1, accessor, data, stride, error))
+			return false;
+
+		const int componentType = (int)(*accessor)["componentType"].number(0);
+		const size_t count = (*accessor)["count"].unsignedValue(0);
+		if (componentType != GLTF_UNSIGNED_BYTE && componentType != GLTF_UNSIGNED_SHORT && componentType != GLTF_UNSIGNED_INT)
+		{
+			error = "indices must be unsigned integers";
+			return false;
+		}
+		indices.assign(count, 0);
+		if (data != NULL)
+		{
+			for (size_t i = 0; i < count; i++)
+			{
+				const char* p = data + i * stride;
+				if (componentType == GLTF_UNSIGNED_BYTE)
+					indices[i] = (uint8_t)*p;
+				else if (componentType == GLTF_UNSIGNED_SHORT)
+				{
+					uint16_t v;
+					memcpy(&v, p, 2);
+					indices[i] = v;
+				}
+				else
+					memcpy(&indices[i], p, 4);
+			}
+		}
+		return true;
+	}
+
+	static glm::mat4 nodeTransform(const JsonValue& node)
+	{
+		glm::mat4 matrix(1.0f);
+		const JsonValue& m = node["matrix"];
+		if (m.size() == 16)
+		{
+			// column-major, as glm stores it
+			for (int c = 0; c < 4; c++)
+				for (int r = 0; r < 4; r++)
+					matrix[c][r] = (float)m[c * 4 + r].number(c == r ? 1.0 : 0.0);
+			return matrix;
+		}
+
+		const JsonValue& t = node["translation"];
+		const JsonValue& r = node["rotation"];
+		const JsonValue& s = node["scale"];
+		const glm::vec3 translation((float)t[0].number(0), (float)t[1].number(0), (float)t[2].number(0));
+		const glm::quat rotation((float)r[3].number(1), (float)r[0].number(0), (float)r[1].number(0), (float)r[2].number(0));
+		const glm::vec3 scale((float)s[0].number(1), (float)s[1].number(1), (float)s[2].number(1));
+		matrix[3] = glm::vec4(translation, 1.0f);
+		return matrix * glm::mat4_cast(rotation) * glm::mat4(glm::mat3(scale.x, 0, 0, 0, scale.y, 0, 0, 0, scale.z));
+	}
+
+	/// Appends the triangles of mesh index, transformed by transform, to triangles.
+	static bool appendGltfMesh(const Gltf& gltf, size_t index, const glm::mat4& transform, std::vector<Vertex>& triangles, std::string& error)
+	{
+		const JsonValue& primitives = gltf.document["meshes"][index]["primitives"];
+		const glm::mat3 normalMatrix = glm::transpose(glm::inverse(glm::mat3(transform)));
+		// a mirroring transform turns front faces into back faces
+		const bool mirrored = glm::determinant(glm::mat3(transform)) < 0.0f;
+
+		for (size_t p = 0; p < primitives.size(); p++)
+		{
+			const JsonValue& primitive = primitives[p];
+			const JsonValue& attributes = primitive["attributes"];
+			if ((int)primitive["mode"].number(GLTF_TRIANGLES) != GLTF_TRIANGLES)
+			{
+				std::cout << "WARNING::MESH_IMPORT: skipping a primitive of mesh " << index << " that is not a triangle list" << std::endl;
+				continue;
+			}
+			if (!attributes.has("POSITION"))
+			{
+				error = "a primitive of mesh " + std::to_string(index) + " has no positions";
+				return false;
+			}
+
+			std::vector<float> positions, normals, texCoords;
+			if (!readAccessor(gltf, attributes["POSITION"].unsignedValue(SIZE_MAX), 3, positions, error)
+				|| (attributes.has("NORMAL") && !readAccessor(gltf, attributes["NORMAL"].unsignedValue(SIZE_MAX), 3, normals, error))
+				|| (attributes.has("TEXCOORD_0") && !readAccessor(gltf, attributes["TEXCOORD_0"].unsignedValue(SIZE_MAX), 2, texCoords, error)))
+				return false;
+			const size_t vertexCount = positions.size() / 3;
+			if ((!normals.empty() && normals.size() / 3 != vertexCount) || (!texCoords.empty() && texCoords.size() / 2 != vertexCount))
+			{
+				error = "attributes of a primitive of mesh " + std::to_string(index) + " differ in length";
+				return false;
+			}
+
+			std::vector<uint32_t> indices;
+			if (primitive.has("indices"))
+			{
+				if (!readIndices(gltf, primitive["indices"].unsignedValue(SIZE_MAX), indices, error))
+					return false;
+			}
+			else
+			{
+				indices.resize(vertexCount);
+				for (size_t i = 0; i < vertexCount; i++)
+					indices[i] = (uint32_t)i;
+			}
+
+			for (size_t i = 0; i + 2 < indices.size(); i += 3)
+			{
+				Vertex corners[3];
+				for (int k = 0; k < 3; k++)
+				{
+					const uint32_t v = indices[i + (mirrored ? 2 - k : k)];
+					if (v >= vertexCount)
+					{
+						error = "an index of mesh " + std::to_string(index) + " is out of range";
+						return false;
+					}
+					corners[k].position = glm::vec3(transform * glm::vec4(positions[v * 3], positions[v * 3 + 1], positions[v * 3 + 2], 1.0f));
+					corners[k].normal = normals.empty() ? glm::vec3(0.0f) : safeNormalize(normalMatrix * glm::vec3(normals[v * 3], normals[v * 3 + 1], normals[v * 3 + 2]));
+					corners[k].texCoords = texCoords.empty() ? glm::vec2(0.0f) : glm::vec2(texCoords[v * 2], texCoords[v * 2 + 1]);
+				}
+				// without normals a primitive is flat shaded
+				if (normals.empty())
+					corners[0].normal = corners[1].normal = corners[2].normal = safeNormalize(faceNormal(corners[0].position, corners[1].position, corners[2].position));
+				triangles.insert(triangles.end(), corners, corners + 3);
+			}
+		}
+		return true;
+	}
+
+	static bool readGltf(const std::string& path, std::vector<Vertex>& triangles, std::string& error)
+	{
+		Gltf gltf;
+		if (!loadGltf(path, gltf, error))
+			return false;
+
+		const JsonValue& document = gltf.document;
+		const JsonValue& nodes = document["nodes"];
+		const JsonValue& scene = document["scenes"][document["scene"].unsignedValue(0)];
+
+		// without a scene, every mesh is drawn once where it stands
+		if (!scene.isObject())
+		{
+			for (size_t i = 0; i < document["meshes"].size(); i++)
+				if (!appendGltfMesh(gltf, i, glm::mat4(1.0f), triangles, error))
+					return false;
+			return true;
+		}
+
+		// walk the node hierarchy; a node count of steps is enough for any tree and stops a cyclic one
+		struct Visit
+		{
+			size_t node;
+			glm::mat4 parent;
+		};
+		std::vector<Visit> stack;
+		for (size_t i = 0; i < scene["nodes"].size(); i++)
+			stack.push_back(Visit{ scene["nodes"][i].unsignedValue(SIZE_MAX), glm::mat4(1.0f) });
+		for (size_t steps = 0; !stack.empty(); steps++)
+		{
+			if (steps > nodes.size())
+			{
+				error = "the node hierarchy has a cycle";
+				return false;
+			}
+			const Visit visit = stack.back();
+			stack.pop_back();
+			const JsonValue& node = nodes[visit.node];
+			if (!node.isObject())
+			{
+				error = "node " + std::to_string(visit.node) + " does not exist";
+				return false;
+			}
+
+			const glm::mat4 transform = visit.parent * nodeTransform(node);
+			if (node.has("mesh") && !appendGltfMesh(gltf, node["mesh"].unsignedValue(SIZE_MAX), transform, triangles, error))
+				return false;
+			for (size_t i = 0; i < node["children"].size(); i++)
+				stack.push_back(Visit{ node["children"][i].unsignedValue(SIZE_MAX), transform });
+		}
+		return true;
+	}
+};
@@ -0,0 +1,322 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include "vertex_format.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+/// Reorders indexed triangle lists for the GPU, in the order the importer runs them:
+///
+/// - deduplicate(): one vertex for every distinct packed vertex, so the index buffer can reuse it.
+/// - optimizeVertexCache(): triangles in an order that reuses recently transformed vertices (Forsyth's
+///   linear-speed algorithm, modelled on a 32-entry LRU cache).
+/// - optimizeOverdraw(): clusters of that order sorted so surfaces facing outwards are drawn first and
+///   hide what is behind them, giving up no more than a set fraction of the cache efficiency (Sander,
+///   Nehab and Barczak, "Fast Triangle Reordering for Vertex Locality and Reduced Overdraw").
+/// - optimizeVertexFetch(): vertices renumbered in the order the triangles first use them, so fetching
+///   them walks the vertex buffer forwards.
+///
+/// Indices are GL_UNSIGNED_INT triangle lists throughout.
+
+namespace MeshOptimizer
+{
+	/// Entries in the cache the reordering models. Larger than any real post-transform cache, which the
+	/// algorithm tolerates far better than a model that is too small.
+	const int CACHE_SIZE = 32;
+	/// Entries in the FIFO cache acmr() simulates, typical of current hardware.
+	const unsigned int FIFO_SIZE = 16;
+
+	/// Average cache miss ratio: vertices transformed per triangle through a FIFO cache of cacheSize
+	/// entries. 3 is no reuse at all; 0.5 is the limit for a large regular grid.
+	inline float acmr(const uint32_t* indices, size_t indexCount, size_t vertexCount, unsigned int cacheSize = FIFO_SIZE)
+	{
+		if (indexCount < 3)
+			return 0.0f;
+
+		// a vertex is in the cache if fewer than cacheSize vertices were loaded since it was
+		std::vector<unsigned int> loadedAt(vertexCount, 0);
+		unsigned int time = cacheSize + 1;
+		size_t misses = 0;
+		for (size_t i = 0; i < indexCount; i++)
+		{
+			if (time - loadedAt[indices[i]] > cacheSize)
+			{
+				loadedAt[indices[i]] = time++;
+				misses++;
+			}
+		}
+		return (float)misses / (float)(indexCount / 3);
+	}
+
+	/// Collapses vertices that pack to the same bytes. The unique vertices are moved to the front of
+	/// vertices, in order of first appearance, and indices receives one entry per input vertex. Returns the
+	/// number of unique vertices.
+	inline size_t deduplicate(PackedVertex* vertices, size_t count, uint32_t* indices)
+	{
+		static_assert(sizeof(PackedVertex) == 16, "hashed as two 64-bit words");
+
+		size_t tableSize = 16;
+		while (tableSize < count * 2)
+			tableSize *= 2;
+		std::vector<uint32_t> table(tableSize, ~0u);
+
+		size_t unique = 0;
+		for (size_t i = 0; i < count; i++)
+		{
+			uint64_t words[2];
+			memcpy(words, &vertices[i], sizeof(words));
+			uint64_t hash = (words[0] ^ (words[1] * 0x9E3779B97F4A7C15ull)) * 0xFF51AFD7ED558CCDull;
+			hash ^= hash >> 32;
+
+			// linear probing; the table is at most half full
+			size_t slot = (size_t)hash & (tableSize - 1);
+			while (table[slot] != ~0u && memcmp(&vertices[table[slot]], &vertices[i], sizeof(PackedVertex)) != 0)
+				slot = (slot + 1) & (tableSize - 1);
+
+			if (table[slot] == ~0u)
+			{
+				table[slot] = (uint32_t)unique;
+				vertices[unique++] = vertices[i];
+			}
+			indices[i] = table[slot];
+		}
+		return unique;
+	}
+
+	/// Forsyth's vertex score: high for vertices near the front of the cache, and for vertices with few
+	/// triangles left, so lone triangles are not stranded.
+	inline float vertexScore(int cachePosition, unsigned int remainingTriangles)
+	{
+		if (remainingTriangles == 0)
+			return -1.0f;
+
+		float score = 0.0f;
+		if (cachePosition >= 0)
+		{
+			// the triangle just drawn is scored the same whatever order it put its vertices in
+			if (cachePosition < 3)
+				score = 0.75f;
+			else
+				score = powf(1.0f - (float)(cachePosition - 3) / (float)(CACHE_SIZE - 3), 1.5f);
+		}
+		return score + 2.0f * powf((float)remainingTriangles, -0.5f);
+	}
+
+	/// Reorders the triangles of indices in place for vertex reuse.
+	inline void optimizeVertexCache(uint32_t* indices, size_t indexCount, size_t vertexCount)
+	{
+		const size_t triangleCount = indexCount / 3;
+		if (triangleCount == 0)
+			return;
+
+		// the triangles using each vertex, as one array sliced by offsets; the first remaining[v] of each
+		// slice are those not yet drawn
+		std::vector<unsigned int> remaining(vertexCount, 0), offsets(vertexCount + 1, 0);
+		for (size_t i = 0; i < indexCount; i++)
+			remaining[indices[i]]++;
+		for (size_t v = 0; v < vertexCount; v++)
+			offsets[v + 1] = offsets[v] + remaining[v];
+		std::vector<uint32_t> adjacency(indexCount);
+		std::vector<unsigned int> filled(offsets.begin(), offsets.end() - 1);
+		for (size_t i = 0; i < indexCount; i++)
+			adjacency[filled[indices[i]]++] = (uint32_t)(i / 3);
+
+		std::vector<float> vertexScores(vertexCount);
+		for (size_t v = 0; v < vertexCount; v++)
+			vertexScores[v] = vertexScore(-1, remaining[v]);
+
+		std::vector<uint32_t> output(indexCount);
+		std::vector<bool> emitted(triangleCount, false);
+		// three spare entries for the vertices of the triangle being added
+		uint32_t cache[CACHE_SIZE + 3], nextCache[CACHE_SIZE + 3];
+		int cacheSize = 0;
+		size_t nextUnemitted = 0;
+		int best = 0;
+
+		for (size_t drawn = 0; drawn < triangleCount; drawn++)
+		{
+			// when nothing in the cache has triangles left, take the first triangle not yet drawn
+			if (best < 0)
+			{
+				while (emitted[nextUnemitted])
+					nextUnemitted++;
+				best = (int)nextUnemitted;
+			}
+
+			const uint32_t* triangle = indices + best * 3;
+			memcpy(&output[drawn * 3], triangle, 3 * sizeof(uint32_t));
+			emitted[best] = true;
+
+			// take the triangle off its vertices' lists of remaining triangles
+			for (int k = 0; k < 3; k++)
+			{
+				const uint32_t v = triangle[k];
+				uint32_t* list = &adjacency[offsets[v]];
+				for (unsigned int j = 0; j < remaining[v]; j++)
+				{
+					if (list[j] == (uint32_t)best)
+					{
+						list[j] = list[--remaining[v]];
+						break;
+					}
+				}
+			}
+
+			// the triangle's vertices move to the front of the cache, the rest shift back
+			int nextSize = 0;
+			for (int k = 0; k < 3; k++)
+				nextCache[nextSize++] = triangle[k];
+			for (int j = 0; j < cacheSize; j++)
+			{
+				const uint32_t v = cache[j];
+				if (v != triangle[0] && v != triangle[1] && v != triangle[2])
+					nextCache[nextSize++] = v;
+			}
+
+			// vertices pushed out of the cache lose their cache score
+			for (int j = CACHE_SIZE; j < nextSize; j++)
+				vertexScores[nextCache[j]] = vertexScore(-1, remaining[nextCache[j]]);
+			cacheSize = std::min(nextSize, CACHE_SIZE);
+			memcpy(cache, nextCache, cacheSize * sizeof(uint32_t));
+			for (int j = 0; j < cacheSize; j++)
+				vertexScores[cache[j]] = vertexScore(j, remaining[cache[j]]);
+
+			// only triangles touching the cache changed score; the best of them is drawn next
+			best = -1;
+			float bestScore = -1.0f;
+			for (int j = 0; j < cacheSize; j++)
+			{
+				const uint32_t v = cache[j];
+				const uint32_t* list = &adjacency[offsets[v]];
+				for (unsigned int n = 0; n < remaining[v]; n++)
+				{
+					const uint32_t t = list[n];
+					const float score = vertexScores[indices[t * 3]] + vertexScores[indices[t * 3 + 1]] + vertexScores[indices[t * 3 + 2]];
+					if (score > bestScore)
+					{
+						bestScore = score;
+						best = (int)t;
+					}
+				}
+			}
+		}
+
+		memcpy(indices, output.data(), indexCount * sizeof(uint32_t));
+	}
+
+	/// Sorts clusters of the cache-optimised order so the triangles facing away from the mesh's centre,
+	/// which tend to cover the others, are drawn first. A cluster ends once its own cache miss ratio,
+	/// counted from an empty cache, is within threshold times that of the whole mesh, so the reordering
+	/// costs at most that much vertex reuse.
+	///
+	/// Only the vertices' grid positions are read: the quantization is a uniform scale and an offset,
+	/// which changes no direction the sort depends on.
+	inline void optimizeOverdraw(uint32_t* indices, size_t indexCount, const PackedVertex* vertices, size_t vertexCount, float threshold = 1.05f)
+	{
+		const size_t triangleCount = indexCount / 3;
+		if (triangleCount < 2)
+			return;
+
+		const float target = acmr(indices, indexCount, vertexCount) * threshold;
+
+		std::vector<size_t> clusterStarts;
+		std::vector<unsigned int> loadedAt(vertexCount, 0);
+		unsigned int time = FIFO_SIZE + 1;
+		size_t start = 0, misses = 0;
+		for (size_t t = 0; t < triangleCount; t++)
+		{
+			if (t == start)
+			{
+				// an empty cache for every cluster, as if it were drawn on its own
+				clusterStarts.push_back(start);
+				time += FIFO_SIZE + 1;
+				misses = 0;
+			}
+			for (int k = 0; k < 3; k++)
+			{
+				const uint32_t v = indices[t * 3 + k];
+				if (time - loadedAt[v] > FIFO_SIZE)
+				{
+					loadedAt[v] = time++;
+					misses++;
+				}
+			}
+			if ((float)misses / (float)(t + 1 - start) <= target)
+				start = t + 1;
+		}
+		const size_t clusterCount = clusterStarts.size();
+		clusterStarts.push_back(triangleCount);
+
+		// area-weighted centroids and normals; a triangle's cross product is twice its area along its normal
+		std::vector<glm::vec3> centroids(clusterCount, glm::vec3(0.0f)), normals(clusterCount, glm::vec3(0.0f));
+		std::vector<float> areas(clusterCount, 0.0f);
+		glm::vec3 meshCentroid(0.0f);
+		float meshArea = 0.0f;
+		for (size_t c = 0; c < clusterCount; c++)
+		{
+			for (size_t t = clusterStarts[c]; t < clusterStarts[c + 1]; t++)
+			{
+				glm::vec3 corners[3];
+				for (int k = 0; k < 3; k++)
+				{
+					const int16_t* p = vertices[indices[t * 3 + k]].position;
+					corners[k] = glm::vec3(p[0], p[1], p[2]);
+				}
+				const glm::vec3 cross = glm::cross(corners[1] - corners[0], corners[2] - corners[0]);
+				const float area = glm::length(cross);
+				centroids[c] += (corners[0] + corners[1] + corners[2]) * (area / 3.0f);
+				normals[c] += cross;
+				areas[c] += area;
+			}
+			meshCentroid += centroids[c];
+			meshArea += areas[c];
+		}
+		if (meshArea > 0.0f)
+			meshCentroid /= meshArea;
+
+		std::vector<float> keys(clusterCount);
+		for (size_t c = 0; c < clusterCount; c++)
+		{
+			const glm::vec3 centroid = areas[c] > 0.0f ? centroids[c] / areas[c] : meshCentroid;
+			const float length = glm::length(normals[c]);
+			keys[c] = length > 0.0f ? glm::dot(centroid - meshCentroid, normals[c] / length) : 0.0f;
+		}
+
+		std::vector<uint32_t> order(clusterCount);
+		for (size_t c = 0; c < clusterCount; c++)
+			order[c] = (uint32_t)c;
+		std::stable_sort(order.begin(), order.end(), [&keys](uint32_t a, uint32_t b) { return keys[a] > keys[b]; });
+
+		std::vector<uint32_t> output;
+		output.reserve(indexCount);
+		for (size_t i = 0; i < clusterCount; i++)
+		{
+			const size_t c = order[i];
+			output.insert(output.end(), indices + clusterStarts[c] * 3, indices + clusterStarts[c + 1] * 3);
+		}
+		memcpy(indices, output.data(), indexCount * sizeof(uint32_t));
+	}
+
+	/// Renumbers vertices in the order indices first uses them, writing them to destination. Vertices no
+	/// triangle uses are dropped. Returns the number written.
+	inline size_t optimizeVertexFetch(PackedVertex* destination, uint32_t* indices, size_t indexCount, const PackedVertex* vertices, size_t vertexCount)
+	{
+		std::vector<uint32_t> remap(vertexCount, ~0u);
+		size_t next = 0;
+		for (size_t i = 0; i < indexCount; i++)
+		{
+			uint32_t& index = remap[indices[i]];
+			if (index == ~0u)
+			{
+				destination[next] = vertices[indices[i]];
+				index = (uint32_t)next++;
+			}
+			indices[i] = index;
+		}
+		return next;
+	}
+}
@@ -0,0 +1,527 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include "shader.h"
+#include "bounds.h"
+#include "gl_handle.h"
+
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+/// Hierarchical-Z occlusion culling.
+///
+/// Every frame the major occluders are drawn depth-only into a small power-of-two depth texture, and its
+/// mip chain is rebuilt on the GPU so that each texel holds the farthest depth of the texels below it.
+/// The whole pyramid is then copied into a pixel buffer object. A frame or two later, once its fence has
+/// signalled, it is mapped and kept on the CPU together with the view-projection matrix it was drawn with.
+///
+/// isVisible() projects a box with that matrix, picks the pyramid level where the box's screen rectangle
+/// spans at most two texels in each direction, and reports the box hidden if its nearest point is behind
+/// the farthest depth stored in those texels. Because the pyramid lags the camera by the readback latency,
+/// an object coming out from behind an occluder can appear a frame late; nothing is ever culled while it
+/// is in front of the occluders, and boxes crossing the near plane or leaving the old view are always drawn.
+
+class HiZOcclusion
+{
+public:
+	bool enabled = true;
+
+	HiZOcclusion() { }
+
+	/// width and height must be powers of two.
+	HiZOcclusion(int width, int height)
+	{
+		m_width = width;
+		m_height = height;
+		m_levels = 1;
+		while ((width >> m_levels) > 0 || (height >> m_levels) > 0)
+			m_levels++;
+
+		m_depthPyramid = GLTexture::create("Hi-Z occlusion");
+		glBindTexture(GL_TEXTURE_2D, m_depthPyramid.id());
+		for (int level = 0; level < m_levels; level++)
+			glTexImage2D(GL_TEXTURE_2D, level, GL_DEPTH_COMPONENT32F, levelWidth(level), levelHeight(level), 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_NONE);
+
+		m_FBO = GLFramebuffer::create("Hi-Z occlusion");
+		glBindFramebuffer(GL_FRAMEBUFFER, m_FBO.id());
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, m_depthPyramid.id(), 0);
+		glDrawBuffer(GL_NONE);
+		glReadBuffer(GL_NONE);
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+		// a core profile context needs some vertex array bound to draw, even one with no attributes
+		m_emptyVAO = GLVertexArray::create("Hi-Z occlusion");
+		GpuResources::resize(GPU_TEXTURE, m_depthPyramid.id(), GpuResources::imageBytes(GL_DEPTH_COMPONENT32F, width, height, 1, m_levels));
+
+		m_pyramidFloats = 0;
+		for (int level = 0; level < m_levels; level++)
+			m_pyramidFloats += levelWidth(level) * levelHeight(level);
+
+		for (int i = 0; i < READBACK_SLOTS; i++)
+		{
+			m_PBOs[i] = GLBuffer::create("Hi-Z occlusion");
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, m_PBOs[i].id());
+			glBufferData(GL_PIXEL_PACK_BUFFER, m_pyramidFloats * sizeof(float), NULL, GL_STREAM_READ);
+			GpuResources::resize(GPU_BUFFER, m_PBOs[i].id(), m_pyramidFloats * sizeof(float));
+			m_fences[i] = 0;
+		}
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+		m_pyramid.resize(m_pyramidFloats);
+
+		m_depthShader = Shader("shaderfiles/hiz_depth.vs", "shaderfiles/hiz_depth.fs");
+		m_downsampleShader = Shader("shaderfiles/hiz_downsample.vs", "shaderfiles/hiz_downsample.fs");
+	}
+
+	/// Picks up any finished readback, resets the statistics and binds the occluder pass.
+	/// Occluders are then drawn with DrawDepth(depthShader(), 1).
+	void beginOccluders(const glm::mat4& viewProjection)
+	{
+		collectReadback();
+		m_lastTested = m_tested;
+		m_lastCulled = m_culled;
+		m_tested = 0;
+		m_culled = 0;
+
+		glGetIntegerv(GL_VIEWPORT, m_savedViewport);
+		glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &m_savedFramebuffer);
+		glBindFramebuffer(GL_FRAMEBUFFER, m_FBO.id());
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, m_depthPyramid.id(), 0);
+		glViewport(0, 0, m_width, m_height);
+		glClear(GL_DEPTH_BUFFER_BIT);
+
+		m_pendingViewProjection = viewProjection;
+		m_depthShader.use();
+		m_depthShader.setMat4("viewProjection", viewProjection);
+	}
+
+	/// Builds the pyramid from the occluder depth and starts reading it back.
+	void endOccluders()
+	{
+		glDepthFunc(GL_ALWAYS);
+		glBindVertexArray(m_emptyVAO.id());
+		glActiveTexture(GL_TEXTURE0);
+		glBindTexture(GL_TEXTURE_2D, m_depthPyramid.id());
+		m_downsampleShader.use();
+		m_downsampleShader.setInt("depthPyramid", 0);
+		for (int level = 1; level < m_levels; level++)
+		{
+			// only the source level may be sampled while the next one is attached
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level - 1);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, level - 1);
+			glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, m_depthPyramid.id(), level);
+			glViewport(0, 0, levelWidth(level), levelHeight(level));
+			glDrawArrays(GL_TRIANGLES, 0, 3);
+		}
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, m_levels - 1);
+		glDepthFunc(GL_LESS);
+
+		startReadback();
+
+		glBindFramebuffer(GL_FRAMEBUFFER, (GLuint)m_savedFramebuffer);
+		glViewport(m_savedViewport[0], m_savedViewport[1], m_savedViewport[2], m_savedViewport[3]);
+	}
+
+	/// True unless bounds is certainly hidden behind the occluders. Counts towards the statistics.
+	bool isVisible(const AABB& bounds)
+	{
+		m_tested++;
+		if (isHidden(bounds))
+		{
+			m_culled++;
+			return false;
+		}
+		return true;
+	}
+
+	/// The opposite of isVisible(), but without counting, so several threads may test at once; they report
+	/// their counts with addStatistics().
+	bool isHidden(const AABB& bounds) const
+	{
+		if (!enabled || !m_valid)
+			return false;
+
+		float minX = 1.0f, minY = 1.0f, maxX = 0.0f, maxY = 0.0f;
+		float nearestDepth = 1.0f;
+		for (int i = 0; i < 8; i++)
+		{
+			glm::vec4 clip = m_viewProjection * glm::vec4(bounds.corner(i), 1.0f);
+			if (clip.w <= 1e-5f)
+				return false;
+
+			glm::vec3 ndc = glm::vec3(clip) / clip.w;
+			minX = glm::min(minX, ndc.x * 0.5f + 0.5f);
+			maxX = glm::max(maxX, ndc.x * 0.5f + 0.5f);
+			minY = glm::min(minY, ndc.y * 0.5f + 0.5f);
+			maxY = glm::max(maxY, ndc.y * 0.5f + 0.5f);
+			nearestDepth = glm::min(nearestDepth, ndc.z * 0.5f + 0.5f);
+		}
+
+		// outside the view the pyramid was built for; leave it to clipping
+		if (maxX < 0.0f || maxY < 0.0f || minX > 1.0f || minY > 1.0f)
+			return false;
+		minX = glm::max(minX, 0.0f);
+		minY = glm::max(minY, 0.0f);
+		maxX = glm::min(maxX, 1.0f);
+		maxY = glm::min(maxY, 1.0f);
+
+		// the level where the rectangle covers at most 2x2 texels
+		float size = glm::max((maxX - minX) * m_width, (maxY - minY) * m_height);
+		int level = size <= 1.0f ? 0 : (int)std::ceil(std::log2(size));
+		level = glm::min(level, m_levels - 1);
+
+		const int width = levelWidth(level);
+		const int height = levelHeight(level);
+		const int x0 = glm::min((int)(minX * width), width - 1), x1 = glm::min((int)(maxX * width), width - 1);
+		const int y0 = glm::min((int)(minY * height), height - 1), y1 = glm::min((int)(maxY * height), height - 1);
+		const float* texels = &m_pyramid[levelOffset(level)];
+
+		float farthest = 0.0f;
+		for (int y = y0; y <= y1; y++)
+			for (int x = x0; x <= x1; x++)
+				farthest = glm::max(farthest, texels[y * width + x]);
+
+		return nearestDepth > farthest;
+	}
+
+	void addStatistics(int tested, int culled)
+	{
+		m_tested += tested;
+		m_culled += culled;
+	}
+
+	Shader& depthShader() { return m_depthShader; }
+	Shader& downsampleShader() { return m_downsampleShader; }
+
+	/// Objects tested and culled during the previous frame.
+	int lastTested() const { return m_lastTested; }
+	int lastCulled() const { return m_lastCulled; }
+
+	/// Forgets the pyramid and any copies still in flight. Call when occluders have not been drawn for a
+	/// while, so a pyramid from an old camera position is never tested against.
+	void invalidate()
+	{
+		for (int i = 0; i < READBACK_SLOTS; i++)
+		{
+			if (m_fences[i] != 0)
+				glDeleteSync(m_fences[i]);
+			m_fences[i] = 0;
+		}
+		m_valid = false;
+	}
+
+protected:
+	static const int READBACK_SLOTS = 2;
+
+	int levelWidth(int level) const { return glm::max(m_width >> level, 1); }
+	int levelHeight(int level) const { return glm::max(m_height >> level, 1); }
+
+	size_t levelOffset(int level) const
+	{
+		size_t offset = 0;
+		for (int i = 0; i < level; i++)
+			offset += levelWidth(i) * levelHeight(i);
+		return offset;
+	}
+
+	void startReadback()
+	{
+		int slot = m_nextSlot;
+		if (m_fences[slot] != 0)
+			return; // both slots are still in flight; skip this frame's copy rather than wait
+
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, m_PBOs[slot].id());
+		glPixelStorei(GL_PACK_ALIGNMENT, 4);
+		for (int level = 0; level < m_levels; level++)
+			glGetTexImage(GL_TEXTURE_2D, level, GL_DEPTH_COMPONENT, GL_FLOAT, (void*)(levelOffset(level) * sizeof(float)));
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+		m_fences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		m_slotViewProjection[slot] = m_pendingViewProjection;
+		m_nextSlot = (slot + 1) % READBACK_SLOTS;
+	}
+
+	/// Copies the newest completed readback to the CPU without ever waiting on the GPU.
+	void collectReadback()
+	{
+		for (int i = 0; i < READBACK_SLOTS; i++)
+		{
+			// oldest first, so the newest finished copy is the one that sticks
+			int slot = (m_nextSlot + i) % READBACK_SLOTS;
+			if (m_fences[slot] == 0)
+				continue;
+
+			GLenum status = glClientWaitSync(m_fences[slot], 0, 0);
+			if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+				continue;
+
+			glDeleteSync(m_fences[slot]);
+			m_fences[slot] = 0;
+
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, m_PBOs[slot].id());
+			const void* data = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, m_pyramidFloats * sizeof(float), GL_MAP_READ_BIT);
+			if (data != NULL)
+			{
+				memcpy(m_pyramid.data(), data, m_pyramidFloats * sizeof(float));
+				m_viewProjection = m_slotViewProjection[slot];
+				m_valid = true;
+			}
+			glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		}
+	}
+
+	int m_width = 0, m_height = 0, m_levels = 0;
+	GLTexture m_depthPyramid;
+	GLFramebuffer m_FBO;
+	GLVertexArray m_emptyVAO;
+	Shader m_depthShader, m_downsampleShader;
+	GLint m_savedViewport[4];
+	GLint m_savedFramebuffer = 0;
+
+	GLBuffer m_PBOs[READBACK_SLOTS];
+	GLsync m_fences[READBACK_SLOTS];
+	glm::mat4 m_slotViewProjection[READBACK_SLOTS];
+	int m_nextSlot = 0;
+	size_t m_pyramidFloats = 0;
+	glm::mat4 m_pendingViewProjection;
+
+	/// CPU copy of the most recent pyramid, all levels back to back, and the matrix it was drawn with.
+	std::vector<float> m_pyramid;
+	glm::mat4 m_viewProjection;
+	bool m_valid = false;
+
+	int m_tested = 0, m_culled = 0;
+	int m_lastTested = 0, m_lastCulled = 0;
+};
+
+/// Hardware occlusion queries with conditional rendering, an alternative to HiZOcclusion for a handful of
+/// large objects that needs no readback at all.
+///
+/// After the frame's geometry is in the depth buffer, issueQuery() draws each tracked object's bounding box
+/// with colour and depth writes off inside a GL_ANY_SAMPLES_PASSED query. On the next frame the object's
+/// draw calls are wrapped in beginConditional()/endConditional(), which uses that query with
+/// GL_QUERY_NO_WAIT: the GPU skips the draws if no sample of the box passed, and simply draws the object if
+/// the result is not ready yet. The CPU never waits either; results are read only once
+/// GL_QUERY_RESULT_AVAILABLE says so, and only for the statistics.
+///
+/// Query objects are pooled. A query returns to the pool once its result has been read and a newer query
+/// for the same object has replaced it.
+
+class OcclusionQueries
+{
+public:
+	bool enabled = true;
+
+	OcclusionQueries() { }
+
+	OcclusionQueries(int maxPendingPerObject)
+	{
+		m_maxPending = maxPendingPerObject;
+
+		// a unit cube centred on the origin, scaled to each object's bounds
+		const float corners[] = {
+			-0.5f, -0.5f, -0.5f,   0.5f, -0.5f, -0.5f,  -0.5f,  0.5f, -0.5f,   0.5f,  0.5f, -0.5f,
+			-0.5f, -0.5f,  0.5f,   0.5f, -0.5f,  0.5f,  -0.5f,  0.5f,  0.5f,   0.5f,  0.5f,  0.5f,
+		};
+		const GLubyte indices[] = {
+			0, 2, 1,  1, 2, 3,   4, 5, 6,  5, 7, 6,   0, 1, 4,  1, 5, 4,
+			2, 6, 3,  3, 6, 7,   0, 4, 2,  2, 4, 6,   1, 3, 5,  3, 7, 5,
+		};
+
+		m_boxVAO = GLVertexArray::create("occlusion queries");
+		m_boxVBO = GLBuffer::create("occlusion queries");
+		m_boxEBO = GLBuffer::create("occlusion queries");
+		glBindVertexArray(m_boxVAO.id());
+		glBindBuffer(GL_ARRAY_BUFFER, m_boxVBO.id());
+		glBufferData(GL_ARRAY_BUFFER, sizeof(corners), corners, GL_STATIC_DRAW);
+		// plain floats; the shader's position quantization, attribute 3, is left disabled and reads as (0, 0, 0, 1)
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
+		glEnableVertexAttribArray(0);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_boxEBO.id());
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
+		glBindVertexArray(0);
+		GpuResources::resize(GPU_BUFFER, m_boxVBO.id(), sizeof(corners));
+		GpuResources::resize(GPU_BUFFER, m_boxEBO.id(), sizeof(indices));
+
+		// the boxes are drawn depth-only, exactly like the Hi-Z occluders
+		m_boxShader = Shader("shaderfiles/hiz_depth.vs", "shaderfiles/hiz_depth.fs");
+	}
+
+	/// Starts tracking an object; the returned handle is passed to the other calls.
+	int add()
+	{
+		m_objects.push_back(TrackedObject());
+		return (int)m_objects.size() - 1;
+	}
+
+	/// Stops tracking every object, as when the scene is replaced; their queries go back to the pool.
+	void clear()
+	{
+		for (size_t i = 0; i < m_objects.size(); i++)
+			m_free.insert(m_free.end(), m_objects[i].pending.begin(), m_objects[i].pending.end());
+		m_objects.clear();
+	}
+
+	/// Wraps an object's draw calls. They are skipped on the GPU if the object's most recent box query
+	/// found no visible samples.
+	void beginConditional(int handle)
+	{
+		m_conditional = enabled ? m_objects[handle].latest : 0;
+		if (m_conditional != 0)
+			glBeginConditionalRender(m_conditional, GL_QUERY_NO_WAIT);
+	}
+
+	void endConditional()
+	{
+		if (m_conditional != 0)
+			glEndConditionalRender();
+		m_conditional = 0;
+	}
+
+	/// Collects finished results and prepares the bounding box pass. Colour and depth writes stay off until
+	/// endQueries().
+	void beginQueries(const glm::mat4& viewProjection, glm::vec3 cameraPosition)
+	{
+		collectResults();
+		m_cameraPosition = cameraPosition;
+		m_issued = 0;
+
+		glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+		glDepthMask(GL_FALSE);
+		glBindVertexArray(m_boxVAO.id());
+		m_boxShader.use();
+		m_boxShader.setMat4("viewProjection", viewProjection);
+	}
+
+	/// Issues the query deciding whether the object is drawn next frame.
+	void issueQuery(int handle, const AABB& bounds)
+	{
+		TrackedObject& object = m_objects[handle];
+
+		// the near plane would clip away a box the camera is inside of; such objects are always drawn
+		AABB padded(bounds.min - glm::vec3(BOX_PADDING), bounds.max + glm::vec3(BOX_PADDING));
+		glm::vec3 margin(CAMERA_MARGIN);
+		if (glm::all(glm::greaterThan(m_cameraPosition, padded.min - margin)) && glm::all(glm::lessThan(m_cameraPosition, padded.max + margin)))
+		{
+			object.latest = 0;
+			object.visible = true;
+			return;
+		}
+
+		// should the GPU fall far behind, keep using the old query rather than piling up new ones
+		if ((int)object.pending.size() >= m_maxPending)
+			return;
+
+		GLuint query = acquire();
+		glm::mat4 model = glm::translate(glm::mat4(1.0f), padded.center());
+		model = glm::scale(model, padded.extent());
+		m_boxShader.setMat4("model", model);
+
+		glBeginQuery(GL_ANY_SAMPLES_PASSED, query);
+		glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_BYTE, 0);
+		glEndQuery(GL_ANY_SAMPLES_PASSED);
+
+		object.pending.push_back(query);
+		object.latest = query;
+		m_issued++;
+	}
+
+	void endQueries()
+	{
+		glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+		glDepthMask(GL_TRUE);
+		glBindVertexArray(0);
+	}
+
+	Shader& boxShader() { return m_boxShader; }
+
+	/// Tracked objects whose most recently read query found them hidden.
+	int lastHidden() const
+	{
+		int hidden = 0;
+		for (size_t i = 0; i < m_objects.size(); i++)
+			if (!m_objects[i].visible)
+				hidden++;
+		return hidden;
+	}
+	int tracked() const { return (int)m_objects.size(); }
+	int lastIssued() const { return m_issued; }
+	/// Query objects created so far; stops growing once the pool has warmed up.
+	int poolSize() const { return (int)m_queries.size(); }
+
+protected:
+	/// World units added around each box, so an object's own surface never hides its box.
+	static constexpr float BOX_PADDING = 0.05f;
+	/// Keeps the near plane from clipping a box the camera is just outside of.
+	static constexpr float CAMERA_MARGIN = 0.2f;
+
+	struct TrackedObject
+	{
+		/// Query used for conditional rendering; 0 means draw unconditionally.
+		GLuint latest = 0;
+		/// Queries whose results have not been read yet, oldest first.
+		std::vector<GLuint> pending;
+		bool visible = true;
+	};
+
+	GLuint acquire()
+	{
+		if (m_free.empty())
+		{
+			m_queries.push_back(GLQuery::create("occlusion queries"));
+			return m_queries.back().id();
+		}
+		GLuint query = m_free.back();
+		m_free.pop_back();
+		return query;
+	}
+
+	void collectResults()
+	{
+		for (size_t i = 0; i < m_objects.size(); i++)
+		{
+			TrackedObject& object = m_objects[i];
+			while (!object.pending.empty())
+			{
+				GLuint query = object.pending.front();
+				GLuint available = 0;
+				glGetQueryObjectuiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+				if (!available)
+					break;
+
+				GLuint anySamples = 0;
+				glGetQueryObjectuiv(query, GL_QUERY_RESULT, &anySamples);
+				object.visible = anySamples != 0;
+
+				// the latest query is still needed for conditional rendering
+				if (query == object.latest)
+					break;
+				object.pending.erase(object.pending.begin());
+				m_free.push_back(query);
+			}
+		}
+	}
+
+	int m_maxPending = 0;
+	GLVertexArray m_boxVAO;
+	GLBuffer m_boxVBO, m_boxEBO;
+	Shader m_boxShader;
+	glm::vec3 m_cameraPosition;
+	GLuint m_conditional = 0;
+
+	std::vector<TrackedObject> m_objects;
+	/// Every query created, which the pool lends out by name.
+	std::vector<GLQuery> m_queries;
+	std::vector<GLuint> m_free;
+	int m_issued = 0;
+};
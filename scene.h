@@ -0,0 +1,423 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include "mesh.h"
+#include "bounds.h"
+#include "job_system.h"
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+/// Refers to one entity for as long as it exists. Handles of destroyed entities are recognised as stale
+/// rather than silently referring to whatever entity reused the slot.
+struct EntityHandle
+{
+	uint32_t slot = INVALID;
+	uint32_t generation = 0;
+
+	static const uint32_t INVALID = 0xffffffffu;
+	bool valid() const { return slot != INVALID; }
+};
+
+/// How an entity's surface is shaded by the lighting pass.
+struct Material
+{
+	/// Textured materials use the TEXTURED lighting variant, the others a flat colour.
+	bool textured = false;
+	glm::vec3 color = glm::vec3(1.0f);
+	/// Bound to texture units 0 and 1. A mesh's secondary range always samples unit 1.
+	GLuint textures[2] = { 0, 0 };
+	/// Unit sampled by the mesh's main range.
+	int sampler = 0;
+};
+
+enum LightType
+{
+	LIGHT_DIRECTIONAL,
+	LIGHT_POINT,
+	/// The flashlight; it follows the camera, so its position and direction are not stored.
+	LIGHT_SPOT,
+};
+
+/// A light of the lighting shader. Unused fields of a type keep their defaults.
+struct Light
+{
+	LightType type = LIGHT_POINT;
+	glm::vec3 position = glm::vec3(0.0f);
+	glm::vec3 direction = glm::vec3(0.0f, -1.0f, 0.0f);
+	glm::vec3 ambient = glm::vec3(0.0f);
+	glm::vec3 diffuse = glm::vec3(0.0f);
+	glm::vec3 specular = glm::vec3(0.0f);
+	/// Attenuation of point and spot lights.
+	float constant = 1.0f;
+	float linear = 0.0f;
+	float quadratic = 0.0f;
+	/// Spot light cone, as cosines of the inner and outer angles.
+	float cutOff = 1.0f;
+	float outerCutOff = 1.0f;
+};
+
+/// Spectators seated on the inside of a torus-shaped stand, drawn by the crowd pass (see crowd.h).
+struct CrowdStand
+{
+	/// Placed like an entity of the torus.
+	glm::vec3 position = glm::vec3(0.0f);
+	float rotationY = 0.0f;
+	glm::vec3 scale = glm::vec3(1.0f);
+	/// Radii of the torus, as Torus takes them.
+	float mainRadius = 1.0f;
+	float tubeRadius = 0.25f;
+	/// Seats fill the tube between these angles, in degrees: 0 faces outwards, 90 up and 180 inwards.
+	float fromDegrees = 90.0f;
+	float toDegrees = 180.0f;
+	uint32_t spectators = 0;
+};
+
+inline bool operator==(const CrowdStand& a, const CrowdStand& b)
+{
+	return a.position == b.position && a.rotationY == b.rotationY && a.scale == b.scale && a.mainRadius == b.mainRadius
+		&& a.tubeRadius == b.tubeRadius && a.fromDegrees == b.fromDegrees && a.toDegrees == b.toDegrees && a.spectators == b.spectators;
+}
+
+inline bool operator!=(const CrowdStand& a, const CrowdStand& b) { return !(a == b); }
+
+enum EntityFlags
+{
+	/// Drawn into the shadow cascades.
+	ENTITY_CASTS_SHADOW = 1 << 0,
+	/// Drawn into the Hi-Z pyramid, hiding what is behind it.
+	ENTITY_OCCLUDER = 1 << 1,
+	/// Tested against the occluders before being drawn.
+	ENTITY_OCCLUDABLE = 1 << 2,
+	/// Given a hardware occlusion query of its own when the scene is set up.
+	ENTITY_OCCLUSION_QUERY = 1 << 3,
+};
+
+/// Every entity of the scene, stored as a structure of arrays.
+///
+/// Entity i's position, rotation, scale, model matrix, world bounds, mesh, material and flags are element i
+/// of separate contiguous arrays, so a pass that only needs bounds, say, streams through bounds alone.
+/// Entities are kept densely packed: destroy() moves the last entity into the hole, so dense indices change
+/// while handles stay valid. Passes iterate dense indices 0..size()-1; anything kept across frames should
+/// hold an EntityHandle.
+///
+/// Moving an entity only records it as dirty; updateTransforms() recomputes the model matrices and world
+/// bounds of dirty entities in one linear pass, and must run before the frame's passes read them.
+
+class Scene
+{
+public:
+	Scene() { }
+
+	/// Adds a mesh, and the GL objects behind it if the scene is to own them; they are deleted with the scene.
+	/// source, if given, names what the mesh was built from, so that a scene loaded in this one's place can
+	/// take it over rather than build it again; see findMesh().
+	int addMesh(const Mesh& mesh, MeshBuffers buffers = MeshBuffers(), const std::string& source = std::string())
+	{
+		m_meshes.push_back(mesh);
+		m_meshBuffers.push_back(std::move(buffers));
+		m_meshSources.push_back(source);
+		return (int)m_meshes.size() - 1;
+	}
+
+	/// Adds a model's mesh, taking over its GL objects.
+	template <class Model>
+	int addModel(Model model, const std::string& source = std::string())
+	{
+		const Mesh mesh = model.GetMesh();
+		return addMesh(mesh, model.TakeBuffers(), source);
+	}
+
+	/// The mesh built from source and still holding its GL objects, or -1.
+	int findMesh(const std::string& source) const
+	{
+		if (source.empty())
+			return -1;
+		for (size_t i = 0; i < m_meshes.size(); i++)
+			if (m_meshSources[i] == source && m_meshBuffers[i].vertexArray)
+				return (int)i;
+		return -1;
+	}
+
+	/// Adds mesh id of from, moving its GL objects over; from's entities must no longer be drawn with it.
+	int adoptMesh(Scene& from, uint32_t id)
+	{
+		return addMesh(from.m_meshes[id], std::move(from.m_meshBuffers[id]), from.m_meshSources[id]);
+	}
+
+	int addMaterial(const Material& material)
+	{
+		m_materials.push_back(material);
+		return (int)m_materials.size() - 1;
+	}
+
+	void addLight(const Light& light) { m_lights.push_back(light); }
+	const std::vector<Light>& lights() const { return m_lights; }
+
+	/// Number of lights of the given type.
+	int lightCount(LightType type) const
+	{
+		int count = 0;
+		for (size_t i = 0; i < m_lights.size(); i++)
+			if (m_lights[i].type == type)
+				count++;
+		return count;
+	}
+
+	void addCrowdStand(const CrowdStand& stand) { m_crowdStands.push_back(stand); }
+	const std::vector<CrowdStand>& crowdStands() const { return m_crowdStands; }
+
+	const Mesh& mesh(uint32_t id) const { return m_meshes[id]; }
+	const Material& material(uint32_t id) const { return m_materials[id]; }
+	size_t meshCount() const { return m_meshes.size(); }
+	size_t materialCount() const { return m_materials.size(); }
+
+	/// rotationY is an angle in degrees; flags is a combination of EntityFlags.
+	EntityHandle create(int mesh, int material, glm::vec3 position, float rotationY, glm::vec3 scale, unsigned int flags)
+	{
+		EntityHandle handle;
+		if (m_freeSlots.empty())
+		{
+			handle.slot = (uint32_t)m_slots.size();
+			m_slots.push_back(Slot());
+		}
+		else
+		{
+			handle.slot = m_freeSlots.back();
+			m_freeSlots.pop_back();
+		}
+		handle.generation = m_slots[handle.slot].generation;
+
+		uint32_t index = (uint32_t)m_positions.size();
+		m_slots[handle.slot].index = index;
+		m_slotOfIndex.push_back(handle.slot);
+
+		m_positions.push_back(position);
+		m_rotationsY.push_back(rotationY);
+		m_scales.push_back(scale);
+		m_modelMatrices.push_back(glm::mat4(1.0f));
+		m_worldBounds.push_back(AABB());
+		m_meshIds.push_back((uint32_t)mesh);
+		m_materialIds.push_back((uint32_t)material);
+		m_flags.push_back((uint8_t)flags);
+		m_occlusionQueries.push_back(-1);
+		m_dirty.push_back(1);
+		m_anyDirty = true;
+		m_structureVersion++;
+		return handle;
+	}
+
+	/// Appends count entities from parallel arrays with one bulk copy per array, as the binary scene loader
+	/// does. Their transforms are computed by the next updateTransforms().
+	void append(size_t count, const glm::vec3* positions, const float* rotationsY, const glm::vec3* scales,
+		const uint32_t* meshIds, const uint32_t* materialIds, const uint8_t* flags)
+	{
+		const uint32_t first = (uint32_t)m_positions.size();
+		const uint32_t firstSlot = (uint32_t)m_slots.size();
+		m_slots.resize(firstSlot + count);
+		m_slotOfIndex.resize(first + count);
+		for (size_t i = 0; i < count; i++)
+		{
+			m_slots[firstSlot + i].index = first + (uint32_t)i;
+			m_slotOfIndex[first + i] = firstSlot + (uint32_t)i;
+		}
+
+		m_positions.insert(m_positions.end(), positions, positions + count);
+		m_rotationsY.insert(m_rotationsY.end(), rotationsY, rotationsY + count);
+		m_scales.insert(m_scales.end(), scales, scales + count);
+		m_modelMatrices.resize(first + count, glm::mat4(1.0f));
+		m_worldBounds.resize(first + count);
+		m_meshIds.insert(m_meshIds.end(), meshIds, meshIds + count);
+		m_materialIds.insert(m_materialIds.end(), materialIds, materialIds + count);
+		m_flags.insert(m_flags.end(), flags, flags + count);
+		m_occlusionQueries.resize(first + count, -1);
+		m_dirty.resize(first + count, 1);
+		m_anyDirty = m_anyDirty || count > 0;
+		m_structureVersion++;
+	}
+
+	void destroy(EntityHandle handle)
+	{
+		if (!alive(handle))
+			return;
+
+		uint32_t index = m_slots[handle.slot].index;
+		uint32_t last = (uint32_t)m_positions.size() - 1;
+		if (index != last)
+		{
+			moveEntity(last, index);
+			m_slots[m_slotOfIndex[index]].index = index;
+		}
+		popEntity();
+
+		m_slots[handle.slot].generation++;
+		m_slots[handle.slot].index = EntityHandle::INVALID;
+		m_freeSlots.push_back(handle.slot);
+		m_structureVersion++;
+	}
+
+	bool alive(EntityHandle handle) const
+	{
+		return handle.slot < m_slots.size() && m_slots[handle.slot].generation == handle.generation
+			&& m_slots[handle.slot].index != EntityHandle::INVALID;
+	}
+
+	/// Current dense index of a live entity.
+	uint32_t indexOf(EntityHandle handle) const { return m_slots[handle.slot].index; }
+
+	/// Handle of the entity currently at a dense index.
+	EntityHandle handleAt(uint32_t index) const
+	{
+		EntityHandle handle;
+		handle.slot = m_slotOfIndex[index];
+		handle.generation = m_slots[handle.slot].generation;
+		return handle;
+	}
+
+	void setPosition(EntityHandle handle, glm::vec3 position)
+	{
+		uint32_t index = indexOf(handle);
+		m_positions[index] = position;
+		markDirty(index);
+	}
+
+	void setRotationY(EntityHandle handle, float rotationY)
+	{
+		uint32_t index = indexOf(handle);
+		m_rotationsY[index] = rotationY;
+		markDirty(index);
+	}
+
+	void setScale(EntityHandle handle, glm::vec3 scale)
+	{
+		uint32_t index = indexOf(handle);
+		m_scales[index] = scale;
+		markDirty(index);
+	}
+
+	/// Associates an OcclusionQueries handle with the entity; -1, the default, means none.
+	void setOcclusionQuery(EntityHandle handle, int query) { m_occlusionQueries[indexOf(handle)] = query; }
+
+	/// Recomputes the model matrices and world bounds of every entity moved since the last call, spread over
+	/// the threads of jobs if given. Returns whether there were any.
+	bool updateTransforms(JobSystem* jobs = NULL)
+	{
+		if (!m_anyDirty)
+			return false;
+
+		if (jobs != NULL)
+			jobs->parallelFor(m_positions.size(), TRANSFORM_GRAIN, [this](size_t begin, size_t end) { updateTransformRange(begin, end); });
+		else
+			updateTransformRange(0, m_positions.size());
+		m_anyDirty = false;
+		return true;
+	}
+
+	size_t size() const { return m_positions.size(); }
+
+	/// Changes whenever entities are created or destroyed, and so whenever dense indices may have changed.
+	unsigned int structureVersion() const { return m_structureVersion; }
+
+	/// The arrays, indexed by dense index; valid until the next create() or destroy().
+	const glm::vec3* positions() const { return m_positions.data(); }
+	const float* rotationsY() const { return m_rotationsY.data(); }
+	const glm::vec3* scales() const { return m_scales.data(); }
+	const glm::mat4* modelMatrices() const { return m_modelMatrices.data(); }
+	const AABB* worldBounds() const { return m_worldBounds.data(); }
+	const uint32_t* meshIds() const { return m_meshIds.data(); }
+	const uint32_t* materialIds() const { return m_materialIds.data(); }
+	const uint8_t* flags() const { return m_flags.data(); }
+	const int* occlusionQueries() const { return m_occlusionQueries.data(); }
+
+protected:
+	struct Slot
+	{
+		/// Dense index of the entity, or EntityHandle::INVALID while the slot is free.
+		uint32_t index = EntityHandle::INVALID;
+		uint32_t generation = 0;
+	};
+
+	/// Entities per range when updateTransforms() is spread over threads.
+	static const size_t TRANSFORM_GRAIN = 4096;
+
+	void updateTransformRange(size_t begin, size_t end)
+	{
+		for (size_t i = begin; i < end; i++)
+		{
+			if (!m_dirty[i])
+				continue;
+
+			glm::mat4 model = glm::translate(glm::mat4(1.0f), m_positions[i]);
+			if (m_rotationsY[i] != 0.0f)
+				model = glm::rotate(model, glm::radians(m_rotationsY[i]), glm::vec3(0, 1, 0));
+			model = glm::scale(model, m_scales[i]);
+
+			m_modelMatrices[i] = model;
+			m_worldBounds[i] = m_meshes[m_meshIds[i]].bounds.transformed(model);
+			m_dirty[i] = 0;
+		}
+	}
+
+	void markDirty(uint32_t index)
+	{
+		m_dirty[index] = 1;
+		m_anyDirty = true;
+	}
+
+	void moveEntity(uint32_t from, uint32_t to)
+	{
+		m_slotOfIndex[to] = m_slotOfIndex[from];
+		m_positions[to] = m_positions[from];
+		m_rotationsY[to] = m_rotationsY[from];
+		m_scales[to] = m_scales[from];
+		m_modelMatrices[to] = m_modelMatrices[from];
+		m_worldBounds[to] = m_worldBounds[from];
+		m_meshIds[to] = m_meshIds[from];
+		m_materialIds[to] = m_materialIds[from];
+		m_flags[to] = m_flags[from];
+		m_occlusionQueries[to] = m_occlusionQueries[from];
+		m_dirty[to] = m_dirty[from];
+	}
+
+	void popEntity()
+	{
+		m_slotOfIndex.pop_back();
+		m_positions.pop_back();
+		m_rotationsY.pop_back();
+		m_scales.pop_back();
+		m_modelMatrices.pop_back();
+		m_worldBounds.pop_back();
+		m_meshIds.pop_back();
+		m_materialIds.pop_back();
+		m_flags.pop_back();
+		m_occlusionQueries.pop_back();
+		m_dirty.pop_back();
+	}
+
+	std::vector<Mesh> m_meshes;
+	std::vector<MeshBuffers> m_meshBuffers;
+	std::vector<std::string> m_meshSources;
+	std::vector<Material> m_materials;
+	std::vector<Light> m_lights;
+	std::vector<CrowdStand> m_crowdStands;
+
+	std::vector<Slot> m_slots;
+	std::vector<uint32_t> m_freeSlots;
+	std::vector<uint32_t> m_slotOfIndex;
+
+	std::vector<glm::vec3> m_positions;
+	std::vector<float> m_rotationsY;
+	std::vector<glm::vec3> m_scales;
+	std::vector<glm::mat4> m_modelMatrices;
+	std::vector<AABB> m_worldBounds;
+	std::vector<uint32_t> m_meshIds;
+	std::vector<uint32_t> m_materialIds;
+	std::vector<uint8_t> m_flags;
+	std::vector<int> m_occlusionQueries;
+	std::vector<uint8_t> m_dirty;
+	bool m_anyDirty = false;
+	unsigned int m_structureVersion = 0;
+};
@@ -0,0 +1,761 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include "scene.h"
+#include "mapped_file.h"
+
+/// Models
+#include "Plane.h"
+#include "Cube.h"
+#include "Pyramid.h"
+#include "Torus.h"
+#include "ImportedModel.h"
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+/// Scene files: a line-based text format for authoring and a compiled binary form for loading.
+///
+/// The text form, by convention *.scene, has one record per line; # starts a comment. Names are declared
+/// before they are used.
+///
+///   texture  <name> <path>
+///   mesh     <name> plane
+///   mesh     <name> cube <textureScaleX> <textureScaleY>
+///   mesh     <name> pyramid
+///   mesh     <name> torus <mainRadius> <tubeRadius>
+///   mesh     <name> model <path>
+///   material <name> color <r> <g> <b>
+///   material <name> textured <texture> <texture> <sampler>
+///   light directional <direction> <ambient> <diffuse> <specular>
+///   light point <position> <ambient> <diffuse> <specular> <constant> <linear> <quadratic>
+///   light spot <ambient> <diffuse> <specular> <constant> <linear> <quadratic> <cutOffDegrees> <outerCutOffDegrees>
+///   entity   <mesh> <material> <position> <rotationY> <scale> [casts-shadow] [occluder] [occludable] [occlusion-query]
+///   crowd    <torusMesh> <position> <rotationY> <scale> <spectators> <fromDegrees> <toDegrees>
+///
+/// Vectors are three numbers. The spot light follows the camera. Models are OBJ or glTF files, imported
+/// through their own caches; see mesh_import.h. A crowd seats spectators on the inside of a torus placed as
+/// an entity would be, between two angles around its tube; see CrowdStand.
+///
+/// The binary form, *.scenebin, is a header followed by fixed-size records and then the entity arrays,
+/// laid out exactly as Scene stores them and aligned to 16 bytes. Loading maps the file and copies each
+/// array into the scene in one go; nothing is parsed per entity. load() compiles the text file whenever
+/// its binary is missing, from another version of the format, or stamped with another size or modification
+/// time of the text than it has now (see FileStamp).
+///
+/// reload() loads a scene in place of another, edited or a different venue, and takes over every mesh the
+/// two build from the same record rather than building it again; models count as the same only while their
+/// file's stamp is unchanged. Textures are shared through the loader, which returns the texture it already has for
+/// an unchanged image.
+
+class SceneFile
+{
+public:
+	typedef unsigned int (*TextureLoader)(const char* path);
+
+	struct LoadStats
+	{
+		double textureMilliseconds = 0.0;
+		/// Meshes of the file, and those of them taken over from the previous scene.
+		uint32_t meshes = 0;
+		uint32_t reusedMeshes = 0;
+	};
+
+	/// Loads textPath through its compiled binary, compiling it first if needed. Meshes previous has built
+	/// from the same records are taken from it; see reload().
+	static bool load(const std::string& textPath, Scene& scene, TextureLoader loadTexture, Scene* previous = NULL)
+	{
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+		std::string binaryPath = binaryPathFor(textPath);
+		bool compiled = false;
+		if (!compileIfStale(textPath, &compiled))
+			return false;
+
+		size_t before = scene.size();
+		LoadStats stats;
+		if (!loadBinary(binaryPath, scene, loadTexture, &stats, previous))
+			return false;
+
+		double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		std::cout << "Loaded " << binaryPath << (compiled ? " (recompiled)" : "") << ": " << scene.size() - before
+			<< " entities in " << milliseconds << " ms, " << stats.textureMilliseconds << " ms of it decoding textures";
+		if (previous != NULL)
+			std::cout << "; " << stats.reusedMeshes << " of " << stats.meshes << " meshes reused";
+		std::cout << std::endl;
+		return true;
+	}
+
+	/// Replaces scene with textPath's, taking over the meshes the two share and deleting the rest once the
+	/// new scene is in place. recompile compiles textPath even if its binary looks current, for a file known
+	/// to have just changed. Returns false, leaving scene as it was, if textPath cannot be loaded.
+	static bool reload(const std::string& textPath, Scene& scene, TextureLoader loadTexture, bool recompile = false)
+	{
+		if (recompile && !compile(textPath, binaryPathFor(textPath)))
+			return false;
+		Scene next;
+		if (!load(textPath, next, loadTexture, &scene))
+			return false;
+		scene = std::move(next);
+		return true;
+	}
+
+	/// Compiles textPath if its binary is missing, from another version of the format, or stamped with
+	/// another FileStamp of textPath, so that processes loading it afterwards all map the same file.
+	/// compiled, if given, tells whether it was.
+	static bool compileIfStale(const std::string& textPath, bool* compiled = NULL)
+	{
+		std::string binaryPath = binaryPathFor(textPath);
+		const FileStamp text = MappedFile::stamp(textPath);
+		if (compiled != NULL)
+			*compiled = false;
+		if (!text.exists() || isCurrentBinary(binaryPath, text))
+			return true;
+		if (!compile(textPath, binaryPath))
+			return false;
+		if (compiled != NULL)
+			*compiled = true;
+		return true;
+	}
+
+	static std::string binaryPathFor(const std::string& textPath)
+	{
+		std::string::size_type dot = textPath.find_last_of('.');
+		std::string::size_type slash = textPath.find_last_of("/\\");
+		if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+			return textPath + ".scenebin";
+		return textPath.substr(0, dot) + ".scenebin";
+	}
+
+	/// Parses a text scene and writes its binary form. Errors are reported as path:line.
+	static bool compile(const std::string& textPath, const std::string& binaryPath)
+	{
+		// stamped before parsing, so an edit made meanwhile is compiled again next time
+		const FileStamp text = MappedFile::stamp(textPath);
+		Description description;
+		if (!parse(textPath, description))
+			return false;
+		return write(binaryPath, description, text);
+	}
+
+	/// Maps a compiled scene and adds its textures, meshes, materials, lights and entities to scene. Meshes
+	/// previous has built from the same records are moved over from it instead of being built again.
+	static bool loadBinary(const std::string& binaryPath, Scene& scene, TextureLoader loadTexture, LoadStats* stats = NULL,
+		Scene* previous = NULL)
+	{
+		MappedFile file;
+		if (!file.open(binaryPath))
+		{
+			std::cout << "ERROR::SCENE::CANNOT_OPEN: " << binaryPath << std::endl;
+			return false;
+		}
+
+		const unsigned char* data = file.data();
+		const Header* header = (const Header*)data;
+		if (!validate(header, file.size()))
+		{
+			std::cout << "ERROR::SCENE::INVALID_BINARY: " << binaryPath << std::endl;
+			return false;
+		}
+
+		const uint32_t firstMesh = (uint32_t)scene.meshCount();
+		const uint32_t firstMaterial = (uint32_t)scene.materialCount();
+
+		std::chrono::steady_clock::time_point textureStart = std::chrono::steady_clock::now();
+		std::vector<GLuint> textures(header->textureCount);
+		const TextureRecord* textureRecords = (const TextureRecord*)(data + header->textures);
+		for (uint32_t i = 0; i < header->textureCount; i++)
+			textures[i] = loadTexture(textureRecords[i].path);
+		const double textureMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - textureStart).count();
+
+		uint32_t reusedMeshes = 0;
+		const MeshRecord* meshes = (const MeshRecord*)(data + header->meshes);
+		for (uint32_t i = 0; i < header->meshCount; i++)
+		{
+			const std::string source = meshSource(meshes[i]);
+			const int reused = previous != NULL ? previous->findMesh(source) : -1;
+			if (reused >= 0)
+			{
+				scene.adoptMesh(*previous, (uint32_t)reused);
+				reusedMeshes++;
+			}
+			else
+				addMesh(scene, meshes[i], source);
+		}
+		if (stats != NULL)
+		{
+			stats->textureMilliseconds = textureMilliseconds;
+			stats->meshes = header->meshCount;
+			stats->reusedMeshes = reusedMeshes;
+		}
+
+		const MaterialRecord* materials = (const MaterialRecord*)(data + header->materials);
+		for (uint32_t i = 0; i < header->materialCount; i++)
+		{
+			Material material;
+			material.textured = materials[i].textured != 0;
+			material.color = glm::vec3(materials[i].color[0], materials[i].color[1], materials[i].color[2]);
+			for (int j = 0; j < 2; j++)
+				material.textures[j] = materials[i].textures[j] < 0 ? 0 : textures[materials[i].textures[j]];
+			material.sampler = materials[i].sampler;
+			scene.addMaterial(material);
+		}
+
+		const LightRecord* lights = (const LightRecord*)(data + header->lights);
+		for (uint32_t i = 0; i < header->lightCount; i++)
+			scene.addLight(toLight(lights[i]));
+
+		const CrowdRecord* crowds = (const CrowdRecord*)(data + header->crowds);
+		for (uint32_t i = 0; i < header->crowdCount; i++)
+			scene.addCrowdStand(toCrowdStand(crowds[i]));
+
+		const size_t count = header->entityCount;
+		const uint32_t* meshIds = (const uint32_t*)(data + header->meshIds);
+		const uint32_t* materialIds = (const uint32_t*)(data + header->materialIds);
+
+		// ids are stored relative to this file; rebase them only if the scene already had meshes or materials
+		std::vector<uint32_t> rebasedMeshIds, rebasedMaterialIds;
+		if (firstMesh != 0 || firstMaterial != 0)
+		{
+			rebasedMeshIds.assign(meshIds, meshIds + count);
+			rebasedMaterialIds.assign(materialIds, materialIds + count);
+			for (size_t i = 0; i < count; i++)
+			{
+				rebasedMeshIds[i] += firstMesh;
+				rebasedMaterialIds[i] += firstMaterial;
+			}
+			meshIds = rebasedMeshIds.data();
+			materialIds = rebasedMaterialIds.data();
+		}
+
+		scene.append(count,
+			(const glm::vec3*)(data + header->positions),
+			(const float*)(data + header->rotations),
+			(const glm::vec3*)(data + header->scales),
+			meshIds, materialIds,
+			(const uint8_t*)(data + header->flags));
+		return true;
+	}
+
+protected:
+	static const uint32_t VERSION = 4;
+	static const size_t ALIGNMENT = 16;
+
+	enum MeshType
+	{
+		MESH_PLANE,
+		MESH_CUBE,
+		MESH_PYRAMID,
+		MESH_TORUS,
+		MESH_MODEL,
+	};
+
+	/// Offsets are in bytes from the start of the file.
+	struct Header
+	{
+		char magic[8];
+		uint32_t version;
+		uint32_t textureCount, meshCount, materialCount, lightCount, crowdCount, entityCount;
+		uint64_t textures, meshes, materials, lights, crowds;
+		uint64_t positions, rotations, scales, meshIds, materialIds, flags;
+		/// The text file as it was when compiled.
+		FileStamp source;
+		uint64_t fileSize;
+	};
+
+	struct TextureRecord
+	{
+		char path[256];
+	};
+
+	struct MeshRecord
+	{
+		uint32_t type;
+		/// Texture scales of a cube, radii of a torus.
+		float parameters[2];
+		/// File of a model.
+		char path[256];
+	};
+
+	struct MaterialRecord
+	{
+		uint32_t textured;
+		/// Indices into the texture records, or -1.
+		int32_t textures[2];
+		int32_t sampler;
+		float color[3];
+	};
+
+	struct LightRecord
+	{
+		uint32_t type;
+		float position[3], direction[3], ambient[3], diffuse[3], specular[3];
+		float constant, linear, quadratic, cutOff, outerCutOff;
+	};
+
+	struct CrowdRecord
+	{
+		float position[3], rotationY, scale[3];
+		/// Copied from the torus mesh.
+		float mainRadius, tubeRadius;
+		float fromDegrees, toDegrees;
+		uint32_t spectators;
+	};
+
+	/// A parsed text scene, in the order the binary stores it.
+	struct Description
+	{
+		std::vector<TextureRecord> textures;
+		std::vector<MeshRecord> meshes;
+		std::vector<MaterialRecord> materials;
+		std::vector<LightRecord> lights;
+		std::vector<CrowdRecord> crowds;
+		std::vector<glm::vec3> positions;
+		std::vector<float> rotations;
+		std::vector<glm::vec3> scales;
+		std::vector<uint32_t> meshIds, materialIds;
+		std::vector<uint8_t> flags;
+	};
+
+	static const char* magic() { return "STADSCN"; }
+
+	static bool isCurrentBinary(const std::string& binaryPath, const FileStamp& source)
+	{
+		Header header;
+		std::ifstream file(binaryPath.c_str(), std::ios::binary);
+		return file.read((char*)&header, sizeof(header)) && memcmp(header.magic, magic(), 8) == 0 && header.version == VERSION
+			&& header.source == source;
+	}
+
+	static bool inFile(uint64_t offset, uint64_t bytes, size_t fileSize)
+	{
+		return offset % 4 == 0 && offset <= fileSize && bytes <= fileSize - offset;
+	}
+
+	/// Checks that every section lies inside the file and every id is in range.
+	static bool validate(const Header* header, size_t fileSize)
+	{
+		if (fileSize < sizeof(Header) || memcmp(header->magic, magic(), 8) != 0 || header->version != VERSION || header->fileSize != fileSize)
+			return false;
+
+		const uint64_t n = header->entityCount;
+		if (!inFile(header->textures, header->textureCount * sizeof(TextureRecord), fileSize)
+			|| !inFile(header->meshes, header->meshCount * sizeof(MeshRecord), fileSize)
+			|| !inFile(header->materials, header->materialCount * sizeof(MaterialRecord), fileSize)
+			|| !inFile(header->lights, header->lightCount * sizeof(LightRecord), fileSize)
+			|| !inFile(header->crowds, header->crowdCount * sizeof(CrowdRecord), fileSize)
+			|| !inFile(header->positions, n * sizeof(glm::vec3), fileSize)
+			|| !inFile(header->rotations, n * sizeof(float), fileSize)
+			|| !inFile(header->scales, n * sizeof(glm::vec3), fileSize)
+			|| !inFile(header->meshIds, n * sizeof(uint32_t), fileSize)
+			|| !inFile(header->materialIds, n * sizeof(uint32_t), fileSize)
+			|| !inFile(header->flags, n, fileSize))
+			return false;
+
+		const unsigned char* data = (const unsigned char*)header;
+		const TextureRecord* textures = (const TextureRecord*)(data + header->textures);
+		for (uint32_t i = 0; i < header->textureCount; i++)
+			if (memchr(textures[i].path, 0, sizeof(textures[i].path)) == NULL)
+				return false;
+		const MeshRecord* meshes = (const MeshRecord*)(data + header->meshes);
+		for (uint32_t i = 0; i < header->meshCount; i++)
+			if (meshes[i].type > MESH_MODEL || memchr(meshes[i].path, 0, sizeof(meshes[i].path)) == NULL)
+				return false;
+		const MaterialRecord* materials = (const MaterialRecord*)(data + header->materials);
+		for (uint32_t i = 0; i < header->materialCount; i++)
+			for (int j = 0; j < 2; j++)
+				if (materials[i].textures[j] >= (int32_t)header->textureCount)
+					return false;
+		const LightRecord* lights = (const LightRecord*)(data + header->lights);
+		for (uint32_t i = 0; i < header->lightCount; i++)
+			if (lights[i].type > LIGHT_SPOT)
+				return false;
+
+		// one branch-free pass per array, so a corrupt file cannot index past the meshes or materials
+		const uint32_t* meshIds = (const uint32_t*)(data + header->meshIds);
+		const uint32_t* materialIds = (const uint32_t*)(data + header->materialIds);
+		uint32_t maxMesh = 0, maxMaterial = 0;
+		for (uint64_t i = 0; i < n; i++)
+		{
+			maxMesh = glm::max(maxMesh, meshIds[i]);
+			maxMaterial = glm::max(maxMaterial, materialIds[i]);
+		}
+		return n == 0 || (maxMesh < header->meshCount && maxMaterial < header->materialCount);
+	}
+
+	static int addMesh(Scene& scene, const MeshRecord& record, const std::string& source)
+	{
+		switch (record.type)
+		{
+		case MESH_PLANE:
+			return scene.addModel(Plane(), source);
+		case MESH_CUBE:
+			return scene.addModel(Cube(record.parameters[0], record.parameters[1]), source);
+		case MESH_PYRAMID:
+			return scene.addModel(Pyramid(), source);
+		case MESH_MODEL:
+			return scene.addModel(ImportedModel(record.path), source);
+		default:
+			return scene.addModel(Torus(record.parameters[0], record.parameters[1]), source);
+		}
+	}
+
+	/// Identifies what a mesh is built from: its record, and for a model the stamp of its file, so an edited
+	/// model is imported again.
+	static std::string meshSource(const MeshRecord& record)
+	{
+		std::ostringstream source;
+		source.precision(9);
+		source << record.type << ' ' << record.parameters[0] << ' ' << record.parameters[1];
+		if (record.type == MESH_MODEL)
+		{
+			const FileStamp model = MappedFile::stamp(record.path);
+			source << ' ' << record.path << ' ' << model.size << ' ' << model.modified;
+		}
+		return source.str();
+	}
+
+	static Light toLight(const LightRecord& record)
+	{
+		Light light;
+		light.type = (LightType)record.type;
+		light.position = glm::vec3(record.position[0], record.position[1], record.position[2]);
+		light.direction = glm::vec3(record.direction[0], record.direction[1], record.direction[2]);
+		light.ambient = glm::vec3(record.ambient[0], record.ambient[1], record.ambient[2]);
+		light.diffuse = glm::vec3(record.diffuse[0], record.diffuse[1], record.diffuse[2]);
+		light.specular = glm::vec3(record.specular[0], record.specular[1], record.specular[2]);
+		light.constant = record.constant;
+		light.linear = record.linear;
+		light.quadratic = record.quadratic;
+		light.cutOff = record.cutOff;
+		light.outerCutOff = record.outerCutOff;
+		return light;
+	}
+
+	static CrowdStand toCrowdStand(const CrowdRecord& record)
+	{
+		CrowdStand stand;
+		stand.position = glm::vec3(record.position[0], record.position[1], record.position[2]);
+		stand.rotationY = record.rotationY;
+		stand.scale = glm::vec3(record.scale[0], record.scale[1], record.scale[2]);
+		stand.mainRadius = record.mainRadius;
+		stand.tubeRadius = record.tubeRadius;
+		stand.fromDegrees = record.fromDegrees;
+		stand.toDegrees = record.toDegrees;
+		stand.spectators = record.spectators;
+		return stand;
+	}
+
+	static bool readVector(std::istringstream& line, float* out)
+	{
+		return (bool)(line >> out[0] >> out[1] >> out[2]);
+	}
+
+	static bool readVector(std::istringstream& line, glm::vec3& out)
+	{
+		return (bool)(line >> out.x >> out.y >> out.z);
+	}
+
+	static bool lookup(const std::map<std::string, int>& names, const std::string& name, int& index)
+	{
+		std::map<std::string, int>::const_iterator found = names.find(name);
+		if (found == names.end())
+			return false;
+		index = found->second;
+		return true;
+	}
+
+	static bool parse(const std::string& textPath, Description& description)
+	{
+		std::ifstream file(textPath.c_str());
+		if (!file)
+		{
+			std::cout << "ERROR::SCENE::CANNOT_OPEN: " << textPath << std::endl;
+			return false;
+		}
+
+		std::map<std::string, int> textures, meshes, materials;
+		std::string text;
+		for (int lineNumber = 1; std::getline(file, text); lineNumber++)
+		{
+			std::string::size_type comment = text.find('#');
+			if (comment != std::string::npos)
+				text.erase(comment);
+
+			std::istringstream line(text);
+			std::string keyword;
+			if (!(line >> keyword))
+				continue;
+
+			std::string error = parseRecord(keyword, line, description, textures, meshes, materials);
+			if (error.empty())
+			{
+				std::string rest;
+				if (line >> rest)
+					error = "unexpected '" + rest + "'";
+			}
+			if (!error.empty())
+			{
+				std::cout << "ERROR::SCENE::PARSE: " << textPath << ":" << lineNumber << ": " << error << std::endl;
+				return false;
+			}
+		}
+		return true;
+	}
+
+	/// Parses one record into description. Returns an error message, or an empty string on success.
+	static std::string parseRecord(const std::string& keyword, std::istringstream& line, Description& description,
+		std::map<std::string, int>& textures, std::map<std::string, int>& meshes, std::map<std::string, int>& materials)
+	{
+		if (keyword == "texture")
+		{
+			std::string name, path;
+			if (!(line >> name >> path))
+				return "expected: texture <name> <path>";
+			if (path.size() >= sizeof(TextureRecord().path))
+				return "texture path too long";
+
+			TextureRecord record;
+			memset(&record, 0, sizeof(record));
+			memcpy(record.path, path.c_str(), path.size());
+			textures[name] = (int)description.textures.size();
+			description.textures.push_back(record);
+			return "";
+		}
+
+		if (keyword == "mesh")
+		{
+			std::string name, type;
+			if (!(line >> name >> type))
+				return "expected: mesh <name> <type> ...";
+
+			MeshRecord record;
+			memset(&record, 0, sizeof(record));
+			if (type == "plane")
+				record.type = MESH_PLANE;
+			else if (type == "pyramid")
+				record.type = MESH_PYRAMID;
+			else if (type == "cube" || type == "torus")
+			{
+				record.type = type == "cube" ? MESH_CUBE : MESH_TORUS;
+				if (!(line >> record.parameters[0] >> record.parameters[1]))
+					return type == "cube" ? "expected: mesh <name> cube <textureScaleX> <textureScaleY>" : "expected: mesh <name> torus <mainRadius> <tubeRadius>";
+			}
+			else if (type == "model")
+			{
+				std::string path;
+				record.type = MESH_MODEL;
+				if (!(line >> path))
+					return "expected: mesh <name> model <path>";
+				if (path.size() >= sizeof(record.path))
+					return "model path too long";
+				memcpy(record.path, path.c_str(), path.size());
+			}
+			else
+				return "unknown mesh type '" + type + "'";
+
+			meshes[name] = (int)description.meshes.size();
+			description.meshes.push_back(record);
+			return "";
+		}
+
+		if (keyword == "material")
+		{
+			std::string name, type;
+			if (!(line >> name >> type))
+				return "expected: material <name> <type> ...";
+
+			MaterialRecord record;
+			memset(&record, 0, sizeof(record));
+			record.textures[0] = record.textures[1] = -1;
+			if (type == "color")
+			{
+				if (!readVector(line, record.color))
+					return "expected: material <name> color <r> <g> <b>";
+			}
+			else if (type == "textured")
+			{
+				std::string texture0, texture1;
+				record.textured = 1;
+				if (!(line >> texture0 >> texture1 >> record.sampler))
+					return "expected: material <name> textured <texture> <texture> <sampler>";
+				if (!lookup(textures, texture0, record.textures[0]) || !lookup(textures, texture1, record.textures[1]))
+					return "unknown texture";
+				if (record.sampler != 0 && record.sampler != 1)
+					return "sampler must be 0 or 1";
+			}
+			else
+				return "unknown material type '" + type + "'";
+
+			materials[name] = (int)description.materials.size();
+			description.materials.push_back(record);
+			return "";
+		}
+
+		if (keyword == "light")
+		{
+			std::string type;
+			LightRecord record;
+			memset(&record, 0, sizeof(record));
+			record.constant = 1.0f;
+			record.cutOff = record.outerCutOff = 1.0f;
+			if (!(line >> type))
+				return "expected: light <type> ...";
+
+			if (type == "directional")
+			{
+				record.type = LIGHT_DIRECTIONAL;
+				if (!readVector(line, record.direction) || !readVector(line, record.ambient) || !readVector(line, record.diffuse) || !readVector(line, record.specular))
+					return "expected: light directional <direction> <ambient> <diffuse> <specular>";
+			}
+			else if (type == "point")
+			{
+				record.type = LIGHT_POINT;
+				if (!readVector(line, record.position) || !readVector(line, record.ambient) || !readVector(line, record.diffuse) || !readVector(line, record.specular)
+					|| !(line >> record.constant >> record.linear >> record.quadratic))
+					return "expected: light point <position> <ambient> <diffuse> <specular> <constant> <linear> <quadratic>";
+			}
+			else if (type == "spot")
+			{
+				float cutOff, outerCutOff;
+				record.type = LIGHT_SPOT;
+				if (!readVector(line, record.ambient) || !readVector(line, record.diffuse) || !readVector(line, record.specular)
+					|| !(line >> record.constant >> record.linear >> record.quadratic >> cutOff >> outerCutOff))
+					return "expected: light spot <ambient> <diffuse> <specular> <constant> <linear> <quadratic> <cutOff> <outerCutOff>";
+				record.cutOff = glm::cos(glm::radians(cutOff));
+				record.outerCutOff = glm::cos(glm::radians(outerCutOff));
+			}
+			else
+				return "unknown light type '" + type + "'";
+
+			description.lights.push_back(record);
+			return "";
+		}
+
+		if (keyword == "entity")
+		{
+			std::string meshName, materialName;
+			int mesh, material;
+			glm::vec3 position, scale;
+			float rotation;
+			if (!(line >> meshName >> materialName) || !readVector(line, position) || !(line >> rotation) || !readVector(line, scale))
+				return "expected: entity <mesh> <material> <position> <rotationY> <scale> [flags]";
+			if (!lookup(meshes, meshName, mesh))
+				return "unknown mesh '" + meshName + "'";
+			if (!lookup(materials, materialName, material))
+				return "unknown material '" + materialName + "'";
+
+			uint8_t flags = 0;
+			std::string flag;
+			while (line >> flag)
+			{
+				if (flag == "casts-shadow")
+					flags |= ENTITY_CASTS_SHADOW;
+				else if (flag == "occluder")
+					flags |= ENTITY_OCCLUDER;
+				else if (flag == "occludable")
+					flags |= ENTITY_OCCLUDABLE;
+				else if (flag == "occlusion-query")
+					flags |= ENTITY_OCCLUSION_QUERY;
+				else
+					return "unknown entity flag '" + flag + "'";
+			}
+
+			description.positions.push_back(position);
+			description.rotations.push_back(rotation);
+			description.scales.push_back(scale);
+			description.meshIds.push_back((uint32_t)mesh);
+			description.materialIds.push_back((uint32_t)material);
+			description.flags.push_back(flags);
+			return "";
+		}
+
+		if (keyword == "crowd")
+		{
+			std::string meshName;
+			int mesh;
+			CrowdRecord record;
+			memset(&record, 0, sizeof(record));
+			if (!(line >> meshName) || !readVector(line, record.position) || !(line >> record.rotationY) || !readVector(line, record.scale)
+				|| !(line >> record.spectators >> record.fromDegrees >> record.toDegrees))
+				return "expected: crowd <torusMesh> <position> <rotationY> <scale> <spectators> <fromDegrees> <toDegrees>";
+			if (!lookup(meshes, meshName, mesh))
+				return "unknown mesh '" + meshName + "'";
+			if (description.meshes[mesh].type != MESH_TORUS)
+				return "crowd mesh '" + meshName + "' is not a torus";
+
+			record.mainRadius = description.meshes[mesh].parameters[0];
+			record.tubeRadius = description.meshes[mesh].parameters[1];
+			description.crowds.push_back(record);
+			return "";
+		}
+
+		return "unknown record '" + keyword + "'";
+	}
+
+	/// Appends an array to the file image at the next aligned offset, returning that offset.
+	template <typename T>
+	static uint64_t append(std::vector<char>& image, const std::vector<T>& items)
+	{
+		size_t offset = (image.size() + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+		image.resize(offset + items.size() * sizeof(T));
+		if (!items.empty())
+			memcpy(&image[offset], items.data(), items.size() * sizeof(T));
+		return offset;
+	}
+
+	static bool write(const std::string& binaryPath, const Description& description, const FileStamp& source)
+	{
+		std::vector<char> image(sizeof(Header));
+		Header header;
+		memset(&header, 0, sizeof(header));
+		memcpy(header.magic, magic(), 8);
+		header.version = VERSION;
+		header.textureCount = (uint32_t)description.textures.size();
+		header.meshCount = (uint32_t)description.meshes.size();
+		header.materialCount = (uint32_t)description.materials.size();
+		header.lightCount = (uint32_t)description.lights.size();
+		header.crowdCount = (uint32_t)description.crowds.size();
+		header.entityCount = (uint32_t)description.positions.size();
+		header.textures = append(image, description.textures);
+		header.meshes = append(image, description.meshes);
+		header.materials = append(image, description.materials);
+		header.lights = append(image, description.lights);
+		header.crowds = append(image, description.crowds);
+		header.positions = append(image, description.positions);
+		header.rotations = append(image, description.rotations);
+		header.scales = append(image, description.scales);
+		header.meshIds = append(image, description.meshIds);
+		header.materialIds = append(image, description.materialIds);
+		header.flags = append(image, description.flags);
+		header.source = source;
+		header.fileSize = image.size();
+		memcpy(&image[0], &header, sizeof(header));
+
+		// write to a temporary file and rename it, so a crash never leaves a truncated binary behind
+		std::string temporaryPath = binaryPath + ".tmp";
+		{
+			std::ofstream file(temporaryPath.c_str(), std::ios::binary | std::ios::trunc);
+			if (!file.write(image.data(), image.size()))
+			{
+				std::cout << "ERROR::SCENE::CANNOT_WRITE: " << binaryPath << std::endl;
+				return false;
+			}
+		}
+		std::remove(binaryPath.c_str());
+		if (std::rename(temporaryPath.c_str(), binaryPath.c_str()) != 0)
+		{
+			std::cout << "ERROR::SCENE::CANNOT_WRITE: " << binaryPath << std::endl;
+			return false;
+		}
+		return true;
+	}
+};
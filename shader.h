@@ -4,21 +4,153 @@
 #include <glad/glad.h>
 
 #include <glm/glm.hpp>
+#include "uniform_name.h"
+#include "gl_handle.h"
 
 #include <string>
+#include <vector>
+#include <algorithm>
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <utility>
 
 class Shader
 {
 public:
-	unsigned int ID;
-	Shader() { ID = 0;  }
+	Shader() { }
 	// constructor generates the shader on the fly
+	// defines is a block of #define lines inserted after each stage's #version line (see shader_variants.h)
 	// ------------------------------------------------------------------------
-	Shader(const char* vertexPath, const char* fragmentPath, const char* geometryPath = nullptr)
+	Shader(const char* vertexPath, const char* fragmentPath, const char* geometryPath = nullptr, const std::string& defines = "")
+		: m_vertexPath(vertexPath), m_fragmentPath(fragmentPath), m_geometryPath(geometryPath != nullptr ? geometryPath : ""), m_defines(defines)
 	{
+		bool linked;
+		m_program = build(linked);
+		m_uniforms.build(m_program.id());
+	}
+	// recompiles the program from its source files. The program is only replaced if the new one links and
+	// its uniform names hash apart, so a typo in a shader being edited leaves the last working program in
+	// place. Uniform values set on the old program are copied to the new one, so callers don't need to set
+	// their constant state again.
+	// ------------------------------------------------------------------------
+	bool reload()
+	{
+		bool linked;
+		GLProgram program = build(linked);
+		UniformTable uniforms;
+		if (!linked || !uniforms.build(program.id()))
+			return false;
+		copyUniforms(m_program.id(), program.id());
+		m_program = std::move(program);
+		m_uniforms = std::move(uniforms);
+		return true;
+	}
+	// true if path is one of the source files this program was built from
+	// ------------------------------------------------------------------------
+	bool usesFile(const std::string& path) const
+	{
+		return path == m_vertexPath || path == m_fragmentPath || (!m_geometryPath.empty() && path == m_geometryPath);
+	}
+	std::vector<std::string> sourceFiles() const
+	{
+		std::vector<std::string> files;
+		files.push_back(m_vertexPath);
+		files.push_back(m_fragmentPath);
+		if (!m_geometryPath.empty())
+			files.push_back(m_geometryPath);
+		return files;
+	}
+	// activate the shader
+	// ------------------------------------------------------------------------
+	void use()
+	{
+		glUseProgram(m_program.id());
+	}
+	// the program's name, for binding it directly
+	// ------------------------------------------------------------------------
+	GLuint id() const { return m_program.id(); }
+	// location of a uniform, looked up by the hash of its name; -1 if the program has none
+	// ------------------------------------------------------------------------
+	GLint location(UniformName name) const
+	{
+		return m_uniforms.location(name);
+	}
+	// utility uniform functions; names are hashed at compile time, see uniform_name.h
+	// ------------------------------------------------------------------------
+	void setBool(UniformName name, bool value) const
+	{
+		glUniform1i(m_uniforms.location(name), (int)value);
+	}
+	// ------------------------------------------------------------------------
+	void setInt(UniformName name, int value) const
+	{
+		glUniform1i(m_uniforms.location(name), value);
+	}
+	// ------------------------------------------------------------------------
+	void setFloat(UniformName name, float value) const
+	{
+		glUniform1f(m_uniforms.location(name), value);
+	}
+	// ------------------------------------------------------------------------
+	void setVec2(UniformName name, const glm::vec2 &value) const
+	{
+		glUniform2fv(m_uniforms.location(name), 1, &value[0]);
+	}
+	void setVec2(UniformName name, float x, float y) const
+	{
+		glUniform2f(m_uniforms.location(name), x, y);
+	}
+	// ------------------------------------------------------------------------
+	void setVec3(UniformName name, const glm::vec3 &value) const
+	{
+		glUniform3fv(m_uniforms.location(name), 1, &value[0]);
+	}
+	void setVec3(UniformName name, float x, float y, float z) const
+	{
+		glUniform3f(m_uniforms.location(name), x, y, z);
+	}
+	// ------------------------------------------------------------------------
+	void setVec4(UniformName name, const glm::vec4 &value) const
+	{
+		glUniform4fv(m_uniforms.location(name), 1, &value[0]);
+	}
+	void setVec4(UniformName name, float x, float y, float z, float w)
+	{
+		glUniform4f(m_uniforms.location(name), x, y, z, w);
+	}
+	// ------------------------------------------------------------------------
+	void setMat2(UniformName name, const glm::mat2 &mat) const
+	{
+		glUniformMatrix2fv(m_uniforms.location(name), 1, GL_FALSE, &mat[0][0]);
+	}
+	// ------------------------------------------------------------------------
+	void setMat3(UniformName name, const glm::mat3 &mat) const
+	{
+		glUniformMatrix3fv(m_uniforms.location(name), 1, GL_FALSE, &mat[0][0]);
+	}
+	// ------------------------------------------------------------------------
+	void setMat4(UniformName name, const glm::mat4 &mat) const
+	{
+		glUniformMatrix4fv(m_uniforms.location(name), 1, GL_FALSE, &mat[0][0]);
+	}
+
+private:
+	std::string m_vertexPath;
+	std::string m_fragmentPath;
+	std::string m_geometryPath;
+	std::string m_defines;
+	UniformTable m_uniforms;
+	GLProgram m_program;
+
+	// reads, compiles and links the source files, returning the new program
+	// ------------------------------------------------------------------------
+	GLProgram build(bool& linked)
+	{
+		const char* vertexPath = m_vertexPath.c_str();
+		const char* fragmentPath = m_fragmentPath.c_str();
+		const char* geometryPath = m_geometryPath.empty() ? nullptr : m_geometryPath.c_str();
+		linked = false;
 		// 1. retrieve the vertex/fragment source code from filePath
 		std::string vertexCode;
 		std::string fragmentCode;
@@ -59,6 +191,13 @@ public:
 		{
 			std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ" << std::endl;
 		}
+		if (!m_defines.empty())
+		{
+			vertexCode = injectDefines(vertexCode, m_defines);
+			fragmentCode = injectDefines(fragmentCode, m_defines);
+			if (geometryPath != nullptr)
+				geometryCode = injectDefines(geometryCode, m_defines);
+		}
 		const char* vShaderCode = vertexCode.c_str();
 		const char * fShaderCode = fragmentCode.c_str();
 		// 2. compile shaders
@@ -67,106 +206,119 @@ public:
 		vertex = glCreateShader(GL_VERTEX_SHADER);
 		glShaderSource(vertex, 1, &vShaderCode, NULL);
 		glCompileShader(vertex);
-		checkCompileErrors(vertex, "VERTEX");
+		bool compiled = checkCompileErrors(vertex, "VERTEX");
 		// fragment Shader
 		fragment = glCreateShader(GL_FRAGMENT_SHADER);
 		glShaderSource(fragment, 1, &fShaderCode, NULL);
 		glCompileShader(fragment);
-		checkCompileErrors(fragment, "FRAGMENT");
+		compiled = checkCompileErrors(fragment, "FRAGMENT") && compiled;
 		// if geometry shader is given, compile geometry shader
-		unsigned int geometry;
+		unsigned int geometry = 0;
 		if (geometryPath != nullptr)
 		{
 			const char * gShaderCode = geometryCode.c_str();
 			geometry = glCreateShader(GL_GEOMETRY_SHADER);
 			glShaderSource(geometry, 1, &gShaderCode, NULL);
 			glCompileShader(geometry);
-			checkCompileErrors(geometry, "GEOMETRY");
+			compiled = checkCompileErrors(geometry, "GEOMETRY") && compiled;
 		}
 		// shader Program
-		ID = glCreateProgram();
-		glAttachShader(ID, vertex);
-		glAttachShader(ID, fragment);
+		GLProgram program = GLProgram::create(m_vertexPath);
+		glAttachShader(program.id(), vertex);
+		glAttachShader(program.id(), fragment);
 		if (geometryPath != nullptr)
-			glAttachShader(ID, geometry);
-		glLinkProgram(ID);
-		checkCompileErrors(ID, "PROGRAM");
+			glAttachShader(program.id(), geometry);
+		glLinkProgram(program.id());
+		linked = checkCompileErrors(program.id(), "PROGRAM") && compiled;
 		// delete the shaders as they're linked into our program now and no longer necessery
 		glDeleteShader(vertex);
 		glDeleteShader(fragment);
 		if (geometryPath != nullptr)
 			glDeleteShader(geometry);
-
-	}
-	// activate the shader
-	// ------------------------------------------------------------------------
-	void use()
-	{
-		glUseProgram(ID);
-	}
-	// utility uniform functions
-	// ------------------------------------------------------------------------
-	void setBool(const std::string &name, bool value) const
-	{
-		glUniform1i(glGetUniformLocation(ID, name.c_str()), (int)value);
-	}
-	// ------------------------------------------------------------------------
-	void setInt(const std::string &name, int value) const
-	{
-		glUniform1i(glGetUniformLocation(ID, name.c_str()), value);
+		return program;
 	}
+	// copies the current value of every active uniform of from into the same-named uniform of to.
 	// ------------------------------------------------------------------------
-	void setFloat(const std::string &name, float value) const
+	static void copyUniforms(unsigned int from, unsigned int to)
 	{
-		glUniform1f(glGetUniformLocation(ID, name.c_str()), value);
-	}
-	// ------------------------------------------------------------------------
-	void setVec2(const std::string &name, const glm::vec2 &value) const
-	{
-		glUniform2fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
-	}
-	void setVec2(const std::string &name, float x, float y) const
-	{
-		glUniform2f(glGetUniformLocation(ID, name.c_str()), x, y);
-	}
-	// ------------------------------------------------------------------------
-	void setVec3(const std::string &name, const glm::vec3 &value) const
-	{
-		glUniform3fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
-	}
-	void setVec3(const std::string &name, float x, float y, float z) const
-	{
-		glUniform3f(glGetUniformLocation(ID, name.c_str()), x, y, z);
-	}
-	// ------------------------------------------------------------------------
-	void setVec4(const std::string &name, const glm::vec4 &value) const
-	{
-		glUniform4fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
-	}
-	void setVec4(const std::string &name, float x, float y, float z, float w)
-	{
-		glUniform4f(glGetUniformLocation(ID, name.c_str()), x, y, z, w);
-	}
-	// ------------------------------------------------------------------------
-	void setMat2(const std::string &name, const glm::mat2 &mat) const
-	{
-		glUniformMatrix2fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
-	}
-	// ------------------------------------------------------------------------
-	void setMat3(const std::string &name, const glm::mat3 &mat) const
-	{
-		glUniformMatrix3fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+		GLint previous = 0;
+		glGetIntegerv(GL_CURRENT_PROGRAM, &previous);
+		glUseProgram(to);
+
+		GLint count = 0;
+		glGetProgramiv(from, GL_ACTIVE_UNIFORMS, &count);
+		for (GLint i = 0; i < count; i++)
+		{
+			GLchar name[256];
+			GLsizei length = 0;
+			GLint size = 0;
+			GLenum type = 0;
+			glGetActiveUniform(from, (GLuint)i, sizeof(name), &length, &size, &type, name);
+
+			// arrays are reported once as "name[0]"; copy each element
+			std::string base(name, length);
+			if (size > 1 && base.size() > 3 && base.compare(base.size() - 3, 3, "[0]") == 0)
+				base.erase(base.size() - 3);
+			for (GLint element = 0; element < size; element++)
+			{
+				std::string elementName = size > 1 ? base + "[" + std::to_string(element) + "]" : base;
+				GLint source = glGetUniformLocation(from, elementName.c_str());
+				GLint target = glGetUniformLocation(to, elementName.c_str());
+				if (source < 0 || target < 0)
+					continue;
+
+				GLfloat f[16];
+				GLint n[4];
+				GLuint u[4];
+				switch (type)
+				{
+				case GL_FLOAT: glGetUniformfv(from, source, f); glUniform1fv(target, 1, f); break;
+				case GL_FLOAT_VEC2: glGetUniformfv(from, source, f); glUniform2fv(target, 1, f); break;
+				case GL_FLOAT_VEC3: glGetUniformfv(from, source, f); glUniform3fv(target, 1, f); break;
+				case GL_FLOAT_VEC4: glGetUniformfv(from, source, f); glUniform4fv(target, 1, f); break;
+				case GL_FLOAT_MAT2: glGetUniformfv(from, source, f); glUniformMatrix2fv(target, 1, GL_FALSE, f); break;
+				case GL_FLOAT_MAT3: glGetUniformfv(from, source, f); glUniformMatrix3fv(target, 1, GL_FALSE, f); break;
+				case GL_FLOAT_MAT4: glGetUniformfv(from, source, f); glUniformMatrix4fv(target, 1, GL_FALSE, f); break;
+				case GL_FLOAT_MAT2x3: glGetUniformfv(from, source, f); glUniformMatrix2x3fv(target, 1, GL_FALSE, f); break;
+				case GL_FLOAT_MAT2x4: glGetUniformfv(from, source, f); glUniformMatrix2x4fv(target, 1, GL_FALSE, f); break;
+				case GL_FLOAT_MAT3x2: glGetUniformfv(from, source, f); glUniformMatrix3x2fv(target, 1, GL_FALSE, f); break;
+				case GL_FLOAT_MAT3x4: glGetUniformfv(from, source, f); glUniformMatrix3x4fv(target, 1, GL_FALSE, f); break;
+				case GL_FLOAT_MAT4x2: glGetUniformfv(from, source, f); glUniformMatrix4x2fv(target, 1, GL_FALSE, f); break;
+				case GL_FLOAT_MAT4x3: glGetUniformfv(from, source, f); glUniformMatrix4x3fv(target, 1, GL_FALSE, f); break;
+				// bool vectors are set through the int calls
+				case GL_INT_VEC2: case GL_BOOL_VEC2: glGetUniformiv(from, source, n); glUniform2iv(target, 1, n); break;
+				case GL_INT_VEC3: case GL_BOOL_VEC3: glGetUniformiv(from, source, n); glUniform3iv(target, 1, n); break;
+				case GL_INT_VEC4: case GL_BOOL_VEC4: glGetUniformiv(from, source, n); glUniform4iv(target, 1, n); break;
+				case GL_UNSIGNED_INT: glGetUniformuiv(from, source, u); glUniform1uiv(target, 1, u); break;
+				case GL_UNSIGNED_INT_VEC2: glGetUniformuiv(from, source, u); glUniform2uiv(target, 1, u); break;
+				case GL_UNSIGNED_INT_VEC3: glGetUniformuiv(from, source, u); glUniform3uiv(target, 1, u); break;
+				case GL_UNSIGNED_INT_VEC4: glGetUniformuiv(from, source, u); glUniform4uiv(target, 1, u); break;
+				default:
+					// int, bool and all sampler types are a single integer
+					glGetUniformiv(from, source, n); glUniform1iv(target, 1, n); break;
+				}
+			}
+		}
+
+		glUseProgram((GLuint)previous);
 	}
+	// inserts defines after the #version directive, which GLSL requires to be the first statement.
 	// ------------------------------------------------------------------------
-	void setMat4(const std::string &name, const glm::mat4 &mat) const
+	static std::string injectDefines(const std::string& source, const std::string& defines)
 	{
-		glUniformMatrix4fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+		std::string::size_type version = source.find("#version");
+		if (version == std::string::npos)
+			return defines + source;
+		std::string::size_type lineEnd = source.find('\n', version);
+		if (lineEnd == std::string::npos)
+			return source + "\n" + defines;
+		// keep compiler error line numbers pointing at the file on disk
+		int nextLine = 2 + (int)std::count(source.begin(), source.begin() + lineEnd, '\n');
+		return source.substr(0, lineEnd + 1) + defines + "#line " + std::to_string(nextLine) + "\n" + source.substr(lineEnd + 1);
 	}
-
-private:
 	// utility function for checking shader compilation/linking errors.
 	// ------------------------------------------------------------------------
-	void checkCompileErrors(GLuint shader, std::string type)
+	bool checkCompileErrors(GLuint shader, std::string type)
 	{
 		GLint success;
 		GLchar infoLog[1024];
@@ -188,6 +340,7 @@ private:
 				std::cout << "ERROR::PROGRAM_LINKING_ERROR of type: " << type << "\n" << infoLog << "\n -- --------------------------------------------------- -- " << std::endl;
 			}
 		}
+		return success != 0;
 	}
 };
 #endif
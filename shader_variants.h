@@ -0,0 +1,93 @@
+#pragma once
+
+#include "shader.h"
+#include "file_watcher.h"
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+/// Identifies one specialisation of a shader source. Every field turns into a #define that is injected
+/// ahead of the source, so branches a variant does not need are stripped by the GLSL compiler instead of
+/// being evaluated per fragment.
+struct ShaderKey
+{
+	bool textured;
+	int pointLights;
+	bool spotLight;
+	bool shadows;
+
+	ShaderKey(bool textured = false, int pointLights = 1, bool spotLight = true, bool shadows = false)
+		: textured(textured), pointLights(pointLights), spotLight(spotLight), shadows(shadows) { }
+
+	/// Packs the key into a single integer used to look up the variant cache.
+	unsigned int packed() const
+	{
+		return (textured ? 1u : 0u) | (spotLight ? 2u : 0u) | (shadows ? 4u : 0u) | ((unsigned int)pointLights << 8);
+	}
+
+	std::string defines() const
+	{
+		std::string result;
+		if (textured)
+			result += "#define TEXTURED\n";
+		result += "#define NR_POINT_LIGHTS " + std::to_string(pointLights) + "\n";
+		if (spotLight)
+			result += "#define SPOT_LIGHT\n";
+		if (shadows)
+			result += "#define SHADOWS\n";
+		return result;
+	}
+};
+
+/// A set of programs built from one vertex/fragment source pair. Variants are compiled the first time
+/// they are requested and cached by key; the returned references stay valid for the lifetime of the set.
+class ShaderVariants
+{
+public:
+	ShaderVariants() { }
+	ShaderVariants(const char* vertexPath, const char* fragmentPath)
+		: m_vertexPath(vertexPath), m_fragmentPath(fragmentPath) { }
+
+	Shader& get(const ShaderKey& key)
+	{
+		std::unordered_map<unsigned int, Shader>::iterator it = m_variants.find(key.packed());
+		if (it != m_variants.end())
+			return it->second;
+
+		Shader& shader = m_variants[key.packed()];
+		shader = Shader(m_vertexPath.c_str(), m_fragmentPath.c_str(), nullptr, key.defines());
+		return shader;
+	}
+
+	size_t size() const { return m_variants.size(); }
+
+	/// Registers the shared source files with watcher, so their edits show up in watcher.poll().
+	void watch(FileWatcher& watcher) const
+	{
+		watcher.watch(m_vertexPath);
+		watcher.watch(m_fragmentPath);
+	}
+
+	/// Recompiles every compiled variant built from one of changedPaths. A variant that fails to compile
+	/// keeps running its previous program. Returns the number of variants that were replaced.
+	int reload(const std::vector<std::string>& changedPaths)
+	{
+		int reloaded = 0;
+		for (std::unordered_map<unsigned int, Shader>::iterator it = m_variants.begin(); it != m_variants.end(); ++it)
+		{
+			bool affected = false;
+			for (size_t i = 0; i < changedPaths.size(); i++)
+				affected = affected || it->second.usesFile(changedPaths[i]);
+
+			if (affected && it->second.reload())
+				reloaded++;
+		}
+		return reloaded;
+	}
+
+private:
+	std::string m_vertexPath;
+	std::string m_fragmentPath;
+	std::unordered_map<unsigned int, Shader> m_variants;
+};
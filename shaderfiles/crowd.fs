@@ -0,0 +1,18 @@
+#version 330 core
+// Flat-shaded spectators (see crowd.vs): the figures are a few boxes, so the face normal is taken from the
+// screen-space derivatives of the position instead of being stored per vertex.
+out vec4 FragColor;
+
+in vec3 FragPos;
+in vec3 Color;
+
+uniform vec3 lightDirection;
+uniform vec3 lightAmbient;
+uniform vec3 lightDiffuse;
+
+void main()
+{
+    vec3 normal = normalize(cross(dFdx(FragPos), dFdy(FragPos)));
+    float diffuse = max(dot(normal, -normalize(lightDirection)), 0.0);
+    FragColor = vec4(Color * (lightAmbient + lightDiffuse * diffuse), 1.0);
+}
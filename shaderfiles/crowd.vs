@@ -0,0 +1,49 @@
+#version 330 core
+// Spectators of the crowd pass (see crowd.h), all drawn by one instanced call. Each instance is a seat:
+// where it is, which way it faces, the seat spacing that sizes the figure, and a shirt colour with an
+// animation phase in alpha. Everything that moves is computed here, so the CPU cost of the crowd is one
+// uniform and one draw whatever its size.
+layout (location = 0) in vec3 aPos;
+// 1 for the head, 0 for the body
+layout (location = 1) in float aHead;
+layout (location = 2) in vec3 aSeat;
+// radians / pi; the figure's +z turns to face this way
+layout (location = 3) in float aFacing;
+layout (location = 4) in float aSize;
+layout (location = 5) in vec4 aColorPhase;
+
+out vec3 FragPos;
+out vec3 Color;
+
+uniform mat4 view;
+uniform mat4 projection;
+uniform float time;
+
+const float PI = 3.14159265;
+// radians of azimuth per second the wave travels around the stand, and its width
+const float WAVE_SPEED = 0.8;
+const float WAVE_SHARPNESS = 24.0;
+const vec3 SKIN = vec3(0.80, 0.62, 0.50);
+
+void main()
+{
+    float facing = aFacing * PI;
+    float phase = aColorPhase.a * 2.0 * PI;
+
+    // the seat faces the middle of the stand, so its azimuth around it is the opposite way
+    float wave = pow(max(cos(facing + PI - time * WAVE_SPEED), 0.0), WAVE_SHARPNESS);
+    // everyone shifts about a little, each at their own pace
+    float fidget = 0.04 * sin(time * (2.0 + aColorPhase.a) + phase);
+
+    vec3 figure = aPos;
+    figure.y *= 1.0 + 0.35 * wave;
+    figure.y += 0.45 * wave + fidget * (1.0 - wave);
+    figure.x *= 1.0 - 0.15 * wave * aHead;
+
+    float s = sin(facing), c = cos(facing);
+    vec3 turned = vec3(c * figure.x + s * figure.z, figure.y, -s * figure.x + c * figure.z);
+    FragPos = aSeat + turned * aSize;
+    Color = mix(aColorPhase.rgb, SKIN, aHead);
+
+    gl_Position = projection * view * vec4(FragPos, 1.0);
+}
@@ -0,0 +1,15 @@
+#version 330 core
+// Depth-only pass drawing the major occluders into the Hi-Z pyramid's base level (see occlusion.h).
+// Vertices are packed as in vertex_format.h; aPositionQuantization maps positions back to model space. The
+// query boxes leave attribute 3 disabled, so it reads (0, 0, 0, 1) and their float corners pass unchanged.
+layout (location = 0) in vec3 aPos;
+layout (location = 3) in vec4 aPositionQuantization;
+
+uniform mat4 model;
+uniform mat4 viewProjection;
+
+void main()
+{
+    vec3 position = aPositionQuantization.xyz + aPos * aPositionQuantization.w;
+    gl_Position = viewProjection * model * vec4(position, 1.0);
+}
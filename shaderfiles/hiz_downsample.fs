@@ -0,0 +1,17 @@
+#version 330 core
+// Builds one level of the Hi-Z pyramid: each texel keeps the farthest of the four depths below it, so a
+// box whose nearest point is behind that value is hidden by everything the texel covers.
+
+// TEXTURE_BASE_LEVEL is set to the source level while each level is built, so level 0 below is the
+// source level, not the base of the pyramid.
+uniform sampler2D depthPyramid;
+
+void main()
+{
+    ivec2 source = ivec2(gl_FragCoord.xy) * 2;
+    float d0 = texelFetch(depthPyramid, source, 0).r;
+    float d1 = texelFetch(depthPyramid, source + ivec2(1, 0), 0).r;
+    float d2 = texelFetch(depthPyramid, source + ivec2(0, 1), 0).r;
+    float d3 = texelFetch(depthPyramid, source + ivec2(1, 1), 0).r;
+    gl_FragDepth = max(max(d0, d1), max(d2, d3));
+}
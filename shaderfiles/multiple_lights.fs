@@ -1,15 +1,30 @@
 #version 330 core
+// This file is specialised by ShaderVariants (see shader_variants.h), which injects these defines
+// right after the #version line:
+//   TEXTURED        - material is a pair of sampler2Ds instead of flat colours
+//   NR_POINT_LIGHTS - number of point lights, 0 removes the point light phase entirely
+//   SPOT_LIGHT      - camera flashlight is evaluated
+//   SHADOWS         - the directional light is shadowed
 out vec4 FragColor;
 
+#ifndef NR_POINT_LIGHTS
+#define NR_POINT_LIGHTS 1
+#endif
+
 struct Material {
+#ifdef TEXTURED
     sampler2D diffuse;
     sampler2D specular;
+#else
+    vec3 diffuse;
+    vec3 specular;
+#endif
     float shininess;
-}; 
+};
 
 struct DirLight {
     vec3 direction;
-	
+
     vec3 ambient;
     vec3 diffuse;
     vec3 specular;
@@ -17,11 +32,11 @@ struct DirLight {
 
 struct PointLight {
     vec3 position;
-    
+
     float constant;
     float linear;
     float quadratic;
-	
+
     vec3 ambient;
     vec3 diffuse;
     vec3 specular;
@@ -32,39 +47,64 @@ struct SpotLight {
     vec3 direction;
     float cutOff;
     float outerCutOff;
-  
+
     float constant;
     float linear;
     float quadratic;
-  
+
     vec3 ambient;
     vec3 diffuse;
-    vec3 specular;       
+    vec3 specular;
 };
 
-#define NR_POINT_LIGHTS 1
-
 in vec3 FragPos;
 in vec3 Normal;
+#ifdef TEXTURED
 in vec2 TexCoords;
+#endif
 
 uniform vec3 viewPos;
 uniform DirLight dirLight;
+#if NR_POINT_LIGHTS > 0
 uniform PointLight pointLights[NR_POINT_LIGHTS];
+#endif
+#ifdef SPOT_LIGHT
 uniform SpotLight spotLight;
+#endif
 uniform Material material;
 
+#ifdef SHADOWS
+// must match SHADOW_CASCADES in shadows.h
+#define MAX_CASCADES 4
+#define SHADOW_BIAS 0.0005
+
+uniform sampler2DArrayShadow shadowMap;
+uniform mat4 lightSpaceMatrices[MAX_CASCADES];
+uniform int cascadeCount;
+
+float CalcShadow(vec3 fragPos);
+#endif
+
 // function prototypes
-vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir);
-vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir);
-vec3 CalcSpotLight(SpotLight light, vec3 normal, vec3 fragPos, vec3 viewDir);
+vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir, vec3 diffuseColor, vec3 specularColor, float visibility);
+vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir, vec3 diffuseColor, vec3 specularColor);
+vec3 CalcSpotLight(SpotLight light, vec3 normal, vec3 fragPos, vec3 viewDir, vec3 diffuseColor, vec3 specularColor);
 
 void main()
-{    
+{
     // properties
     vec3 norm = normalize(Normal);
     vec3 viewDir = normalize(viewPos - FragPos);
-    
+
+    // the material is fetched once here rather than once per light
+#ifdef TEXTURED
+    vec3 diffuseColor = vec3(texture(material.diffuse, TexCoords));
+    vec3 specularColor = vec3(texture(material.specular, TexCoords));
+#else
+    vec3 diffuseColor = material.diffuse;
+    vec3 specularColor = material.specular;
+#endif
+
     // == =====================================================
     // Our lighting is set up in 3 phases: directional, point lights and an optional flashlight
     // For each phase, a calculate function is defined that calculates the corresponding color
@@ -72,18 +112,52 @@ void main()
     // this fragment's final color.
     // == =====================================================
     // phase 1: directional lighting
-    vec3 result = CalcDirLight(dirLight, norm, viewDir);
+#ifdef SHADOWS
+    float visibility = CalcShadow(FragPos);
+#else
+    float visibility = 1.0;
+#endif
+    vec3 result = CalcDirLight(dirLight, norm, viewDir, diffuseColor, specularColor, visibility);
     // phase 2: point lights
+#if NR_POINT_LIGHTS > 0
     for(int i = 0; i < NR_POINT_LIGHTS; i++)
-        result += CalcPointLight(pointLights[i], norm, FragPos, viewDir);    
+        result += CalcPointLight(pointLights[i], norm, FragPos, viewDir, diffuseColor, specularColor);
+#endif
     // phase 3: spot light
-    result += CalcSpotLight(spotLight, norm, FragPos, viewDir);    
-    
+#ifdef SPOT_LIGHT
+    result += CalcSpotLight(spotLight, norm, FragPos, viewDir, diffuseColor, specularColor);
+#endif
+
     FragColor = vec4(result, 1.0);
 }
 
+#ifdef SHADOWS
+// returns how much of the directional light reaches fragPos: 0 is fully in shadow, 1 is fully lit.
+// Cascades are tried nearest first; the first one whose map covers the fragment is used, which stays
+// correct while far cascades are only re-rendered every few frames.
+float CalcShadow(vec3 fragPos)
+{
+    for (int i = 0; i < cascadeCount; i++)
+    {
+        vec4 lightSpace = lightSpaceMatrices[i] * vec4(fragPos, 1.0);
+        vec3 coords = lightSpace.xyz / lightSpace.w * 0.5 + 0.5;
+        if (all(greaterThan(coords.xy, vec2(0.01))) && all(lessThan(coords.xy, vec2(0.99))) && coords.z < 1.0)
+        {
+            // 3x3 PCF; every tap is a hardware depth comparison
+            vec2 texelSize = 1.0 / vec2(textureSize(shadowMap, 0).xy);
+            float lit = 0.0;
+            for (int x = -1; x <= 1; x++)
+                for (int y = -1; y <= 1; y++)
+                    lit += texture(shadowMap, vec4(coords.xy + vec2(x, y) * texelSize, float(i), coords.z - SHADOW_BIAS));
+            return lit / 9.0;
+        }
+    }
+    return 1.0;
+}
+#endif
+
 // calculates the color when using a directional light.
-vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir)
+vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir, vec3 diffuseColor, vec3 specularColor, float visibility)
 {
     vec3 lightDir = normalize(-light.direction);
     // diffuse shading
@@ -92,14 +166,14 @@ vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir)
     vec3 reflectDir = reflect(-lightDir, normal);
     float spec = pow(max(dot(viewDir, reflectDir), 0.0), material.shininess);
     // combine results
-    vec3 ambient = light.ambient * vec3(texture(material.diffuse, TexCoords));
-    vec3 diffuse = light.diffuse * diff * vec3(texture(material.diffuse, TexCoords));
-    vec3 specular = light.specular * spec * vec3(texture(material.specular, TexCoords));
-    return (ambient + diffuse + specular);
+    vec3 ambient = light.ambient * diffuseColor;
+    vec3 diffuse = light.diffuse * diff * diffuseColor;
+    vec3 specular = light.specular * spec * specularColor;
+    return (ambient + visibility * (diffuse + specular));
 }
 
 // calculates the color when using a point light.
-vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir)
+vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir, vec3 diffuseColor, vec3 specularColor)
 {
     vec3 lightDir = normalize(light.position - fragPos);
     // diffuse shading
@@ -109,11 +183,11 @@ vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir)
     float spec = pow(max(dot(viewDir, reflectDir), 0.0), material.shininess);
     // attenuation
     float distance = length(light.position - fragPos);
-    float attenuation = 1.0 / (light.constant + light.linear * distance + light.quadratic * (distance * distance));    
+    float attenuation = 1.0 / (light.constant + light.linear * distance + light.quadratic * (distance * distance));
     // combine results
-    vec3 ambient = light.ambient * vec3(texture(material.diffuse, TexCoords));
-    vec3 diffuse = light.diffuse * diff * vec3(texture(material.diffuse, TexCoords));
-    vec3 specular = light.specular * spec * vec3(texture(material.specular, TexCoords));
+    vec3 ambient = light.ambient * diffuseColor;
+    vec3 diffuse = light.diffuse * diff * diffuseColor;
+    vec3 specular = light.specular * spec * specularColor;
     ambient *= attenuation;
     diffuse *= attenuation;
     specular *= attenuation;
@@ -121,7 +195,7 @@ vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir)
 }
 
 // calculates the color when using a spot light.
-vec3 CalcSpotLight(SpotLight light, vec3 normal, vec3 fragPos, vec3 viewDir)
+vec3 CalcSpotLight(SpotLight light, vec3 normal, vec3 fragPos, vec3 viewDir, vec3 diffuseColor, vec3 specularColor)
 {
     vec3 lightDir = normalize(light.position - fragPos);
     // diffuse shading
@@ -131,17 +205,17 @@ vec3 CalcSpotLight(SpotLight light, vec3 normal, vec3 fragPos, vec3 viewDir)
     float spec = pow(max(dot(viewDir, reflectDir), 0.0), material.shininess);
     // attenuation
     float distance = length(light.position - fragPos);
-    float attenuation = 1.0 / (light.constant + light.linear * distance + light.quadratic * (distance * distance));    
+    float attenuation = 1.0 / (light.constant + light.linear * distance + light.quadratic * (distance * distance));
     // spotlight intensity
-    float theta = dot(lightDir, normalize(-light.direction)); 
+    float theta = dot(lightDir, normalize(-light.direction));
     float epsilon = light.cutOff - light.outerCutOff;
     float intensity = clamp((theta - light.outerCutOff) / epsilon, 0.0, 1.0);
     // combine results
-    vec3 ambient = light.ambient * vec3(texture(material.diffuse, TexCoords));
-    vec3 diffuse = light.diffuse * diff * vec3(texture(material.diffuse, TexCoords));
-    vec3 specular = light.specular * spec * vec3(texture(material.specular, TexCoords));
+    vec3 ambient = light.ambient * diffuseColor;
+    vec3 diffuse = light.diffuse * diff * diffuseColor;
+    vec3 specular = light.specular * spec * specularColor;
     ambient *= attenuation * intensity;
     diffuse *= attenuation * intensity;
     specular *= attenuation * intensity;
     return (ambient + diffuse + specular);
-}
\ No newline at end of file
+}
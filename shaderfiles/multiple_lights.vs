@@ -1,21 +1,42 @@
 #version 330 core
+// TEXTURED is injected by ShaderVariants when the variant samples a diffuse/specular map.
+// Vertices are packed as in vertex_format.h: positions on a per-mesh grid, mapped back by
+// aPositionQuantization (offset, step), which is the same for every vertex and instance of the mesh, and
+// octahedral normals scaled by 32767.
 layout (location = 0) in vec3 aPos;
-layout (location = 1) in vec3 aNormal;
+layout (location = 1) in vec2 aNormal;
+#ifdef TEXTURED
 layout (location = 2) in vec2 aTexCoords;
+#endif
+layout (location = 3) in vec4 aPositionQuantization;
 
 out vec3 FragPos;
 out vec3 Normal;
+#ifdef TEXTURED
 out vec2 TexCoords;
+#endif
 
 uniform mat4 model;
 uniform mat4 view;
 uniform mat4 projection;
 
+vec3 decodeOctahedral(vec2 encoded)
+{
+    vec3 n = vec3(encoded, 1.0 - abs(encoded.x) - abs(encoded.y));
+    float t = max(-n.z, 0.0);
+    n.x += n.x >= 0.0 ? -t : t;
+    n.y += n.y >= 0.0 ? -t : t;
+    return normalize(n);
+}
+
 void main()
 {
-    FragPos = vec3(model * vec4(aPos, 1.0));
-    Normal = mat3(transpose(inverse(model))) * aNormal;  
+    vec3 position = aPositionQuantization.xyz + aPos * aPositionQuantization.w;
+    FragPos = vec3(model * vec4(position, 1.0));
+    Normal = mat3(transpose(inverse(model))) * decodeOctahedral(aNormal / 32767.0);  
+#ifdef TEXTURED
     TexCoords = aTexCoords;
+#endif
     
     gl_Position = projection * view * vec4(FragPos, 1.0);
 }
\ No newline at end of file
@@ -0,0 +1,6 @@
+#version 330 core
+// Depth is written by the fixed-function pipeline; nothing to shade.
+
+void main()
+{
+}
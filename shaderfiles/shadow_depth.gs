@@ -0,0 +1,23 @@
+#version 330 core
+// Routes each triangle to the cascade layer chosen in shadow_depth.vs and projects it with that
+// cascade's light matrix. GL 3.3 can only write gl_Layer from a geometry shader.
+layout (triangles) in;
+layout (triangle_strip, max_vertices = 3) out;
+
+#define MAX_CASCADES 4
+
+uniform mat4 lightSpaceMatrices[MAX_CASCADES];
+
+flat in int vCascade[];
+
+void main()
+{
+    int cascade = vCascade[0];
+    for (int i = 0; i < 3; i++)
+    {
+        gl_Layer = cascade;
+        gl_Position = lightSpaceMatrices[cascade] * gl_in[i].gl_Position;
+        EmitVertex();
+    }
+    EndPrimitive();
+}
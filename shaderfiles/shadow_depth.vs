@@ -0,0 +1,19 @@
+#version 330 core
+// Depth-only pass for CascadedShadowMap (see shadows.h). Each instance of a draw renders the mesh into
+// one cascade; cascadeIndices maps the instance to the texture array layer it belongs to.
+// Vertices are packed as in vertex_format.h; aPositionQuantization maps positions back to model space.
+layout (location = 0) in vec3 aPos;
+layout (location = 3) in vec4 aPositionQuantization;
+
+#define MAX_CASCADES 4
+
+uniform mat4 model;
+uniform int cascadeIndices[MAX_CASCADES];
+
+flat out int vCascade;
+
+void main()
+{
+    vCascade = cascadeIndices[gl_InstanceID];
+    gl_Position = model * vec4(aPositionQuantization.xyz + aPos * aPositionQuantization.w, 1.0);
+}
@@ -0,0 +1,38 @@
+#version 330 core
+// Stretches the scene, drawn into the lower left sourceSize pixels of scene, over the window, and sharpens
+// it to win back some of the detail the lower resolution lost. The sharpening is contrast adaptive: each
+// pixel is pushed away from its four neighbours, less where they already differ a lot, so edges do not
+// ring and flat areas do not pick up noise.
+out vec4 FragColor;
+
+uniform sampler2D scene;
+// pixels of scene drawn this frame, and the size of the window
+uniform vec2 sourceSize;
+uniform vec2 outputSize;
+// 0 leaves the bilinear upscale as it is; 1 sharpens as much as the filter allows
+uniform float sharpness;
+
+vec3 source(vec2 position)
+{
+    // stay half a texel inside the drawn area, so the undrawn texels around it never bleed in
+    position = clamp(position, vec2(0.5), sourceSize - 0.5);
+    return texture(scene, position / vec2(textureSize(scene, 0))).rgb;
+}
+
+void main()
+{
+    vec2 position = gl_FragCoord.xy * sourceSize / outputSize;
+    vec3 center = source(position);
+    vec3 left = source(position - vec2(1.0, 0.0));
+    vec3 right = source(position + vec2(1.0, 0.0));
+    vec3 down = source(position - vec2(0.0, 1.0));
+    vec3 up = source(position + vec2(0.0, 1.0));
+
+    vec3 lowest = min(center, min(min(left, right), min(down, up)));
+    vec3 highest = max(center, max(max(left, right), max(down, up)));
+    vec3 amplitude = sqrt(clamp(min(lowest, 1.0 - highest) / max(highest, 1.0 / 256.0), 0.0, 1.0));
+    vec3 weight = -amplitude * sharpness / 5.0;
+
+    vec3 color = (center + weight * (left + right + down + up)) / (1.0 + 4.0 * weight);
+    FragColor = vec4(clamp(color, 0.0, 1.0), 1.0);
+}
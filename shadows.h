@@ -0,0 +1,269 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include "shader.h"
+#include "gl_handle.h"
+
+#include <cmath>
+
+/// Number of cascades; must match MAX_CASCADES in multiple_lights.fs and shadow_depth.*.
+const int SHADOW_CASCADES = 4;
+
+/// Cascaded shadow maps for the directional light.
+///
+/// The camera frustum, up to shadowDistance, is split into SHADOW_CASCADES slices using the practical split
+/// scheme. Each slice is enclosed in a bounding sphere, so a cascade's size does not change as the camera
+/// turns, and its centre is snapped to whole shadow map texels in light space, so static geometry does not
+/// shimmer as the camera moves.
+///
+/// All cascades live in the layers of one depth texture array. Casters are drawn once per frame with one
+/// instance per cascade being updated (see shadow_depth.gs). Far cascades cover more of the scene at lower
+/// resolution and change little from frame to frame, so they are re-rendered less often: cascade i is
+/// updated every updateInterval(i) frames, staggered so the far cascades never fall on the same frame.
+/// A cascade keeps the matrix it was last rendered with until its next update.
+
+class CascadedShadowMap
+{
+public:
+	/// Depth offset of the casters, as glPolygonOffset() takes it.
+	static constexpr float POLYGON_OFFSET_FACTOR = 2.0f;
+	static constexpr float POLYGON_OFFSET_UNITS = 4.0f;
+
+	CascadedShadowMap() { }
+
+	CascadedShadowMap(int resolution, float shadowDistance)
+	{
+		m_resolution = resolution;
+		m_shadowDistance = shadowDistance;
+
+		m_depthTexture = GLTexture::create("shadows");
+		glBindTexture(GL_TEXTURE_2D_ARRAY, m_depthTexture.id());
+		glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT24, resolution, resolution, SHADOW_CASCADES, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+
+		m_FBO = GLFramebuffer::create("shadows");
+		glBindFramebuffer(GL_FRAMEBUFFER, m_FBO.id());
+		glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, m_depthTexture.id(), 0);
+		glDrawBuffer(GL_NONE);
+		glReadBuffer(GL_NONE);
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+		for (int i = 0; i < TIMER_QUERIES; i++)
+			m_timerQueries[i] = GLQuery::create("shadows");
+		GpuResources::resize(GPU_TEXTURE, m_depthTexture.id(), GpuResources::imageBytes(GL_DEPTH_COMPONENT24, resolution, resolution, SHADOW_CASCADES));
+
+		m_depthShader = Shader("shaderfiles/shadow_depth.vs", "shaderfiles/shadow_depth.fs", "shaderfiles/shadow_depth.gs");
+	}
+
+	/// Cascade 0 is updated every frame, cascade 1 every frame, cascade 2 every second frame and cascade 3 every fourth.
+	static int updateInterval(int cascade)
+	{
+		return cascade < 2 ? 1 : 1 << (cascade - 1);
+	}
+
+	/// Makes the next update() refit and redraw every cascade, as after a camera cut.
+	void invalidate() { m_matricesValid = false; }
+
+	/// Chooses the cascades to re-render this frame and refits them to the camera frustum.
+	/// view and projection are the camera's matrices; near and far are the planes projection was built with.
+	/// Returns the number of cascades that need drawing between begin() and end().
+	int update(const glm::mat4& view, const glm::mat4& projection, float near, float far, glm::vec3 lightDirection, unsigned int frame)
+	{
+		m_updateCount = 0;
+
+		glm::vec3 direction = glm::normalize(lightDirection);
+		glm::vec3 up = std::abs(direction.y) > 0.99f ? glm::vec3(1, 0, 0) : glm::vec3(0, 1, 0);
+		glm::mat4 lightView = glm::lookAt(glm::vec3(0.0f), direction, up);
+
+		// frustum corners at the near (z = -1) and far (z = 1) planes, in world space
+		glm::mat4 inverseViewProjection = glm::inverse(projection * view);
+		glm::vec3 nearCorners[4], farCorners[4];
+		for (int i = 0; i < 4; i++)
+		{
+			glm::vec4 ndc((i & 1) ? 1.0f : -1.0f, (i & 2) ? 1.0f : -1.0f, -1.0f, 1.0f);
+			glm::vec4 nearCorner = inverseViewProjection * ndc;
+			ndc.z = 1.0f;
+			glm::vec4 farCorner = inverseViewProjection * ndc;
+			nearCorners[i] = glm::vec3(nearCorner) / nearCorner.w;
+			farCorners[i] = glm::vec3(farCorner) / farCorner.w;
+		}
+
+		const float shadowFar = glm::min(far, m_shadowDistance);
+		for (int cascade = 0; cascade < SHADOW_CASCADES; cascade++)
+		{
+			// stagger updates of the same interval so they don't all land on the same frame
+			int interval = updateInterval(cascade);
+			if (m_matricesValid && (frame + (unsigned int)cascade) % (unsigned int)interval != 0)
+				continue;
+
+			// slice the frustum along each corner ray; view depth is linear along the rays for both
+			// perspective and orthographic projections
+			float sliceNear = cascade == 0 ? 0.0f : (splitDistance(cascade, near, shadowFar) - near) / (far - near);
+			float sliceFar = (splitDistance(cascade + 1, near, shadowFar) - near) / (far - near);
+			glm::vec3 corners[8];
+			glm::vec3 center(0.0f);
+			for (int i = 0; i < 4; i++)
+			{
+				corners[i] = glm::mix(nearCorners[i], farCorners[i], sliceNear);
+				corners[i + 4] = glm::mix(nearCorners[i], farCorners[i], sliceFar);
+			}
+			for (int i = 0; i < 8; i++)
+				center += corners[i] / 8.0f;
+
+			float radius = 0.0f;
+			for (int i = 0; i < 8; i++)
+				radius = glm::max(radius, glm::length(corners[i] - center));
+			// quantise the radius so floating point noise does not change the cascade's size
+			radius = std::ceil(radius * 16.0f) / 16.0f;
+
+			// snap the centre to whole texels in light space
+			float texelSize = 2.0f * radius / (float)m_resolution;
+			glm::vec3 lightCenter = glm::vec3(lightView * glm::vec4(center, 1.0f));
+			lightCenter.x = std::floor(lightCenter.x / texelSize) * texelSize;
+			lightCenter.y = std::floor(lightCenter.y / texelSize) * texelSize;
+
+			// light space looks down -z; casters between the light and the slice have larger z
+			glm::mat4 lightProjection = glm::ortho(
+				lightCenter.x - radius, lightCenter.x + radius,
+				lightCenter.y - radius, lightCenter.y + radius,
+				-(lightCenter.z + radius + CASTER_DISTANCE), -(lightCenter.z - radius));
+
+			m_lightSpaceMatrices[cascade] = lightProjection * lightView;
+			m_updated[m_updateCount++] = cascade;
+		}
+
+		m_matricesValid = true;
+		return m_updateCount;
+	}
+
+	/// Binds the shadow framebuffer, clears the layers being updated and prepares the depth shader.
+	/// Casters are then drawn with DrawDepth(depthShader(), updateCount()).
+	void begin()
+	{
+		collectTimerResults();
+		m_timerActive = m_queryFrame - m_queryResolved < (unsigned int)TIMER_QUERIES;
+		if (m_timerActive)
+			glBeginQuery(GL_TIME_ELAPSED, m_timerQueries[m_queryFrame % TIMER_QUERIES].id());
+
+		glGetIntegerv(GL_VIEWPORT, m_savedViewport);
+		glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &m_savedFramebuffer);
+		glBindFramebuffer(GL_FRAMEBUFFER, m_FBO.id());
+		glViewport(0, 0, m_resolution, m_resolution);
+
+		for (int i = 0; i < m_updateCount; i++)
+		{
+			glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, m_depthTexture.id(), 0, m_updated[i]);
+			glClear(GL_DEPTH_BUFFER_BIT);
+		}
+		glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, m_depthTexture.id(), 0);
+
+		// offset depth away from the light to avoid acne on lit surfaces
+		glEnable(GL_POLYGON_OFFSET_FILL);
+		glPolygonOffset(POLYGON_OFFSET_FACTOR, POLYGON_OFFSET_UNITS);
+
+		m_depthShader.use();
+		for (int i = 0; i < SHADOW_CASCADES; i++)
+		{
+			m_depthShader.setMat4(UniformName("lightSpaceMatrices").at(i), m_lightSpaceMatrices[i]);
+			m_depthShader.setInt(UniformName("cascadeIndices").at(i), i < m_updateCount ? m_updated[i] : 0);
+		}
+	}
+
+	/// Restores the framebuffer and viewport begin() found.
+	void end()
+	{
+		glDisable(GL_POLYGON_OFFSET_FILL);
+		glBindFramebuffer(GL_FRAMEBUFFER, (GLuint)m_savedFramebuffer);
+		glViewport(m_savedViewport[0], m_savedViewport[1], m_savedViewport[2], m_savedViewport[3]);
+
+		if (m_timerActive)
+		{
+			glEndQuery(GL_TIME_ELAPSED);
+			m_queryFrame++;
+		}
+	}
+
+	/// Binds the cascades to textureUnit and sets the sampling uniforms of a SHADOWS variant.
+	void bind(Shader& shader, int textureUnit)
+	{
+		glActiveTexture(GL_TEXTURE0 + textureUnit);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, m_depthTexture.id());
+		shader.setInt("shadowMap", textureUnit);
+		shader.setInt("cascadeCount", SHADOW_CASCADES);
+		for (int i = 0; i < SHADOW_CASCADES; i++)
+			shader.setMat4(UniformName("lightSpaceMatrices").at(i), m_lightSpaceMatrices[i]);
+	}
+
+	Shader& depthShader() { return m_depthShader; }
+	int updateCount() const { return m_updateCount; }
+	/// The index-th cascade chosen by the last update(), for index < updateCount().
+	int updatedCascade(int index) const { return m_updated[index]; }
+	/// The matrix the cascade was last rendered with, and is sampled with.
+	const glm::mat4& lightSpaceMatrix(int cascade) const { return m_lightSpaceMatrices[cascade]; }
+	int resolution() const { return m_resolution; }
+
+	/// GPU time of the most recently completed shadow pass, in milliseconds. Read back a few frames late
+	/// so the CPU never waits for the GPU.
+	float lastPassMilliseconds() const { return m_lastPassMilliseconds; }
+
+protected:
+	static const int TIMER_QUERIES = 4;
+	/// How far behind a slice, towards the light, casters are still included.
+	static constexpr float CASTER_DISTANCE = 50.0f;
+
+	/// Practical split scheme: a blend of logarithmic and uniform splits.
+	float splitDistance(int split, float near, float far) const
+	{
+		if (split == 0)
+			return near;
+		if (split == SHADOW_CASCADES)
+			return far;
+		const float lambda = 0.75f;
+		float fraction = (float)split / (float)SHADOW_CASCADES;
+		float logarithmic = near * std::pow(far / near, fraction);
+		float uniform = near + (far - near) * fraction;
+		return lambda * logarithmic + (1.0f - lambda) * uniform;
+	}
+
+	void collectTimerResults()
+	{
+		while (m_queryResolved < m_queryFrame)
+		{
+			GLuint query = m_timerQueries[m_queryResolved % TIMER_QUERIES].id();
+			GLint available = 0;
+			glGetQueryObjectiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+			if (!available)
+				break;
+
+			GLuint64 nanoseconds = 0;
+			glGetQueryObjectui64v(query, GL_QUERY_RESULT, &nanoseconds);
+			m_lastPassMilliseconds = (float)nanoseconds / 1.0e6f;
+			m_queryResolved++;
+		}
+	}
+
+	int m_resolution = 0;
+	float m_shadowDistance = 0.0f;
+	GLTexture m_depthTexture;
+	GLFramebuffer m_FBO;
+	Shader m_depthShader;
+
+	glm::mat4 m_lightSpaceMatrices[SHADOW_CASCADES];
+	bool m_matricesValid = false;
+	int m_updated[SHADOW_CASCADES] = {};
+	int m_updateCount = 0;
+	GLint m_savedViewport[4];
+	GLint m_savedFramebuffer = 0;
+
+	GLQuery m_timerQueries[TIMER_QUERIES];
+	unsigned int m_queryFrame = 0, m_queryResolved = 0;
+	bool m_timerActive = false;
+	float m_lastPassMilliseconds = 0.0f;
+};
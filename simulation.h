@@ -0,0 +1,232 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include "camera.h"
+#include "triple_buffer.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+
+/// Everything the render thread needs from one simulation tick. Snapshots are immutable once published.
+struct SimulationSnapshot
+{
+	uint64_t tick = 0;
+	/// Simulation::now() at which current became the newest state.
+	double time = 0.0;
+	/// The camera before and after the tick, for interpolation.
+	Camera previous;
+	Camera current;
+	bool perspective = true;
+	/// Running totals of one-off requests; the render thread acts on any increase since the last snapshot
+	/// it saw, so none are lost when snapshots are skipped.
+	unsigned int occlusionCycles = 0;
+	unsigned int picks = 0;
+	unsigned int memoryReports = 0;
+	unsigned int venueSwitches = 0;
+};
+
+/// Runs the camera on a thread of its own at a fixed tick, independent of the frame rate.
+///
+/// The window thread feeds input in as it arrives; each tick takes everything gathered since the previous
+/// tick, steps the camera by exactly TICK seconds and publishes a snapshot through a TripleBuffer. The same
+/// input per tick therefore always gives the same camera path, whatever the frame rate, and a frame that
+/// takes long to render neither delays input nor makes the simulation skip ahead unevenly.
+///
+/// The render thread draws a camera interpolated between the snapshot's two states, so it is one tick
+/// behind the simulation but moves smoothly at any frame rate.
+
+class Simulation
+{
+public:
+	static constexpr double TICK = 1.0 / 120.0;
+	/// Ticks run back to back to catch up after a stall; beyond that, time is dropped.
+	static const int MAX_CATCH_UP = 8;
+
+	Simulation() { }
+	Simulation(const Simulation&) = delete;
+	Simulation& operator=(const Simulation&) = delete;
+	~Simulation() { stop(); }
+
+	/// Seconds on the clock snapshots are stamped with.
+	static double now()
+	{
+		static const std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+		return std::chrono::duration<double>(std::chrono::steady_clock::now() - epoch).count();
+	}
+
+	/// Publishes the initial state, so there is a snapshot to read straight away, and starts ticking.
+	void start(const Camera& camera, float movementSpeed)
+	{
+		stop();
+		m_camera = camera;
+		m_movementSpeed = movementSpeed;
+		m_tick = 0;
+		m_nextTime = now();
+		publish(m_camera);
+
+		m_quit = false;
+		m_thread = std::thread(&Simulation::run, this);
+	}
+
+	void stop()
+	{
+		m_quit = true;
+		if (m_thread.joinable())
+			m_thread.join();
+	}
+
+	/// Window thread: input, gathered until the next tick.
+	void setMoving(Camera_Movement direction, bool moving)
+	{
+		std::lock_guard<std::mutex> lock(m_inputMutex);
+		m_input.moving[direction] = moving;
+	}
+
+	void addMouseMovement(float xoffset, float yoffset)
+	{
+		std::lock_guard<std::mutex> lock(m_inputMutex);
+		m_input.lookX += xoffset;
+		m_input.lookY += yoffset;
+	}
+
+	void addScroll(float yoffset)
+	{
+		std::lock_guard<std::mutex> lock(m_inputMutex);
+		m_input.scroll += yoffset;
+	}
+
+	void toggleProjection() { std::lock_guard<std::mutex> lock(m_inputMutex); m_input.projectionToggles++; }
+	void cycleOcclusion() { std::lock_guard<std::mutex> lock(m_inputMutex); m_input.occlusionCycles++; }
+	void pick() { std::lock_guard<std::mutex> lock(m_inputMutex); m_input.picks++; }
+	void reportGpuMemory() { std::lock_guard<std::mutex> lock(m_inputMutex); m_input.memoryReports++; }
+	void switchVenue() { std::lock_guard<std::mutex> lock(m_inputMutex); m_input.venueSwitches++; }
+
+	/// Render thread: the newest snapshot.
+	const SimulationSnapshot& latest() { return m_snapshots.read(); }
+
+	/// The camera as it was at time, between the snapshot's two states.
+	static Camera interpolate(const SimulationSnapshot& snapshot, double time)
+	{
+		float alpha = (float)glm::clamp((time - snapshot.time) / TICK, 0.0, 1.0);
+		const Camera& from = snapshot.previous;
+		const Camera& to = snapshot.current;
+
+		// written as from + (to - from) * alpha so a camera at rest is reproduced exactly
+		Camera camera = to;
+		camera.Position = from.Position + (to.Position - from.Position) * alpha;
+		camera.Zoom = from.Zoom + (to.Zoom - from.Zoom) * alpha;
+		camera.SetEulerAngles(from.Yaw + (to.Yaw - from.Yaw) * alpha, from.Pitch + (to.Pitch - from.Pitch) * alpha);
+		return camera;
+	}
+
+protected:
+	struct Input
+	{
+		/// Held keys, indexed by Camera_Movement; they stay set between ticks.
+		bool moving[6] = { false, false, false, false, false, false };
+		/// Accumulated since the last tick.
+		float lookX = 0.0f;
+		float lookY = 0.0f;
+		float scroll = 0.0f;
+		unsigned int projectionToggles = 0;
+		unsigned int occlusionCycles = 0;
+		unsigned int picks = 0;
+		unsigned int memoryReports = 0;
+		unsigned int venueSwitches = 0;
+	};
+
+	void run()
+	{
+		while (!m_quit)
+		{
+			double wait = m_nextTime - now();
+			if (wait > 0.0)
+			{
+				std::this_thread::sleep_for(std::chrono::duration<double>(wait));
+				continue;
+			}
+
+			int ticks = 0;
+			while (m_nextTime <= now() && ticks < MAX_CATCH_UP)
+			{
+				step(takeInput());
+				m_nextTime += TICK;
+				ticks++;
+			}
+			if (m_nextTime <= now())
+				m_nextTime = now() + TICK;
+		}
+	}
+
+	/// Takes the input gathered since the last tick, leaving the held keys.
+	Input takeInput()
+	{
+		std::lock_guard<std::mutex> lock(m_inputMutex);
+		Input input = m_input;
+		m_input.lookX = m_input.lookY = m_input.scroll = 0.0f;
+		m_input.projectionToggles = m_input.occlusionCycles = m_input.picks = m_input.memoryReports = m_input.venueSwitches = 0;
+		return input;
+	}
+
+	void step(const Input& input)
+	{
+		const Camera previous = m_camera;
+
+		if (input.lookX != 0.0f || input.lookY != 0.0f)
+			m_camera.ProcessMouseMovement(input.lookX, input.lookY);
+		if (input.scroll != 0.0f)
+		{
+			m_movementSpeed = std::max(m_movementSpeed + input.scroll, 0.5f);
+			m_camera.MovementSpeed = m_movementSpeed;
+		}
+		for (int direction = 0; direction < 6; direction++)
+			if (input.moving[direction])
+				m_camera.ProcessKeyboard((Camera_Movement)direction, (float)TICK);
+
+		m_perspective = m_perspective != (input.projectionToggles % 2 == 1);
+		m_occlusionCycles += input.occlusionCycles;
+		m_picks += input.picks;
+		m_memoryReports += input.memoryReports;
+		m_venueSwitches += input.venueSwitches;
+		m_tick++;
+		publish(previous);
+	}
+
+	void publish(const Camera& previous)
+	{
+		SimulationSnapshot& snapshot = m_snapshots.back();
+		snapshot.tick = m_tick;
+		snapshot.time = m_nextTime;
+		snapshot.previous = previous;
+		snapshot.current = m_camera;
+		snapshot.perspective = m_perspective;
+		snapshot.occlusionCycles = m_occlusionCycles;
+		snapshot.picks = m_picks;
+		snapshot.memoryReports = m_memoryReports;
+		snapshot.venueSwitches = m_venueSwitches;
+		m_snapshots.publish();
+	}
+
+	std::thread m_thread;
+	std::atomic<bool> m_quit{ false };
+
+	std::mutex m_inputMutex;
+	Input m_input;
+
+	// owned by the simulation thread once started
+	Camera m_camera;
+	float m_movementSpeed = 0.0f;
+	bool m_perspective = true;
+	unsigned int m_occlusionCycles = 0;
+	unsigned int m_picks = 0;
+	unsigned int m_memoryReports = 0;
+	unsigned int m_venueSwitches = 0;
+	uint64_t m_tick = 0;
+	double m_nextTime = 0.0;
+
+	TripleBuffer<SimulationSnapshot> m_snapshots;
+};
@@ -0,0 +1,1055 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include "scene.h"
+#include "shadows.h"
+#include "job_system.h"
+#include "vertex_format.h"
+#include "gl_handle.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define SOFTWARE_RASTERIZER_SSE2
+#endif
+
+/// The lanes the rasteriser tests pixels in: eight with AVX2, four with SSE2, and one elsewhere. Masks are
+/// integer lanes of all ones or all zeros.
+namespace RasterLanes
+{
+#if defined(__AVX2__)
+	const int WIDTH = 8;
+	typedef __m256i Int;
+	typedef __m256 Float;
+
+	inline Int loadInt(const int32_t* p) { return _mm256_loadu_si256((const __m256i*)p); }
+	inline void storeInt(int32_t* p, Int v) { _mm256_storeu_si256((__m256i*)p, v); }
+	inline Int setInt(int32_t v) { return _mm256_set1_epi32(v); }
+	inline Int add(Int a, Int b) { return _mm256_add_epi32(a, b); }
+	inline Int bitOr(Int a, Int b) { return _mm256_or_si256(a, b); }
+	inline Int bitAnd(Int a, Int b) { return _mm256_and_si256(a, b); }
+	inline Int nonNegative(Int a) { return _mm256_cmpgt_epi32(a, _mm256_set1_epi32(-1)); }
+	inline Int select(Int mask, Int a, Int b) { return _mm256_blendv_epi8(b, a, mask); }
+	inline bool any(Int mask) { return _mm256_movemask_epi8(mask) != 0; }
+
+	inline Float loadFloat(const float* p) { return _mm256_loadu_ps(p); }
+	inline void storeFloat(float* p, Float v) { _mm256_storeu_ps(p, v); }
+	inline Float setFloat(float v) { return _mm256_set1_ps(v); }
+	inline Float add(Float a, Float b) { return _mm256_add_ps(a, b); }
+	inline Float mul(Float a, Float b) { return _mm256_mul_ps(a, b); }
+	inline Int less(Float a, Float b) { return _mm256_castps_si256(_mm256_cmp_ps(a, b, _CMP_LT_OQ)); }
+	inline Float select(Int mask, Float a, Float b) { return _mm256_blendv_ps(b, a, _mm256_castsi256_ps(mask)); }
+#elif defined(SOFTWARE_RASTERIZER_SSE2)
+	const int WIDTH = 4;
+	typedef __m128i Int;
+	typedef __m128 Float;
+
+	inline Int loadInt(const int32_t* p) { return _mm_loadu_si128((const __m128i*)p); }
+	inline void storeInt(int32_t* p, Int v) { _mm_storeu_si128((__m128i*)p, v); }
+	inline Int setInt(int32_t v) { return _mm_set1_epi32(v); }
+	inline Int add(Int a, Int b) { return _mm_add_epi32(a, b); }
+	inline Int bitOr(Int a, Int b) { return _mm_or_si128(a, b); }
+	inline Int bitAnd(Int a, Int b) { return _mm_and_si128(a, b); }
+	inline Int nonNegative(Int a) { return _mm_cmpgt_epi32(a, _mm_set1_epi32(-1)); }
+	inline Int select(Int mask, Int a, Int b) { return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b)); }
+	inline bool any(Int mask) { return _mm_movemask_epi8(mask) != 0; }
+
+	inline Float loadFloat(const float* p) { return _mm_loadu_ps(p); }
+	inline void storeFloat(float* p, Float v) { _mm_storeu_ps(p, v); }
+	inline Float setFloat(float v) { return _mm_set1_ps(v); }
+	inline Float add(Float a, Float b) { return _mm_add_ps(a, b); }
+	inline Float mul(Float a, Float b) { return _mm_mul_ps(a, b); }
+	inline Int less(Float a, Float b) { return _mm_castps_si128(_mm_cmplt_ps(a, b)); }
+	inline Float select(Int mask, Float a, Float b) { return _mm_castsi128_ps(select(mask, _mm_castps_si128(a), _mm_castps_si128(b))); }
+#else
+	const int WIDTH = 1;
+	typedef int32_t Int;
+	typedef float Float;
+
+	inline Int loadInt(const int32_t* p) { return *p; }
+	inline void storeInt(int32_t* p, Int v) { *p = v; }
+	inline Int setInt(int32_t v) { return v; }
+	inline Int add(Int a, Int b) { return (Int)((uint32_t)a + (uint32_t)b); }
+	inline Int bitOr(Int a, Int b) { return a | b; }
+	inline Int bitAnd(Int a, Int b) { return a & b; }
+	inline Int nonNegative(Int a) { return a >= 0 ? -1 : 0; }
+	inline Int select(Int mask, Int a, Int b) { return mask ? a : b; }
+	inline bool any(Int mask) { return mask != 0; }
+
+	inline Float loadFloat(const float* p) { return *p; }
+	inline void storeFloat(float* p, Float v) { *p = v; }
+	inline Float setFloat(float v) { return v; }
+	inline Float add(Float a, Float b) { return a + b; }
+	inline Float mul(Float a, Float b) { return a * b; }
+	inline Int less(Float a, Float b) { return a < b ? -1 : 0; }
+	inline Float select(Int mask, Float a, Float b) { return mask ? a : b; }
+#endif
+}
+
+/// Draws the lighting pass on the CPU: the scene's entities, Phong lit and shadowed exactly as
+/// multiple_lights.* shade them, for machines without a GPU and as a reference to compare drivers with.
+///
+/// Frames go through four stages, each spread over a JobSystem:
+/// - geometry: entities are transformed as multiple_lights.vs does, clipped against the near and far planes
+///   and a guard band, and set up with their vertices snapped to SUBPIXEL_BITS;
+/// - binning: every triangle is listed in each TILE_SIZE tile its bounds touch, by a counting sort that
+///   keeps the tiles' lists in draw order;
+/// - rasterisation: one job per tile tests RasterLanes::WIDTH pixels at a time against integer edge
+///   functions with the top-left rule, and keeps the nearest triangle of each pixel in a visibility buffer;
+/// - shading: each visible pixel is shaded once, by the job that rasterised its tile.
+///
+/// The shadow cascades are drawn by the same stages, depth only, with the matrices CascadedShadowMap chose.
+/// Meshes and textures are read back from GL by load(), so both paths draw the very same data; rendering
+/// itself makes no GL calls. The crowd is not drawn.
+
+class SoftwareRasterizer
+{
+public:
+	static const int TILE_SIZE = 64;
+	/// Largest width or height of a frame or shadow map; keeps every edge function in 32 bits within a tile.
+	static const int MAX_SIZE = 8192;
+
+	/// What setShaderVariables() gives the lighting shaders besides the lights.
+	struct View
+	{
+		glm::mat4 view = glm::mat4(1.0f);
+		glm::mat4 projection = glm::mat4(1.0f);
+		/// The camera; the flashlight follows it.
+		glm::vec3 position = glm::vec3(0.0f);
+		glm::vec3 front = glm::vec3(0.0f, 0.0f, -1.0f);
+		float shininess = 32.0f;
+		glm::vec3 clearColor = glm::vec3(0.1f);
+	};
+
+	struct Statistics
+	{
+		/// Triangles set up for the view, after clipping.
+		size_t triangles = 0;
+		float shadowMilliseconds = 0.0f;
+		float geometryMilliseconds = 0.0f;
+		float binningMilliseconds = 0.0f;
+		/// Rasterising and shading.
+		float rasterMilliseconds = 0.0f;
+	};
+
+	SoftwareRasterizer() { }
+
+	/// Reads back the vertices and indices of every mesh of scene and every mip level of its materials'
+	/// textures. Needs the GL context; call again when the scene's meshes or materials change.
+	void load(const Scene& scene)
+	{
+		m_geometry.resize(scene.meshCount());
+		for (size_t i = 0; i < scene.meshCount(); i++)
+			readGeometry(scene.mesh((uint32_t)i), m_geometry[i]);
+
+		m_textures.clear();
+		m_surfaces.resize(scene.materialCount() * 2);
+		for (size_t i = 0; i < scene.materialCount(); i++)
+		{
+			const Material& material = scene.material((uint32_t)i);
+			for (int range = 0; range < 2; range++)
+			{
+				// as the lighting pass draws meshes: the main range samples the material's unit, the secondary
+				// range unit 1; see mesh.h
+				Surface& surface = m_surfaces[i * 2 + range];
+				surface.color = material.color;
+				surface.texture = material.textured ? textureIndex(material.textures[range == 0 ? material.sampler : 1]) : -1;
+			}
+		}
+	}
+
+	/// Draws entities, dense indices into scene, as the lighting pass would into a width by height frame.
+	/// Cascades that shadows updated this frame, or that were never drawn, are redrawn first.
+	void render(const Scene& scene, const View& view, const uint32_t* entities, size_t count, const CascadedShadowMap& shadows,
+		JobSystem& jobs, int width, int height)
+	{
+		width = glm::clamp(width, 1, MAX_SIZE);
+		height = glm::clamp(height, 1, MAX_SIZE);
+		m_threadVertices.resize(jobs.workerCount() + 1);
+		m_statistics = Statistics();
+		m_view = view;
+		m_lights = &scene.lights();
+		m_color.resize((size_t)width * height * 4);
+
+		Clock::time_point start = Clock::now();
+		renderShadows(scene, shadows, jobs);
+		m_statistics.shadowMilliseconds = millisecondsSince(start);
+
+		m_target.resize(width, height);
+		m_visible.resize(m_target.depth.size());
+		Pass pass;
+		pass.viewProjection = view.projection * view.view;
+		pass.target = &m_target;
+		pass.shaded = true;
+		draw(scene, pass, entities, count, jobs, &m_statistics);
+		m_statistics.triangles = m_triangles.size();
+	}
+
+	/// The last frame, RGBA, bottom row first as glReadPixels() returns it.
+	const uint8_t* pixels() const { return m_color.data(); }
+	int width() const { return m_target.width; }
+	int height() const { return m_target.height; }
+	const Statistics& lastStatistics() const { return m_statistics; }
+
+	/// Deletes what present() created in GL; call before the context goes. The next present() creates it
+	/// again.
+	void releasePresent()
+	{
+		m_presentTexture.reset();
+		m_presentFBO.reset();
+	}
+
+	/// Copies the last frame to the bottom left of the default framebuffer.
+	void present()
+	{
+		if (!m_presentTexture)
+		{
+			m_presentTexture = GLTexture::create("software rasterizer");
+			m_presentFBO = GLFramebuffer::create("software rasterizer");
+			m_presentWidth = m_presentHeight = 0;
+		}
+
+		glBindTexture(GL_TEXTURE_2D, m_presentTexture.id());
+		if (m_presentWidth != width() || m_presentHeight != height())
+		{
+			m_presentWidth = width();
+			m_presentHeight = height();
+			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, m_presentWidth, m_presentHeight, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+			GpuResources::resize(GPU_TEXTURE, m_presentTexture.id(), GpuResources::imageBytes(GL_RGBA8, m_presentWidth, m_presentHeight));
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+			glBindFramebuffer(GL_READ_FRAMEBUFFER, m_presentFBO.id());
+			glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, m_presentTexture.id(), 0);
+		}
+		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_presentWidth, m_presentHeight, GL_RGBA, GL_UNSIGNED_BYTE, m_color.data());
+
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, m_presentFBO.id());
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+		glBlitFramebuffer(0, 0, m_presentWidth, m_presentHeight, 0, 0, m_presentWidth, m_presentHeight, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	}
+
+protected:
+	typedef std::chrono::steady_clock Clock;
+
+	static const int TILE_PIXELS = TILE_SIZE * TILE_SIZE;
+	/// Vertices are snapped to 1/16 pixel, as most GPUs do.
+	static const int SUBPIXEL_BITS = 4;
+	static const int SUBPIXELS = 1 << SUBPIXEL_BITS;
+	/// Edge function values beyond this are clamped when a tile is entered: no edge of a triangle within
+	/// MAX_SIZE can change sign across a tile from there, and stepping over the tile stays within 32 bits.
+	static const int64_t EDGE_LIMIT = 1 << 30;
+	/// World position, normal and texture coordinates.
+	static const int ATTRIBUTES = 8;
+	/// A polygon clipped by the six planes has at most nine vertices.
+	static const int MAX_CLIPPED = 9;
+	static const int32_t NO_TRIANGLE = -1;
+	/// Entities set up per job, and triangles binned per job.
+	static const size_t GEOMETRY_GRAIN = 4;
+	static const size_t BIN_GRAIN = 4096;
+	/// As SHADOW_BIAS in multiple_lights.fs.
+	static constexpr float SHADOW_BIAS = 0.0005f;
+
+	/// A mesh's triangles, three indices each, as the vertex shader sees them. Triangles from
+	/// secondaryFirst on are the mesh's secondary range.
+	struct Geometry
+	{
+		std::vector<Vertex> vertices;
+		std::vector<uint32_t> indices;
+		size_t secondaryFirst = 0;
+	};
+
+	/// A texture's mip levels, RGBA, as GL generated them.
+	struct Texture
+	{
+		GLuint id = 0;
+		std::vector<int> widths, heights;
+		std::vector<std::vector<uint8_t>> levels;
+	};
+
+	/// What a range of a mesh is shaded with: a texture, or the material's colour if texture is -1.
+	struct Surface
+	{
+		int32_t texture = -1;
+		glm::vec3 color = glm::vec3(1.0f);
+	};
+
+	/// A depth buffer stored tile by tile, so that each tile's pixels are contiguous for the job drawing it.
+	struct Target
+	{
+		int width = 0, height = 0, tilesX = 0, tilesY = 0;
+		std::vector<float> depth;
+
+		void resize(int newWidth, int newHeight)
+		{
+			width = newWidth;
+			height = newHeight;
+			tilesX = (width + TILE_SIZE - 1) / TILE_SIZE;
+			tilesY = (height + TILE_SIZE - 1) / TILE_SIZE;
+			depth.resize((size_t)tiles() * TILE_PIXELS);
+		}
+
+		int tiles() const { return tilesX * tilesY; }
+
+		float at(int x, int y) const
+		{
+			const int tile = (y / TILE_SIZE) * tilesX + x / TILE_SIZE;
+			return depth[(size_t)tile * TILE_PIXELS + (y % TILE_SIZE) * TILE_SIZE + x % TILE_SIZE];
+		}
+	};
+
+	/// One run of the stages into a target.
+	struct Pass
+	{
+		glm::mat4 viewProjection;
+		Target* target = NULL;
+		/// Shaded passes keep the visibility buffer and shade it; the others only write depth.
+		bool shaded = false;
+		/// Slope-scaled depth offset, as glPolygonOffset() takes it.
+		float offsetFactor = 0.0f;
+		float offsetUnits = 0.0f;
+	};
+
+	struct ClipVertex
+	{
+		glm::vec4 position;
+		float attributes[ATTRIBUTES];
+	};
+
+	/// A triangle ready to rasterise, counterclockwise in window coordinates. Depth, 1/w and each attribute
+	/// over w are planes: value = plane[0] + plane[1] * (x - originX) + plane[2] * (y - originY), with x and
+	/// y in pixels.
+	struct Triangle
+	{
+		/// Snapped vertices, in 1/SUBPIXELS of a pixel.
+		int32_t x[3], y[3];
+		/// Pixels whose centres may be covered, clamped to the target.
+		int32_t minX, minY, maxX, maxY;
+		float originX, originY;
+		float depth[3];
+		float inverseW[3];
+		float attributes[ATTRIBUTES][3];
+		Surface surface;
+	};
+
+	static float millisecondsSince(Clock::time_point start)
+	{
+		return std::chrono::duration<float, std::milli>(Clock::now() - start).count();
+	}
+
+	/// Unpacks a mesh's buffers as the vertex shaders read them, and splits its primitives into triangles.
+	static void readGeometry(const Mesh& mesh, Geometry& geometry)
+	{
+		geometry = Geometry();
+		if (mesh.VAO == 0 || mesh.count <= 0)
+			return;
+
+		glBindVertexArray(mesh.VAO);
+		GLint vbo = 0, ebo = 0;
+		void* quantizationOffset = NULL;
+		glGetVertexAttribiv(0, GL_VERTEX_ATTRIB_ARRAY_BUFFER_BINDING, &vbo);
+		glGetVertexAttribPointerv(VertexFormat::QUANTIZATION_ATTRIBUTE, GL_VERTEX_ATTRIB_ARRAY_POINTER, &quantizationOffset);
+		glGetIntegerv(GL_ELEMENT_ARRAY_BUFFER_BINDING, &ebo);
+
+		// the quantization follows the vertices
+		const size_t vertexCount = (size_t)quantizationOffset / sizeof(PackedVertex);
+		std::vector<PackedVertex> packed(vertexCount);
+		VertexQuantization quantization;
+		glBindBuffer(GL_ARRAY_BUFFER, (GLuint)vbo);
+		glGetBufferSubData(GL_ARRAY_BUFFER, 0, vertexCount * sizeof(PackedVertex), packed.data());
+		glGetBufferSubData(GL_ARRAY_BUFFER, (GLintptr)quantizationOffset, sizeof(quantization), &quantization);
+		geometry.vertices.resize(vertexCount);
+		for (size_t i = 0; i < vertexCount; i++)
+			geometry.vertices[i] = VertexFormat::unpack(packed[i], quantization);
+
+		std::vector<GLuint> elements(mesh.count);
+		if (mesh.indexed && ebo != 0)
+			glGetBufferSubData(GL_ELEMENT_ARRAY_BUFFER, 0, mesh.count * sizeof(GLuint), elements.data());
+		else
+			for (GLsizei i = 0; i < mesh.count; i++)
+				elements[i] = (GLuint)i;
+		glBindVertexArray(0);
+
+		appendTriangles(mesh, elements.data(), 0, mesh.secondaryFirst, vertexCount, geometry.indices);
+		geometry.secondaryFirst = geometry.indices.size();
+		appendTriangles(mesh, elements.data(), mesh.secondaryFirst, mesh.count, vertexCount, geometry.indices);
+	}
+
+	/// Appends the triangles of elements[first, last), a list or strips broken by the restart index.
+	static void appendTriangles(const Mesh& mesh, const GLuint* elements, GLsizei first, GLsizei last, size_t vertexCount, std::vector<uint32_t>& indices)
+	{
+		const bool strip = mesh.primitive == GL_TRIANGLE_STRIP;
+		GLsizei stripStart = first;
+		for (GLsizei i = first; i < last; i++)
+		{
+			if (mesh.restartIndex >= 0 && elements[i] == (GLuint)mesh.restartIndex)
+			{
+				stripStart = i + 1;
+				continue;
+			}
+			const bool complete = strip ? i - stripStart >= 2 : (i - first) % 3 == 2;
+			if (!complete || elements[i - 2] >= vertexCount || elements[i - 1] >= vertexCount || elements[i] >= vertexCount)
+				continue;
+
+			// winding does not matter: nothing is culled, and setup orders every triangle itself
+			indices.push_back(elements[i - 2]);
+			indices.push_back(elements[i - 1]);
+			indices.push_back(elements[i]);
+		}
+	}
+
+	int32_t textureIndex(GLuint id)
+	{
+		for (size_t i = 0; i < m_textures.size(); i++)
+			if (m_textures[i].id == id)
+				return (int32_t)i;
+
+		m_textures.push_back(Texture());
+		Texture& texture = m_textures.back();
+		texture.id = id;
+		glBindTexture(GL_TEXTURE_2D, id);
+		for (int level = 0; ; level++)
+		{
+			GLint width = 0, height = 0;
+			glGetTexLevelParameteriv(GL_TEXTURE_2D, level, GL_TEXTURE_WIDTH, &width);
+			glGetTexLevelParameteriv(GL_TEXTURE_2D, level, GL_TEXTURE_HEIGHT, &height);
+			if (width <= 0 || height <= 0)
+				break;
+
+			texture.widths.push_back(width);
+			texture.heights.push_back(height);
+			texture.levels.push_back(std::vector<uint8_t>((size_t)width * height * 4));
+			glGetTexImage(GL_TEXTURE_2D, level, GL_RGBA, GL_UNSIGNED_BYTE, texture.levels.back().data());
+			if (width == 1 && height == 1)
+				break;
+		}
+		return (int32_t)m_textures.size() - 1;
+	}
+
+	/// Redraws the cascades shadows updated this frame, and any never drawn, from the shadow casters.
+	void renderShadows(const Scene& scene, const CascadedShadowMap& shadows, JobSystem& jobs)
+	{
+		bool due[SHADOW_CASCADES];
+		for (int i = 0; i < SHADOW_CASCADES; i++)
+			due[i] = !m_cascadeDrawn[i];
+		for (int i = 0; i < shadows.updateCount(); i++)
+			due[shadows.updatedCascade(i)] = true;
+
+		m_casters.clear();
+		const uint8_t* flags = scene.flags();
+		for (uint32_t i = 0; i < (uint32_t)scene.size(); i++)
+			if (flags[i] & ENTITY_CASTS_SHADOW)
+				m_casters.push_back(i);
+
+		for (int i = 0; i < SHADOW_CASCADES; i++)
+		{
+			m_lightSpaceMatrices[i] = shadows.lightSpaceMatrix(i);
+			if (!due[i])
+				continue;
+
+			m_cascades[i].resize(shadows.resolution(), shadows.resolution());
+			Pass pass;
+			pass.viewProjection = m_lightSpaceMatrices[i];
+			pass.target = &m_cascades[i];
+			pass.offsetFactor = CascadedShadowMap::POLYGON_OFFSET_FACTOR;
+			pass.offsetUnits = CascadedShadowMap::POLYGON_OFFSET_UNITS;
+			draw(scene, pass, m_casters.data(), m_casters.size(), jobs, NULL);
+			m_cascadeDrawn[i] = true;
+		}
+	}
+
+	/// Runs the stages for entities into pass.target.
+	void draw(const Scene& scene, const Pass& pass, const uint32_t* entities, size_t count, JobSystem& jobs, Statistics* statistics)
+	{
+		Clock::time_point start = Clock::now();
+		const size_t ranges = (count + GEOMETRY_GRAIN - 1) / GEOMETRY_GRAIN;
+		if (m_rangeTriangles.size() < ranges)
+			m_rangeTriangles.resize(ranges);
+		jobs.parallelFor(count, GEOMETRY_GRAIN, [&](size_t begin, size_t end) {
+			std::vector<Triangle>& out = m_rangeTriangles[begin / GEOMETRY_GRAIN];
+			out.clear();
+			setupEntities(scene, pass, entities, begin, end, out);
+		});
+
+		// ranges are joined in order, so triangles keep the entities' order
+		m_rangeFirst.resize(ranges + 1);
+		m_rangeFirst[0] = 0;
+		for (size_t i = 0; i < ranges; i++)
+			m_rangeFirst[i + 1] = m_rangeFirst[i] + m_rangeTriangles[i].size();
+		m_triangles.resize(m_rangeFirst[ranges]);
+		jobs.parallelFor(ranges, 1, [&](size_t begin, size_t end) {
+			for (size_t i = begin; i < end; i++)
+				std::copy(m_rangeTriangles[i].begin(), m_rangeTriangles[i].end(), m_triangles.begin() + m_rangeFirst[i]);
+		});
+		Clock::time_point binStart = Clock::now();
+
+		bin(*pass.target, jobs);
+		Clock::time_point rasterStart = Clock::now();
+
+		jobs.parallelFor(pass.target->tiles(), 1, [&](size_t begin, size_t end) {
+			for (size_t tile = begin; tile < end; tile++)
+				drawTile(pass, (int)tile);
+		});
+
+		if (statistics != NULL)
+		{
+			statistics->geometryMilliseconds = std::chrono::duration<float, std::milli>(binStart - start).count();
+			statistics->binningMilliseconds = std::chrono::duration<float, std::milli>(rasterStart - binStart).count();
+			statistics->rasterMilliseconds = millisecondsSince(rasterStart);
+		}
+	}
+
+	/// Transforms entities[first, last) as multiple_lights.vs does, and sets up their triangles.
+	void setupEntities(const Scene& scene, const Pass& pass, const uint32_t* entities, size_t first, size_t last, std::vector<Triangle>& out)
+	{
+		const glm::mat4* modelMatrices = scene.modelMatrices();
+		const uint32_t* meshIds = scene.meshIds();
+		const uint32_t* materialIds = scene.materialIds();
+		std::vector<ClipVertex>& transformed = m_threadVertices[JobSystem::threadIndex()];
+		for (size_t e = first; e < last; e++)
+		{
+			const uint32_t entity = entities[e];
+			if (meshIds[entity] >= m_geometry.size() || materialIds[entity] * 2 >= m_surfaces.size())
+				continue;
+
+			const Geometry& geometry = m_geometry[meshIds[entity]];
+			const glm::mat4& model = modelMatrices[entity];
+			const glm::mat4 clip = pass.viewProjection * model;
+			const glm::mat3 normalMatrix = glm::mat3(glm::transpose(glm::inverse(model)));
+			transformed.resize(geometry.vertices.size());
+			for (size_t i = 0; i < geometry.vertices.size(); i++)
+			{
+				const Vertex& vertex = geometry.vertices[i];
+				ClipVertex& v = transformed[i];
+				v.position = clip * glm::vec4(vertex.position, 1.0f);
+				if (!pass.shaded)
+					continue;
+
+				const glm::vec3 position = glm::vec3(model * glm::vec4(vertex.position, 1.0f));
+				const glm::vec3 normal = normalMatrix * vertex.normal;
+				v.attributes[0] = position.x;
+				v.attributes[1] = position.y;
+				v.attributes[2] = position.z;
+				v.attributes[3] = normal.x;
+				v.attributes[4] = normal.y;
+				v.attributes[5] = normal.z;
+				v.attributes[6] = vertex.texCoords.x;
+				v.attributes[7] = vertex.texCoords.y;
+			}
+
+			const Surface* surfaces = &m_surfaces[materialIds[entity] * 2];
+			for (size_t i = 0; i + 2 < geometry.indices.size(); i += 3)
+			{
+				const ClipVertex* triangle[3] = { &transformed[geometry.indices[i]], &transformed[geometry.indices[i + 1]], &transformed[geometry.indices[i + 2]] };
+				clipTriangle(pass, triangle, surfaces[i < geometry.secondaryFirst ? 0 : 1], out);
+			}
+		}
+	}
+
+	/// Distances to the clip planes, inside when not negative: near, far, and the guard band's sides.
+	static float planeDistance(const glm::vec4& p, int plane, const glm::vec2& guard)
+	{
+		switch (plane)
+		{
+		case 0: return p.w + p.z;
+		case 1: return p.w - p.z;
+		case 2: return guard.x * p.w + p.x;
+		case 3: return guard.x * p.w - p.x;
+		case 4: return guard.y * p.w + p.y;
+		default: return guard.y * p.w - p.y;
+		}
+	}
+
+	static unsigned int outcode(const glm::vec4& p, const glm::vec2& guard)
+	{
+		unsigned int code = 0;
+		for (int plane = 0; plane < 6; plane++)
+			if (planeDistance(p, plane, guard) < 0.0f)
+				code |= 1u << plane;
+		return code;
+	}
+
+	/// Clips a triangle against the near and far planes and a guard band that keeps it within MAX_SIZE
+	/// pixels, and sets up what is left as a fan.
+	void clipTriangle(const Pass& pass, const ClipVertex* const* vertices, const Surface& surface, std::vector<Triangle>& out) const
+	{
+		const glm::vec2 guard((float)MAX_SIZE / pass.target->width, (float)MAX_SIZE / pass.target->height);
+		const unsigned int codes[3] = { outcode(vertices[0]->position, guard), outcode(vertices[1]->position, guard), outcode(vertices[2]->position, guard) };
+		if (codes[0] & codes[1] & codes[2])
+			return;
+		if ((codes[0] | codes[1] | codes[2]) == 0)
+		{
+			setupTriangle(pass, vertices, surface, out);
+			return;
+		}
+
+		ClipVertex polygons[2][MAX_CLIPPED];
+		int count = 3;
+		for (int i = 0; i < 3; i++)
+			polygons[0][i] = *vertices[i];
+		int current = 0;
+		for (int plane = 0; plane < 6 && count >= 3; plane++)
+		{
+			if (!((codes[0] | codes[1] | codes[2]) & (1u << plane)))
+				continue;
+
+			const ClipVertex* in = polygons[current];
+			ClipVertex* clipped = polygons[current ^ 1];
+			int clippedCount = 0;
+			for (int i = 0; i < count; i++)
+			{
+				const ClipVertex& a = in[i];
+				const ClipVertex& b = in[(i + 1) % count];
+				const float da = planeDistance(a.position, plane, guard), db = planeDistance(b.position, plane, guard);
+				if (da >= 0.0f)
+					clipped[clippedCount++] = a;
+				if ((da >= 0.0f) != (db >= 0.0f))
+				{
+					const float t = da / (da - db);
+					ClipVertex& v = clipped[clippedCount++];
+					v.position = a.position + (b.position - a.position) * t;
+					for (int k = 0; k < ATTRIBUTES; k++)
+						v.attributes[k] = a.attributes[k] + (b.attributes[k] - a.attributes[k]) * t;
+				}
+			}
+			count = clippedCount;
+			current ^= 1;
+		}
+
+		for (int i = 1; i + 1 < count; i++)
+		{
+			const ClipVertex* fan[3] = { &polygons[current][0], &polygons[current][i], &polygons[current][i + 1] };
+			setupTriangle(pass, fan, surface, out);
+		}
+	}
+
+	/// The plane through the three values, over window positions relative to the first vertex.
+	static void setPlane(float* plane, float value0, float value1, float value2, const glm::vec2& d1, const glm::vec2& d2, float inverseDeterminant)
+	{
+		plane[0] = value0;
+		plane[1] = ((value1 - value0) * d2.y - (value2 - value0) * d1.y) * inverseDeterminant;
+		plane[2] = ((value2 - value0) * d1.x - (value1 - value0) * d2.x) * inverseDeterminant;
+	}
+
+	/// Projects and snaps a clipped triangle and computes its bounds and planes. Degenerate triangles and
+	/// those that cover no pixel centre are dropped.
+	void setupTriangle(const Pass& pass, const ClipVertex* const* vertices, const Surface& surface, std::vector<Triangle>& out) const
+	{
+		const Target& target = *pass.target;
+		int32_t x[3], y[3];
+		float z[3], inverseW[3];
+		for (int i = 0; i < 3; i++)
+		{
+			const glm::vec4& p = vertices[i]->position;
+			inverseW[i] = 1.0f / p.w;
+			x[i] = (int32_t)lrintf((p.x * inverseW[i] * 0.5f + 0.5f) * target.width * SUBPIXELS);
+			y[i] = (int32_t)lrintf((p.y * inverseW[i] * 0.5f + 0.5f) * target.height * SUBPIXELS);
+			z[i] = p.z * inverseW[i] * 0.5f + 0.5f;
+		}
+
+		const int64_t area = (int64_t)(x[1] - x[0]) * (y[2] - y[0]) - (int64_t)(y[1] - y[0]) * (x[2] - x[0]);
+		if (area == 0)
+			return;
+		int order[3] = { 0, 1, 2 };
+		if (area < 0)
+			std::swap(order[1], order[2]);
+
+		Triangle t;
+		for (int i = 0; i < 3; i++)
+		{
+			t.x[i] = x[order[i]];
+			t.y[i] = y[order[i]];
+		}
+
+		// pixel centres lie at half a pixel
+		const int32_t half = SUBPIXELS / 2;
+		t.minX = std::max(0, -((half - std::min(t.x[0], std::min(t.x[1], t.x[2]))) >> SUBPIXEL_BITS));
+		t.minY = std::max(0, -((half - std::min(t.y[0], std::min(t.y[1], t.y[2]))) >> SUBPIXEL_BITS));
+		t.maxX = std::min(target.width - 1, (std::max(t.x[0], std::max(t.x[1], t.x[2])) - half) >> SUBPIXEL_BITS);
+		t.maxY = std::min(target.height - 1, (std::max(t.y[0], std::max(t.y[1], t.y[2])) - half) >> SUBPIXEL_BITS);
+		if (t.minX > t.maxX || t.minY > t.maxY)
+			return;
+
+		t.originX = (float)t.x[0] / SUBPIXELS;
+		t.originY = (float)t.y[0] / SUBPIXELS;
+		const glm::vec2 d1((float)(t.x[1] - t.x[0]) / SUBPIXELS, (float)(t.y[1] - t.y[0]) / SUBPIXELS);
+		const glm::vec2 d2((float)(t.x[2] - t.x[0]) / SUBPIXELS, (float)(t.y[2] - t.y[0]) / SUBPIXELS);
+		const float inverseDeterminant = 1.0f / (d1.x * d2.y - d2.x * d1.y);
+		setPlane(t.depth, z[order[0]], z[order[1]], z[order[2]], d1, d2, inverseDeterminant);
+		if (pass.offsetFactor != 0.0f || pass.offsetUnits != 0.0f)
+			t.depth[0] += pass.offsetFactor * std::max(fabsf(t.depth[1]), fabsf(t.depth[2])) + pass.offsetUnits / 16777216.0f;
+
+		if (pass.shaded)
+		{
+			setPlane(t.inverseW, inverseW[order[0]], inverseW[order[1]], inverseW[order[2]], d1, d2, inverseDeterminant);
+			for (int k = 0; k < ATTRIBUTES; k++)
+				setPlane(t.attributes[k], vertices[order[0]]->attributes[k] * inverseW[order[0]], vertices[order[1]]->attributes[k] * inverseW[order[1]],
+					vertices[order[2]]->attributes[k] * inverseW[order[2]], d1, d2, inverseDeterminant);
+			t.surface = surface;
+		}
+		out.push_back(t);
+	}
+
+	/// Lists each triangle in every tile its bounds touch. Triangles are counted per chunk of BIN_GRAIN and
+	/// tile, and each chunk's go after those of the chunks before it, so every tile's list is in draw order.
+	void bin(const Target& target, JobSystem& jobs)
+	{
+		const size_t tiles = target.tiles();
+		const size_t count = m_triangles.size();
+		const size_t chunks = (count + BIN_GRAIN - 1) / BIN_GRAIN;
+		m_binOffsets.assign(chunks * tiles, 0);
+		jobs.parallelFor(count, BIN_GRAIN, [&](size_t begin, size_t end) {
+			uint32_t* counts = &m_binOffsets[(begin / BIN_GRAIN) * tiles];
+			for (size_t i = begin; i < end; i++)
+			{
+				const Triangle& t = m_triangles[i];
+				for (int ty = t.minY / TILE_SIZE; ty <= t.maxY / TILE_SIZE; ty++)
+					for (int tx = t.minX / TILE_SIZE; tx <= t.maxX / TILE_SIZE; tx++)
+						counts[ty * target.tilesX + tx]++;
+			}
+		});
+
+		m_tileFirst.resize(tiles + 1);
+		uint32_t total = 0;
+		for (size_t tile = 0; tile < tiles; tile++)
+		{
+			m_tileFirst[tile] = total;
+			for (size_t chunk = 0; chunk < chunks; chunk++)
+			{
+				uint32_t& offset = m_binOffsets[chunk * tiles + tile];
+				const uint32_t binned = offset;
+				offset = total;
+				total += binned;
+			}
+		}
+		m_tileFirst[tiles] = total;
+
+		m_binned.resize(total);
+		jobs.parallelFor(count, BIN_GRAIN, [&](size_t begin, size_t end) {
+			uint32_t* offsets = &m_binOffsets[(begin / BIN_GRAIN) * tiles];
+			for (size_t i = begin; i < end; i++)
+			{
+				const Triangle& t = m_triangles[i];
+				for (int ty = t.minY / TILE_SIZE; ty <= t.maxY / TILE_SIZE; ty++)
+					for (int tx = t.minX / TILE_SIZE; tx <= t.maxX / TILE_SIZE; tx++)
+						m_binned[offsets[ty * target.tilesX + tx]++] = (uint32_t)i;
+			}
+		});
+	}
+
+	/// Clears a tile, rasterises its triangles and, for a shaded pass, shades it.
+	void drawTile(const Pass& pass, int tile)
+	{
+		Target& target = *pass.target;
+		const int originX = (tile % target.tilesX) * TILE_SIZE, originY = (tile / target.tilesX) * TILE_SIZE;
+		float* depth = &target.depth[(size_t)tile * TILE_PIXELS];
+		int32_t* visible = pass.shaded ? &m_visible[(size_t)tile * TILE_PIXELS] : NULL;
+		std::fill(depth, depth + TILE_PIXELS, 1.0f);
+		if (visible != NULL)
+			std::fill(visible, visible + TILE_PIXELS, (int32_t)NO_TRIANGLE);
+
+		for (uint32_t i = m_tileFirst[tile]; i < m_tileFirst[tile + 1]; i++)
+			rasterize(m_triangles[m_binned[i]], (int32_t)m_binned[i], originX, originY, depth, visible);
+
+		if (visible != NULL)
+			shadeTile(originX, originY, visible);
+	}
+
+	/// Depth tests the pixels of the tile at origin that t covers, RasterLanes::WIDTH at a time, and
+	/// writes id into visible, if given, where t is nearest.
+	static void rasterize(const Triangle& t, int32_t id, int originX, int originY, float* depth, int32_t* visible)
+	{
+		// declared rather than imported, so nothing the includer imports from std competes with them
+		using RasterLanes::WIDTH;
+		using RasterLanes::Int;
+		using RasterLanes::Float;
+		using RasterLanes::loadInt;
+		using RasterLanes::storeInt;
+		using RasterLanes::setInt;
+		using RasterLanes::loadFloat;
+		using RasterLanes::storeFloat;
+		using RasterLanes::setFloat;
+		using RasterLanes::add;
+		using RasterLanes::mul;
+		using RasterLanes::bitOr;
+		using RasterLanes::bitAnd;
+		using RasterLanes::nonNegative;
+		using RasterLanes::less;
+		using RasterLanes::select;
+		using RasterLanes::any;
+
+		const int firstX = std::max(t.minX - originX, 0), lastX = std::min(t.maxX - originX, TILE_SIZE - 1);
+		const int firstY = std::max(t.minY - originY, 0), lastY = std::min(t.maxY - originY, TILE_SIZE - 1);
+		if (firstX > lastX || firstY > lastY)
+			return;
+		const int startX = firstX & ~(WIDTH - 1);
+
+		// edge i runs from vertex i to the next; it is positive inside, and zero on it counts as inside
+		// only for top and left edges, so pixels on an edge shared by two triangles are drawn once
+		int32_t a[3], b[3], bias[3];
+		Int laneSteps[3], widthSteps[3];
+		for (int i = 0; i < 3; i++)
+		{
+			const int next = (i + 1) % 3;
+			a[i] = t.y[i] - t.y[next];
+			b[i] = t.x[next] - t.x[i];
+			bias[i] = a[i] > 0 || (a[i] == 0 && b[i] < 0) ? 0 : -1;
+
+			int32_t lanes[WIDTH];
+			for (int lane = 0; lane < WIDTH; lane++)
+				lanes[lane] = a[i] * SUBPIXELS * lane;
+			laneSteps[i] = loadInt(lanes);
+			widthSteps[i] = setInt(a[i] * SUBPIXELS * WIDTH);
+		}
+
+		// depth is the row's value at the tile's left edge plus the slope times the column, computed the
+		// same way at any lane width, so every build draws the same image
+		float columns[WIDTH];
+		for (int lane = 0; lane < WIDTH; lane++)
+			columns[lane] = (float)lane;
+		const Float laneColumns = loadFloat(columns);
+		const Float depthSlope = setFloat(t.depth[1]);
+		const Int triangle = setInt(id);
+		const int64_t limit = EDGE_LIMIT;
+
+		for (int y = firstY; y <= lastY; y++)
+		{
+			const int64_t centerX = (int64_t)(originX + startX) * SUBPIXELS + SUBPIXELS / 2;
+			const int64_t centerY = (int64_t)(originY + y) * SUBPIXELS + SUBPIXELS / 2;
+			Int edges[3];
+			for (int i = 0; i < 3; i++)
+			{
+				const int64_t value = (int64_t)a[i] * (centerX - t.x[i]) + (int64_t)b[i] * (centerY - t.y[i]) + bias[i];
+				edges[i] = add(setInt((int32_t)std::max(-limit, std::min(limit, value))), laneSteps[i]);
+			}
+			const Float rowDepth = setFloat(t.depth[0] + t.depth[1] * (originX + 0.5f - t.originX) + t.depth[2] * (originY + y + 0.5f - t.originY));
+
+			float* depthRow = depth + y * TILE_SIZE;
+			int32_t* visibleRow = visible != NULL ? visible + y * TILE_SIZE : NULL;
+			for (int x = startX; x <= lastX; x += WIDTH)
+			{
+				const Int inside = nonNegative(bitOr(bitOr(edges[0], edges[1]), edges[2]));
+				if (any(inside))
+				{
+					const Float z = add(rowDepth, mul(depthSlope, add(setFloat((float)x), laneColumns)));
+					const Float stored = loadFloat(depthRow + x);
+					const Int nearer = bitAnd(inside, less(z, stored));
+					storeFloat(depthRow + x, select(nearer, z, stored));
+					if (visibleRow != NULL)
+						storeInt(visibleRow + x, select(nearer, triangle, loadInt(visibleRow + x)));
+				}
+				for (int i = 0; i < 3; i++)
+					edges[i] = add(edges[i], widthSteps[i]);
+			}
+		}
+	}
+
+	static float evaluate(const float* plane, float dx, float dy)
+	{
+		return plane[0] + plane[1] * dx + plane[2] * dy;
+	}
+
+	/// Shades every pixel of the tile at origin inside the frame into m_color.
+	void shadeTile(int originX, int originY, const int32_t* visible)
+	{
+		const int width = m_target.width;
+		const int lastX = std::min(originX + TILE_SIZE, width), lastY = std::min(originY + TILE_SIZE, m_target.height);
+		for (int y = originY; y < lastY; y++)
+		{
+			const int32_t* row = visible + (y - originY) * TILE_SIZE;
+			uint8_t* out = &m_color[((size_t)y * width + originX) * 4];
+			for (int x = originX; x < lastX; x++, out += 4)
+			{
+				const int32_t id = row[x - originX];
+				const glm::vec3 color = glm::clamp(id == NO_TRIANGLE ? m_view.clearColor : shade(m_triangles[id], x + 0.5f, y + 0.5f), 0.0f, 1.0f);
+				out[0] = (uint8_t)(color.r * 255.0f + 0.5f);
+				out[1] = (uint8_t)(color.g * 255.0f + 0.5f);
+				out[2] = (uint8_t)(color.b * 255.0f + 0.5f);
+				out[3] = 255;
+			}
+		}
+	}
+
+	/// As main() in multiple_lights.fs, for the pixel centred at (x, y).
+	glm::vec3 shade(const Triangle& t, float x, float y) const
+	{
+		const float dx = x - t.originX, dy = y - t.originY;
+		const float w = 1.0f / evaluate(t.inverseW, dx, dy);
+		float values[ATTRIBUTES];
+		for (int k = 0; k < ATTRIBUTES; k++)
+			values[k] = evaluate(t.attributes[k], dx, dy) * w;
+		const glm::vec3 fragPos(values[0], values[1], values[2]);
+		const glm::vec3 norm = glm::normalize(glm::vec3(values[3], values[4], values[5]));
+		const glm::vec3 viewDir = glm::normalize(m_view.position - fragPos);
+
+		glm::vec3 diffuseColor = t.surface.color;
+		if (t.surface.texture >= 0)
+		{
+			// derivatives of u = (u/w) / (1/w) across the pixel, for the mip level
+			const glm::vec2 texCoords(values[6], values[7]);
+			const glm::vec2 ddx = (glm::vec2(t.attributes[6][1], t.attributes[7][1]) - texCoords * t.inverseW[1]) * w;
+			const glm::vec2 ddy = (glm::vec2(t.attributes[6][2], t.attributes[7][2]) - texCoords * t.inverseW[2]) * w;
+			diffuseColor = sample(m_textures[t.surface.texture], texCoords, ddx, ddy);
+		}
+		// both maps sample the same unit
+		const glm::vec3 specularColor = diffuseColor;
+
+		glm::vec3 result(0.0f);
+		const std::vector<Light>& lights = *m_lights;
+		for (size_t i = 0; i < lights.size(); i++)
+		{
+			const Light& light = lights[i];
+			if (light.type == LIGHT_DIRECTIONAL)
+			{
+				const glm::vec3 lightDir = glm::normalize(-light.direction);
+				const float diff = glm::max(glm::dot(norm, lightDir), 0.0f);
+				const float spec = specular(norm, lightDir, viewDir);
+				result += light.ambient * diffuseColor + shadowVisibility(fragPos) * (light.diffuse * diff * diffuseColor + light.specular * spec * specularColor);
+				continue;
+			}
+
+			// the flashlight follows the camera
+			const glm::vec3 position = light.type == LIGHT_SPOT ? m_view.position : light.position;
+			const glm::vec3 lightDir = glm::normalize(position - fragPos);
+			const float diff = glm::max(glm::dot(norm, lightDir), 0.0f);
+			const float spec = specular(norm, lightDir, viewDir);
+			const float distance = glm::length(position - fragPos);
+			float attenuation = 1.0f / (light.constant + light.linear * distance + light.quadratic * (distance * distance));
+			if (light.type == LIGHT_SPOT)
+			{
+				const float theta = glm::dot(lightDir, glm::normalize(-m_view.front));
+				const float epsilon = light.cutOff - light.outerCutOff;
+				attenuation *= glm::clamp((theta - light.outerCutOff) / epsilon, 0.0f, 1.0f);
+			}
+			result += (light.ambient * diffuseColor + light.diffuse * diff * diffuseColor + light.specular * spec * specularColor) * attenuation;
+		}
+		return result;
+	}
+
+	float specular(const glm::vec3& norm, const glm::vec3& lightDir, const glm::vec3& viewDir) const
+	{
+		const glm::vec3 reflectDir = glm::reflect(-lightDir, norm);
+		return powf(glm::max(glm::dot(viewDir, reflectDir), 0.0f), m_view.shininess);
+	}
+
+	/// As GL_LINEAR_MIPMAP_LINEAR with GL_REPEAT, given the derivatives of the coordinates across a pixel.
+	static glm::vec3 sample(const Texture& texture, const glm::vec2& texCoords, const glm::vec2& ddx, const glm::vec2& ddy)
+	{
+		if (texture.levels.empty())
+			return glm::vec3(0.0f);
+
+		const glm::vec2 size((float)texture.widths[0], (float)texture.heights[0]);
+		const float rho = glm::max(glm::length(ddx * size), glm::length(ddy * size));
+		const float lod = rho > 0.0f ? log2f(rho) : 0.0f;
+		if (lod <= 0.0f)
+			return sampleLevel(texture, 0, texCoords);
+
+		const int maxLevel = (int)texture.levels.size() - 1;
+		const float clamped = glm::min(lod, (float)maxLevel);
+		const int level = (int)clamped;
+		const float blend = clamped - level;
+		const glm::vec3 color = sampleLevel(texture, level, texCoords);
+		return blend > 0.0f && level < maxLevel ? glm::mix(color, sampleLevel(texture, level + 1, texCoords), blend) : color;
+	}
+
+	static glm::vec3 sampleLevel(const Texture& texture, int level, const glm::vec2& texCoords)
+	{
+		const int width = texture.widths[level], height = texture.heights[level];
+		const float u = texCoords.x * width - 0.5f, v = texCoords.y * height - 0.5f;
+		const float u0 = floorf(u), v0 = floorf(v);
+		const float fu = u - u0, fv = v - v0;
+		const int x0 = wrap((int64_t)u0, width), x1 = wrap((int64_t)u0 + 1, width);
+		const int y0 = wrap((int64_t)v0, height), y1 = wrap((int64_t)v0 + 1, height);
+		const uint8_t* texels = texture.levels[level].data();
+		const glm::vec3 top = glm::mix(texel(texels, width, x0, y0), texel(texels, width, x1, y0), fu);
+		const glm::vec3 bottom = glm::mix(texel(texels, width, x0, y1), texel(texels, width, x1, y1), fu);
+		return glm::mix(top, bottom, fv);
+	}
+
+	static int wrap(int64_t coordinate, int size)
+	{
+		const int64_t wrapped = coordinate % size;
+		return (int)(wrapped < 0 ? wrapped + size : wrapped);
+	}
+
+	static glm::vec3 texel(const uint8_t* texels, int width, int x, int y)
+	{
+		const uint8_t* p = texels + ((size_t)y * width + x) * 4;
+		return glm::vec3(p[0], p[1], p[2]) / 255.0f;
+	}
+
+	/// As CalcShadow() in multiple_lights.fs: 3x3 taps, each a bilinear depth comparison as GL_LINEAR does.
+	float shadowVisibility(const glm::vec3& fragPos) const
+	{
+		for (int i = 0; i < SHADOW_CASCADES; i++)
+		{
+			const glm::vec4 lightSpace = m_lightSpaceMatrices[i] * glm::vec4(fragPos, 1.0f);
+			const glm::vec3 coords = glm::vec3(lightSpace) / lightSpace.w * 0.5f + 0.5f;
+			if (coords.x > 0.01f && coords.y > 0.01f && coords.x < 0.99f && coords.y < 0.99f && coords.z < 1.0f)
+			{
+				const Target& map = m_cascades[i];
+				const float texelSize = 1.0f / map.width;
+				float lit = 0.0f;
+				for (int x = -1; x <= 1; x++)
+					for (int y = -1; y <= 1; y++)
+						lit += compare(map, coords.x + x * texelSize, coords.y + y * texelSize, coords.z - SHADOW_BIAS);
+				return lit / 9.0f;
+			}
+		}
+		return 1.0f;
+	}
+
+	static float compare(const Target& map, float s, float t, float reference)
+	{
+		const float u = s * map.width - 0.5f, v = t * map.height - 0.5f;
+		const float u0 = floorf(u), v0 = floorf(v);
+		const float fu = u - u0, fv = v - v0;
+		const int x0 = glm::clamp((int)u0, 0, map.width - 1), x1 = glm::clamp((int)u0 + 1, 0, map.width - 1);
+		const int y0 = glm::clamp((int)v0, 0, map.height - 1), y1 = glm::clamp((int)v0 + 1, 0, map.height - 1);
+		const float top = glm::mix(reference <= map.at(x0, y0) ? 1.0f : 0.0f, reference <= map.at(x1, y0) ? 1.0f : 0.0f, fu);
+		const float bottom = glm::mix(reference <= map.at(x0, y1) ? 1.0f : 0.0f, reference <= map.at(x1, y1) ? 1.0f : 0.0f, fu);
+		return glm::mix(top, bottom, fv);
+	}
+
+	std::vector<Geometry> m_geometry;
+	std::vector<Texture> m_textures;
+	/// Per material, the surfaces of the main and secondary ranges.
+	std::vector<Surface> m_surfaces;
+
+	/// The frame being drawn.
+	View m_view;
+	const std::vector<Light>* m_lights = NULL;
+	Target m_target;
+	/// Per pixel, stored as m_target's depth, the index of the nearest triangle, or NO_TRIANGLE.
+	std::vector<int32_t> m_visible;
+	std::vector<uint8_t> m_color;
+	Statistics m_statistics;
+
+	Target m_cascades[SHADOW_CASCADES];
+	glm::mat4 m_lightSpaceMatrices[SHADOW_CASCADES];
+	bool m_cascadeDrawn[SHADOW_CASCADES] = {};
+	std::vector<uint32_t> m_casters;
+
+	/// Working memory of the stages, kept so frames reuse it: transformed vertices per thread, triangles
+	/// per geometry range and then joined, and the bins.
+	std::vector<std::vector<ClipVertex>> m_threadVertices;
+	std::vector<std::vector<Triangle>> m_rangeTriangles;
+	std::vector<size_t> m_rangeFirst;
+	std::vector<Triangle> m_triangles;
+	std::vector<uint32_t> m_binOffsets;
+	std::vector<uint32_t> m_tileFirst;
+	std::vector<uint32_t> m_binned;
+
+	GLTexture m_presentTexture;
+	GLFramebuffer m_presentFBO;
+	int m_presentWidth = 0, m_presentHeight = 0;
+};
@@ -0,0 +1,599 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include "mapped_file.h"
+#include "gl_handle.h"
+
+#include <algorithm>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+/// Streams textures' mip levels into GL memory as the view needs them, and out again once it no longer
+/// does, keeping the levels resident within a budget of bytes.
+///
+/// Each image is imported once into a mip cache next to it, *.texbin:
+///
+///   Header, then every mip level, finest first, as tightly packed RGBA8 rows, each aligned to 16 bytes.
+///
+/// and imported again whenever the cache is missing, from another version of the format, or stamped with
+/// another size or modification time of the image than it has now (see FileStamp). load() maps the cache
+/// and uploads only the tail, the levels at most TAIL_SIZE texels across, which stay resident for good.
+/// Finer levels are defined in GL only while they are resident, and GL_TEXTURE_BASE_LEVEL names the finest
+/// of them, so sampling never reaches a missing level.
+///
+/// Every frame the renderer tells require() how large each visible textured surface is on screen, which
+/// gives the finest level each texture needs. update() then
+///
+/// - uploads the levels the loader thread has read in,
+/// - drops the levels finer than needed once they have gone unneeded for EVICT_FRAMES frames,
+/// - and asks the loader thread for the next finer level of each texture that needs one, those furthest
+///   from what they need first, one level per texture at a time, while the budget has room.
+///
+/// The loader thread reads a level by touching its pages of the mapped cache, so the disk waits happen on
+/// it; the render thread then uploads straight from the mapping. Uploads stop for the frame once
+/// UPLOAD_BYTES_PER_FRAME have gone up. The budget counts the levels defined; a driver may hold on to the
+/// memory of a dropped level for a while.
+
+class TextureStreamer
+{
+public:
+	/// Decodes an image file to RGBA8, top row first. Returns false if it cannot be read.
+	typedef bool (*ImageDecoder)(const char* path, int& width, int& height, std::vector<uint8_t>& pixels);
+
+	static const int TAIL_SIZE = 64;
+	static const int MAX_LEVELS = 16;
+	static const unsigned int EVICT_FRAMES = 120;
+	static const size_t UPLOAD_BYTES_PER_FRAME = 8u << 20;
+	static const size_t DEFAULT_BUDGET = 64u << 20;
+
+	/// Offsets are in bytes from the start of the file.
+	struct Header
+	{
+		char magic[8];
+		uint32_t version;
+		uint32_t width, height;
+		uint32_t levelCount;
+		/// The image as it was when imported.
+		FileStamp source;
+		uint64_t levels[MAX_LEVELS];
+		uint64_t fileSize;
+	};
+
+	/// Off, load() uploads every level and nothing is streamed; for the software rasterizer, which reads
+	/// all of them back once. Set before the first load().
+	bool streaming = true;
+	/// Bytes the resident levels may take, tails included.
+	size_t budgetBytes = DEFAULT_BUDGET;
+
+	TextureStreamer() { }
+	TextureStreamer(const TextureStreamer&) = delete;
+	TextureStreamer& operator=(const TextureStreamer&) = delete;
+	~TextureStreamer() { stop(); }
+
+	static std::string cachePathFor(const std::string& imagePath)
+	{
+		std::string::size_type dot = imagePath.find_last_of('.');
+		std::string::size_type slash = imagePath.find_last_of("/\\");
+		if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+			return imagePath + ".texbin";
+		return imagePath.substr(0, dot) + ".texbin";
+	}
+
+	/// Creates a texture from the image at path through its mip cache, importing it first if needed, and
+	/// uploads its tail; or returns the texture already loaded from path, if the image has not changed since.
+	/// Returns 0, having reported why, if the image cannot be read. Call with the loader thread stopped.
+	GLuint load(const char* path, ImageDecoder decode)
+	{
+		const std::string cachePath = cachePathFor(path);
+		const FileStamp image = MappedFile::stamp(path);
+		for (size_t i = 0; i < m_textures.size(); i++)
+			if (m_textures[i].path == path && m_textures[i].image == image)
+				return m_textures[i].object.id();
+		if (image.exists() && !isCurrentCache(cachePath, image) && !import(path, cachePath, image, decode))
+			return 0;
+
+		std::unique_ptr<MappedFile> file(new MappedFile());
+		if (!file->open(cachePath) || !validate((const Header*)file->data(), file->size()))
+		{
+			std::cout << "ERROR::TEXTURE_STREAMER::INVALID_CACHE: " << cachePath << std::endl;
+			return 0;
+		}
+
+		cancelRequests();
+		Texture texture;
+		texture.path = path;
+		texture.image = image;
+		texture.header = (const Header*)file->data();
+		texture.tail = 0;
+		while (texture.tail + 1 < (int)texture.header->levelCount
+			&& std::max(levelWidth(texture.header, texture.tail), levelHeight(texture.header, texture.tail)) > TAIL_SIZE)
+			texture.tail++;
+		texture.resident = streaming ? texture.tail : 0;
+		texture.needed = texture.target = texture.resident;
+
+		texture.object = GLTexture::create(path);
+		glBindTexture(GL_TEXTURE_2D, texture.object.id());
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, texture.resident);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, (GLint)texture.header->levelCount - 1);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		for (int level = texture.resident; level < (int)texture.header->levelCount; level++)
+		{
+			upload(texture.header, level);
+			m_committedBytes += levelBytes(texture.header, level);
+		}
+		glBindTexture(GL_TEXTURE_2D, 0);
+		GpuResources::resize(GPU_TEXTURE, texture.object.id(), residentBytes(texture.header, texture.resident));
+
+		const GLuint id = texture.object.id();
+		m_index[id] = m_textures.size();
+		m_textures.push_back(std::move(texture));
+		m_files.push_back(std::move(file));
+		m_loaded.push_back(0);
+		m_ready.push_back(0);
+		m_order.push_back(0);
+		m_queue.push_back(Request());
+		return id;
+	}
+
+	/// Starts the loader thread.
+	void start()
+	{
+		if (!streaming || m_thread.joinable())
+			return;
+		m_stopping = false;
+		m_thread = std::thread(&TextureStreamer::run, this);
+	}
+
+	/// Waits for the level being read, if any, and stops the loader thread.
+	void stop()
+	{
+		if (!m_thread.joinable())
+			return;
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_stopping = true;
+		}
+		m_wake.notify_all();
+		m_thread.join();
+	}
+
+	/// Deletes every texture not in used and unmaps its cache, as when the scene using them is replaced.
+	/// Returns the number deleted. Call on the GL thread, with the loader thread stopped.
+	size_t retain(const std::vector<GLuint>& used)
+	{
+		cancelRequests();
+		size_t kept = 0;
+		for (size_t i = 0; i < m_textures.size(); i++)
+		{
+			if (std::find(used.begin(), used.end(), m_textures[i].object.id()) == used.end())
+			{
+				m_committedBytes -= residentBytes(m_textures[i].header, m_textures[i].resident);
+				continue;
+			}
+			if (kept != i)
+			{
+				m_textures[kept] = std::move(m_textures[i]);
+				m_files[kept] = std::move(m_files[i]);
+			}
+			kept++;
+		}
+		const size_t deleted = m_textures.size() - kept;
+		m_textures.erase(m_textures.begin() + kept, m_textures.end());
+		m_files.erase(m_files.begin() + kept, m_files.end());
+
+		m_index.clear();
+		for (size_t i = 0; i < kept; i++)
+			m_index[m_textures[i].object.id()] = i;
+		m_loaded.resize(kept);
+		m_ready.resize(kept);
+		m_order.resize(kept);
+		m_queue.resize(kept);
+		return deleted;
+	}
+
+	/// Deletes every texture and unmaps its cache. Call on the GL thread, with the loader thread stopped.
+	void clear()
+	{
+		m_textures.clear();
+		m_files.clear();
+		m_index.clear();
+		m_committedBytes = 0;
+		m_ready.clear();
+		m_order.clear();
+		m_queue.clear();
+		m_queueHead = m_queueCount = 0;
+		m_loaded.clear();
+	}
+
+	/// Reports a visible surface textured with texture, which repeats texCoordsPerUnit times per world unit
+	/// and shows pixelsPerUnit pixels per world unit where it is closest to the camera.
+	void require(GLuint texture, float texCoordsPerUnit, float pixelsPerUnit)
+	{
+		std::unordered_map<GLuint, size_t>::const_iterator found = m_index.find(texture);
+		if (found == m_index.end() || pixelsPerUnit <= 0.0f)
+			return;
+
+		Texture& t = m_textures[found->second];
+		const float texelsPerPixel = (float)std::max(t.header->width, t.header->height) * texCoordsPerUnit / pixelsPerUnit;
+		const int level = texelsPerPixel <= 1.0f ? 0 : (int)std::log2(texelsPerPixel);
+		t.needed = std::min(t.needed, level);
+	}
+
+	/// Streams towards the levels this frame's require() calls asked for. Call once a frame on the GL
+	/// thread, after them and before drawing.
+	void update()
+	{
+		if (!streaming)
+			return;
+		updateTargets(false);
+		stream(false);
+	}
+
+	/// Streams until every texture has the levels this frame's require() calls asked for, or the budget
+	/// is full, and drops finer ones at once; for output that must not depend on timing, or on what was
+	/// drawn before.
+	void settle()
+	{
+		if (!streaming)
+			return;
+		updateTargets(true);
+		while (stream(true))
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_loadedCondition.wait(lock, [this]() { return std::find(m_loaded.begin(), m_loaded.end(), 1) != m_loaded.end(); });
+		}
+	}
+
+	size_t committedBytes() const { return m_committedBytes; }
+	/// Textures at or finer than the level they need.
+	size_t satisfied() const
+	{
+		size_t count = 0;
+		for (size_t i = 0; i < m_textures.size(); i++)
+			count += m_textures[i].resident <= m_textures[i].target ? 1 : 0;
+		return count;
+	}
+	size_t textureCount() const { return m_textures.size(); }
+
+protected:
+	static const uint32_t VERSION = 2;
+	static const size_t ALIGNMENT = 16;
+	static const size_t PAGE_SIZE = 4096;
+
+	struct Texture
+	{
+		GLTexture object;
+		/// Image loaded, as it was then.
+		std::string path;
+		FileStamp image = { 0, 0 };
+		const Header* header = NULL;
+		/// Coarsest level streamed; it and the coarser ones stay resident.
+		int tail = 0;
+		/// Finest level resident.
+		int resident = 0;
+		/// Finest level this frame's require() calls asked for, and the level streamed towards.
+		int needed = 0;
+		int target = 0;
+		/// Last frame target was needed.
+		unsigned int targetFrame = 0;
+		/// Level the loader thread is reading in, or -1. Its bytes are already committed.
+		int loading = -1;
+	};
+
+	struct Request
+	{
+		size_t texture = 0;
+		int level = 0;
+	};
+
+	static const char* magic() { return "STADTEX"; }
+
+	static int levelWidth(const Header* header, int level) { return std::max(1, (int)(header->width >> level)); }
+	static int levelHeight(const Header* header, int level) { return std::max(1, (int)(header->height >> level)); }
+	static size_t levelBytes(const Header* header, int level) { return (size_t)levelWidth(header, level) * levelHeight(header, level) * 4; }
+
+	/// Bytes of the levels from resident down.
+	static size_t residentBytes(const Header* header, int resident)
+	{
+		size_t bytes = 0;
+		for (int level = resident; level < (int)header->levelCount; level++)
+			bytes += levelBytes(header, level);
+		return bytes;
+	}
+
+	/// Defines level of the texture bound from the mapped cache.
+	static void upload(const Header* header, int level)
+	{
+		glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA8, levelWidth(header, level), levelHeight(header, level), 0, GL_RGBA, GL_UNSIGNED_BYTE,
+			(const unsigned char*)header + header->levels[level]);
+	}
+
+	static bool isCurrentCache(const std::string& cachePath, const FileStamp& source)
+	{
+		Header header;
+		std::ifstream file(cachePath.c_str(), std::ios::binary);
+		return file.read((char*)&header, sizeof(header)) && memcmp(header.magic, magic(), 8) == 0 && header.version == VERSION
+			&& header.source == source;
+	}
+
+	/// Checks that every level lies inside the file.
+	static bool validate(const Header* header, size_t fileSize)
+	{
+		if (fileSize < sizeof(Header) || memcmp(header->magic, magic(), 8) != 0 || header->version != VERSION || header->fileSize != fileSize
+			|| header->width == 0 || header->height == 0 || header->levelCount == 0 || header->levelCount > MAX_LEVELS)
+			return false;
+		for (uint32_t i = 0; i < header->levelCount; i++)
+			if (header->levels[i] % ALIGNMENT != 0 || header->levels[i] > fileSize || levelBytes(header, (int)i) > fileSize - header->levels[i])
+				return false;
+		return true;
+	}
+
+	/// Decodes an image, stamped source before it was read, builds its mip levels and writes its cache.
+	/// Errors are reported on stdout.
+	static bool import(const std::string& imagePath, const std::string& cachePath, const FileStamp& source, ImageDecoder decode)
+	{
+		int width = 0, height = 0;
+		std::vector<uint8_t> level;
+		if (!decode(imagePath.c_str(), width, height, level) || width <= 0 || height <= 0)
+		{
+			std::cout << "Texture failed to load at path: " << imagePath << std::endl;
+			return false;
+		}
+
+		Header header;
+		memset(&header, 0, sizeof(header));
+		memcpy(header.magic, magic(), 8);
+		header.version = VERSION;
+		header.width = (uint32_t)width;
+		header.height = (uint32_t)height;
+		header.source = source;
+		std::vector<char> image(sizeof(Header));
+		std::vector<uint8_t> next;
+		for (;;)
+		{
+			header.levels[header.levelCount++] = append(image, level.data(), level.size());
+			if ((width == 1 && height == 1) || header.levelCount == MAX_LEVELS)
+				break;
+			downsample(level, width, height, next);
+			level.swap(next);
+			width = std::max(1, width / 2);
+			height = std::max(1, height / 2);
+		}
+		header.fileSize = image.size();
+		memcpy(&image[0], &header, sizeof(header));
+
+		// write to a temporary file and rename it, so a crash never leaves a truncated cache behind
+		std::string temporaryPath = cachePath + ".tmp";
+		{
+			std::ofstream file(temporaryPath.c_str(), std::ios::binary | std::ios::trunc);
+			if (!file.write(image.data(), image.size()))
+			{
+				std::cout << "ERROR::TEXTURE_STREAMER::CANNOT_WRITE: " << cachePath << std::endl;
+				return false;
+			}
+		}
+		std::remove(cachePath.c_str());
+		if (std::rename(temporaryPath.c_str(), cachePath.c_str()) != 0)
+		{
+			std::cout << "ERROR::TEXTURE_STREAMER::CANNOT_WRITE: " << cachePath << std::endl;
+			return false;
+		}
+		return true;
+	}
+
+	/// Halves a width by height RGBA8 level with a 2x2 box filter, as glGenerateMipmap does; an odd last
+	/// row or column is left out, and a side of 1 stays 1.
+	static void downsample(const std::vector<uint8_t>& level, int width, int height, std::vector<uint8_t>& next)
+	{
+		const int nextWidth = std::max(1, width / 2), nextHeight = std::max(1, height / 2);
+		next.resize((size_t)nextWidth * nextHeight * 4);
+		for (int y = 0; y < nextHeight; y++)
+		{
+			const uint8_t* row0 = &level[(size_t)std::min(2 * y, height - 1) * width * 4];
+			const uint8_t* row1 = &level[(size_t)std::min(2 * y + 1, height - 1) * width * 4];
+			for (int x = 0; x < nextWidth; x++)
+			{
+				const size_t x0 = (size_t)std::min(2 * x, width - 1) * 4, x1 = (size_t)std::min(2 * x + 1, width - 1) * 4;
+				for (int c = 0; c < 4; c++)
+					next[((size_t)y * nextWidth + x) * 4 + c] = (uint8_t)((row0[x0 + c] + row0[x1 + c] + row1[x0 + c] + row1[x1 + c] + 2) / 4);
+			}
+		}
+	}
+
+	/// Appends bytes to the file image at the next aligned offset, returning that offset.
+	static uint64_t append(std::vector<char>& image, const void* data, size_t bytes)
+	{
+		size_t offset = (image.size() + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+		image.resize(offset + bytes);
+		memcpy(&image[offset], data, bytes);
+		return offset;
+	}
+
+	/// Gives back the bytes of the levels being read and drops the requests, so that textures can be added
+	/// or removed; the levels are asked for again by the next update(). The loader thread must be stopped.
+	void cancelRequests()
+	{
+		for (size_t i = 0; i < m_textures.size(); i++)
+		{
+			Texture& t = m_textures[i];
+			if (t.loading >= 0)
+				m_committedBytes -= levelBytes(t.header, t.loading);
+			t.loading = -1;
+		}
+		m_queueHead = m_queueCount = 0;
+		std::fill(m_loaded.begin(), m_loaded.end(), 0);
+	}
+
+	/// Takes this frame's needs as the targets; unless immediately, a coarser need only once the finer
+	/// target has gone unneeded for EVICT_FRAMES frames, so looking away and back does not stream it twice.
+	void updateTargets(bool immediately)
+	{
+		m_frame++;
+		for (size_t i = 0; i < m_textures.size(); i++)
+		{
+			Texture& t = m_textures[i];
+			t.needed = std::min(t.needed, t.tail);
+			if (t.needed <= t.target || immediately)
+			{
+				t.target = t.needed;
+				t.targetFrame = m_frame;
+			}
+			else if (m_frame - t.targetFrame > EVICT_FRAMES)
+			{
+				t.target = t.needed;
+				t.targetFrame = m_frame;
+			}
+			t.needed = t.tail;
+		}
+	}
+
+	/// Uploads what was read in, drops what is not needed and asks for what is. Returns whether levels
+	/// are still being read.
+	bool stream(bool unlimited)
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			std::copy(m_loaded.begin(), m_loaded.end(), m_ready.begin());
+		}
+
+		// uploads; a level no longer needed by the time it is in gives its bytes back
+		size_t uploaded = 0;
+		for (size_t i = 0; i < m_textures.size(); i++)
+		{
+			Texture& t = m_textures[i];
+			if (!m_ready[i] || (!unlimited && uploaded >= UPLOAD_BYTES_PER_FRAME))
+				continue;
+			if (t.loading >= t.target)
+			{
+				glBindTexture(GL_TEXTURE_2D, t.object.id());
+				upload(t.header, t.loading);
+				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, t.loading);
+				t.resident = t.loading;
+				uploaded += levelBytes(t.header, t.loading);
+				GpuResources::resize(GPU_TEXTURE, t.object.id(), residentBytes(t.header, t.resident));
+			}
+			else
+				m_committedBytes -= levelBytes(t.header, t.loading);
+			t.loading = -1;
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_loaded[i] = 0;
+		}
+
+		// evictions; the base level moves up first, so the levels dropped are never sampled
+		for (size_t i = 0; i < m_textures.size(); i++)
+		{
+			Texture& t = m_textures[i];
+			if (t.resident >= t.target)
+				continue;
+			glBindTexture(GL_TEXTURE_2D, t.object.id());
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, t.target);
+			for (; t.resident < t.target; t.resident++)
+			{
+				glTexImage2D(GL_TEXTURE_2D, t.resident, GL_RGBA8, 0, 0, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+				m_committedBytes -= levelBytes(t.header, t.resident);
+			}
+			GpuResources::resize(GPU_TEXTURE, t.object.id(), residentBytes(t.header, t.resident));
+		}
+		glBindTexture(GL_TEXTURE_2D, 0);
+
+		// requests, for the textures furthest from their targets first
+		size_t candidates = 0;
+		for (size_t i = 0; i < m_textures.size(); i++)
+			if (m_textures[i].loading < 0 && m_textures[i].target < m_textures[i].resident)
+				m_order[candidates++] = i;
+		std::sort(m_order.begin(), m_order.begin() + candidates, [this](size_t a, size_t b) {
+			return m_textures[a].resident - m_textures[a].target > m_textures[b].resident - m_textures[b].target;
+		});
+		bool requested = false;
+		for (size_t k = 0; k < candidates; k++)
+		{
+			Texture& t = m_textures[m_order[k]];
+			const size_t bytes = levelBytes(t.header, t.resident - 1);
+			if (m_committedBytes + bytes > budgetBytes)
+				continue;
+			m_committedBytes += bytes;
+			t.loading = t.resident - 1;
+
+			std::lock_guard<std::mutex> lock(m_mutex);
+			Request& request = m_queue[(m_queueHead + m_queueCount) % m_queue.size()];
+			request.texture = m_order[k];
+			request.level = t.loading;
+			m_queueCount++;
+			requested = true;
+		}
+		if (requested)
+			m_wake.notify_one();
+
+		for (size_t i = 0; i < m_textures.size(); i++)
+			if (m_textures[i].loading >= 0)
+				return true;
+		return false;
+	}
+
+	/// Reads requested levels into memory until stopped.
+	void run()
+	{
+		for (;;)
+		{
+			Request request;
+			{
+				std::unique_lock<std::mutex> lock(m_mutex);
+				m_wake.wait(lock, [this]() { return m_stopping || m_queueCount > 0; });
+				if (m_stopping)
+					return;
+				request = m_queue[m_queueHead];
+				m_queueHead = (m_queueHead + 1) % m_queue.size();
+				m_queueCount--;
+			}
+
+			const Texture& texture = m_textures[request.texture];
+			const unsigned char* level = (const unsigned char*)texture.header + texture.header->levels[request.level];
+			unsigned int sum = 0;
+			for (size_t offset = 0; offset < levelBytes(texture.header, request.level); offset += PAGE_SIZE)
+				sum += level[offset];
+			m_touched = sum;
+
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				m_loaded[request.texture] = 1;
+			}
+			m_loadedCondition.notify_all();
+		}
+	}
+
+	std::vector<Texture> m_textures;
+	std::vector<std::unique_ptr<MappedFile>> m_files;
+	std::unordered_map<GLuint, size_t> m_index;
+	size_t m_committedBytes = 0;
+	unsigned int m_frame = 0;
+	/// Per texture, scratch for stream(): whether its level was read in, and the order of the requests.
+	std::vector<uint8_t> m_ready;
+	std::vector<size_t> m_order;
+
+	std::thread m_thread;
+	std::mutex m_mutex;
+	std::condition_variable m_wake, m_loadedCondition;
+	bool m_stopping = false;
+	/// Guarded by m_mutex: the requests, a ring as long as there are textures, and which textures' levels
+	/// have been read in.
+	std::vector<Request> m_queue;
+	size_t m_queueHead = 0, m_queueCount = 0;
+	std::vector<uint8_t> m_loaded;
+	/// Keeps the page touches from being optimised away.
+	volatile unsigned int m_touched = 0;
+};
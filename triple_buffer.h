@@ -0,0 +1,46 @@
+#pragma once
+
+#include <atomic>
+
+/// Hands the newest value from one writer thread to one reader thread without either ever waiting.
+///
+/// Of the three slots, the writer owns one, the reader owns one and the third sits in between. publish()
+/// swaps the writer's slot with the middle one and marks it fresh; read() swaps the middle slot with the
+/// reader's if it is fresh. A slow reader therefore skips values rather than holding the writer up, and a
+/// slow writer leaves the reader with the last value published.
+
+template <typename T>
+class TripleBuffer
+{
+public:
+	TripleBuffer() { }
+	TripleBuffer(const TripleBuffer&) = delete;
+	TripleBuffer& operator=(const TripleBuffer&) = delete;
+
+	/// Writer only: the slot to fill before the next publish(). Its contents are stale, not the last value.
+	T& back() { return m_slots[m_back]; }
+
+	/// Writer only: makes back() the newest value and hands the writer a free slot.
+	void publish()
+	{
+		m_back = m_middle.exchange(m_back | FRESH, std::memory_order_acq_rel) & INDEX;
+	}
+
+	/// Reader only: picks up the newest published value, if there is one since the last call, and returns
+	/// it. The reference stays valid until the next call.
+	const T& read()
+	{
+		if (m_middle.load(std::memory_order_relaxed) & FRESH)
+			m_front = m_middle.exchange(m_front, std::memory_order_acq_rel) & INDEX;
+		return m_slots[m_front];
+	}
+
+private:
+	static const int INDEX = 3;
+	static const int FRESH = 4;
+
+	T m_slots[3];
+	int m_back = 0;
+	std::atomic<int> m_middle{ 1 };
+	int m_front = 2;
+};
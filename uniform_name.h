@@ -0,0 +1,174 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+/// A uniform name, reduced to its 32-bit FNV-1a hash. Built from a string literal the hash is a constant
+/// expression, so setting a uniform by name costs a lookup in the program's UniformTable and nothing else:
+/// no string is built or compared.
+///
+/// Names of array elements and struct members are appended with at() and member(), which continue the
+/// hash where it left off, so "pointLights[2].position" is UniformName("pointLights").at(2).member("position")
+/// and needs no formatting either.
+
+class UniformName
+{
+public:
+	/// From a literal, or a char array holding a name up to its first NUL.
+	template <size_t N>
+	constexpr UniformName(const char (&text)[N]) : m_hash(append(OFFSET, text, N)) { }
+
+	/// From a name built at run time. A function rather than a constructor, which overload resolution
+	/// would prefer to the constant one for literals.
+	static UniformName fromString(const char* text) { return UniformName(append(OFFSET, text, strlen(text))); }
+
+	/// This name followed by "[index]".
+	constexpr UniformName at(unsigned int index) const
+	{
+		return UniformName(append(appendNumber(append(m_hash, "[", 1), index), "]", 1));
+	}
+
+	/// This name followed by "." and name.
+	template <size_t N>
+	constexpr UniformName member(const char (&name)[N]) const
+	{
+		return UniformName(append(append(m_hash, ".", 1), name, N));
+	}
+
+	constexpr uint32_t hash() const { return m_hash; }
+
+protected:
+	static constexpr uint32_t OFFSET = 2166136261u;
+	static constexpr uint32_t PRIME = 16777619u;
+
+	constexpr explicit UniformName(uint32_t hash) : m_hash(hash) { }
+
+	static constexpr uint32_t append(uint32_t hash, const char* text, size_t length)
+	{
+		for (size_t i = 0; i < length && text[i] != '\0'; i++)
+			hash = (hash ^ (uint8_t)text[i]) * PRIME;
+		return hash;
+	}
+
+	static constexpr uint32_t appendNumber(uint32_t hash, unsigned int number)
+	{
+		char digits[10] = { };
+		int count = 0;
+		do
+		{
+			digits[count++] = (char)('0' + number % 10);
+			number /= 10;
+		} while (number > 0);
+		while (count > 0)
+			hash = (hash ^ (uint8_t)digits[--count]) * PRIME;
+		return hash;
+	}
+
+	uint32_t m_hash;
+};
+
+/// Every active uniform of a program, by the hash of its name, in one array sorted by hash. Arrays are
+/// listed under their bare name and under each element's, as GL accepts both for the first element.
+///
+/// Built once per link, where looking names up as strings is fine; after that, finding a location is a
+/// binary search over a few dozen integers. Lookups only carry the hash, so two of the program's names
+/// that hash alike cannot be told apart: build() then fails and leaves both out, rather than letting one
+/// name set the other's uniform.
+
+class UniformTable
+{
+public:
+	UniformTable() { }
+
+	/// False if two of the program's uniforms have the same hash; see above.
+	bool build(GLuint program)
+	{
+		m_entries.clear();
+		std::vector<NamedEntry> named;
+
+		GLint count = 0;
+		glGetProgramiv(program, GL_ACTIVE_UNIFORMS, &count);
+		for (GLint i = 0; i < count; i++)
+		{
+			GLchar name[256];
+			GLsizei length = 0;
+			GLint size = 0;
+			GLenum type = 0;
+			glGetActiveUniform(program, (GLuint)i, sizeof(name), &length, &size, &type, name);
+
+			// arrays are reported once, as "name[0]"
+			if (length > 3 && strcmp(name + length - 3, "[0]") == 0)
+			{
+				name[length - 3] = '\0';
+				add(program, name, named);
+				for (GLint element = 0; element < size; element++)
+				{
+					char elementName[280];
+					snprintf(elementName, sizeof(elementName), "%s[%d]", name, element);
+					add(program, elementName, named);
+				}
+			}
+			else
+				add(program, name, named);
+		}
+
+		std::sort(named.begin(), named.end());
+		std::vector<uint32_t> collisions;
+		for (size_t i = 1; i < named.size(); i++)
+			if (named[i].entry.hash == named[i - 1].entry.hash && named[i].entry.location != named[i - 1].entry.location)
+			{
+				printf("ERROR::UNIFORM_TABLE::HASH_COLLISION between %s and %s\n", named[i - 1].name.c_str(), named[i].name.c_str());
+				collisions.push_back(named[i].entry.hash);
+			}
+		for (size_t i = 0; i < named.size(); i++)
+			if (std::find(collisions.begin(), collisions.end(), named[i].entry.hash) == collisions.end())
+				m_entries.push_back(named[i].entry);
+		return collisions.empty();
+	}
+
+	/// The uniform's location, or -1, which glUniform* ignores, if the program has no such uniform.
+	GLint location(UniformName name) const
+	{
+		Entry key = { name.hash(), -1 };
+		std::vector<Entry>::const_iterator entry = std::lower_bound(m_entries.begin(), m_entries.end(), key);
+		return entry != m_entries.end() && entry->hash == key.hash ? entry->location : -1;
+	}
+
+	size_t size() const { return m_entries.size(); }
+
+protected:
+	struct Entry
+	{
+		uint32_t hash;
+		GLint location;
+
+		bool operator<(const Entry& other) const { return hash < other.hash; }
+	};
+
+	/// An entry with its name, kept while building to report collisions.
+	struct NamedEntry
+	{
+		Entry entry;
+		std::string name;
+
+		bool operator<(const NamedEntry& other) const { return entry < other.entry; }
+	};
+
+	static void add(GLuint program, const char* name, std::vector<NamedEntry>& named)
+	{
+		GLint location = glGetUniformLocation(program, name);
+		if (location < 0)
+			return;
+		NamedEntry entry = { { UniformName::fromString(name).hash(), location }, name };
+		named.push_back(entry);
+	}
+
+	std::vector<Entry> m_entries;
+};
@@ -0,0 +1,188 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/packing.hpp>
+#include "frame_arena.h"
+#include "gpu_resources.h"
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+/// A vertex as the model classes generate it: 32 bytes of floats.
+struct Vertex
+{
+	glm::vec3 position;
+	glm::vec3 normal;
+	glm::vec2 texCoords;
+};
+
+/// The vertex as it is uploaded: 16 bytes, half of Vertex.
+///
+/// - position: three 16-bit integers on a grid fitted to the mesh (see VertexQuantization).
+/// - normal: octahedral encoding, two 16-bit integers scaled by 32767.
+/// - texCoords: two half floats.
+///
+/// The integers are passed to the shaders unnormalised and scaled there, so they convert exactly whatever
+/// rule the driver uses for normalised integers.
+struct PackedVertex
+{
+	int16_t position[3];
+	int16_t padding;
+	int16_t normal[2];
+	uint16_t texCoords[2];
+};
+
+/// Maps a mesh's quantised positions back to model space: position = offset + quantised * step. step is a
+/// power of two, so coordinates on a coarse grid, like the corners of the unit cube, come back exactly.
+///
+/// It is stored after the vertices and read by the vertex shaders as attribute 3, with a divisor so large
+/// that every instance reads the same value: per-mesh data that lives in the vertex array and costs no
+/// uniform updates between draws.
+struct VertexQuantization
+{
+	glm::vec3 offset;
+	float step;
+};
+
+namespace VertexFormat
+{
+	const GLuint QUANTIZATION_ATTRIBUTE = 3;
+	const GLuint QUANTIZATION_DIVISOR = 1u << 30;
+	const float NORMAL_SCALE = 32767.0f;
+
+	/// Reads interleaved floats: position, normal and, if stride is 8, texture coordinates.
+	inline void fromFloats(const float* data, int stride, size_t count, Vertex* vertices)
+	{
+		for (size_t i = 0; i < count; i++)
+		{
+			const float* v = data + i * stride;
+			vertices[i].position = glm::vec3(v[0], v[1], v[2]);
+			vertices[i].normal = glm::vec3(v[3], v[4], v[5]);
+			vertices[i].texCoords = stride >= 8 ? glm::vec2(v[6], v[7]) : glm::vec2(0.0f);
+		}
+	}
+
+	/// Texture repeats per model-space unit of a triangle list: the square root of the ratio of its
+	/// triangles' area in texture space to their area in model space, or 1 if either is zero.
+	inline float texCoordDensity(const Vertex* triangles, size_t count)
+	{
+		double texCoordArea = 0.0, area = 0.0;
+		for (size_t i = 0; i + 2 < count; i += 3)
+		{
+			const Vertex* v = triangles + i;
+			area += glm::length(glm::cross(v[1].position - v[0].position, v[2].position - v[0].position));
+			const glm::vec2 a = v[1].texCoords - v[0].texCoords, b = v[2].texCoords - v[0].texCoords;
+			texCoordArea += std::fabs(a.x * b.y - a.y * b.x);
+		}
+		return area > 0.0 && texCoordArea > 0.0 ? (float)std::sqrt(texCoordArea / area) : 1.0f;
+	}
+
+	/// Centres the grid on the vertices' bounds and picks the smallest power-of-two step that covers
+	/// them in -32767..32767.
+	inline VertexQuantization quantization(const Vertex* vertices, size_t count)
+	{
+		glm::vec3 low(0.0f), high(0.0f);
+		for (size_t i = 0; i < count; i++)
+		{
+			low = i == 0 ? vertices[i].position : glm::min(low, vertices[i].position);
+			high = i == 0 ? vertices[i].position : glm::max(high, vertices[i].position);
+		}
+
+		VertexQuantization quantization;
+		quantization.offset = 0.5f * (low + high);
+		const glm::vec3 extent = 0.5f * (high - low);
+		const float largest = glm::max(extent.x, glm::max(extent.y, extent.z));
+		quantization.step = largest > 0.0f ? exp2f(ceilf(log2f(largest / 32767.0f))) : 1.0f;
+		return quantization;
+	}
+
+	/// Unit vector to the octahedron folded onto [-1, 1]^2.
+	inline glm::vec2 encodeOctahedral(const glm::vec3& normal)
+	{
+		glm::vec3 n = normal / (fabsf(normal.x) + fabsf(normal.y) + fabsf(normal.z));
+		if (n.z >= 0.0f)
+			return glm::vec2(n.x, n.y);
+		return glm::vec2((1.0f - fabsf(n.y)) * (n.x >= 0.0f ? 1.0f : -1.0f), (1.0f - fabsf(n.x)) * (n.y >= 0.0f ? 1.0f : -1.0f));
+	}
+
+	/// As decodeOctahedral() in multiple_lights.vs.
+	inline glm::vec3 decodeOctahedral(const glm::vec2& encoded)
+	{
+		glm::vec3 n(encoded.x, encoded.y, 1.0f - fabsf(encoded.x) - fabsf(encoded.y));
+		const float t = glm::max(-n.z, 0.0f);
+		n.x += n.x >= 0.0f ? -t : t;
+		n.y += n.y >= 0.0f ? -t : t;
+		return glm::normalize(n);
+	}
+
+	inline int16_t quantize(float value)
+	{
+		return (int16_t)glm::clamp(roundf(value), -32767.0f, 32767.0f);
+	}
+
+	inline PackedVertex pack(const Vertex& vertex, const VertexQuantization& quantization)
+	{
+		PackedVertex packed;
+		const glm::vec3 grid = (vertex.position - quantization.offset) / quantization.step;
+		packed.position[0] = quantize(grid.x);
+		packed.position[1] = quantize(grid.y);
+		packed.position[2] = quantize(grid.z);
+		packed.padding = 0;
+		const glm::vec2 normal = encodeOctahedral(vertex.normal) * NORMAL_SCALE;
+		packed.normal[0] = quantize(normal.x);
+		packed.normal[1] = quantize(normal.y);
+		packed.texCoords[0] = glm::packHalf1x16(vertex.texCoords.x);
+		packed.texCoords[1] = glm::packHalf1x16(vertex.texCoords.y);
+		return packed;
+	}
+
+	/// The vertex the shaders see.
+	inline Vertex unpack(const PackedVertex& packed, const VertexQuantization& quantization)
+	{
+		Vertex vertex;
+		vertex.position = quantization.offset + glm::vec3(packed.position[0], packed.position[1], packed.position[2]) * quantization.step;
+		vertex.normal = decodeOctahedral(glm::vec2(packed.normal[0], packed.normal[1]) / NORMAL_SCALE);
+		vertex.texCoords = glm::vec2(glm::unpackHalf1x16(packed.texCoords[0]), glm::unpackHalf1x16(packed.texCoords[1]));
+		return vertex;
+	}
+
+	/// Sets up attributes 0 to 3 of vao to read count packed vertices from vbo, followed by their
+	/// quantization, as upload() lays them out. Leaves vao bound.
+	inline void setAttributes(GLuint vao, GLuint vbo, size_t count)
+	{
+		const size_t vertexBytes = count * sizeof(PackedVertex);
+		glBindBuffer(GL_ARRAY_BUFFER, vbo);
+		glBindVertexArray(vao);
+		glVertexAttribPointer(0, 3, GL_SHORT, GL_FALSE, sizeof(PackedVertex), (void*)offsetof(PackedVertex, position));
+		glEnableVertexAttribArray(0);
+		glVertexAttribPointer(1, 2, GL_SHORT, GL_FALSE, sizeof(PackedVertex), (void*)offsetof(PackedVertex, normal));
+		glEnableVertexAttribArray(1);
+		glVertexAttribPointer(2, 2, GL_HALF_FLOAT, GL_FALSE, sizeof(PackedVertex), (void*)offsetof(PackedVertex, texCoords));
+		glEnableVertexAttribArray(2);
+		glVertexAttribPointer(QUANTIZATION_ATTRIBUTE, 4, GL_FLOAT, GL_FALSE, sizeof(VertexQuantization), (void*)vertexBytes);
+		glVertexAttribDivisor(QUANTIZATION_ATTRIBUTE, QUANTIZATION_DIVISOR);
+		glEnableVertexAttribArray(QUANTIZATION_ATTRIBUTE);
+	}
+
+	/// Packs vertices into vbo, followed by their quantization, and sets up attributes 0 to 3 of vao to
+	/// read them. Leaves vao bound.
+	inline void upload(GLuint vao, GLuint vbo, const Vertex* vertices, size_t count)
+	{
+		const VertexQuantization quantization = VertexFormat::quantization(vertices, count);
+		const size_t vertexBytes = count * sizeof(PackedVertex);
+
+		Arena scratch(vertexBytes + sizeof(VertexQuantization) + alignof(std::max_align_t));
+		PackedVertex* packed = scratch.allocateArray<PackedVertex>(count);
+		for (size_t i = 0; i < count; i++)
+			packed[i] = pack(vertices[i], quantization);
+
+		glBindBuffer(GL_ARRAY_BUFFER, vbo);
+		glBufferData(GL_ARRAY_BUFFER, vertexBytes + sizeof(VertexQuantization), NULL, GL_STATIC_DRAW);
+		glBufferSubData(GL_ARRAY_BUFFER, 0, vertexBytes, packed);
+		glBufferSubData(GL_ARRAY_BUFFER, vertexBytes, sizeof(VertexQuantization), &quantization);
+		setAttributes(vao, vbo, count);
+		GpuResources::resize(GPU_BUFFER, vbo, vertexBytes + sizeof(VertexQuantization));
+	}
+}
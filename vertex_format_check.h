@@ -0,0 +1,92 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include "vertex_format.h"
+#include "Cube.h"
+#include "Plane.h"
+#include "Pyramid.h"
+#include "Torus.h"
+
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+/// Packs the vertices of every primitive as they are uploaded, unpacks them as the vertex shaders do, and
+/// compares the result with the float vertices they came from. Run with --check-vertex-format; needs no
+/// window or GL context.
+///
+/// Positions must come back within half a grid step on each axis, normals within MAX_NORMAL_DEGREES, and
+/// texture coordinates within half a unit in the last place of a half float.
+
+namespace VertexFormatCheck
+{
+	const float MAX_NORMAL_DEGREES = 0.01f;
+
+	/// Checks one mesh; returns false if any vertex is off by more than the format allows.
+	inline bool run(const char* name, const std::vector<Vertex>& vertices)
+	{
+		const VertexQuantization quantization = VertexFormat::quantization(vertices.data(), vertices.size());
+		float positionError = 0.0f, normalDegrees = 0.0f, texCoordError = 0.0f;
+		bool passed = true;
+		for (size_t i = 0; i < vertices.size(); i++)
+		{
+			const Vertex& reference = vertices[i];
+			const Vertex unpacked = VertexFormat::unpack(VertexFormat::pack(reference, quantization), quantization);
+
+			const glm::vec3 position = glm::abs(unpacked.position - reference.position);
+			positionError = glm::max(positionError, glm::max(position.x, glm::max(position.y, position.z)));
+			passed = passed && glm::all(glm::lessThanEqual(position, glm::vec3(0.5f * quantization.step)));
+
+			// atan2 of sine and cosine; acos alone cannot resolve angles this small in floats
+			const glm::vec3 normal = glm::normalize(reference.normal);
+			const float angle = atan2f(glm::length(glm::cross(unpacked.normal, normal)), glm::dot(unpacked.normal, normal));
+			normalDegrees = glm::max(normalDegrees, glm::degrees(angle));
+
+			// a half float has 11 significant bits
+			for (int c = 0; c < 2; c++)
+			{
+				const float error = fabsf(unpacked.texCoords[c] - reference.texCoords[c]);
+				texCoordError = glm::max(texCoordError, error);
+				passed = passed && error <= fabsf(reference.texCoords[c]) * exp2f(-11.0f) + exp2f(-25.0f);
+			}
+		}
+		passed = passed && normalDegrees <= MAX_NORMAL_DEGREES;
+
+		std::cout << std::setw(20) << name << std::setw(9) << vertices.size()
+			<< std::setw(12) << vertices.size() * sizeof(Vertex) << std::setw(12) << vertices.size() * sizeof(PackedVertex)
+			<< std::setw(14) << positionError << std::setw(12) << quantization.step
+			<< std::setw(12) << normalDegrees << std::setw(13) << texCoordError
+			<< (passed ? "" : "   FAILED") << std::endl;
+		return passed;
+	}
+
+	/// Returns the process exit code: 0 if every primitive is within bounds.
+	inline int runAll()
+	{
+		std::cout << std::scientific << std::setprecision(2);
+		std::cout << "                mesh vertices  float bytes  packed bytes  position err   grid step  normal deg  texcoord err" << std::endl;
+
+		bool passed = true;
+		std::vector<Vertex> vertices(Cube::VERTEX_COUNT);
+		Cube::GetVertices(1.0f, 1.0f, vertices.data());
+		passed = run("cube", vertices) && passed;
+		Cube::GetVertices(3.7f, 9.3f, vertices.data());
+		passed = run("cube 3.7 x 9.3", vertices) && passed;
+
+		vertices.resize(Plane::VERTEX_COUNT);
+		Plane::GetVertices(vertices.data());
+		passed = run("plane", vertices) && passed;
+
+		vertices.resize(Pyramid::VERTEX_COUNT);
+		Pyramid::GetVertices(vertices.data());
+		passed = run("pyramid", vertices) && passed;
+
+		vertices.resize(Torus::VERTEX_COUNT);
+		Torus::GetVertices(1.0f, 0.3f, vertices.data());
+		passed = run("torus 1 0.3", vertices) && passed;
+		Torus::GetVertices(8.0f, 2.5f, vertices.data());
+		passed = run("torus 8 2.5", vertices) && passed;
+		return passed ? 0 : 1;
+	}
+}